@@ -0,0 +1,824 @@
+/*
+ * nghttp3
+ *
+ * Copyright (c) 2019 nghttp3 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_DL_ITERATE_PHDR
+#  include <link.h>
+#endif /* HAVE_DL_ITERATE_PHDR */
+
+#include <nghttp3/nghttp3.h>
+
+/*
+ * alloc_bench runs fixed conn and QPACK scenarios through an
+ * instrumenting nghttp3_mem, and checks their allocations against
+ * the budgets recorded in scenarios[].  Each endpoint (client and
+ * server, or encoder and decoder) has its own nghttp3_mem, and
+ * everything from its creation to deletion is counted.  It reports
+ * the number of calls which allocate memory (malloc, calloc, and
+ * realloc), the bytes requested, and the peak of live bytes, as the
+ * totals and per request and per header block.  A conn scenario
+ * sends 2 header blocks per request.  It exits with failure if a
+ * scenario exceeds its budget, and "make check" runs it for that
+ * reason.
+ *
+ * With -s, it also lists the call sites of each endpoint by the
+ * number of calls.  A call site is the return address of the
+ * allocator function, which is the caller of nghttp3_mem_malloc and
+ * the like because they are compiled into tail calls with
+ * optimization.  Without optimization, they all show up as the
+ * nghttp3_mem functions.  The address is the link-time address if
+ * dl_iterate_phdr is available, and it can be resolved with
+ * "addr2line -f -e alloc_bench".
+ */
+
+#define MAX_SITES 256
+
+typedef struct {
+  const void *addr;
+  size_t ncalls;
+  uint64_t bytes;
+} alloc_site;
+
+typedef struct {
+  /* ncalls is the number of calls which allocate memory. */
+  size_t ncalls;
+  /* bytes is the number of bytes requested by those calls. */
+  uint64_t bytes;
+  /* live is the number of bytes currently allocated, and peak is
+     the maximum of live. */
+  size_t live, peak;
+  alloc_site sites[MAX_SITES];
+  size_t nsites;
+} alloc_stat;
+
+/* alloc_hd precedes each allocation to remember its size. */
+typedef union {
+  size_t size;
+  long double ld;
+  void *p;
+  uint64_t u;
+} alloc_hd;
+
+#ifdef __GNUC__
+#  define CALL_SITE() __builtin_return_address(0)
+#else /* !__GNUC__ */
+#  define CALL_SITE() NULL
+#endif /* !__GNUC__ */
+
+/*
+ * alloc_record accounts an allocation of |size| bytes made from
+ * |site|.
+ */
+static void alloc_record(alloc_stat *st, size_t size, const void *site) {
+  alloc_site *as;
+  size_t i;
+
+  ++st->ncalls;
+  st->bytes += size;
+
+  for (i = 0; i < st->nsites; ++i) {
+    if (st->sites[i].addr == site) {
+      break;
+    }
+  }
+
+  if (i == st->nsites) {
+    if (st->nsites == MAX_SITES) {
+      /* The last slot collects the rest. */
+      i = MAX_SITES - 1;
+      st->sites[i].addr = NULL;
+    } else {
+      st->sites[st->nsites++].addr = site;
+    }
+  }
+
+  as = &st->sites[i];
+  ++as->ncalls;
+  as->bytes += size;
+}
+
+static void alloc_add_live(alloc_stat *st, size_t size) {
+  st->live += size;
+  if (st->live > st->peak) {
+    st->peak = st->live;
+  }
+}
+
+static void *alloc_malloc(size_t size, void *user_data) {
+  alloc_stat *st = user_data;
+  alloc_hd *hd = malloc(sizeof(alloc_hd) + size);
+
+  if (hd == NULL) {
+    return NULL;
+  }
+
+  hd->size = size;
+  alloc_record(st, size, CALL_SITE());
+  alloc_add_live(st, size);
+
+  return hd + 1;
+}
+
+static void alloc_free(void *ptr, void *user_data) {
+  alloc_stat *st = user_data;
+  alloc_hd *hd;
+
+  if (ptr == NULL) {
+    return;
+  }
+
+  hd = (alloc_hd *)ptr - 1;
+  st->live -= hd->size;
+
+  free(hd);
+}
+
+static void *alloc_calloc(size_t nmemb, size_t size, void *user_data) {
+  alloc_stat *st = user_data;
+  alloc_hd *hd;
+
+  if (size && nmemb > (SIZE_MAX - sizeof(alloc_hd)) / size) {
+    return NULL;
+  }
+
+  size *= nmemb;
+
+  hd = calloc(1, sizeof(alloc_hd) + size);
+  if (hd == NULL) {
+    return NULL;
+  }
+
+  hd->size = size;
+  alloc_record(st, size, CALL_SITE());
+  alloc_add_live(st, size);
+
+  return hd + 1;
+}
+
+static void *alloc_realloc(void *ptr, size_t size, void *user_data) {
+  alloc_stat *st = user_data;
+  alloc_hd *hd = ptr ? (alloc_hd *)ptr - 1 : NULL;
+  size_t oldsize = hd ? hd->size : 0;
+
+  hd = realloc(hd, sizeof(alloc_hd) + size);
+  if (hd == NULL) {
+    return NULL;
+  }
+
+  hd->size = size;
+  alloc_record(st, size, CALL_SITE());
+  st->live -= oldsize;
+  alloc_add_live(st, size);
+
+  return hd + 1;
+}
+
+static void alloc_mem_init(nghttp3_mem *mem, alloc_stat *st) {
+  memset(st, 0, sizeof(*st));
+
+  mem->mem_user_data = st;
+  mem->malloc = alloc_malloc;
+  mem->free = alloc_free;
+  mem->calloc = alloc_calloc;
+  mem->realloc = alloc_realloc;
+}
+
+#define MAKE_NV(NAME, VALUE)                                                   \
+  {                                                                            \
+    (uint8_t *)(NAME), (uint8_t *)(VALUE), sizeof(NAME) - 1,                   \
+        sizeof(VALUE) - 1, NGHTTP3_NV_FLAG_NONE                                \
+  }
+
+static const nghttp3_nv req_nva[] = {
+    MAKE_NV(":method", "GET"),
+    MAKE_NV(":scheme", "https"),
+    MAKE_NV(":authority", "example.com"),
+    MAKE_NV(":path", "/index.html"),
+    MAKE_NV("user-agent", "alloc_bench"),
+    MAKE_NV("accept", "*/*"),
+    MAKE_NV("accept-encoding", "gzip, deflate, br"),
+    MAKE_NV("cookie", "session=0123456789abcdef; lang=en"),
+};
+
+static const nghttp3_nv resp_nva[] = {
+    MAKE_NV(":status", "200"),
+    MAKE_NV("content-type", "text/html; charset=utf-8"),
+    MAKE_NV("cache-control", "max-age=3600"),
+    MAKE_NV("server", "alloc_bench"),
+};
+
+#define arraylen(A) (sizeof(A) / sizeof((A)[0]))
+
+typedef struct scenario scenario;
+
+typedef struct {
+  /* name is the name of endpoint, such as "client". */
+  const char *name;
+  alloc_stat st;
+} endpoint;
+
+struct scenario {
+  const char *name;
+  /* run runs the scenario with the endpoints |ep|.  It returns 0 if
+     it succeeds, or -1. */
+  int (*run)(const scenario *sc, endpoint *ep);
+  size_t max_dtable_size;
+  size_t max_blocked;
+  /* arena is passed to nghttp3_conn_settings.arena. */
+  int arena;
+  /* nreqs is the number of requests, and concurrency is the number
+     of requests in flight at once. */
+  size_t nreqs;
+  size_t concurrency;
+  /* nblocks is the number of header blocks. */
+  size_t nblocks;
+  /* max_calls_per_block and max_peak are the budgets for the number
+     of calls per header block, and the peak of live bytes, summed
+     over the endpoints. */
+  double max_calls_per_block;
+  size_t max_peak;
+};
+
+/*
+ * qpack_decode feeds the header block which consists of |pbuf| and
+ * |rbuf| to |dec|.  It returns 0 if it succeeds, or -1.
+ */
+static int qpack_decode(nghttp3_qpack_decoder *dec, int64_t stream_id,
+                        const nghttp3_buf *pbuf, const nghttp3_buf *rbuf,
+                        const nghttp3_mem *mem) {
+  nghttp3_qpack_stream_context *sctx;
+  nghttp3_qpack_nv nv;
+  const nghttp3_buf *buf = pbuf;
+  const uint8_t *p = pbuf->pos;
+  size_t len = nghttp3_buf_len(pbuf);
+  uint8_t flags;
+  ssize_t nread;
+  int rv, ret = -1;
+
+  rv = nghttp3_qpack_stream_context_new(&sctx, stream_id, mem);
+  if (rv != 0) {
+    fprintf(stderr, "nghttp3_qpack_stream_context_new: %s\n",
+            nghttp3_strerror(rv));
+    return -1;
+  }
+
+  for (;;) {
+    if (len == 0 && buf == pbuf) {
+      buf = rbuf;
+      p = rbuf->pos;
+      len = nghttp3_buf_len(rbuf);
+    }
+
+    nread = nghttp3_qpack_decoder_read_request(dec, sctx, &nv, &flags, p, len,
+                                               buf == rbuf);
+    if (nread < 0) {
+      fprintf(stderr, "nghttp3_qpack_decoder_read_request: %s\n",
+              nghttp3_strerror((int)nread));
+      break;
+    }
+
+    p += nread;
+    len -= (size_t)nread;
+
+    if (flags & NGHTTP3_QPACK_DECODE_FLAG_EMIT) {
+      nghttp3_rcbuf_decref(nv.name);
+      nghttp3_rcbuf_decref(nv.value);
+    }
+    if (flags & NGHTTP3_QPACK_DECODE_FLAG_FINAL) {
+      ret = 0;
+      break;
+    }
+    if (flags & NGHTTP3_QPACK_DECODE_FLAG_BLOCKED) {
+      fprintf(stderr, "header block is blocked\n");
+      break;
+    }
+  }
+
+  nghttp3_qpack_stream_context_del(sctx);
+
+  return ret;
+}
+
+/*
+ * run_qpack encodes request and response header blocks alternately,
+ * and immediately feeds them and the encoder stream to the decoder
+ * whose decoder stream goes back to the encoder.
+ */
+static int run_qpack(const scenario *sc, endpoint *ep) {
+  nghttp3_mem emem, dmem;
+  nghttp3_qpack_encoder *enc = NULL;
+  nghttp3_qpack_decoder *dec = NULL;
+  nghttp3_buf pbuf, rbuf, ebuf, dbuf;
+  const nghttp3_nv *nva;
+  size_t i, nvlen;
+  int64_t stream_id;
+  ssize_t nread;
+  int rv, ret = -1;
+
+  ep[0].name = "encoder";
+  ep[1].name = "decoder";
+
+  alloc_mem_init(&emem, &ep[0].st);
+  alloc_mem_init(&dmem, &ep[1].st);
+
+  nghttp3_buf_init(&pbuf);
+  nghttp3_buf_init(&rbuf);
+  nghttp3_buf_init(&ebuf);
+  nghttp3_buf_init(&dbuf);
+
+  rv = nghttp3_qpack_encoder_new(&enc, sc->max_dtable_size, sc->max_blocked,
+                                 &emem);
+  if (rv != 0) {
+    fprintf(stderr, "nghttp3_qpack_encoder_new: %s\n", nghttp3_strerror(rv));
+    goto fin;
+  }
+
+  rv = nghttp3_qpack_decoder_new(&dec, sc->max_dtable_size, sc->max_blocked,
+                                 &dmem);
+  if (rv != 0) {
+    fprintf(stderr, "nghttp3_qpack_decoder_new: %s\n", nghttp3_strerror(rv));
+    goto fin;
+  }
+
+  for (i = 0; i < sc->nblocks; ++i) {
+    stream_id = (int64_t)(i / 2 * 4);
+
+    if (i & 1) {
+      nva = resp_nva;
+      nvlen = arraylen(resp_nva);
+    } else {
+      nva = req_nva;
+      nvlen = arraylen(req_nva);
+    }
+
+    rv = nghttp3_qpack_encoder_encode(enc, &pbuf, &rbuf, &ebuf, stream_id, nva,
+                                      nvlen);
+    if (rv != 0) {
+      fprintf(stderr, "nghttp3_qpack_encoder_encode: %s\n",
+              nghttp3_strerror(rv));
+      goto fin;
+    }
+
+    nread = nghttp3_qpack_decoder_read_encoder(dec, ebuf.pos,
+                                               nghttp3_buf_len(&ebuf));
+    if (nread < 0) {
+      fprintf(stderr, "nghttp3_qpack_decoder_read_encoder: %s\n",
+              nghttp3_strerror((int)nread));
+      goto fin;
+    }
+
+    if (qpack_decode(dec, stream_id, &pbuf, &rbuf, &dmem) != 0) {
+      goto fin;
+    }
+
+    rv = nghttp3_qpack_decoder_write_decoder(dec, &dbuf);
+    if (rv != 0) {
+      fprintf(stderr, "nghttp3_qpack_decoder_write_decoder: %s\n",
+              nghttp3_strerror(rv));
+      goto fin;
+    }
+
+    nread = nghttp3_qpack_encoder_read_decoder(enc, dbuf.pos,
+                                               nghttp3_buf_len(&dbuf));
+    if (nread < 0) {
+      fprintf(stderr, "nghttp3_qpack_encoder_read_decoder: %s\n",
+              nghttp3_strerror((int)nread));
+      goto fin;
+    }
+
+    nghttp3_buf_reset(&pbuf);
+    nghttp3_buf_reset(&rbuf);
+    nghttp3_buf_reset(&ebuf);
+    nghttp3_buf_reset(&dbuf);
+  }
+
+  ret = 0;
+
+fin:
+  nghttp3_qpack_decoder_del(dec);
+  nghttp3_qpack_encoder_del(enc);
+  nghttp3_buf_free(&dbuf, &dmem);
+  nghttp3_buf_free(&ebuf, &emem);
+  nghttp3_buf_free(&rbuf, &emem);
+  nghttp3_buf_free(&pbuf, &emem);
+
+  return ret;
+}
+
+typedef struct {
+  /* pending is the request streams which server has received request
+     header and has not responded to. */
+  int64_t *pending;
+  size_t npending;
+} conn_state;
+
+static uint8_t body[1000];
+
+static int server_end_headers(nghttp3_conn *conn, int64_t stream_id,
+                              void *user_data, void *stream_user_data) {
+  conn_state *cs = user_data;
+
+  (void)conn;
+  (void)stream_user_data;
+
+  cs->pending[cs->npending++] = stream_id;
+
+  return 0;
+}
+
+static int server_read_data(nghttp3_conn *conn, int64_t stream_id,
+                            const uint8_t **pdata, size_t *pdatalen,
+                            uint32_t *pflags, void *user_data,
+                            void *stream_user_data) {
+  (void)conn;
+  (void)stream_id;
+  (void)user_data;
+  (void)stream_user_data;
+
+  *pdata = body;
+  *pdatalen = sizeof(body);
+  *pflags = NGHTTP3_DATA_FLAG_EOF;
+
+  return 0;
+}
+
+/*
+ * conn_xfer moves all stream data which |src| has to |dst|, and
+ * acknowledges them immediately.  It returns the number of bytes
+ * moved, or -1.
+ */
+static ssize_t conn_xfer(nghttp3_conn *src, nghttp3_conn *dst) {
+  nghttp3_vec vec[16];
+  ssize_t sveccnt, nread;
+  int64_t stream_id;
+  int fin, rv;
+  size_t i, len, n = 0;
+
+  for (;;) {
+    sveccnt = nghttp3_conn_writev_stream(src, &stream_id, &fin, vec,
+                                         arraylen(vec));
+    if (sveccnt < 0) {
+      fprintf(stderr, "nghttp3_conn_writev_stream: %s\n",
+              nghttp3_strerror((int)sveccnt));
+      return -1;
+    }
+
+    if (sveccnt == 0) {
+      return (ssize_t)n;
+    }
+
+    len = nghttp3_vec_len(vec, (size_t)sveccnt);
+
+    rv = nghttp3_conn_add_write_offset(src, stream_id, len);
+    if (rv != 0) {
+      fprintf(stderr, "nghttp3_conn_add_write_offset: %s\n",
+              nghttp3_strerror(rv));
+      return -1;
+    }
+
+    for (i = 0; i < (size_t)sveccnt; ++i) {
+      nread = nghttp3_conn_read_stream(dst, stream_id, vec[i].base, vec[i].len,
+                                       fin && i == (size_t)sveccnt - 1);
+      if (nread < 0) {
+        fprintf(stderr, "nghttp3_conn_read_stream: %s\n",
+                nghttp3_strerror((int)nread));
+        return -1;
+      }
+    }
+
+    rv = nghttp3_conn_add_ack_offset(src, stream_id, len);
+    if (rv != 0) {
+      fprintf(stderr, "nghttp3_conn_add_ack_offset: %s\n",
+              nghttp3_strerror(rv));
+      return -1;
+    }
+
+    n += len + (fin ? 1 : 0);
+  }
+}
+
+/*
+ * run_conn sends requests from client to server in batches of
+ * sc->concurrency, and server responds to each of them with a small
+ * body.  The request streams in a batch are closed on both endpoints
+ * after all responses are received.
+ */
+static int run_conn(const scenario *sc, endpoint *ep) {
+  nghttp3_mem cmem, smem;
+  nghttp3_conn *cl = NULL, *sv = NULL;
+  nghttp3_conn_callbacks ccb, scb;
+  nghttp3_conn_settings settings;
+  nghttp3_data_reader dr;
+  conn_state cs;
+  ssize_t ncl, nsv;
+  size_t i, next, first;
+  int64_t stream_id;
+  int rv, ret = -1;
+
+  ep[0].name = "client";
+  ep[1].name = "server";
+
+  alloc_mem_init(&cmem, &ep[0].st);
+  alloc_mem_init(&smem, &ep[1].st);
+
+  memset(&cs, 0, sizeof(cs));
+  cs.pending = malloc(sizeof(cs.pending[0]) * sc->concurrency);
+  if (cs.pending == NULL) {
+    fprintf(stderr, "out of memory\n");
+    return -1;
+  }
+
+  memset(&ccb, 0, sizeof(ccb));
+  memset(&scb, 0, sizeof(scb));
+  scb.end_headers = server_end_headers;
+
+  nghttp3_conn_settings_default(&settings);
+  settings.qpack_max_table_capacity = (uint32_t)sc->max_dtable_size;
+  settings.qpack_blocked_streams = (uint16_t)sc->max_blocked;
+  settings.arena = sc->arena;
+
+  rv = nghttp3_conn_client_new(&cl, &ccb, &settings, &cmem, NULL);
+  if (rv == 0) {
+    rv = nghttp3_conn_server_new(&sv, &scb, &settings, &smem, &cs);
+  }
+  if (rv != 0) {
+    fprintf(stderr, "nghttp3_conn_new: %s\n", nghttp3_strerror(rv));
+    goto fin;
+  }
+
+  nghttp3_conn_set_max_client_streams_bidi(sv, sc->nreqs);
+
+  if ((rv = nghttp3_conn_bind_control_stream(cl, 2)) != 0 ||
+      (rv = nghttp3_conn_bind_control_stream(sv, 3)) != 0 ||
+      (rv = nghttp3_conn_bind_qpack_streams(cl, 6, 10)) != 0 ||
+      (rv = nghttp3_conn_bind_qpack_streams(sv, 7, 11)) != 0) {
+    fprintf(stderr, "nghttp3_conn_bind: %s\n", nghttp3_strerror(rv));
+    goto fin;
+  }
+
+  memset(&dr, 0, sizeof(dr));
+  dr.read_data = server_read_data;
+
+  for (next = 0; next < sc->nreqs;) {
+    first = next;
+
+    for (; next < sc->nreqs && next - first < sc->concurrency; ++next) {
+      rv = nghttp3_conn_submit_request(cl, (int64_t)(next * 4), NULL, req_nva,
+                                       arraylen(req_nva), NULL, NULL);
+      if (rv != 0) {
+        fprintf(stderr, "nghttp3_conn_submit_request: %s\n",
+                nghttp3_strerror(rv));
+        goto fin;
+      }
+    }
+
+    do {
+      ncl = conn_xfer(cl, sv);
+      if (ncl < 0) {
+        goto fin;
+      }
+
+      for (i = 0; i < cs.npending; ++i) {
+        rv = nghttp3_conn_submit_response(sv, cs.pending[i], resp_nva,
+                                          arraylen(resp_nva), &dr);
+        if (rv != 0) {
+          fprintf(stderr, "nghttp3_conn_submit_response: %s\n",
+                  nghttp3_strerror(rv));
+          goto fin;
+        }
+      }
+
+      cs.npending = 0;
+
+      nsv = conn_xfer(sv, cl);
+      if (nsv < 0) {
+        goto fin;
+      }
+    } while (ncl || nsv);
+
+    for (i = first; i < next; ++i) {
+      stream_id = (int64_t)(i * 4);
+
+      if ((rv = nghttp3_conn_close_stream(cl, stream_id)) != 0 ||
+          (rv = nghttp3_conn_close_stream(sv, stream_id)) != 0) {
+        fprintf(stderr, "nghttp3_conn_close_stream: %s\n",
+                nghttp3_strerror(rv));
+        goto fin;
+      }
+    }
+  }
+
+  ret = 0;
+
+fin:
+  nghttp3_conn_del(sv);
+  nghttp3_conn_del(cl);
+  free(cs.pending);
+
+  return ret;
+}
+
+/*
+ * scenarios lists the scenarios and their budgets.  The budgets are
+ * the measured values with about 10% headroom.  When a change
+ * reduces allocations, lower the budget accordingly so that it
+ * catches the next regression.
+ */
+static const scenario scenarios[] = {
+    {"qpack-static", run_qpack, 0, 0, 0, 0, 0, 200, 5.0, 23000},
+    {"qpack-dynamic", run_qpack, 4096, 100, 0, 0, 0, 200, 4.6, 29000},
+    {"conn", run_conn, 4096, 100, 0, 100, 10, 200, 13.3, 176000},
+    {"conn-arena", run_conn, 4096, 100, 1, 100, 10, 200, 0.07, 288000},
+};
+
+static int site_compar(const void *lhs, const void *rhs) {
+  const alloc_site *a = lhs, *b = rhs;
+
+  if (a->ncalls != b->ncalls) {
+    return a->ncalls < b->ncalls ? 1 : -1;
+  }
+
+  return a->bytes < b->bytes ? 1 : a->bytes > b->bytes ? -1 : 0;
+}
+
+#ifdef HAVE_DL_ITERATE_PHDR
+static int first_object(struct dl_phdr_info *info, size_t size, void *data) {
+  (void)size;
+
+  *(uintptr_t *)data = (uintptr_t)info->dlpi_addr;
+
+  /* The first object is the executable. */
+  return 1;
+}
+#endif /* HAVE_DL_ITERATE_PHDR */
+
+/*
+ * load_bias returns the difference between the run-time and the
+ * link-time addresses of the executable, or 0 if it is unknown.
+ */
+static uintptr_t load_bias(void) {
+  uintptr_t bias = 0;
+
+#ifdef HAVE_DL_ITERATE_PHDR
+  dl_iterate_phdr(first_object, &bias);
+#endif /* HAVE_DL_ITERATE_PHDR */
+
+  return bias;
+}
+
+static void print_sites(endpoint *ep) {
+  alloc_stat *st = &ep->st;
+  uintptr_t bias = load_bias();
+  size_t i;
+
+  qsort(st->sites, st->nsites, sizeof(st->sites[0]), site_compar);
+
+  printf("  %s call sites:\n", ep->name);
+  printf("  %18s %8s %10s\n", "address", "calls", "bytes");
+
+  for (i = 0; i < st->nsites; ++i) {
+    printf("  %#18llx %8zu %10llu\n",
+           st->sites[i].addr
+               ? (unsigned long long)((uintptr_t)st->sites[i].addr - bias)
+               : 0,
+           st->sites[i].ncalls, (unsigned long long)st->sites[i].bytes);
+  }
+}
+
+static void print_usage(void) {
+  fprintf(stderr, "Usage: alloc_bench [-s] [SCENARIO]...\n");
+}
+
+int main(int argc, char **argv) {
+  const scenario *sc;
+  endpoint ep[2];
+  size_t i, j, calls, peak, nreqs;
+  int sites = 0, c, nfail = 0, nrun = 0;
+  double per_block;
+  const char *verdict;
+
+  while ((c = getopt(argc, argv, "s")) != -1) {
+    switch (c) {
+    case 's':
+      sites = 1;
+      break;
+    default:
+      print_usage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  printf("%-14s %-8s %8s %10s %8s %9s %9s %10s %s\n", "scenario",
+         "endpoint", "calls", "bytes", "peak", "calls/req", "calls/blk",
+         "bytes/blk", "budget");
+
+  for (i = 0; i < arraylen(scenarios); ++i) {
+    sc = &scenarios[i];
+
+    if (optind < argc) {
+      for (j = (size_t)optind; j < (size_t)argc; ++j) {
+        if (strcmp(argv[j], sc->name) == 0) {
+          break;
+        }
+      }
+      if (j == (size_t)argc) {
+        continue;
+      }
+    }
+
+    ++nrun;
+
+    memset(ep, 0, sizeof(ep));
+
+    if (sc->run(sc, ep) != 0) {
+      fprintf(stderr, "%s: failed\n", sc->name);
+      return EXIT_FAILURE;
+    }
+
+    /* A QPACK scenario has no request, and it counts a pair of
+       request and response header blocks as one. */
+    nreqs = sc->nreqs ? sc->nreqs : sc->nblocks / 2;
+    calls = 0;
+    peak = 0;
+
+    for (j = 0; j < 2; ++j) {
+      alloc_stat *st = &ep[j].st;
+
+      if (st->live) {
+        fprintf(stderr, "%s: %s leaked %zu bytes\n", sc->name, ep[j].name,
+                st->live);
+        ++nfail;
+      }
+
+      calls += st->ncalls;
+      peak += st->peak;
+
+      printf("%-14s %-8s %8zu %10llu %8zu %9.2f %9.2f %10.1f\n", sc->name,
+             ep[j].name, st->ncalls, (unsigned long long)st->bytes, st->peak,
+             (double)st->ncalls / (double)nreqs,
+             (double)st->ncalls / (double)sc->nblocks,
+             (double)st->bytes / (double)sc->nblocks);
+    }
+
+    per_block = (double)calls / (double)sc->nblocks;
+
+    if (per_block > sc->max_calls_per_block || peak > sc->max_peak) {
+      verdict = "FAIL";
+      ++nfail;
+    } else {
+      verdict = "ok";
+    }
+
+    printf("%-14s %-8s %8zu %10s %8zu %9.2f %9.2f %10s %s (%.2f, %zu)\n",
+           sc->name, "total", calls, "", peak, (double)calls / (double)nreqs,
+           per_block, "", verdict, sc->max_calls_per_block, sc->max_peak);
+
+    if (sites) {
+      for (j = 0; j < 2; ++j) {
+        print_sites(&ep[j]);
+      }
+    }
+  }
+
+  if (nrun == 0) {
+    print_usage();
+    return EXIT_FAILURE;
+  }
+
+  if (nfail) {
+    fprintf(stderr, "%d scenario(s) exceeded the allocation budget\n", nfail);
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,318 @@
+/*
+ * nghttp3
+ *
+ * Copyright (c) 2019 nghttp3 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#include <nghttp3/nghttp3.h>
+
+/*
+ * file_bench measures the throughput of sending a large file as a
+ * request body.  It compares reading the file into heap buffers with
+ * read_data callback against sending the memory mapped file.  QUIC
+ * stack is emulated by acknowledging data as soon as they are
+ * written.
+ */
+
+#define BUFSIZE (16 * 1024)
+
+typedef struct heap_buf {
+  struct heap_buf *next;
+  size_t len;
+  size_t acked;
+  uint8_t data[BUFSIZE];
+} heap_buf;
+
+typedef struct {
+  int fd;
+  int64_t offset;
+  uint64_t left;
+  /* acked is the number of bytes of application data acknowledged,
+     which are reported by acked_stream_data callback in both
+     modes. */
+  uint64_t acked;
+  /* head and tail form a queue of buffers waiting for
+     acknowledgement. */
+  heap_buf *head, *tail;
+} bench_data;
+
+static int read_data(nghttp3_conn *conn, int64_t stream_id,
+                     const uint8_t **pdata, size_t *pdatalen,
+                     uint32_t *pflags, void *user_data,
+                     void *stream_user_data) {
+  bench_data *bd = user_data;
+  heap_buf *hb;
+  ssize_t nread;
+  size_t n = bd->left < BUFSIZE ? (size_t)bd->left : BUFSIZE;
+
+  (void)conn;
+  (void)stream_id;
+  (void)stream_user_data;
+
+  hb = malloc(sizeof(heap_buf));
+  if (hb == NULL) {
+    return NGHTTP3_ERR_CALLBACK_FAILURE;
+  }
+
+  nread = pread(bd->fd, hb->data, n, (off_t)bd->offset);
+  if (nread != (ssize_t)n) {
+    free(hb);
+    return NGHTTP3_ERR_CALLBACK_FAILURE;
+  }
+
+  hb->next = NULL;
+  hb->len = n;
+  hb->acked = 0;
+
+  if (bd->tail) {
+    bd->tail->next = hb;
+  } else {
+    bd->head = hb;
+  }
+  bd->tail = hb;
+
+  bd->offset += (int64_t)n;
+  bd->left -= n;
+
+  if (bd->left == 0) {
+    *pflags |= NGHTTP3_DATA_FLAG_EOF;
+  }
+
+  *pdata = hb->data;
+  *pdatalen = n;
+
+  return 0;
+}
+
+static int acked_stream_data(nghttp3_conn *conn, int64_t stream_id,
+                             size_t datalen, void *user_data,
+                             void *stream_user_data) {
+  bench_data *bd = user_data;
+  heap_buf *hb;
+  size_t n;
+
+  (void)conn;
+  (void)stream_id;
+  (void)stream_user_data;
+
+  bd->acked += datalen;
+
+  for (; datalen && bd->head;) {
+    hb = bd->head;
+    n = hb->len - hb->acked;
+    if (n > datalen) {
+      hb->acked += datalen;
+      return 0;
+    }
+
+    datalen -= n;
+    bd->head = hb->next;
+    if (bd->head == NULL) {
+      bd->tail = NULL;
+    }
+    free(hb);
+  }
+
+  return 0;
+}
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/*
+ * run sends |len| bytes of file |fd| once, and returns the elapsed
+ * time in seconds, or negative value on error, including when not
+ * all bytes are sent and acknowledged.
+ */
+static double run(int fd, uint64_t len, int use_file) {
+  nghttp3_conn *conn;
+  nghttp3_conn_callbacks callbacks;
+  nghttp3_conn_settings settings;
+  nghttp3_data_reader dr;
+  nghttp3_vec vec[64];
+  bench_data bd;
+  const nghttp3_nv nva[] = {
+      {(uint8_t *)":method", (uint8_t *)"POST", 7, 4, NGHTTP3_NV_FLAG_NONE},
+      {(uint8_t *)":scheme", (uint8_t *)"https", 7, 5, NGHTTP3_NV_FLAG_NONE},
+      {(uint8_t *)":authority", (uint8_t *)"localhost", 10, 9,
+       NGHTTP3_NV_FLAG_NONE},
+      {(uint8_t *)":path", (uint8_t *)"/", 5, 1, NGHTTP3_NV_FLAG_NONE},
+  };
+  ssize_t sveccnt;
+  int64_t stream_id;
+  int fin;
+  size_t i, n;
+  double t;
+  int rv;
+
+  memset(&callbacks, 0, sizeof(callbacks));
+  callbacks.acked_stream_data = acked_stream_data;
+
+  nghttp3_conn_settings_default(&settings);
+
+  memset(&bd, 0, sizeof(bd));
+  bd.fd = fd;
+  bd.left = len;
+
+  memset(&dr, 0, sizeof(dr));
+  if (use_file) {
+    dr.file.fd = fd;
+    dr.file.offset = 0;
+    dr.file.len = (size_t)len;
+  } else {
+    dr.read_data = read_data;
+  }
+
+  rv = nghttp3_conn_client_new(&conn, &callbacks, &settings,
+                               nghttp3_mem_default(), &bd);
+  if (rv != 0) {
+    return -1;
+  }
+
+  t = now();
+
+  rv = nghttp3_conn_bind_qpack_streams(conn, 2, 6);
+  if (rv != 0) {
+    goto fail;
+  }
+
+  rv = nghttp3_conn_submit_request(conn, 0, NULL, nva,
+                                   sizeof(nva) / sizeof(nva[0]), &dr, NULL);
+  if (rv != 0) {
+    goto fail;
+  }
+
+  for (;;) {
+    sveccnt = nghttp3_conn_writev_stream(conn, &stream_id, &fin, vec,
+                                         sizeof(vec) / sizeof(vec[0]));
+    if (sveccnt < 0) {
+      goto fail;
+    }
+    if (sveccnt == 0) {
+      break;
+    }
+
+    for (i = 0, n = 0; i < (size_t)sveccnt; ++i) {
+      n += vec[i].len;
+    }
+
+    if (nghttp3_conn_add_write_offset(conn, stream_id, n) != 0 ||
+        nghttp3_conn_add_ack_offset(conn, stream_id, n) != 0) {
+      goto fail;
+    }
+  }
+
+  t = now() - t;
+
+  nghttp3_conn_del(conn);
+
+  if (bd.acked != len || (!use_file && bd.left)) {
+    fprintf(stderr, "%llu bytes acknowledged, expected %llu\n",
+            (unsigned long long)bd.acked, (unsigned long long)len);
+    return -1;
+  }
+
+  return t;
+
+fail:
+  nghttp3_conn_del(conn);
+
+  return -1;
+}
+
+int main(int argc, char **argv) {
+  uint64_t len = 256 * 1024 * 1024;
+  int niters = 5;
+  FILE *fp;
+  uint8_t buf[BUFSIZE];
+  uint64_t n;
+  int i, use_file;
+  double t, best;
+  static const char *const names[] = {"read_data", "file"};
+
+  if (argc > 1) {
+    len = strtoull(argv[1], NULL, 10) * 1024 * 1024;
+  }
+  if (argc > 2) {
+    niters = atoi(argv[2]);
+  }
+
+  if (len == 0 || niters <= 0) {
+    fprintf(stderr, "Usage: file_bench [SIZE_IN_MIB [ITERATIONS]]\n");
+    return EXIT_FAILURE;
+  }
+
+  fp = tmpfile();
+  if (fp == NULL) {
+    perror("tmpfile");
+    return EXIT_FAILURE;
+  }
+
+  memset(buf, 'x', sizeof(buf));
+
+  for (n = 0; n < len; n += sizeof(buf)) {
+    if (fwrite(buf, sizeof(buf), 1, fp) != 1) {
+      perror("fwrite");
+      return EXIT_FAILURE;
+    }
+  }
+
+  fflush(fp);
+
+  for (use_file = 0; use_file < 2; ++use_file) {
+    best = 0;
+
+    for (i = 0; i < niters; ++i) {
+      t = run(fileno(fp), len, use_file);
+      if (t < 0) {
+        fprintf(stderr, "%s: failed\n", names[use_file]);
+        return EXIT_FAILURE;
+      }
+      if (i == 0 || t < best) {
+        best = t;
+      }
+    }
+
+    printf("%-10s %8.1f MiB/s\n", names[use_file],
+           (double)len / (1024 * 1024) / best);
+  }
+
+  fclose(fp);
+
+  return EXIT_SUCCESS;
+}
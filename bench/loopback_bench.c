@@ -0,0 +1,867 @@
+/*
+ * nghttp3
+ *
+ * Copyright (c) 2019 nghttp3 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <nghttp3/nghttp3.h>
+
+/*
+ * loopback_bench connects a client and a server nghttp3_conn back to
+ * back through an in-process stand-in for QUIC, and measures the
+ * whole request and response exchange.  The stand-in splits stream
+ * data into packets, and delivers them in rounds.  Within a round,
+ * packets of different streams may be reordered, and a packet may be
+ * lost, in which case it and the subsequent packets of the same
+ * stream are delivered in a later round.  A lost packet on QPACK
+ * encoder stream makes request streams blocked on the decoder side.
+ * Each request stream has a flow control window, and the stream is
+ * blocked when the unacknowledged data reach the window.  A packet is
+ * acknowledged as soon as it is delivered.
+ *
+ * The time spent in nghttp3 functions is measured, and the time
+ * spent in the stand-in is not.  The time spent for a request stream
+ * on both endpoints is its per-request CPU, from which the median and
+ * 99th percentile are reported.  Requests per second is the number of
+ * requests divided by the total time spent in nghttp3, including
+ * control and QPACK streams.  Bytes per request counts all stream
+ * data in both directions.
+ */
+
+#define MAX_PKTLEN 1200
+
+typedef struct {
+  /* sent is the number of bytes passed to
+     nghttp3_conn_add_write_offset. */
+  uint64_t sent;
+  /* acked is the number of bytes acknowledged. */
+  uint64_t acked;
+  /* recv is the number of bytes delivered to the receiver. */
+  uint64_t recv;
+  /* blocked is nonzero if nghttp3_conn_block_stream has been
+     called. */
+  int blocked;
+} sim_dir;
+
+typedef struct {
+  /* dir is the state of client to server, and server to client
+     directions. */
+  sim_dir dir[2];
+  /* body_left is the number of response body bytes which server has
+     not provided yet. */
+  size_t body_left;
+  /* body_recv is the number of response body bytes which client has
+     received. */
+  size_t body_recv;
+  /* headers_recv is nonzero if client has received response
+     header. */
+  int headers_recv;
+  /* fin_recv is nonzero if fin has been delivered to client. */
+  int fin_recv;
+  /* done is nonzero if the request stream has been queued to
+     sim.done. */
+  int done;
+  /* cpu is the time spent for this stream in seconds. */
+  double cpu;
+} sim_req;
+
+typedef struct {
+  int64_t stream_id;
+  uint64_t offset;
+  size_t len;
+  int fin;
+  /* lost is nonzero if the packet is lost in this round. */
+  int lost;
+  uint8_t data[];
+} sim_pkt;
+
+typedef struct {
+  sim_pkt **pkts;
+  size_t len, cap;
+} sim_link;
+
+typedef struct {
+  const char *name;
+  size_t nreqs;
+  size_t concurrency;
+  size_t bodylen;
+} sim_workload;
+
+typedef struct {
+  /* conn[0] is client, and conn[1] is server. */
+  nghttp3_conn *conn[2];
+  /* link[i] carries the packets sent by conn[i]. */
+  sim_link link[2];
+  sim_req *reqs;
+  /* uni is the state of unidirectional streams, indexed by the
+     initiator (0 is client) and stream ID / 4. */
+  sim_dir uni[2][4];
+  /* pending is the request streams which server has received
+     request header and has not responded to. */
+  int64_t *pending;
+  size_t npending;
+  /* done is the request streams whose response client has received
+     entirely. */
+  int64_t *done;
+  size_t ndone;
+  const sim_workload *wl;
+  size_t window;
+  double reorder, loss;
+  uint64_t rnd_state;
+  size_t nsubmitted, ncompleted;
+  /* wire_bytes is the number of bytes sent, and delivered is the
+     number of bytes delivered. */
+  uint64_t wire_bytes, delivered;
+  double libtime;
+} sim;
+
+static const uint8_t body[16384];
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static double rnd(sim *s) {
+  s->rnd_state = s->rnd_state * 6364136223846793005llu + 1442695040888963407llu;
+  return (double)(s->rnd_state >> 11) / (double)(1llu << 53);
+}
+
+static int is_bidi(int64_t stream_id) { return (stream_id & 0x2) == 0; }
+
+/*
+ * sim_get_dir returns the state of stream |stream_id| in the
+ * direction where conn[|side|] sends.
+ */
+static sim_dir *sim_get_dir(sim *s, int64_t stream_id, int side) {
+  if (is_bidi(stream_id)) {
+    return &s->reqs[stream_id >> 2].dir[side];
+  }
+
+  return &s->uni[stream_id & 0x1][stream_id >> 2];
+}
+
+/*
+ * sim_charge accounts |t| seconds spent in nghttp3 for
+ * |stream_id|.  |stream_id| is -1 if the time is not for a particular
+ * stream.
+ */
+static void sim_charge(sim *s, int64_t stream_id, double t) {
+  s->libtime += t;
+
+  if (stream_id >= 0 && is_bidi(stream_id)) {
+    s->reqs[stream_id >> 2].cpu += t;
+  }
+}
+
+static int server_end_headers(nghttp3_conn *conn, int64_t stream_id,
+                              void *user_data, void *stream_user_data) {
+  sim *s = user_data;
+
+  (void)conn;
+  (void)stream_user_data;
+
+  s->pending[s->npending++] = stream_id;
+
+  return 0;
+}
+
+/*
+ * client_check_done queues request stream |stream_id| to s->done if
+ * client has received the whole response.  Because decoding header
+ * may be blocked, fin being delivered is not enough.
+ */
+static void client_check_done(sim *s, int64_t stream_id) {
+  sim_req *req = &s->reqs[stream_id >> 2];
+
+  if (!req->done && req->fin_recv && req->headers_recv &&
+      req->body_recv == s->wl->bodylen) {
+    req->done = 1;
+    s->done[s->ndone++] = stream_id;
+  }
+}
+
+static int client_end_headers(nghttp3_conn *conn, int64_t stream_id,
+                              void *user_data, void *stream_user_data) {
+  sim *s = user_data;
+
+  (void)conn;
+  (void)stream_user_data;
+
+  s->reqs[stream_id >> 2].headers_recv = 1;
+  client_check_done(s, stream_id);
+
+  return 0;
+}
+
+static int client_recv_data(nghttp3_conn *conn, int64_t stream_id,
+                            const uint8_t *data, size_t datalen,
+                            void *user_data, void *stream_user_data) {
+  sim *s = user_data;
+
+  (void)conn;
+  (void)data;
+  (void)stream_user_data;
+
+  s->reqs[stream_id >> 2].body_recv += datalen;
+  client_check_done(s, stream_id);
+
+  return 0;
+}
+
+static int server_read_data(nghttp3_conn *conn, int64_t stream_id,
+                            const uint8_t **pdata, size_t *pdatalen,
+                            uint32_t *pflags, void *user_data,
+                            void *stream_user_data) {
+  sim *s = user_data;
+  sim_req *req = &s->reqs[stream_id >> 2];
+  size_t n = req->body_left < sizeof(body) ? req->body_left : sizeof(body);
+
+  (void)conn;
+  (void)stream_user_data;
+
+  *pdata = body;
+  *pdatalen = n;
+  req->body_left -= n;
+
+  if (req->body_left == 0) {
+    *pflags = NGHTTP3_DATA_FLAG_EOF;
+  }
+
+  return 0;
+}
+
+static int sim_link_push(sim_link *link, sim_pkt *pkt) {
+  sim_pkt **pkts;
+  size_t cap;
+
+  if (link->len == link->cap) {
+    cap = link->cap ? link->cap * 2 : 256;
+    pkts = realloc(link->pkts, sizeof(link->pkts[0]) * cap);
+    if (pkts == NULL) {
+      return -1;
+    }
+    link->pkts = pkts;
+    link->cap = cap;
+  }
+
+  link->pkts[link->len++] = pkt;
+
+  return 0;
+}
+
+static void sim_link_free(sim_link *link) {
+  size_t i;
+
+  for (i = 0; i < link->len; ++i) {
+    free(link->pkts[i]);
+  }
+
+  free(link->pkts);
+}
+
+/*
+ * sim_packetize splits the first |len| bytes in |vec| of length
+ * |veccnt| into packets of stream |stream_id| starting at |offset|,
+ * and queues them to |link|.  If |fin| is nonzero, the last packet
+ * carries fin.  It returns 0 if it succeeds, or -1.
+ */
+static int sim_packetize(sim_link *link, int64_t stream_id, uint64_t offset,
+                         const nghttp3_vec *vec, size_t veccnt, size_t len,
+                         int fin) {
+  sim_pkt *pkt;
+  size_t pktlen, n, vecoff = 0;
+
+  do {
+    pktlen = len < MAX_PKTLEN ? len : MAX_PKTLEN;
+
+    pkt = malloc(sizeof(sim_pkt) + pktlen);
+    if (pkt == NULL) {
+      return -1;
+    }
+
+    pkt->stream_id = stream_id;
+    pkt->offset = offset;
+    pkt->len = pktlen;
+    pkt->fin = fin && pktlen == len;
+    pkt->lost = 0;
+
+    for (n = 0; n < pktlen;) {
+      size_t m = vec->len - vecoff;
+
+      if (m > pktlen - n) {
+        m = pktlen - n;
+      }
+
+      memcpy(pkt->data + n, vec->base + vecoff, m);
+      n += m;
+      vecoff += m;
+
+      if (vecoff == vec->len) {
+        ++vec;
+        --veccnt;
+        vecoff = 0;
+      }
+    }
+
+    if (sim_link_push(link, pkt) != 0) {
+      free(pkt);
+      return -1;
+    }
+
+    offset += pktlen;
+    len -= pktlen;
+  } while (len);
+
+  (void)veccnt;
+
+  return 0;
+}
+
+/*
+ * sim_send moves the stream data which conn[|side|] has into its
+ * link as far as flow control allows.  It returns 0 if it succeeds,
+ * or -1.
+ */
+static int sim_send(sim *s, int side) {
+  nghttp3_conn *conn = s->conn[side];
+  nghttp3_vec vec[16];
+  ssize_t sveccnt;
+  int64_t stream_id;
+  int fin, rv;
+  size_t len, n;
+  sim_dir *sd;
+  double t;
+
+  for (;;) {
+    stream_id = -1;
+
+    t = now();
+    sveccnt = nghttp3_conn_writev_stream(conn, &stream_id, &fin, vec,
+                                         sizeof(vec) / sizeof(vec[0]));
+    sim_charge(s, stream_id, now() - t);
+
+    if (sveccnt < 0) {
+      fprintf(stderr, "nghttp3_conn_writev_stream: %s\n",
+              nghttp3_strerror((int)sveccnt));
+      return -1;
+    }
+
+    if (sveccnt == 0) {
+      return 0;
+    }
+
+    len = nghttp3_vec_len(vec, (size_t)sveccnt);
+    sd = sim_get_dir(s, stream_id, side);
+    n = len;
+
+    if (is_bidi(stream_id)) {
+      if (sd->sent - sd->acked >= s->window) {
+        n = 0;
+      } else if (sd->sent - sd->acked + len > s->window) {
+        n = (size_t)(s->window - (sd->sent - sd->acked));
+      }
+    }
+
+    if (n < len) {
+      fin = 0;
+
+      t = now();
+      rv = nghttp3_conn_block_stream(conn, stream_id);
+      sim_charge(s, stream_id, now() - t);
+
+      if (rv != 0) {
+        fprintf(stderr, "nghttp3_conn_block_stream: %s\n",
+                nghttp3_strerror(rv));
+        return -1;
+      }
+
+      sd->blocked = 1;
+
+      if (n == 0) {
+        continue;
+      }
+    }
+
+    if (sim_packetize(&s->link[side], stream_id, sd->sent, vec,
+                      (size_t)sveccnt, n, fin) != 0) {
+      fprintf(stderr, "out of memory\n");
+      return -1;
+    }
+
+    t = now();
+    rv = nghttp3_conn_add_write_offset(conn, stream_id, n);
+    sim_charge(s, stream_id, now() - t);
+
+    if (rv != 0) {
+      fprintf(stderr, "nghttp3_conn_add_write_offset: %s\n",
+              nghttp3_strerror(rv));
+      return -1;
+    }
+
+    sd->sent += n;
+    s->wire_bytes += n;
+  }
+}
+
+/*
+ * sim_complete closes the request streams in s->done on both
+ * endpoints.  It returns 0 if it succeeds, or -1.
+ */
+static int sim_complete(sim *s) {
+  int64_t stream_id;
+  size_t i;
+  int rv, j;
+  double t;
+
+  for (i = 0; i < s->ndone; ++i) {
+    stream_id = s->done[i];
+
+    for (j = 0; j < 2; ++j) {
+      t = now();
+      rv = nghttp3_conn_close_stream(s->conn[j], stream_id);
+      sim_charge(s, stream_id, now() - t);
+
+      if (rv != 0) {
+        fprintf(stderr, "nghttp3_conn_close_stream: %s\n",
+                nghttp3_strerror(rv));
+        return -1;
+      }
+    }
+  }
+
+  s->ncompleted += s->ndone;
+  s->ndone = 0;
+
+  return 0;
+}
+
+/*
+ * sim_deliver delivers the packets in the link of conn[|side|] which
+ * are not lost in this round and whose preceding data in the same
+ * stream have been delivered.  It returns 0 if it succeeds, or -1.
+ */
+static int sim_deliver(sim *s, int side) {
+  sim_link *link = &s->link[side];
+  nghttp3_conn *sender = s->conn[side], *receiver = s->conn[!side];
+  sim_pkt *pkt;
+  sim_dir *sd;
+  size_t i, j;
+  ssize_t nread;
+  int progress, rv;
+  double t;
+
+  for (i = 0; i < link->len; ++i) {
+    if (s->reorder > 0 && i + 1 < link->len && rnd(s) < s->reorder) {
+      j = i + 1 + (size_t)(rnd(s) * (double)(link->len - i - 1));
+      pkt = link->pkts[i];
+      link->pkts[i] = link->pkts[j];
+      link->pkts[j] = pkt;
+    }
+    link->pkts[i]->lost = s->loss > 0 && rnd(s) < s->loss;
+  }
+
+  do {
+    progress = 0;
+
+    for (i = 0; i < link->len; ++i) {
+      pkt = link->pkts[i];
+      if (pkt == NULL || pkt->lost) {
+        continue;
+      }
+
+      sd = sim_get_dir(s, pkt->stream_id, side);
+      if (pkt->offset != sd->recv) {
+        continue;
+      }
+
+      if (pkt->fin && side == 1 && is_bidi(pkt->stream_id)) {
+        s->reqs[pkt->stream_id >> 2].fin_recv = 1;
+      }
+
+      t = now();
+      nread = nghttp3_conn_read_stream(receiver, pkt->stream_id, pkt->data,
+                                       pkt->len, pkt->fin);
+      sim_charge(s, pkt->stream_id, now() - t);
+
+      if (nread < 0) {
+        fprintf(stderr, "nghttp3_conn_read_stream: %s\n",
+                nghttp3_strerror((int)nread));
+        return -1;
+      }
+
+      sd->recv += pkt->len;
+      sd->acked += pkt->len;
+      s->delivered += pkt->len;
+
+      t = now();
+      rv = nghttp3_conn_add_ack_offset(sender, pkt->stream_id, pkt->len);
+      if (rv == 0 && sd->blocked && sd->sent - sd->acked < s->window) {
+        sd->blocked = 0;
+        rv = nghttp3_conn_unblock_stream(sender, pkt->stream_id);
+      }
+      sim_charge(s, pkt->stream_id, now() - t);
+
+      if (rv != 0) {
+        fprintf(stderr, "nghttp3_conn_add_ack_offset: %s\n",
+                nghttp3_strerror(rv));
+        return -1;
+      }
+
+      if (pkt->fin && side == 1 && is_bidi(pkt->stream_id)) {
+        client_check_done(s, pkt->stream_id);
+      }
+
+      if (sim_complete(s) != 0) {
+        return -1;
+      }
+
+      free(pkt);
+      link->pkts[i] = NULL;
+      progress = 1;
+    }
+  } while (progress);
+
+  for (i = 0, j = 0; i < link->len; ++i) {
+    if (link->pkts[i]) {
+      link->pkts[j++] = link->pkts[i];
+    }
+  }
+  link->len = j;
+
+  return 0;
+}
+
+/*
+ * sim_respond submits responses to the pending requests on server.
+ * It returns 0 if it succeeds, or -1.
+ */
+static int sim_respond(sim *s) {
+  nghttp3_nv nva[] = {
+      {(uint8_t *)":status", (uint8_t *)"200", 7, 3, NGHTTP3_NV_FLAG_NONE},
+      {(uint8_t *)"server", (uint8_t *)"loopback_bench", 6, 14,
+       NGHTTP3_NV_FLAG_NONE},
+      {(uint8_t *)"content-type", (uint8_t *)"application/octet-stream", 12,
+       24, NGHTTP3_NV_FLAG_NONE},
+      {(uint8_t *)"content-length", NULL, 14, 0, NGHTTP3_NV_FLAG_NONE},
+  };
+  char clen[32];
+  nghttp3_data_reader dr;
+  int64_t stream_id;
+  size_t i;
+  int rv;
+  double t;
+
+  nva[3].value = (uint8_t *)clen;
+  nva[3].valuelen =
+      (size_t)snprintf(clen, sizeof(clen), "%zu", s->wl->bodylen);
+
+  memset(&dr, 0, sizeof(dr));
+  dr.read_data = server_read_data;
+
+  for (i = 0; i < s->npending; ++i) {
+    stream_id = s->pending[i];
+    s->reqs[stream_id >> 2].body_left = s->wl->bodylen;
+
+    t = now();
+    rv = nghttp3_conn_submit_response(s->conn[1], stream_id, nva,
+                                      sizeof(nva) / sizeof(nva[0]),
+                                      s->wl->bodylen ? &dr : NULL);
+    if (rv == 0) {
+      rv = nghttp3_conn_end_stream(s->conn[1], stream_id);
+    }
+    sim_charge(s, stream_id, now() - t);
+
+    if (rv != 0) {
+      fprintf(stderr, "nghttp3_conn_submit_response: %s\n",
+              nghttp3_strerror(rv));
+      return -1;
+    }
+  }
+
+  s->npending = 0;
+
+  return 0;
+}
+
+/*
+ * sim_request submits requests on client so that the workload's
+ * number of requests are outstanding.  It returns 0 if it succeeds,
+ * or -1.
+ */
+static int sim_request(sim *s) {
+  nghttp3_nv nva[] = {
+      {(uint8_t *)":method", (uint8_t *)"GET", 7, 3, NGHTTP3_NV_FLAG_NONE},
+      {(uint8_t *)":scheme", (uint8_t *)"https", 7, 5, NGHTTP3_NV_FLAG_NONE},
+      {(uint8_t *)":authority", (uint8_t *)"example.com", 10, 11,
+       NGHTTP3_NV_FLAG_NONE},
+      {(uint8_t *)":path", NULL, 5, 0, NGHTTP3_NV_FLAG_NONE},
+      {(uint8_t *)"user-agent", (uint8_t *)"loopback_bench", 10, 14,
+       NGHTTP3_NV_FLAG_NONE},
+      {(uint8_t *)"accept", (uint8_t *)"*/*", 6, 3, NGHTTP3_NV_FLAG_NONE},
+  };
+  char path[32];
+  int64_t stream_id;
+  int rv;
+  double t;
+
+  nva[3].value = (uint8_t *)path;
+
+  for (; s->nsubmitted < s->wl->nreqs &&
+         s->nsubmitted - s->ncompleted < s->wl->concurrency;
+       ++s->nsubmitted) {
+    stream_id = (int64_t)(s->nsubmitted * 4);
+    nva[3].valuelen =
+        (size_t)snprintf(path, sizeof(path), "/%s/%zu", s->wl->name,
+                         s->nsubmitted);
+
+    t = now();
+    rv = nghttp3_conn_submit_request(s->conn[0], stream_id, NULL, nva,
+                                     sizeof(nva) / sizeof(nva[0]), NULL, NULL);
+    if (rv == 0) {
+      rv = nghttp3_conn_end_stream(s->conn[0], stream_id);
+    }
+    sim_charge(s, stream_id, now() - t);
+
+    if (rv != 0) {
+      fprintf(stderr, "nghttp3_conn_submit_request: %s\n",
+              nghttp3_strerror(rv));
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static int sim_init(sim *s, const sim_workload *wl, size_t window,
+                    double reorder, double loss, uint64_t seed) {
+  nghttp3_conn_callbacks callbacks;
+  nghttp3_conn_settings settings;
+  const nghttp3_mem *mem = nghttp3_mem_default();
+  int rv;
+
+  memset(s, 0, sizeof(*s));
+
+  s->wl = wl;
+  s->window = window;
+  s->reorder = reorder;
+  s->loss = loss;
+  s->rnd_state = seed;
+
+  s->reqs = calloc(wl->nreqs, sizeof(s->reqs[0]));
+  s->pending = malloc(sizeof(s->pending[0]) * wl->nreqs);
+  s->done = malloc(sizeof(s->done[0]) * wl->nreqs);
+  if (s->reqs == NULL || s->pending == NULL || s->done == NULL) {
+    return -1;
+  }
+
+  nghttp3_conn_settings_default(&settings);
+  settings.qpack_max_table_capacity = 4096;
+  settings.qpack_blocked_streams = 100;
+
+  memset(&callbacks, 0, sizeof(callbacks));
+  callbacks.end_headers = client_end_headers;
+  callbacks.recv_data = client_recv_data;
+
+  rv = nghttp3_conn_client_new(&s->conn[0], &callbacks, &settings, mem, s);
+  if (rv != 0) {
+    fprintf(stderr, "nghttp3_conn_client_new: %s\n", nghttp3_strerror(rv));
+    return -1;
+  }
+
+  memset(&callbacks, 0, sizeof(callbacks));
+  callbacks.end_headers = server_end_headers;
+
+  rv = nghttp3_conn_server_new(&s->conn[1], &callbacks, &settings, mem, s);
+  if (rv != 0) {
+    fprintf(stderr, "nghttp3_conn_server_new: %s\n", nghttp3_strerror(rv));
+    return -1;
+  }
+
+  nghttp3_conn_set_max_client_streams_bidi(s->conn[1], wl->nreqs);
+
+  if (nghttp3_conn_bind_control_stream(s->conn[0], 2) != 0 ||
+      nghttp3_conn_bind_control_stream(s->conn[1], 3) != 0 ||
+      nghttp3_conn_bind_qpack_streams(s->conn[0], 6, 10) != 0 ||
+      nghttp3_conn_bind_qpack_streams(s->conn[1], 7, 11) != 0) {
+    fprintf(stderr, "Could not bind streams\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+static void sim_free(sim *s) {
+  nghttp3_conn_del(s->conn[1]);
+  nghttp3_conn_del(s->conn[0]);
+  sim_link_free(&s->link[1]);
+  sim_link_free(&s->link[0]);
+  free(s->done);
+  free(s->pending);
+  free(s->reqs);
+}
+
+static int compare_double(const void *lhs, const void *rhs) {
+  double a = *(const double *)lhs, b = *(const double *)rhs;
+
+  return a < b ? -1 : a > b;
+}
+
+/*
+ * run runs workload |wl| to completion, and prints the measurements.
+ * It returns 0 if it succeeds, or -1.
+ */
+static int run(const sim_workload *wl, size_t window, double reorder,
+               double loss, uint64_t seed) {
+  sim s;
+  double *cpu = NULL;
+  size_t i, nrounds = 0, nidle = 0;
+  uint64_t moved;
+  int ret = -1;
+
+  if (sim_init(&s, wl, window, reorder, loss, seed) != 0) {
+    goto fin;
+  }
+
+  while (s.ncompleted < wl->nreqs) {
+    moved = s.wire_bytes + s.delivered;
+
+    if (sim_request(&s) != 0 || sim_send(&s, 0) != 0 ||
+        sim_send(&s, 1) != 0 || sim_deliver(&s, 0) != 0 ||
+        sim_deliver(&s, 1) != 0 || sim_respond(&s) != 0) {
+      goto fin;
+    }
+
+    ++nrounds;
+
+    if (moved != s.wire_bytes + s.delivered) {
+      nidle = 0;
+    } else if (++nidle == 100000) {
+      fprintf(stderr, "%s: no progress after %zu rounds\n", wl->name,
+              nrounds);
+      goto fin;
+    }
+  }
+
+  cpu = malloc(sizeof(cpu[0]) * wl->nreqs);
+  if (cpu == NULL) {
+    goto fin;
+  }
+
+  for (i = 0; i < wl->nreqs; ++i) {
+    cpu[i] = s.reqs[i].cpu;
+  }
+
+  qsort(cpu, wl->nreqs, sizeof(cpu[0]), compare_double);
+
+  printf("%-6s %8zu %6zu %9zu %7zu %12.0f %12.1f %9.2f %9.2f\n", wl->name,
+         wl->nreqs, wl->concurrency, wl->bodylen, nrounds,
+         (double)wl->nreqs / s.libtime,
+         (double)s.wire_bytes / (double)wl->nreqs,
+         cpu[wl->nreqs / 2] * 1e6, cpu[(wl->nreqs * 99) / 100] * 1e6);
+
+  ret = 0;
+
+fin:
+  free(cpu);
+  sim_free(&s);
+
+  return ret;
+}
+
+static void print_usage(void) {
+  fprintf(stderr,
+          "Usage: loopback_bench [-w WORKLOAD] [-W WINDOW] [-r REORDER] "
+          "[-l LOSS] [-s SEED]\n"
+          "  WORKLOAD is small, large, or many.  All of them run by default.\n"
+          "  REORDER and LOSS are probabilities per packet.\n");
+}
+
+int main(int argc, char **argv) {
+  static const sim_workload workloads[] = {
+      {"small", 20000, 10, 1024},
+      {"large", 100, 4, 1 << 20},
+      {"many", 20000, 1000, 1024},
+  };
+  const char *name = NULL;
+  size_t window = 65536, i;
+  double reorder = 0, loss = 0;
+  uint64_t seed = 1;
+  int c;
+
+  while ((c = getopt(argc, argv, "w:W:r:l:s:")) != -1) {
+    switch (c) {
+    case 'w':
+      name = optarg;
+      break;
+    case 'W':
+      window = strtoul(optarg, NULL, 10);
+      break;
+    case 'r':
+      reorder = strtod(optarg, NULL);
+      break;
+    case 'l':
+      loss = strtod(optarg, NULL);
+      break;
+    case 's':
+      seed = strtoull(optarg, NULL, 10);
+      break;
+    default:
+      print_usage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (optind != argc || window == 0 || reorder < 0 || reorder > 1 ||
+      loss < 0 || loss >= 1) {
+    print_usage();
+    return EXIT_FAILURE;
+  }
+
+  printf("%-6s %8s %6s %9s %7s %12s %12s %9s %9s\n", "name", "requests",
+         "conc", "body", "rounds", "req/s", "bytes/req", "p50 us", "p99 us");
+
+  for (i = 0; i < sizeof(workloads) / sizeof(workloads[0]); ++i) {
+    if (name && strcmp(name, workloads[i].name) != 0) {
+      continue;
+    }
+
+    if (run(&workloads[i], window, reorder, loss, seed) != 0) {
+      return EXIT_FAILURE;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,262 @@
+/*
+ * nghttp3
+ *
+ * Copyright (c) 2019 nghttp3 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "nghttp3_map.h"
+
+/*
+ * map_bench measures nghttp3_map with the key pattern of stream IDs,
+ * that is multiples of 4.  "fill" inserts N entries, finds each of
+ * them, and removes them all.  "churn" keeps N entries in the map,
+ * and each operation removes the oldest entry, inserts a new one,
+ * and finds a random live entry, which emulates streams being opened
+ * and closed.  "miss" looks up keys which are not in the map.  It
+ * also reports the size of the table of the empty map before the
+ * first insertion and after all entries are removed.
+ */
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint64_t rnd(uint64_t *state) {
+  *state = *state * 6364136223846793005llu + 1442695040888963407llu;
+  return *state >> 33;
+}
+
+static size_t table_bytes(const nghttp3_map *map) {
+  return map->tablelen * sizeof(nghttp3_map_entry *);
+}
+
+/*
+ * run_fill inserts, finds and removes |n| entries |nrounds| times,
+ * and returns the elapsed time in seconds, or negative value on
+ * error.  It stores the table size after removal in |*pidle|.
+ */
+static double run_fill(nghttp3_map_entry *ents, size_t n, size_t nrounds,
+                       size_t *pidle) {
+  nghttp3_map map;
+  size_t i, r;
+  double t;
+
+  nghttp3_map_init(&map, nghttp3_mem_default());
+
+  t = now();
+
+  for (r = 0; r < nrounds; ++r) {
+    for (i = 0; i < n; ++i) {
+      nghttp3_map_entry_init(&ents[i], (key_type)(i * 4));
+      if (nghttp3_map_insert(&map, &ents[i]) != 0) {
+        t = -1;
+        goto fin;
+      }
+    }
+    for (i = 0; i < n; ++i) {
+      if (nghttp3_map_find(&map, (key_type)(i * 4)) != &ents[i]) {
+        t = -1;
+        goto fin;
+      }
+    }
+    for (i = 0; i < n; ++i) {
+      if (nghttp3_map_remove(&map, (key_type)(i * 4)) != 0) {
+        t = -1;
+        goto fin;
+      }
+    }
+  }
+
+  t = now() - t;
+
+  *pidle = table_bytes(&map);
+
+fin:
+  nghttp3_map_free(&map);
+
+  return t;
+}
+
+/*
+ * run_churn keeps |n| entries in a map, and performs |nops|
+ * operations.  It returns the elapsed time in seconds, or negative
+ * value on error.
+ */
+static double run_churn(nghttp3_map_entry *ents, size_t n, size_t nops) {
+  nghttp3_map map;
+  uint64_t state = 1;
+  key_type next_key = 0, key;
+  size_t i;
+  double t;
+
+  nghttp3_map_init(&map, nghttp3_mem_default());
+
+  for (i = 0; i < n; ++i, next_key += 4) {
+    nghttp3_map_entry_init(&ents[i], next_key);
+    if (nghttp3_map_insert(&map, &ents[i]) != 0) {
+      t = -1;
+      goto fin;
+    }
+  }
+
+  t = now();
+
+  for (i = 0; i < nops; ++i, next_key += 4) {
+    /* The oldest entry is stored at ents[i % n]. */
+    if (nghttp3_map_remove(&map, next_key - n * 4) != 0) {
+      t = -1;
+      goto fin;
+    }
+    nghttp3_map_entry_init(&ents[i % n], next_key);
+    if (nghttp3_map_insert(&map, &ents[i % n]) != 0) {
+      t = -1;
+      goto fin;
+    }
+    key = next_key - (rnd(&state) % n) * 4;
+    if (nghttp3_map_find(&map, key) == NULL) {
+      t = -1;
+      goto fin;
+    }
+  }
+
+  t = now() - t;
+
+fin:
+  nghttp3_map_free(&map);
+
+  return t;
+}
+
+/*
+ * run_miss looks up |nops| keys which are not in a map of |n|
+ * entries.  It returns the elapsed time in seconds, or negative
+ * value on error.
+ */
+static double run_miss(nghttp3_map_entry *ents, size_t n, size_t nops) {
+  nghttp3_map map;
+  size_t i;
+  double t;
+
+  nghttp3_map_init(&map, nghttp3_mem_default());
+
+  for (i = 0; i < n; ++i) {
+    nghttp3_map_entry_init(&ents[i], (key_type)(i * 4));
+    if (nghttp3_map_insert(&map, &ents[i]) != 0) {
+      t = -1;
+      goto fin;
+    }
+  }
+
+  t = now();
+
+  for (i = 0; i < nops; ++i) {
+    if (nghttp3_map_find(&map, (key_type)(i * 4 + 2)) != NULL) {
+      t = -1;
+      goto fin;
+    }
+  }
+
+  t = now() - t;
+
+fin:
+  nghttp3_map_free(&map);
+
+  return t;
+}
+
+int main(int argc, char **argv) {
+  size_t n = 1000;
+  size_t nops = 10000000;
+  size_t nrounds, idle = 0;
+  nghttp3_map map;
+  nghttp3_map_entry *ents;
+  double t;
+
+  if (argc > 1) {
+    n = strtoul(argv[1], NULL, 10);
+  }
+  if (argc > 2) {
+    nops = strtoul(argv[2], NULL, 10);
+  }
+
+  if (n == 0 || nops == 0) {
+    fprintf(stderr, "Usage: map_bench [ENTRIES [OPERATIONS]]\n");
+    return EXIT_FAILURE;
+  }
+
+  ents = malloc(sizeof(nghttp3_map_entry) * n);
+  if (ents == NULL) {
+    return EXIT_FAILURE;
+  }
+
+  nrounds = nops / n ? nops / n : 1;
+
+  t = run_fill(ents, n, nrounds, &idle);
+  if (t < 0) {
+    fprintf(stderr, "fill: failed\n");
+    goto fail;
+  }
+
+  printf("%-10s %10.1f ns/op\n", "fill", t * 1e9 / (double)(nrounds * n * 3));
+
+  t = run_churn(ents, n, nops);
+  if (t < 0) {
+    fprintf(stderr, "churn: failed\n");
+    goto fail;
+  }
+
+  printf("%-10s %10.1f ns/op\n", "churn", t * 1e9 / (double)nops);
+
+  t = run_miss(ents, n, nops);
+  if (t < 0) {
+    fprintf(stderr, "miss: failed\n");
+    goto fail;
+  }
+
+  printf("%-10s %10.1f ns/op\n", "miss", t * 1e9 / (double)nops);
+
+  nghttp3_map_init(&map, nghttp3_mem_default());
+  printf("%-10s %10zu bytes\n", "empty", table_bytes(&map));
+  nghttp3_map_free(&map);
+
+  printf("%-10s %10zu bytes\n", "drained", idle);
+
+  free(ents);
+
+  return EXIT_SUCCESS;
+
+fail:
+  free(ents);
+
+  return EXIT_FAILURE;
+}
@@ -0,0 +1,576 @@
+/*
+ * nghttp3
+ *
+ * Copyright (c) 2019 nghttp3 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <nghttp3/nghttp3.h>
+
+/*
+ * qpack_bench measures QPACK encoder and decoder over QIF files,
+ * which are the header lists used by qifs.sh.  For each combination
+ * of dynamic table size and blocked streams limit, every header
+ * block is encoded, and the encoder stream and the header block are
+ * immediately fed to the decoder whose decoder stream goes back to
+ * the encoder, as if the peer received everything without delay.  It
+ * reports the throughput in MB/s of the header field names and
+ * values, ns per field, the number of allocations per header block,
+ * and the encoded size (header blocks and encoder stream) relative to
+ * the input.  With -c, it writes the same numbers as CSV for
+ * regression tracking.
+ */
+
+typedef struct {
+  /* nva is the header fields in a header block. */
+  nghttp3_nv *nva;
+  size_t nvlen;
+} qif_block;
+
+typedef struct {
+  /* bufs is the contents of the QIF files.  nva points into them. */
+  char **bufs;
+  size_t nbufs;
+  nghttp3_nv *nva;
+  size_t nvlen, nvcap;
+  qif_block *blocks;
+  size_t nblocks, blockscap;
+  /* srclen is the sum of the length of names and values. */
+  size_t srclen;
+} qif_corpus;
+
+typedef struct {
+  /* nalloc is the number of allocations ever made. */
+  size_t nalloc;
+} bench_mem;
+
+static void *bench_malloc(size_t size, void *user_data) {
+  bench_mem *bm = user_data;
+
+  ++bm->nalloc;
+
+  return malloc(size);
+}
+
+static void bench_free(void *ptr, void *user_data) {
+  (void)user_data;
+
+  free(ptr);
+}
+
+static void *bench_calloc(size_t nmemb, size_t size, void *user_data) {
+  bench_mem *bm = user_data;
+
+  ++bm->nalloc;
+
+  return calloc(nmemb, size);
+}
+
+static void *bench_realloc(void *ptr, size_t size, void *user_data) {
+  bench_mem *bm = user_data;
+
+  ++bm->nalloc;
+
+  return realloc(ptr, size);
+}
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void *grow(void *p, size_t *pcap, size_t len, size_t size) {
+  size_t cap = *pcap ? *pcap * 2 : 64;
+
+  if (len < *pcap) {
+    return p;
+  }
+
+  p = realloc(p, cap * size);
+  if (p == NULL) {
+    perror("realloc");
+    exit(EXIT_FAILURE);
+  }
+
+  *pcap = cap;
+
+  return p;
+}
+
+/*
+ * qif_end_block finishes the header block which starts at nva[first]
+ * if it is not empty.
+ */
+static void qif_end_block(qif_corpus *qc, size_t first) {
+  if (qc->nvlen == first) {
+    return;
+  }
+
+  qc->blocks =
+      grow(qc->blocks, &qc->blockscap, qc->nblocks, sizeof(qc->blocks[0]));
+  /* nva is fixed up after all files are read. */
+  qc->blocks[qc->nblocks].nva = (nghttp3_nv *)(uintptr_t)first;
+  qc->blocks[qc->nblocks].nvlen = qc->nvlen - first;
+  ++qc->nblocks;
+}
+
+/*
+ * qif_load reads a QIF file |path| into |qc|.  Each line is a header
+ * field whose name and value are separated by TAB, and an empty line
+ * ends a header block.  A line starting with "#" is a comment.  It
+ * returns 0 if it succeeds, or -1.
+ */
+static int qif_load(qif_corpus *qc, const char *path) {
+  FILE *fp;
+  long size;
+  char *buf, *p, *end, *eol, *le, *tab;
+  size_t first;
+  nghttp3_nv *nv;
+
+  fp = fopen(path, "rb");
+  if (fp == NULL) {
+    perror(path);
+    return -1;
+  }
+
+  if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0 ||
+      fseek(fp, 0, SEEK_SET) != 0) {
+    perror(path);
+    fclose(fp);
+    return -1;
+  }
+
+  buf = malloc((size_t)size + 1);
+  if (buf == NULL || (size && fread(buf, (size_t)size, 1, fp) != 1)) {
+    perror(path);
+    free(buf);
+    fclose(fp);
+    return -1;
+  }
+
+  fclose(fp);
+
+  buf[size] = '\n';
+
+  qc->bufs = realloc(qc->bufs, sizeof(qc->bufs[0]) * (qc->nbufs + 1));
+  if (qc->bufs == NULL) {
+    perror("realloc");
+    exit(EXIT_FAILURE);
+  }
+  qc->bufs[qc->nbufs++] = buf;
+
+  first = qc->nvlen;
+
+  for (p = buf, end = buf + size; p < end; p = eol + 1) {
+    eol = memchr(p, '\n', (size_t)(end + 1 - p));
+    le = eol;
+    if (le > p && le[-1] == '\r') {
+      --le;
+    }
+
+    if (p == le) {
+      qif_end_block(qc, first);
+      first = qc->nvlen;
+      continue;
+    }
+
+    if (*p == '#') {
+      continue;
+    }
+
+    tab = memchr(p, '\t', (size_t)(le - p));
+    if (tab == NULL) {
+      fprintf(stderr, "%s: could not find TAB in header field\n", path);
+      return -1;
+    }
+
+    qc->nva = grow(qc->nva, &qc->nvcap, qc->nvlen, sizeof(qc->nva[0]));
+    nv = &qc->nva[qc->nvlen++];
+
+    nv->name = (uint8_t *)p;
+    nv->namelen = (size_t)(tab - p);
+
+    for (p = tab + 1; p < le && *p == ' '; ++p)
+      ;
+
+    nv->value = (uint8_t *)p;
+    nv->valuelen = (size_t)(le - p);
+    nv->flags = NGHTTP3_NV_FLAG_NONE;
+
+    qc->srclen += nv->namelen + nv->valuelen;
+  }
+
+  qif_end_block(qc, first);
+
+  return 0;
+}
+
+static void qif_free(qif_corpus *qc) {
+  size_t i;
+
+  for (i = 0; i < qc->nbufs; ++i) {
+    free(qc->bufs[i]);
+  }
+
+  free(qc->bufs);
+  free(qc->nva);
+  free(qc->blocks);
+}
+
+/*
+ * decode_request feeds |len| bytes at |p| to |dec| as a part of
+ * header block of |sctx|.  If |fin| is nonzero, it is the end of
+ * header block.  It returns the number of header fields decoded, or
+ * -1.
+ */
+static ssize_t decode_request(nghttp3_qpack_decoder *dec,
+                              nghttp3_qpack_stream_context *sctx,
+                              const uint8_t *p, size_t len, int fin) {
+  nghttp3_qpack_nv nv;
+  uint8_t flags;
+  ssize_t nread, nemit = 0;
+
+  for (;;) {
+    if (len == 0 && !fin) {
+      return nemit;
+    }
+
+    nread = nghttp3_qpack_decoder_read_request(dec, sctx, &nv, &flags, p, len,
+                                               fin);
+    if (nread < 0) {
+      fprintf(stderr, "nghttp3_qpack_decoder_read_request: %s\n",
+              nghttp3_strerror((int)nread));
+      return -1;
+    }
+
+    p += nread;
+    len -= (size_t)nread;
+
+    if (flags & NGHTTP3_QPACK_DECODE_FLAG_EMIT) {
+      nghttp3_rcbuf_decref(nv.name);
+      nghttp3_rcbuf_decref(nv.value);
+      ++nemit;
+    }
+    if (flags & NGHTTP3_QPACK_DECODE_FLAG_FINAL) {
+      return nemit;
+    }
+    if (flags & NGHTTP3_QPACK_DECODE_FLAG_BLOCKED) {
+      fprintf(stderr, "header block is blocked\n");
+      return -1;
+    }
+  }
+}
+
+typedef struct {
+  size_t max_dtable_size;
+  size_t max_blocked;
+  /* tenc and tdec are the time spent in encoder and decoder in
+     seconds. */
+  double tenc, tdec;
+  /* enclen is the number of bytes of header blocks and encoder
+     stream. */
+  size_t enclen;
+  size_t enc_nalloc, dec_nalloc;
+} bench_result;
+
+/*
+ * run encodes and decodes the header blocks in |qc| |nrounds| times
+ * with fresh encoder and decoder, and stores the measurements in
+ * |res| whose max_dtable_size and max_blocked must be set.  It
+ * returns 0 if it succeeds, or -1.
+ */
+static int run(bench_result *res, const qif_corpus *qc, size_t nrounds) {
+  bench_mem em = {0}, dm = {0};
+  nghttp3_mem emem = {&em, bench_malloc, bench_free, bench_calloc,
+                      bench_realloc};
+  nghttp3_mem dmem = {&dm, bench_malloc, bench_free, bench_calloc,
+                      bench_realloc};
+  nghttp3_qpack_encoder *enc = NULL;
+  nghttp3_qpack_decoder *dec = NULL;
+  nghttp3_qpack_stream_context *sctx;
+  nghttp3_buf pbuf, rbuf, ebuf, dbuf;
+  const qif_block *blk;
+  size_t i, r, enc_base, dec_base;
+  int64_t stream_id;
+  ssize_t nread, nemit, n;
+  double t;
+  int rv, ret = -1;
+
+  nghttp3_buf_init(&pbuf);
+  nghttp3_buf_init(&rbuf);
+  nghttp3_buf_init(&ebuf);
+  nghttp3_buf_init(&dbuf);
+
+  for (r = 0; r < nrounds; ++r) {
+    rv = nghttp3_qpack_encoder_new(&enc, res->max_dtable_size,
+                                   res->max_blocked, &emem);
+    if (rv != 0) {
+      fprintf(stderr, "nghttp3_qpack_encoder_new: %s\n", nghttp3_strerror(rv));
+      goto fin;
+    }
+
+    rv = nghttp3_qpack_decoder_new(&dec, res->max_dtable_size,
+                                   res->max_blocked, &dmem);
+    if (rv != 0) {
+      fprintf(stderr, "nghttp3_qpack_decoder_new: %s\n", nghttp3_strerror(rv));
+      goto fin;
+    }
+
+    /* Creation of encoder and decoder is not counted. */
+    enc_base = em.nalloc;
+    dec_base = dm.nalloc;
+
+    for (i = 0; i < qc->nblocks; ++i) {
+      blk = &qc->blocks[i];
+      stream_id = (int64_t)(i * 4);
+
+      t = now();
+
+      rv = nghttp3_qpack_encoder_encode(enc, &pbuf, &rbuf, &ebuf, stream_id,
+                                        blk->nva, blk->nvlen);
+
+      res->tenc += now() - t;
+
+      if (rv != 0) {
+        fprintf(stderr, "nghttp3_qpack_encoder_encode: %s\n",
+                nghttp3_strerror(rv));
+        goto fin;
+      }
+
+      if (r == 0) {
+        res->enclen += nghttp3_buf_len(&pbuf) + nghttp3_buf_len(&rbuf) +
+                       nghttp3_buf_len(&ebuf);
+      }
+
+      t = now();
+
+      nread = nghttp3_qpack_decoder_read_encoder(dec, ebuf.pos,
+                                                 nghttp3_buf_len(&ebuf));
+      if (nread < 0) {
+        fprintf(stderr, "nghttp3_qpack_decoder_read_encoder: %s\n",
+                nghttp3_strerror((int)nread));
+        goto fin;
+      }
+
+      rv = nghttp3_qpack_stream_context_new(&sctx, stream_id, &dmem);
+      if (rv != 0) {
+        fprintf(stderr, "nghttp3_qpack_stream_context_new: %s\n",
+                nghttp3_strerror(rv));
+        goto fin;
+      }
+
+      nemit = decode_request(dec, sctx, pbuf.pos, nghttp3_buf_len(&pbuf), 0);
+      if (nemit >= 0) {
+        n = decode_request(dec, sctx, rbuf.pos, nghttp3_buf_len(&rbuf), 1);
+        nemit = n < 0 ? -1 : nemit + n;
+      }
+
+      nghttp3_qpack_stream_context_del(sctx);
+
+      /* The encoder may split cookie, and nemit can be larger than
+         blk->nvlen. */
+      if (nemit < (ssize_t)blk->nvlen) {
+        if (nemit >= 0) {
+          fprintf(stderr, "decoded %zd header fields, expected %zu\n", nemit,
+                  blk->nvlen);
+        }
+        goto fin;
+      }
+
+      rv = nghttp3_qpack_decoder_write_decoder(dec, &dbuf);
+
+      res->tdec += now() - t;
+
+      if (rv != 0) {
+        fprintf(stderr, "nghttp3_qpack_decoder_write_decoder: %s\n",
+                nghttp3_strerror(rv));
+        goto fin;
+      }
+
+      t = now();
+
+      nread = nghttp3_qpack_encoder_read_decoder(enc, dbuf.pos,
+                                                 nghttp3_buf_len(&dbuf));
+
+      res->tenc += now() - t;
+
+      if (nread < 0) {
+        fprintf(stderr, "nghttp3_qpack_encoder_read_decoder: %s\n",
+                nghttp3_strerror((int)nread));
+        goto fin;
+      }
+
+      nghttp3_buf_reset(&pbuf);
+      nghttp3_buf_reset(&rbuf);
+      nghttp3_buf_reset(&ebuf);
+      nghttp3_buf_reset(&dbuf);
+    }
+
+    res->enc_nalloc += em.nalloc - enc_base;
+    res->dec_nalloc += dm.nalloc - dec_base;
+
+    nghttp3_qpack_decoder_del(dec);
+    dec = NULL;
+    nghttp3_qpack_encoder_del(enc);
+    enc = NULL;
+  }
+
+  ret = 0;
+
+fin:
+  nghttp3_qpack_decoder_del(dec);
+  nghttp3_qpack_encoder_del(enc);
+  nghttp3_buf_free(&dbuf, &dmem);
+  nghttp3_buf_free(&ebuf, &emem);
+  nghttp3_buf_free(&rbuf, &emem);
+  nghttp3_buf_free(&pbuf, &emem);
+
+  return ret;
+}
+
+static void print_usage(void) {
+  fprintf(stderr,
+          "Usage: qpack_bench [-c] [-n ROUNDS] [-b MAX_BLOCKED]... "
+          "QIF_FILE...\n");
+}
+
+int main(int argc, char **argv) {
+  static const size_t table_sizes[] = {0, 256, 4096, 16384};
+  size_t blocked[16] = {0, 100};
+  size_t nblocked = 0, nrounds = 10, i, j, nfield, nblock;
+  qif_corpus qc;
+  bench_result res;
+  int csv = 0, c;
+  double srclen;
+
+  while ((c = getopt(argc, argv, "cn:b:")) != -1) {
+    switch (c) {
+    case 'c':
+      csv = 1;
+      break;
+    case 'n':
+      nrounds = strtoul(optarg, NULL, 10);
+      break;
+    case 'b':
+      if (nblocked == sizeof(blocked) / sizeof(blocked[0])) {
+        fprintf(stderr, "Too many -b\n");
+        return EXIT_FAILURE;
+      }
+      blocked[nblocked++] = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      print_usage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (nblocked == 0) {
+    nblocked = 2;
+  }
+
+  if (optind == argc || nrounds == 0) {
+    print_usage();
+    return EXIT_FAILURE;
+  }
+
+  memset(&qc, 0, sizeof(qc));
+
+  for (i = (size_t)optind; i < (size_t)argc; ++i) {
+    if (qif_load(&qc, argv[i]) != 0) {
+      qif_free(&qc);
+      return EXIT_FAILURE;
+    }
+  }
+
+  for (i = 0; i < qc.nblocks; ++i) {
+    qc.blocks[i].nva = qc.nva + (uintptr_t)qc.blocks[i].nva;
+  }
+
+  if (qc.nblocks == 0) {
+    fprintf(stderr, "No header block found\n");
+    qif_free(&qc);
+    return EXIT_FAILURE;
+  }
+
+  nblock = qc.nblocks * nrounds;
+  nfield = qc.nvlen * nrounds;
+  srclen = (double)qc.srclen * (double)nrounds;
+
+  if (csv) {
+    printf("table,blocked,blocks,fields,input_bytes,enc_mbps,dec_mbps,"
+           "enc_ns_per_field,dec_ns_per_field,enc_allocs_per_block,"
+           "dec_allocs_per_block,ratio\n");
+  } else {
+    printf("%zu header blocks, %zu header fields, %zu bytes, %zu rounds\n",
+           qc.nblocks, qc.nvlen, qc.srclen, nrounds);
+    printf("%6s %7s %9s %9s %9s %9s %9s %9s %6s\n", "table", "blocked",
+           "enc MB/s", "dec MB/s", "enc ns/f", "dec ns/f", "enc a/b",
+           "dec a/b", "ratio");
+  }
+
+  for (i = 0; i < sizeof(table_sizes) / sizeof(table_sizes[0]); ++i) {
+    for (j = 0; j < nblocked; ++j) {
+      memset(&res, 0, sizeof(res));
+      res.max_dtable_size = table_sizes[i];
+      res.max_blocked = blocked[j];
+
+      if (run(&res, &qc, nrounds) != 0) {
+        qif_free(&qc);
+        return EXIT_FAILURE;
+      }
+
+      if (csv) {
+        printf("%zu,%zu,%zu,%zu,%zu,%.2f,%.2f,%.1f,%.1f,%.2f,%.2f,%.4f\n",
+               res.max_dtable_size, res.max_blocked, qc.nblocks, qc.nvlen,
+               qc.srclen, srclen / res.tenc / 1e6, srclen / res.tdec / 1e6,
+               res.tenc * 1e9 / (double)nfield, res.tdec * 1e9 / (double)nfield,
+               (double)res.enc_nalloc / (double)nblock,
+               (double)res.dec_nalloc / (double)nblock,
+               (double)res.enclen / (double)qc.srclen);
+      } else {
+        printf("%6zu %7zu %9.2f %9.2f %9.1f %9.1f %9.2f %9.2f %6.3f\n",
+               res.max_dtable_size, res.max_blocked,
+               srclen / res.tenc / 1e6, srclen / res.tdec / 1e6,
+               res.tenc * 1e9 / (double)nfield, res.tdec * 1e9 / (double)nfield,
+               (double)res.enc_nalloc / (double)nblock,
+               (double)res.dec_nalloc / (double)nblock,
+               (double)res.enclen / (double)qc.srclen);
+      }
+    }
+  }
+
+  qif_free(&qc);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,266 @@
+/*
+ * nghttp3
+ *
+ * Copyright (c) 2019 nghttp3 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <nghttp3/nghttp3.h>
+
+/*
+ * sched_bench measures how the scheduling quantum affects the
+ * completion time of concurrent streams.  A client sends the bodies
+ * of many requests at once.  Each call of
+ * nghttp3_conn_add_write_offset consumes at most one packet, and data
+ * are acknowledged as soon as they are written.  The completion time
+ * of a stream is the number of packets sent until its last byte is
+ * written.
+ */
+
+#define PKTLEN 1200
+
+typedef struct {
+  uint64_t left;
+  /* done is the number of packets sent until the stream finished, or
+     0 if it has not finished yet. */
+  size_t done;
+} bench_stream;
+
+static uint8_t nulldata[16384];
+
+static int read_data(nghttp3_conn *conn, int64_t stream_id,
+                     const uint8_t **pdata, size_t *pdatalen,
+                     uint32_t *pflags, void *user_data,
+                     void *stream_user_data) {
+  bench_stream *bs = stream_user_data;
+  size_t n = bs->left < sizeof(nulldata) ? (size_t)bs->left : sizeof(nulldata);
+
+  (void)conn;
+  (void)stream_id;
+  (void)user_data;
+
+  bs->left -= n;
+  if (bs->left == 0) {
+    *pflags |= NGHTTP3_DATA_FLAG_EOF;
+  }
+
+  *pdata = nulldata;
+  *pdatalen = n;
+
+  return 0;
+}
+
+static int compare_size(const void *lhs, const void *rhs) {
+  size_t a = *(const size_t *)lhs, b = *(const size_t *)rhs;
+
+  return a < b ? -1 : a > b;
+}
+
+/*
+ * run sends |nstreams| request bodies of |len| bytes each with
+ * |quantum|, and stores the completion times to |done|.  It returns
+ * 0 if it succeeds, or -1.
+ */
+static int run(size_t *done, size_t nstreams, uint64_t len, size_t quantum,
+               nghttp3_scheduler scheduler) {
+  nghttp3_conn *conn;
+  nghttp3_conn_callbacks callbacks;
+  nghttp3_conn_settings settings;
+  nghttp3_data_reader dr;
+  nghttp3_vec vec[64];
+  bench_stream *streams;
+  const nghttp3_nv nva[] = {
+      {(uint8_t *)":method", (uint8_t *)"POST", 7, 4, NGHTTP3_NV_FLAG_NONE},
+      {(uint8_t *)":scheme", (uint8_t *)"https", 7, 5, NGHTTP3_NV_FLAG_NONE},
+      {(uint8_t *)":authority", (uint8_t *)"localhost", 10, 9,
+       NGHTTP3_NV_FLAG_NONE},
+      {(uint8_t *)":path", (uint8_t *)"/", 5, 1, NGHTTP3_NV_FLAG_NONE},
+  };
+  ssize_t sveccnt;
+  int64_t stream_id;
+  int fin;
+  size_t i, n, npkts = 0;
+  int rv;
+
+  streams = calloc(nstreams, sizeof(bench_stream));
+  if (streams == NULL) {
+    return -1;
+  }
+
+  memset(&callbacks, 0, sizeof(callbacks));
+
+  nghttp3_conn_settings_default(&settings);
+  settings.tx_quantum = quantum;
+  settings.scheduler = scheduler;
+  settings.max_tx_buffered = (uint64_t)-1;
+
+  memset(&dr, 0, sizeof(dr));
+  dr.read_data = read_data;
+
+  rv = nghttp3_conn_client_new(&conn, &callbacks, &settings,
+                               nghttp3_mem_default(), NULL);
+  if (rv != 0) {
+    free(streams);
+    return -1;
+  }
+
+  rv = nghttp3_conn_bind_qpack_streams(conn, 2, 6);
+  if (rv != 0) {
+    goto fail;
+  }
+
+  for (i = 0; i < nstreams; ++i) {
+    streams[i].left = len;
+    rv = nghttp3_conn_submit_request(conn, (int64_t)i * 4, NULL, nva,
+                                     sizeof(nva) / sizeof(nva[0]), &dr,
+                                     &streams[i]);
+    if (rv != 0) {
+      goto fail;
+    }
+
+    if (scheduler == NGHTTP3_SCHEDULER_URGENCY) {
+      rv = nghttp3_conn_set_stream_urgency(conn, (int64_t)i * 4, 3, 1);
+      if (rv != 0) {
+        goto fail;
+      }
+    }
+  }
+
+  for (;;) {
+    sveccnt = nghttp3_conn_writev_stream(conn, &stream_id, &fin, vec,
+                                         sizeof(vec) / sizeof(vec[0]));
+    if (sveccnt < 0) {
+      goto fail;
+    }
+    if (sveccnt == 0) {
+      break;
+    }
+
+    for (i = 0, n = 0; i < (size_t)sveccnt; ++i) {
+      n += vec[i].len;
+    }
+
+    /* Request bodies are not closed by fin.  A stream finishes when
+       its body has been read, and all buffered data are written. */
+    if (stream_id % 4 == 0) {
+      ++npkts;
+      if (n > PKTLEN) {
+        n = PKTLEN;
+      } else if (streams[stream_id / 4].left == 0) {
+        streams[stream_id / 4].done = npkts;
+      }
+    }
+
+    if (nghttp3_conn_add_write_offset(conn, stream_id, n) != 0 ||
+        nghttp3_conn_add_ack_offset(conn, stream_id, n) != 0) {
+      goto fail;
+    }
+  }
+
+  nghttp3_conn_del(conn);
+
+  for (i = 0; i < nstreams; ++i) {
+    if (streams[i].done == 0) {
+      free(streams);
+      return -1;
+    }
+    done[i] = streams[i].done;
+  }
+
+  free(streams);
+
+  return 0;
+
+fail:
+  nghttp3_conn_del(conn);
+  free(streams);
+
+  return -1;
+}
+
+int main(int argc, char **argv) {
+  size_t nstreams = 100;
+  uint64_t len = 1024 * 1024;
+  size_t *done;
+  size_t i, j, k;
+  double mean;
+  static const size_t quanta[] = {0, 16 * 1024, 64 * 1024, 256 * 1024};
+  static const struct {
+    const char *name;
+    nghttp3_scheduler scheduler;
+  } schedulers[] = {
+      {"tree", NGHTTP3_SCHEDULER_TREE},
+      {"urgency", NGHTTP3_SCHEDULER_URGENCY},
+  };
+
+  if (argc > 1) {
+    nstreams = strtoul(argv[1], NULL, 10);
+  }
+  if (argc > 2) {
+    len = strtoull(argv[2], NULL, 10) * 1024;
+  }
+
+  if (nstreams == 0 || len == 0) {
+    fprintf(stderr, "Usage: sched_bench [STREAMS [SIZE_IN_KIB]]\n");
+    return EXIT_FAILURE;
+  }
+
+  done = malloc(sizeof(size_t) * nstreams);
+  if (done == NULL) {
+    return EXIT_FAILURE;
+  }
+
+  printf("%-8s %8s %10s %10s %10s %10s %10s\n", "sched", "quantum", "min",
+         "p50", "p90", "max", "mean");
+
+  for (i = 0; i < sizeof(schedulers) / sizeof(schedulers[0]); ++i) {
+    for (j = 0; j < sizeof(quanta) / sizeof(quanta[0]); ++j) {
+      if (run(done, nstreams, len, quanta[j], schedulers[i].scheduler) != 0) {
+        fprintf(stderr, "%s: failed\n", schedulers[i].name);
+        free(done);
+        return EXIT_FAILURE;
+      }
+
+      qsort(done, nstreams, sizeof(size_t), compare_size);
+
+      mean = 0;
+      for (k = 0; k < nstreams; ++k) {
+        mean += (double)done[k];
+      }
+      mean /= (double)nstreams;
+
+      printf("%-8s %8zu %10zu %10zu %10zu %10zu %10.0f\n",
+             schedulers[i].name, quanta[j], done[0], done[nstreams / 2],
+             done[nstreams * 9 / 10], done[nstreams - 1], mean);
+    }
+  }
+
+  free(done);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,216 @@
+/*
+ * nghttp3
+ *
+ * Copyright (c) 2019 nghttp3 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <nghttp3/nghttp3.h>
+
+/*
+ * stream_bench measures the memory which a server connection holds
+ * for idle request streams.  A stream is opened by an empty read, and
+ * receives nothing else.  The bytes and the number of allocations
+ * which are live after the streams are opened are divided by the
+ * number of streams.  It also measures the time to delete the
+ * connection.  It runs with and without arena allocator.
+ */
+
+typedef struct {
+  /* allocated is the number of bytes currently allocated. */
+  size_t allocated;
+  /* nalloc is the number of allocations currently live. */
+  size_t nalloc;
+} bench_mem;
+
+/* Each allocation is prefixed by its size so that it can be
+   subtracted when it is freed. */
+typedef union {
+  size_t size;
+  max_align_t align;
+} bench_hdr;
+
+static void *bench_malloc(size_t size, void *user_data) {
+  bench_mem *bm = user_data;
+  bench_hdr *hdr = malloc(sizeof(bench_hdr) + size);
+
+  if (hdr == NULL) {
+    return NULL;
+  }
+
+  hdr->size = size;
+  bm->allocated += size;
+  ++bm->nalloc;
+
+  return hdr + 1;
+}
+
+static void bench_free(void *ptr, void *user_data) {
+  bench_mem *bm = user_data;
+  bench_hdr *hdr;
+
+  if (ptr == NULL) {
+    return;
+  }
+
+  hdr = (bench_hdr *)ptr - 1;
+  bm->allocated -= hdr->size;
+  --bm->nalloc;
+
+  free(hdr);
+}
+
+static void *bench_calloc(size_t nmemb, size_t size, void *user_data) {
+  void *p = bench_malloc(nmemb * size, user_data);
+
+  if (p) {
+    memset(p, 0, nmemb * size);
+  }
+
+  return p;
+}
+
+static void *bench_realloc(void *ptr, size_t size, void *user_data) {
+  void *p;
+  bench_hdr *hdr;
+
+  if (ptr == NULL) {
+    return bench_malloc(size, user_data);
+  }
+
+  hdr = (bench_hdr *)ptr - 1;
+
+  p = bench_malloc(size, user_data);
+  if (p == NULL) {
+    return NULL;
+  }
+
+  memcpy(p, ptr, hdr->size < size ? hdr->size : size);
+  bench_free(ptr, user_data);
+
+  return p;
+}
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/*
+ * run opens |nstreams| idle streams on a server connection whose
+ * settings.arena is |arena|, prints the memory they hold, and the
+ * time taken to delete the connection.  It returns 0 if it succeeds,
+ * or -1.
+ */
+static int run(size_t nstreams, int arena) {
+  bench_mem bm = {0, 0};
+  nghttp3_mem mem = {&bm, bench_malloc, bench_free, bench_calloc,
+                     bench_realloc};
+  nghttp3_conn_callbacks callbacks;
+  nghttp3_conn_settings settings;
+  nghttp3_conn *conn;
+  size_t base_allocated, base_nalloc, i;
+  ssize_t nread;
+  double t;
+  int rv;
+
+  memset(&callbacks, 0, sizeof(callbacks));
+  nghttp3_conn_settings_default(&settings);
+  settings.arena = arena;
+
+  rv = nghttp3_conn_server_new(&conn, &callbacks, &settings, &mem, NULL);
+  if (rv != 0) {
+    fprintf(stderr, "nghttp3_conn_server_new: %s\n", nghttp3_strerror(rv));
+    return -1;
+  }
+
+  nghttp3_conn_set_max_client_streams_bidi(conn, nstreams);
+
+  base_allocated = bm.allocated;
+  base_nalloc = bm.nalloc;
+
+  for (i = 0; i < nstreams; ++i) {
+    nread = nghttp3_conn_read_stream(conn, (int64_t)(i * 4), NULL, 0,
+                                     /* fin = */ 0);
+    if (nread < 0) {
+      fprintf(stderr, "nghttp3_conn_read_stream: %s\n",
+              nghttp3_strerror((int)nread));
+      nghttp3_conn_del(conn);
+      return -1;
+    }
+  }
+
+  printf("%s\n", arena ? "arena" : "default");
+  printf("  %-12s %10zu bytes\n", "connection", base_allocated);
+  printf("  %-12s %10.1f bytes\n", "per stream",
+         (double)(bm.allocated - base_allocated) / (double)nstreams);
+  printf("  %-12s %10.2f\n", "allocations",
+         (double)(bm.nalloc - base_nalloc) / (double)nstreams);
+
+  t = now();
+
+  nghttp3_conn_del(conn);
+
+  t = now() - t;
+
+  printf("  %-12s %10.1f ns/stream\n", "teardown",
+         t * 1e9 / (double)nstreams);
+
+  if (bm.allocated || bm.nalloc) {
+    fprintf(stderr, "leaked %zu bytes in %zu allocations\n", bm.allocated,
+            bm.nalloc);
+    return -1;
+  }
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  size_t nstreams = 100000;
+
+  if (argc > 1) {
+    nstreams = strtoul(argv[1], NULL, 10);
+  }
+
+  if (nstreams == 0) {
+    fprintf(stderr, "Usage: stream_bench [STREAMS]\n");
+    return EXIT_FAILURE;
+  }
+
+  if (run(nstreams, /* arena = */ 0) != 0 ||
+      run(nstreams, /* arena = */ 1) != 0) {
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
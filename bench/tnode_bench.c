@@ -0,0 +1,254 @@
+/*
+ * nghttp3
+ *
+ * Copyright (c) 2019 nghttp3 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "nghttp3_tnode.h"
+
+/*
+ * tnode_bench measures the cost of the priority tree operations under
+ * constant churn.  A root node holds many scheduled siblings.  Each
+ * operation picks one of them at random, and either removes it from
+ * the tree and inserts it back, or squashes it after giving it
+ * children, which emulates closing a stream which other streams
+ * depend on.  It also measures weighted fair scheduling of the
+ * siblings with binary heap and with calendar queue.
+ */
+
+/* NCHILDREN is the number of children given to a node before it is
+   squashed. */
+#define NCHILDREN 2
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint64_t rnd(uint64_t *state) {
+  *state = *state * 6364136223846793005llu + 1442695040888963407llu;
+  return *state >> 33;
+}
+
+/*
+ * run performs |nops| operations on |nsiblings| nodes under root, and
+ * returns the elapsed time in seconds, or negative value on error.
+ */
+static double run(size_t nsiblings, size_t nops, int squash) {
+  const nghttp3_mem *mem = nghttp3_mem_default();
+  nghttp3_tnode root, *nodes, *children, *node;
+  nghttp3_node_id nid;
+  uint64_t state = 1, seq = 0;
+  size_t i, j;
+  double t;
+  int rv;
+
+  nodes = malloc(sizeof(nghttp3_tnode) * nsiblings);
+  children = malloc(sizeof(nghttp3_tnode) * NCHILDREN);
+  if (nodes == NULL || children == NULL) {
+    free(children);
+    free(nodes);
+    return -1;
+  }
+
+  nghttp3_tnode_init(&root, nghttp3_node_id_init(&nid,
+                                                 NGHTTP3_NODE_ID_TYPE_ROOT, 0),
+                     seq++, NGHTTP3_DEFAULT_WEIGHT, NULL, mem);
+
+  for (i = 0; i < nsiblings; ++i) {
+    nghttp3_tnode_init(
+        &nodes[i],
+        nghttp3_node_id_init(&nid, NGHTTP3_NODE_ID_TYPE_STREAM, (int64_t)i),
+        seq++, NGHTTP3_DEFAULT_WEIGHT, &root, mem);
+    rv = nghttp3_tnode_schedule(&nodes[i], 0);
+    if (rv != 0) {
+      t = -1;
+      goto fin;
+    }
+  }
+
+  t = now();
+
+  for (i = 0; i < nops; ++i) {
+    node = &nodes[rnd(&state) % nsiblings];
+
+    if (!squash) {
+      nghttp3_tnode_remove(node);
+      nghttp3_tnode_insert(node, &root);
+    } else {
+      for (j = 0; j < NCHILDREN; ++j) {
+        nghttp3_tnode_init(&children[j],
+                           nghttp3_node_id_init(&nid,
+                                                NGHTTP3_NODE_ID_TYPE_STREAM,
+                                                (int64_t)(nsiblings + j)),
+                           seq++, NGHTTP3_DEFAULT_WEIGHT, node, mem);
+      }
+
+      rv = nghttp3_tnode_squash(node);
+      if (rv != 0) {
+        t = -1;
+        goto fin;
+      }
+
+      for (j = 0; j < NCHILDREN; ++j) {
+        nghttp3_tnode_remove(&children[j]);
+        nghttp3_tnode_free(&children[j]);
+      }
+
+      node->weight = NGHTTP3_DEFAULT_WEIGHT;
+      nghttp3_tnode_insert(node, &root);
+    }
+
+    rv = nghttp3_tnode_schedule(node, 1200);
+    if (rv != 0) {
+      t = -1;
+      goto fin;
+    }
+  }
+
+  t = now() - t;
+
+fin:
+  for (i = 0; i < nsiblings; ++i) {
+    nghttp3_tnode_free(&nodes[i]);
+  }
+  nghttp3_tnode_free(&root);
+  free(children);
+  free(nodes);
+
+  return t;
+}
+
+/*
+ * run_schedule repeatedly sends 1200 bytes from the node which has
+ * the highest priority among |nsiblings| nodes of various weights,
+ * and returns the elapsed time in seconds, or negative value on
+ * error.
+ */
+static double run_schedule(size_t nsiblings, size_t nops, int use_calq) {
+  const nghttp3_mem *mem = nghttp3_mem_default();
+  nghttp3_tnode root, *nodes, *node;
+  nghttp3_node_id nid;
+  size_t i;
+  double t;
+  int rv;
+
+  nodes = malloc(sizeof(nghttp3_tnode) * nsiblings);
+  if (nodes == NULL) {
+    return -1;
+  }
+
+  nghttp3_tnode_init(&root, nghttp3_node_id_init(&nid,
+                                                 NGHTTP3_NODE_ID_TYPE_ROOT, 0),
+                     0, NGHTTP3_DEFAULT_WEIGHT, NULL, mem);
+  if (use_calq) {
+    nghttp3_tnode_enable_calq(&root);
+  }
+
+  for (i = 0; i < nsiblings; ++i) {
+    nghttp3_tnode_init(
+        &nodes[i],
+        nghttp3_node_id_init(&nid, NGHTTP3_NODE_ID_TYPE_STREAM, (int64_t)i),
+        i + 1, (uint32_t)(i % NGHTTP3_MAX_WEIGHT + 1), &root, mem);
+    rv = nghttp3_tnode_schedule(&nodes[i], 0);
+    if (rv != 0) {
+      t = -1;
+      goto fin;
+    }
+  }
+
+  t = now();
+
+  for (i = 0; i < nops; ++i) {
+    node = nghttp3_tnode_get_next(&root);
+    rv = nghttp3_tnode_schedule(node, 1200);
+    if (rv != 0) {
+      t = -1;
+      goto fin;
+    }
+  }
+
+  t = now() - t;
+
+fin:
+  for (i = 0; i < nsiblings; ++i) {
+    nghttp3_tnode_free(&nodes[i]);
+  }
+  nghttp3_tnode_free(&root);
+  free(nodes);
+
+  return t;
+}
+
+int main(int argc, char **argv) {
+  size_t nsiblings = 10000;
+  size_t nops = 1000000;
+  int squash, use_calq;
+  double t;
+  static const char *const names[] = {"remove", "squash"};
+  static const char *const sched_names[] = {"heap", "calendar"};
+
+  if (argc > 1) {
+    nsiblings = strtoul(argv[1], NULL, 10);
+  }
+  if (argc > 2) {
+    nops = strtoul(argv[2], NULL, 10);
+  }
+
+  if (nsiblings == 0 || nops == 0) {
+    fprintf(stderr, "Usage: tnode_bench [SIBLINGS [OPERATIONS]]\n");
+    return EXIT_FAILURE;
+  }
+
+  for (squash = 0; squash < 2; ++squash) {
+    t = run(nsiblings, nops, squash);
+    if (t < 0) {
+      fprintf(stderr, "%s: failed\n", names[squash]);
+      return EXIT_FAILURE;
+    }
+
+    printf("%-10s %10.1f ns/op\n", names[squash], t * 1e9 / (double)nops);
+  }
+
+  for (use_calq = 0; use_calq < 2; ++use_calq) {
+    t = run_schedule(nsiblings, nops, use_calq);
+    if (t < 0) {
+      fprintf(stderr, "%s: failed\n", sched_names[use_calq]);
+      return EXIT_FAILURE;
+    }
+
+    printf("%-10s %10.1f ns/op\n", sched_names[use_calq],
+           t * 1e9 / (double)nops);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -379,13 +379,19 @@ typedef enum {
   /**
    * :enum:`NGHTTP3_NV_FLAG_NO_COPY_NAME` is set solely by
    * application.  If this flag is set, the library does not make a
-   * copy of header field name.  This could improve performance.
+   * copy of header field name.  This could improve performance.  The
+   * name must be in lowercase, and must be kept valid until the
+   * HEADERS frame which contains it is encoded, that is, until
+   * `nghttp3_conn_writev_stream` returns the frame or the stream is
+   * closed.
    */
   NGHTTP3_NV_FLAG_NO_COPY_NAME = 0x02,
   /**
    * :enum:`NGHTTP3_NV_FLAG_NO_COPY_VALUE` is set solely by
    * application.  If this flag is set, the library does not make a
-   * copy of header field value.  This could improve performance.
+   * copy of header field value.  This could improve performance.  The
+   * value must be kept valid as long as the name of the same header
+   * field flagged with :enum:`NGHTTP3_NV_FLAG_NO_COPY_NAME` is.
    */
   NGHTTP3_NV_FLAG_NO_COPY_VALUE = 0x04
 } nghttp3_nv_flag;
@@ -569,6 +575,39 @@ NGHTTP3_EXTERN int nghttp3_qpack_encoder_encode(
     nghttp3_qpack_encoder *encoder, nghttp3_buf *pbuf, nghttp3_buf *rbuf,
     nghttp3_buf *ebuf, int64_t stream_id, const nghttp3_nv *nva, size_t nvlen);
 
+/**
+ * @function
+ *
+ * `nghttp3_qpack_encoder_prewarm` inserts header fields |nva| of
+ * length |nvlen| into dynamic table of |encoder| ahead of any header
+ * block, so that the subsequent header blocks can refer to them once
+ * they are acknowledged.  The encoder stream instructions are written
+ * into |ebuf| which is managed as described in
+ * `nghttp3_qpack_encoder_encode`.  Header fields which are already
+ * in static or dynamic table, which |encoder| never indexes (e.g.,
+ * the ones marked with :macro:`NGHTTP3_NV_FLAG_NEVER_INDEX`, or
+ * ":path"), or which do not fit into dynamic table are skipped.  The
+ * inserted entries are not referenced by any stream, and they do not
+ * count against the limit of blocked streams.
+ *
+ * The capacity of dynamic table must be set by
+ * `nghttp3_qpack_encoder_set_hard_max_dtable_size` before calling
+ * this function.  Otherwise nothing is inserted.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * :enum:`NGHTTP3_ERR_NOMEM`
+ *     Out of memory
+ * :enum:`NGHTTP3_ERR_QPACK_FATAL`
+ *      |encoder| is in unrecoverable error state and cannot be used
+ *      anymore.
+ */
+NGHTTP3_EXTERN int nghttp3_qpack_encoder_prewarm(nghttp3_qpack_encoder *encoder,
+                                                 nghttp3_buf *ebuf,
+                                                 const nghttp3_nv *nva,
+                                                 size_t nvlen);
+
 /**
  * @function
  *
@@ -941,6 +980,197 @@ NGHTTP3_EXTERN int
 nghttp3_qpack_decoder_cancel_stream(nghttp3_qpack_decoder *decoder,
                                     int64_t stream_id);
 
+/**
+ * @struct
+ *
+ * :type:`nghttp3_qpack_intern` is a bounded table of header field
+ * values which QPACK decoders share.  When a decoder which uses the
+ * table decodes a value from a request stream, and the same value is
+ * in the table, the decoder returns the :type:`nghttp3_rcbuf` in the
+ * table with its reference count incremented instead of a new one.
+ * A value is added to the table when it is decoded for the second
+ * time in a row among the values which map to the same slot, so that
+ * the values which appear only once do not evict the others.
+ * Because the reference count of :type:`nghttp3_rcbuf` is not
+ * protected by lock, the table and all decoders which use it must be
+ * used by the same thread.
+ */
+typedef struct nghttp3_qpack_intern nghttp3_qpack_intern;
+
+/**
+ * @function
+ *
+ * `nghttp3_qpack_intern_new` creates :type:`nghttp3_qpack_intern`
+ * which holds at most |nmemb| values, and assigns its pointer to
+ * |*pintern|.  |nmemb| is rounded up to the power of 2.  A value is
+ * only interned if its length is less than or equal to
+ * |max_valuelen|.  |mem| is a memory allocator, which is also used
+ * to allocate the interned values.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * :enum:`NGHTTP3_ERR_INVALID_ARGUMENT`
+ *     |nmemb| is 0.
+ * :enum:`NGHTTP3_ERR_NOMEM`
+ *     Out of memory.
+ */
+NGHTTP3_EXTERN int nghttp3_qpack_intern_new(nghttp3_qpack_intern **pintern,
+                                            size_t nmemb, size_t max_valuelen,
+                                            const nghttp3_mem *mem);
+
+/**
+ * @function
+ *
+ * `nghttp3_qpack_intern_del` releases the references to the values
+ * held by |intern|, and frees memory allocated for |intern|.  The
+ * values which an application still references stay valid.  It must
+ * not be called while a decoder still uses |intern|.
+ */
+NGHTTP3_EXTERN void nghttp3_qpack_intern_del(nghttp3_qpack_intern *intern);
+
+/**
+ * @function
+ *
+ * `nghttp3_qpack_decoder_set_intern` makes |decoder| share header
+ * field values decoded from request streams through |intern|.
+ * |intern| must outlive |decoder|.  Passing NULL disables interning.
+ */
+NGHTTP3_EXTERN void
+nghttp3_qpack_decoder_set_intern(nghttp3_qpack_decoder *decoder,
+                                 nghttp3_qpack_intern *intern);
+
+/**
+ * @function
+ *
+ * `nghttp3_qpack_encoder_clone` creates a copy of |src| which has the
+ * same dynamic table, insert count and known received count, and
+ * assigns its pointer to |*pdest|.  The header field names and values
+ * in the dynamic table are reference counted and shared with |src|,
+ * so that cloning a warmed-up encoder is cheap.  |mem| is a memory
+ * allocator of the copy.  |src| must be in a quiescent state: every
+ * encoded header block has been acknowledged or cancelled, and no
+ * decoder stream instruction is partially read.  |src| and the copy
+ * must be used by the same thread.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * :enum:`NGHTTP3_ERR_INVALID_STATE`
+ *     |src| is not in a quiescent state, or it has encountered a
+ *     fatal error.
+ * :enum:`NGHTTP3_ERR_NOMEM`
+ *     Out of memory.
+ */
+NGHTTP3_EXTERN int nghttp3_qpack_encoder_clone(nghttp3_qpack_encoder **pdest,
+                                               const nghttp3_qpack_encoder *src,
+                                               const nghttp3_mem *mem);
+
+/**
+ * @function
+ *
+ * `nghttp3_qpack_decoder_clone` is the decoder counterpart of
+ * `nghttp3_qpack_encoder_clone`.  |src| must not have a partially
+ * read encoder stream instruction, nor pending decoder stream data
+ * which is not written by `nghttp3_qpack_decoder_write_decoder`.  The
+ * copy shares the table set by `nghttp3_qpack_decoder_set_intern`
+ * with |src|.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * :enum:`NGHTTP3_ERR_INVALID_STATE`
+ *     |src| is not in a quiescent state, or it has encountered a
+ *     fatal error.
+ * :enum:`NGHTTP3_ERR_NOMEM`
+ *     Out of memory.
+ */
+NGHTTP3_EXTERN int nghttp3_qpack_decoder_clone(nghttp3_qpack_decoder **pdest,
+                                               const nghttp3_qpack_decoder *src,
+                                               const nghttp3_mem *mem);
+
+/**
+ * @function
+ *
+ * `nghttp3_qpack_encoder_serialize` writes the state of |encoder|
+ * which `nghttp3_qpack_encoder_clone` would copy into |dest| of
+ * length |destlen|.  If |dest| is NULL, it returns the number of
+ * bytes required without writing anything.  The same restriction on
+ * the state of |encoder| as `nghttp3_qpack_encoder_clone` applies.
+ *
+ * This function returns the number of bytes written if it succeeds,
+ * or one of the following negative error codes:
+ *
+ * :enum:`NGHTTP3_ERR_INVALID_STATE`
+ *     |encoder| is not in a quiescent state, or it has encountered a
+ *     fatal error.
+ * :enum:`NGHTTP3_ERR_NOBUF`
+ *     |destlen| is too small.
+ */
+NGHTTP3_EXTERN ssize_t
+nghttp3_qpack_encoder_serialize(const nghttp3_qpack_encoder *encoder,
+                                uint8_t *dest, size_t destlen);
+
+/**
+ * @function
+ *
+ * `nghttp3_qpack_encoder_deserialize` creates an encoder from |src|
+ * of length |srclen| written by `nghttp3_qpack_encoder_serialize`,
+ * and assigns its pointer to |*pencoder|.  |mem| is a memory
+ * allocator.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * :enum:`NGHTTP3_ERR_INVALID_ARGUMENT`
+ *     |src| is malformed.
+ * :enum:`NGHTTP3_ERR_NOMEM`
+ *     Out of memory.
+ */
+NGHTTP3_EXTERN int
+nghttp3_qpack_encoder_deserialize(nghttp3_qpack_encoder **pencoder,
+                                  const uint8_t *src, size_t srclen,
+                                  const nghttp3_mem *mem);
+
+/**
+ * @function
+ *
+ * `nghttp3_qpack_decoder_serialize` is the decoder counterpart of
+ * `nghttp3_qpack_encoder_serialize`.  The table set by
+ * `nghttp3_qpack_decoder_set_intern` is not serialized.
+ *
+ * This function returns the number of bytes written if it succeeds,
+ * or one of the following negative error codes:
+ *
+ * :enum:`NGHTTP3_ERR_INVALID_STATE`
+ *     |decoder| is not in a quiescent state, or it has encountered a
+ *     fatal error.
+ * :enum:`NGHTTP3_ERR_NOBUF`
+ *     |destlen| is too small.
+ */
+NGHTTP3_EXTERN ssize_t
+nghttp3_qpack_decoder_serialize(const nghttp3_qpack_decoder *decoder,
+                                uint8_t *dest, size_t destlen);
+
+/**
+ * @function
+ *
+ * `nghttp3_qpack_decoder_deserialize` is the decoder counterpart of
+ * `nghttp3_qpack_encoder_deserialize`.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * :enum:`NGHTTP3_ERR_INVALID_ARGUMENT`
+ *     |src| is malformed.
+ * :enum:`NGHTTP3_ERR_NOMEM`
+ *     Out of memory.
+ */
+NGHTTP3_EXTERN int
+nghttp3_qpack_decoder_deserialize(nghttp3_qpack_decoder **pdecoder,
+                                  const uint8_t *src, size_t srclen,
+                                  const nghttp3_mem *mem);
+
 /**
  * @function
  *
@@ -1074,6 +1304,184 @@ typedef int (*nghttp3_recv_header)(nghttp3_conn *conn, int64_t stream_id,
 typedef int (*nghttp3_end_headers)(nghttp3_conn *conn, int64_t stream_id,
                                    void *user_data, void *stream_user_data);
 
+/**
+ * @enum
+ *
+ * :type:`nghttp3_trace_event_type` is the type of
+ * :type:`nghttp3_trace_event`.
+ */
+typedef enum {
+  /**
+   * :enum:`NGHTTP3_TRACE_EVENT_FRAME_SENT` indicates that a frame is
+   * serialized into the outgoing data of a stream.  For DATA frame,
+   * it is emitted for each chunk pulled from an application.
+   * :member:`nghttp3_trace_event.u.frame` is set.
+   */
+  NGHTTP3_TRACE_EVENT_FRAME_SENT,
+  /**
+   * :enum:`NGHTTP3_TRACE_EVENT_FRAME_RECV` indicates that the header
+   * of a frame is received on a control or request stream.
+   * :member:`nghttp3_trace_event.u.frame` is set.
+   */
+  NGHTTP3_TRACE_EVENT_FRAME_RECV,
+  /**
+   * :enum:`NGHTTP3_TRACE_EVENT_QPACK_INSERT` indicates that an entry
+   * is inserted into QPACK dynamic table.
+   * :member:`nghttp3_trace_event.u.qpack_entry` is set.
+   */
+  NGHTTP3_TRACE_EVENT_QPACK_INSERT,
+  /**
+   * :enum:`NGHTTP3_TRACE_EVENT_QPACK_EVICT` indicates that an entry
+   * is evicted from QPACK dynamic table.
+   * :member:`nghttp3_trace_event.u.qpack_entry` is set.
+   */
+  NGHTTP3_TRACE_EVENT_QPACK_EVICT,
+  /**
+   * :enum:`NGHTTP3_TRACE_EVENT_QPACK_ACK` indicates that QPACK
+   * encoder receives Header Acknowledgement or Insert Count
+   * Increment instruction.  :member:`nghttp3_trace_event.stream_id`
+   * is the acknowledged stream for the former, and -1 for the
+   * latter.  :member:`nghttp3_trace_event.u.qpack_ack` is set.
+   */
+  NGHTTP3_TRACE_EVENT_QPACK_ACK,
+  /**
+   * :enum:`NGHTTP3_TRACE_EVENT_STREAM_BLOCKED` indicates that a
+   * stream is blocked.  :member:`nghttp3_trace_event.u.blocked` is set.
+   */
+  NGHTTP3_TRACE_EVENT_STREAM_BLOCKED,
+  /**
+   * :enum:`NGHTTP3_TRACE_EVENT_STREAM_UNBLOCKED` indicates that a
+   * stream is unblocked.  :member:`nghttp3_trace_event.u.blocked` is
+   * set.
+   */
+  NGHTTP3_TRACE_EVENT_STREAM_UNBLOCKED,
+  /**
+   * :enum:`NGHTTP3_TRACE_EVENT_SCHED_PICK` indicates that the
+   * scheduler picks a request or push stream to write next.
+   */
+  NGHTTP3_TRACE_EVENT_SCHED_PICK
+} nghttp3_trace_event_type;
+
+/**
+ * @enum
+ *
+ * :type:`nghttp3_trace_blocked_reason` is the reason why a stream is
+ * blocked or unblocked.
+ */
+typedef enum {
+  /**
+   * :enum:`NGHTTP3_TRACE_BLOCKED_FLOW_CONTROL` indicates that the
+   * stream is blocked by `nghttp3_conn_block_stream`, and unblocked
+   * by `nghttp3_conn_unblock_stream`.
+   */
+  NGHTTP3_TRACE_BLOCKED_FLOW_CONTROL,
+  /**
+   * :enum:`NGHTTP3_TRACE_BLOCKED_QPACK` indicates that decoding a
+   * header block on the stream waits for the insertions on QPACK
+   * encoder stream.
+   */
+  NGHTTP3_TRACE_BLOCKED_QPACK,
+  /**
+   * :enum:`NGHTTP3_TRACE_BLOCKED_READ_DATA` indicates that an
+   * application returns :enum:`NGHTTP3_ERR_WOULDBLOCKED` from the data
+   * source, and resumes it by `nghttp3_conn_resume_stream`.
+   */
+  NGHTTP3_TRACE_BLOCKED_READ_DATA
+} nghttp3_trace_blocked_reason;
+
+/**
+ * @struct
+ *
+ * :type:`nghttp3_trace_event` is an event emitted to
+ * :type:`nghttp3_trace` callback.  Which member of the union is set
+ * depends on :member:`type`.
+ */
+typedef struct {
+  /**
+   * type is the type of this event.
+   */
+  nghttp3_trace_event_type type;
+  /**
+   * stream_id is the stream which this event is about.  It is -1 if
+   * the event is not about a particular stream.
+   */
+  int64_t stream_id;
+  union {
+    struct {
+      /**
+       * type is the frame type.  It may be the one which the library
+       * does not know.
+       */
+      int64_t type;
+      /**
+       * length is the length of frame payload.
+       */
+      int64_t length;
+    } frame;
+    struct {
+      /**
+       * encoder is nonzero if the dynamic table belongs to QPACK
+       * encoder, or 0 if it belongs to QPACK decoder.
+       */
+      int encoder;
+      /**
+       * absidx is the absolute index of the entry.
+       */
+      uint64_t absidx;
+      /**
+       * size is the size of the entry as defined in QPACK, which is
+       * the sum of the length of name and value plus 32.
+       */
+      size_t size;
+      /**
+       * dtable_size is the size of dynamic table after insertion or
+       * eviction.
+       */
+      size_t dtable_size;
+    } qpack_entry;
+    struct {
+      /**
+       * krcnt is the Known Received Count after the acknowledgement.
+       */
+      uint64_t krcnt;
+    } qpack_ack;
+    struct {
+      /**
+       * reason is the reason why the stream is blocked.
+       */
+      nghttp3_trace_blocked_reason reason;
+    } blocked;
+  } u;
+} nghttp3_trace_event;
+
+/**
+ * @functypedef
+ *
+ * :type:`nghttp3_trace` is a callback function which is invoked when
+ * the library emits an event described by |ev|.  |ev| and the memory
+ * it points to are only valid during the call.
+ *
+ * Unlike the debug output enabled by ``DEBUGBUILD``, this callback is
+ * always compiled in.  If it is not set, the cost of each trace point
+ * is a single branch.  The callback must not call the functions
+ * which modify |conn|.
+ */
+typedef void (*nghttp3_trace)(nghttp3_conn *conn, const nghttp3_trace_event *ev,
+                              void *user_data);
+
+/**
+ * @functypedef
+ *
+ * :type:`nghttp3_get_timestamp` is a callback function which is
+ * invoked when the library records the time when an event occurs on
+ * a request stream.  It must return the current time in an arbitrary
+ * but monotonic unit chosen by the application, for example
+ * nanoseconds.  The returned value must not be
+ * :macro:`NGHTTP3_TIMESTAMP_NONE`.  See :type:`nghttp3_stream_timing`.
+ */
+typedef uint64_t (*nghttp3_get_timestamp)(nghttp3_conn *conn,
+                                          void *user_data);
+
 typedef struct {
   nghttp3_acked_stream_data acked_stream_data;
   nghttp3_stream_close stream_close;
@@ -1088,11 +1496,113 @@ typedef struct {
   nghttp3_begin_headers begin_push_promise;
   nghttp3_recv_header recv_push_promise;
   nghttp3_end_headers end_push_promise;
+  /**
+   * trace, if non-NULL, is called with the events described in
+   * :type:`nghttp3_trace_event_type`.
+   */
+  nghttp3_trace trace;
+  /**
+   * get_timestamp, if non-NULL, makes a connection record
+   * :type:`nghttp3_stream_timing` for each request stream.
+   */
+  nghttp3_get_timestamp get_timestamp;
 } nghttp3_conn_callbacks;
 
+/**
+ * @enum
+ *
+ * :type:`nghttp3_scheduler` is the algorithm to decide which stream
+ * is sent next.
+ */
+typedef enum {
+  /**
+   * :enum:`NGHTTP3_SCHEDULER_TREE` schedules streams by the
+   * dependency tree built by PRIORITY frames.
+   */
+  NGHTTP3_SCHEDULER_TREE = 0,
+  /**
+   * :enum:`NGHTTP3_SCHEDULER_URGENCY` schedules streams by urgency
+   * and incremental parameters defined in RFC 9218.  They are set by
+   * `nghttp3_conn_set_stream_urgency`.  Received PRIORITY frames are
+   * validated, but do not build the dependency tree.
+   */
+  NGHTTP3_SCHEDULER_URGENCY = 1,
+  /**
+   * :enum:`NGHTTP3_SCHEDULER_TREE_CALENDAR` schedules streams in the
+   * same way as :enum:`NGHTTP3_SCHEDULER_TREE`, but each node queues
+   * its children by calendar queue instead of binary heap.  It is
+   * faster when a node has thousands of active children.
+   */
+  NGHTTP3_SCHEDULER_TREE_CALENDAR = 2
+} nghttp3_scheduler;
+
 typedef struct {
   uint64_t max_header_list_size;
   uint64_t num_placeholders;
+  /**
+   * max_tx_buffered is the maximum number of bytes buffered in all
+   * request streams until they are acknowledged.  Once it is
+   * reached, no more data is pulled from an application until some
+   * of them are acknowledged.
+   */
+  uint64_t max_tx_buffered;
+  /**
+   * tx_high_watermark is the number of unsent bytes buffered in a
+   * stream above which no more data is pulled from an application.
+   * It must be greater than 0.
+   */
+  size_t tx_high_watermark;
+  /**
+   * tx_low_watermark is the number of unsent bytes buffered in a
+   * stream below which data is pulled from an application again.
+   * It must not be greater than tx_high_watermark.  Otherwise,
+   * `nghttp3_conn_client_new` and `nghttp3_conn_server_new` return
+   * :enum:`NGHTTP3_ERR_INVALID_ARGUMENT`.
+   */
+  size_t tx_low_watermark;
+  /**
+   * scheduler is the algorithm to schedule streams.
+   */
+  nghttp3_scheduler scheduler;
+  /**
+   * tx_quantum is the number of bytes which a stream may send before
+   * it yields to the other streams.  Until then, the stream stays at
+   * the head of the queue, and the bytes it has sent are charged to
+   * it at once.  0 means that a stream is rescheduled every time
+   * `nghttp3_conn_add_write_offset` is called.
+   */
+  size_t tx_quantum;
+  /**
+   * arena, if nonzero, makes a connection allocate its memory from a
+   * region allocator owned by the connection.  Memory is obtained
+   * from the allocator given to `nghttp3_conn_client_new` or
+   * `nghttp3_conn_server_new` in large blocks, and is released all at
+   * once by `nghttp3_conn_del`.  Freed objects are reused by the
+   * connection, but not returned to the allocator until then.  An
+   * application must not keep a reference to :type:`nghttp3_rcbuf`
+   * obtained from the connection after `nghttp3_conn_del` is called.
+   */
+  int arena;
+  /**
+   * eager_encode, if nonzero, makes `nghttp3_conn_submit_request`,
+   * `nghttp3_conn_submit_info`, and `nghttp3_conn_submit_response`
+   * encode HEADERS frame with QPACK encoder immediately if no other
+   * frame is queued on the stream before it.  Then header fields
+   * passed to these functions are not copied regardless of
+   * :type:`nghttp3_nv_flag`, and need not outlive the function call.
+   * Header field names which are not flagged with
+   * :enum:`NGHTTP3_NV_FLAG_NO_COPY_NAME` must be in lowercase to
+   * take this path; otherwise header fields are copied as usual.
+   */
+  int eager_encode;
+  /**
+   * rejoin_cookie, if nonzero, makes a connection join the cookie
+   * header fields in a header block, which a peer may send split into
+   * crumbs, into one whose value is concatenated with "; ".  The
+   * joined header field is passed to the callback after the other
+   * header fields in the block.
+   */
+  int rejoin_cookie;
   uint32_t qpack_max_table_capacity;
   uint16_t qpack_blocked_streams;
 } nghttp3_conn_settings;
@@ -1286,6 +1796,36 @@ NGHTTP3_EXTERN ssize_t nghttp3_conn_writev_stream(nghttp3_conn *conn,
                                                   int *pfin, nghttp3_vec *vec,
                                                   size_t veccnt);
 
+/**
+ * @function
+ *
+ * `nghttp3_conn_get_stream_data_range` stores the stream data in the
+ * range [|offset|, |offset| + |datalen|) of stream denoted by
+ * |stream_id| to |vec| of length |veccnt|, and returns the number of
+ * nghttp3_vec object in which it stored data.  It is intended to be
+ * used to retransmit data which have been lost without keeping a copy
+ * of them in QUIC stack.  |offset| is the stream offset.  The range
+ * must have been passed to `nghttp3_conn_add_write_offset`, and must
+ * not contain the data which has been acknowledged by
+ * `nghttp3_conn_add_ack_offset`.
+ *
+ * The number of bytes stored might be less than |datalen| if |veccnt|
+ * is not large enough, or the range contains the data that an
+ * application supplied and has been notified of its acknowledgement
+ * by :type:`nghttp3_acked_stream_data`.  The returned data are valid
+ * until they are acknowledged.
+ *
+ * This function returns the number of nghttp3_vec stored if it
+ * succeeds, or one of the following negative error codes:
+ *
+ * :enum:`NGHTTP3_ERR_INVALID_ARGUMENT`
+ *     Stream is not found; or the range is outside of the data which
+ *     have been written and not acknowledged.
+ */
+NGHTTP3_EXTERN ssize_t nghttp3_conn_get_stream_data_range(
+    nghttp3_conn *conn, int64_t stream_id, uint64_t offset, size_t datalen,
+    nghttp3_vec *vec, size_t veccnt);
+
 /**
  * @function
  *
@@ -1308,6 +1848,36 @@ NGHTTP3_EXTERN int nghttp3_conn_add_write_offset(nghttp3_conn *conn,
 NGHTTP3_EXTERN int nghttp3_conn_add_ack_offset(nghttp3_conn *conn,
                                                int64_t stream_id, size_t n);
 
+/**
+ * @function
+ *
+ * `nghttp3_conn_add_ack_range` tells |conn| that the data in the
+ * range [|offset|, |offset| + |datalen|) of stream denoted by
+ * |stream_id| has been acknowledged by QUIC stack.  |offset| is the
+ * stream offset, that is the sum of the number of bytes previously
+ * passed to `nghttp3_conn_add_write_offset` for the stream.  Unlike
+ * `nghttp3_conn_add_ack_offset`, ranges may be passed in any order,
+ * and may overlap the ranges already acknowledged.
+ *
+ * :type:`nghttp3_acked_stream_data` is called for the data which an
+ * application supplied as soon as each buffer is entirely
+ * acknowledged, even if the preceding data has not been acknowledged
+ * yet.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * :enum:`NGHTTP3_ERR_INVALID_ARGUMENT`
+ *     Stream is not found.
+ * :enum:`NGHTTP3_ERR_NOMEM`
+ *     Out of memory.
+ * :enum:`NGHTTP3_ERR_CALLBACK_FAILURE`
+ *     User callback failed.
+ */
+NGHTTP3_EXTERN int nghttp3_conn_add_ack_range(nghttp3_conn *conn,
+                                              int64_t stream_id,
+                                              uint64_t offset, size_t datalen);
+
 /**
  * @function
  *
@@ -1355,6 +1925,288 @@ NGHTTP3_EXTERN int nghttp3_conn_close_stream(nghttp3_conn *conn,
 NGHTTP3_EXTERN int nghttp3_conn_reset_stream(nghttp3_conn *conn,
                                              int64_t stream_id);
 
+/**
+ * @function
+ *
+ * `nghttp3_conn_set_qpack_intern` makes QPACK decoder of |conn|
+ * share header field values through |intern|.  See
+ * `nghttp3_qpack_decoder_set_intern`.
+ */
+NGHTTP3_EXTERN void nghttp3_conn_set_qpack_intern(nghttp3_conn *conn,
+                                                  nghttp3_qpack_intern *intern);
+
+/**
+ * @function
+ *
+ * `nghttp3_conn_set_qpack_warm_profile` gives header fields |nva| of
+ * length |nvlen| which are expected to appear in most of the header
+ * blocks sent by |conn|.  They are inserted into dynamic table of
+ * QPACK encoder as soon as the capacity of the table is advertised by
+ * the remote endpoint and QPACK encoder stream is bound.  See
+ * `nghttp3_qpack_encoder_prewarm` for the header fields which are
+ * skipped.  |nva| is copied, and the application can free it after
+ * this function returns.  Calling this function again replaces the
+ * header fields which have not been inserted yet.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * :enum:`NGHTTP3_ERR_NOMEM`
+ *     Out of memory
+ */
+NGHTTP3_EXTERN int nghttp3_conn_set_qpack_warm_profile(nghttp3_conn *conn,
+                                                       const nghttp3_nv *nva,
+                                                       size_t nvlen);
+
+/**
+ * @macro
+ *
+ * :macro:`NGHTTP3_STATS_NUM_FRAME_TYPES` is the number of elements
+ * of the arrays in :type:`nghttp3_frame_stats`.
+ */
+#define NGHTTP3_STATS_NUM_FRAME_TYPES 16
+
+/**
+ * @macro
+ *
+ * :macro:`NGHTTP3_STATS_FRAME_OTHER` is the index in the arrays of
+ * :type:`nghttp3_frame_stats` where the frames of type greater than
+ * or equal to it are counted.  The other frames are counted at the
+ * index of their frame type.
+ */
+#define NGHTTP3_STATS_FRAME_OTHER (NGHTTP3_STATS_NUM_FRAME_TYPES - 1)
+
+/**
+ * @struct
+ *
+ * :type:`nghttp3_frame_stats` is the number of frames and bytes per
+ * frame type in one direction.
+ */
+typedef struct {
+  /**
+   * frames is the number of frames.
+   */
+  uint64_t frames[NGHTTP3_STATS_NUM_FRAME_TYPES];
+  /**
+   * bytes is the number of bytes of frames including frame header.
+   */
+  uint64_t bytes[NGHTTP3_STATS_NUM_FRAME_TYPES];
+} nghttp3_frame_stats;
+
+/**
+ * @struct
+ *
+ * :type:`nghttp3_conn_stats` is the statistics of a connection
+ * obtained by `nghttp3_conn_get_stats`.  All counters are cumulative
+ * since the connection is created unless stated otherwise.
+ */
+typedef struct {
+  /**
+   * sent is the frames serialized into the outgoing stream data.
+   */
+  nghttp3_frame_stats sent;
+  /**
+   * recv is the frames received on control and request streams.
+   */
+  nghttp3_frame_stats recv;
+  /**
+   * qpack_enc_dtable_size is the current size of dynamic table of
+   * QPACK encoder.
+   */
+  size_t qpack_enc_dtable_size;
+  /**
+   * qpack_enc_inserts is the number of entries inserted into dynamic
+   * table of QPACK encoder.
+   */
+  uint64_t qpack_enc_inserts;
+  /**
+   * qpack_enc_evictions is the number of entries evicted from dynamic
+   * table of QPACK encoder.
+   */
+  uint64_t qpack_enc_evictions;
+  /**
+   * qpack_enc_fields is the number of header fields encoded.
+   */
+  uint64_t qpack_enc_fields;
+  /**
+   * qpack_enc_static_hits is the number of header fields whose name
+   * and value are found in static table.
+   */
+  uint64_t qpack_enc_static_hits;
+  /**
+   * qpack_enc_dynamic_hits is the number of header fields whose name
+   * and value are found in dynamic table.
+   */
+  uint64_t qpack_enc_dynamic_hits;
+  /**
+   * qpack_enc_name_hits is the number of header fields only whose
+   * name is found in static or dynamic table.
+   */
+  uint64_t qpack_enc_name_hits;
+  /**
+   * qpack_dec_dtable_size is the current size of dynamic table of
+   * QPACK decoder.
+   */
+  size_t qpack_dec_dtable_size;
+  /**
+   * qpack_dec_inserts is the number of entries inserted into dynamic
+   * table of QPACK decoder.
+   */
+  uint64_t qpack_dec_inserts;
+  /**
+   * qpack_dec_evictions is the number of entries evicted from dynamic
+   * table of QPACK decoder.
+   */
+  uint64_t qpack_dec_evictions;
+  /**
+   * qpack_enc_stream_sent is the number of bytes of encoder
+   * instructions written to local QPACK encoder stream.  This and
+   * the following three fields do not count the stream type.
+   */
+  uint64_t qpack_enc_stream_sent;
+  /**
+   * qpack_enc_stream_recv is the number of bytes of encoder
+   * instructions read from remote QPACK encoder stream.
+   */
+  uint64_t qpack_enc_stream_recv;
+  /**
+   * qpack_dec_stream_sent is the number of bytes of decoder
+   * instructions written to local QPACK decoder stream.
+   */
+  uint64_t qpack_dec_stream_sent;
+  /**
+   * qpack_dec_stream_recv is the number of bytes of decoder
+   * instructions read from remote QPACK decoder stream.
+   */
+  uint64_t qpack_dec_stream_recv;
+  /**
+   * qpack_blocked_streams is the number of streams which are
+   * currently blocked by QPACK decoder.
+   */
+  size_t qpack_blocked_streams;
+  /**
+   * qpack_blocked_total is the number of times a stream is blocked
+   * by QPACK decoder.
+   */
+  uint64_t qpack_blocked_total;
+  /**
+   * qpack_blocked_time is the sum of the time during which streams
+   * are blocked by QPACK decoder, in the unit of
+   * :member:`nghttp3_conn_callbacks.get_timestamp`.  It is always 0
+   * if the callback is not set.
+   */
+  uint64_t qpack_blocked_time;
+  /**
+   * outq_bytes is the number of bytes currently held in the outgoing
+   * queue of all streams, including the bytes which have been sent
+   * but not acknowledged.
+   */
+  uint64_t outq_bytes;
+  /**
+   * inq_bytes is the number of bytes currently buffered for the
+   * streams blocked by QPACK decoder.
+   */
+  uint64_t inq_bytes;
+  /**
+   * chunk_bytes is the number of bytes currently allocated for the
+   * buffers which frame headers and the other small data are written
+   * into.
+   */
+  uint64_t chunk_bytes;
+} nghttp3_conn_stats;
+
+/**
+ * @function
+ *
+ * `nghttp3_conn_get_stats` stores the statistics of |conn| in
+ * |stats|.  The counters are maintained as the connection runs, and
+ * this function just copies them.
+ */
+NGHTTP3_EXTERN void nghttp3_conn_get_stats(nghttp3_conn *conn,
+                                           nghttp3_conn_stats *stats);
+
+/**
+ * @macro
+ *
+ * :macro:`NGHTTP3_TIMESTAMP_NONE` indicates that an event in
+ * :type:`nghttp3_stream_timing` has not occurred yet.
+ */
+#define NGHTTP3_TIMESTAMP_NONE UINT64_MAX
+
+/**
+ * @struct
+ *
+ * :type:`nghttp3_stream_timing` is the time when the events occur on
+ * a request stream, which is obtained from
+ * :member:`nghttp3_conn_callbacks.get_timestamp`.  Each field is
+ * :macro:`NGHTTP3_TIMESTAMP_NONE` if the event has not occurred.
+ */
+typedef struct {
+  /**
+   * first_byte_recv is the time when the first byte of the stream is
+   * received.
+   */
+  uint64_t first_byte_recv;
+  /**
+   * headers_recv is the time when the first header block, that is
+   * request header for server and response header for client, is
+   * received completely.
+   */
+  uint64_t headers_recv;
+  /**
+   * qpack_blocked is the time when the stream is blocked by QPACK
+   * decoder most recently.
+   */
+  uint64_t qpack_blocked;
+  /**
+   * qpack_unblocked is the time when the stream is unblocked by QPACK
+   * decoder most recently.
+   */
+  uint64_t qpack_unblocked;
+  /**
+   * qpack_blocked_time is the sum of the time during which the
+   * stream is blocked by QPACK decoder.  It is 0 if the stream has
+   * never been blocked.
+   */
+  uint64_t qpack_blocked_time;
+  /**
+   * first_read_data is the time when the library asks an application
+   * for the stream data first through :type:`nghttp3_data_reader`.
+   */
+  uint64_t first_read_data;
+  /**
+   * first_byte_sent is the time when the first byte of the stream is
+   * returned from `nghttp3_conn_writev_stream`.
+   */
+  uint64_t first_byte_sent;
+  /**
+   * last_byte_acked is the time when the stream data are acknowledged
+   * most recently.  Once all data are acknowledged, it is the time
+   * when the last byte is acknowledged.
+   */
+  uint64_t last_byte_acked;
+} nghttp3_stream_timing;
+
+/**
+ * @function
+ *
+ * `nghttp3_conn_get_stream_timing` stores the time when the events
+ * occur on a request stream identified by |stream_id| in |timing|.
+ * The timing is only recorded if
+ * :member:`nghttp3_conn_callbacks.get_timestamp` is set.  It is
+ * available until the stream is closed, including in
+ * :member:`nghttp3_conn_callbacks.stream_close` callback.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * :enum:`NGHTTP3_ERR_INVALID_ARGUMENT`
+ *     Stream not found, or the timing is not recorded for the stream.
+ */
+NGHTTP3_EXTERN int
+nghttp3_conn_get_stream_timing(nghttp3_conn *conn, int64_t stream_id,
+                               nghttp3_stream_timing *timing);
+
 typedef enum {
   NGHTTP3_DATA_FLAG_NONE = 0x00,
   NGHTTP3_DATA_FLAG_EOF = 0x01
@@ -1403,6 +2255,38 @@ typedef int (*nghttp3_read_data_callback)(nghttp3_conn *conn, int64_t stream_id,
                                           void *user_data,
                                           void *stream_user_data);
 
+/**
+ * @functypedef
+ *
+ * :type:`nghttp3_read_data_vec_callback` is the vectored variant of
+ * :type:`nghttp3_read_data_callback`.  It is invoked when the library
+ * asks an application to provide stream data for a stream denoted by
+ * |stream_id|.
+ *
+ * The application should store the pointers to data and their
+ * lengths to |vec| of at most |veccnt| elements, and return the
+ * number of elements it filled.  All data returned in a single call
+ * are sent in one DATA frame.  The application must retain data
+ * until they are safe to free.  It is notified by
+ * :type:`nghttp3_acked_stream_data` callback.
+ *
+ * If this is the last data to send (or there is no data to send
+ * because all data have been sent already), set
+ * :enum:`NGHTTP3_DATA_FLAG_EOF` to |*pflags|.
+ *
+ * If the application is unable to provide data temporarily, return
+ * :enum:`NGHTTP3_ERR_WOULDBLOCKED`.  When it is ready to provide
+ * data, call `nghttp3_conn_resume_stream()`.
+ *
+ * The callback should return the number of elements stored in |vec|
+ * if it succeeds, or :enum:`NGHTTP3_ERR_CALLBACK_FAILURE`.  Returning
+ * a number larger than |veccnt| is treated as
+ * :enum:`NGHTTP3_ERR_CALLBACK_FAILURE`.
+ */
+typedef ssize_t (*nghttp3_read_data_vec_callback)(
+    nghttp3_conn *conn, int64_t stream_id, nghttp3_vec *vec, size_t veccnt,
+    uint32_t *pflags, void *user_data, void *stream_user_data);
+
 typedef struct {
   nghttp3_elem_dep_type elem_dep_type;
   int64_t elem_dep_id;
@@ -1414,8 +2298,64 @@ nghttp3_priority_init(nghttp3_priority *pri,
                       nghttp3_elem_dep_type elem_dep_type, int64_t elem_dep_id,
                       uint32_t weight);
 
+/**
+ * @struct
+ *
+ * :type:`nghttp3_data_file` specifies a region of a file which is
+ * sent as stream data.  The library maps the region into memory and
+ * passes the pointers into the mapping to QUIC stack without copying.
+ * The mapping is released as the data are acknowledged.
+ */
 typedef struct {
+  /**
+   * fd is a file descriptor opened for reading.  The library does not
+   * close it.  An application may close it after the data is
+   * submitted.
+   */
+  int fd;
+  /**
+   * offset is the offset in the file where the region begins.
+   */
+  int64_t offset;
+  /**
+   * len is the length of the region.
+   */
+  size_t len;
+} nghttp3_data_file;
+
+/**
+ * @struct
+ *
+ * :type:`nghttp3_data_reader` specifies the way how to read stream
+ * data.  Exactly one of |read_data|, |read_data_vec|, and |file| must
+ * be set, and the others must be NULL or zero-filled.  Otherwise, the
+ * functions which take it return :enum:`NGHTTP3_ERR_INVALID_ARGUMENT`.
+ *
+ * .. warning::
+ *
+ *   This struct has grown fields over time, and more may be added.
+ *   Always zero-initialize it (e.g., with ``memset`` or ``= {0}``)
+ *   before setting the field you use.  Code which only assigns
+ *   |read_data| to an uninitialized struct leaves garbage in the
+ *   other fields, and the request fails depending on whatever
+ *   happens to be on the stack.
+ */
+typedef struct {
+  /**
+   * read_data is a callback which provides a single buffer per DATA
+   * frame.
+   */
   nghttp3_read_data_callback read_data;
+  /**
+   * read_data_vec is a callback which provides multiple buffers per
+   * DATA frame.
+   */
+  nghttp3_read_data_vec_callback read_data_vec;
+  /**
+   * file, if its len is nonzero, specifies the region of a file to
+   * send.  The file must not be truncated while the region is sent.
+   */
+  nghttp3_data_file file;
 } nghttp3_data_reader;
 
 NGHTTP3_EXTERN int
@@ -1446,6 +2386,32 @@ NGHTTP3_EXTERN int nghttp3_conn_submit_trailer(nghttp3_conn *conn,
                                                const nghttp3_nv *nva,
                                                size_t nvlen);
 
+/**
+ * @function
+ *
+ * `nghttp3_conn_set_stream_urgency` sets the urgency |urgency| and
+ * incremental parameter |inc| of a stream identified by |stream_id|.
+ * |urgency| must be in the range [0, 7], inclusive, and lower value
+ * means higher priority.  If |inc| is nonzero, the stream shares
+ * bandwidth with the other incremental streams of the same urgency
+ * in round-robin fashion.  Otherwise, it is sent ahead of them,
+ * after the non-incremental streams of the same urgency which were
+ * scheduled earlier.  The default urgency is 3 and the stream is not
+ * incremental.
+ *
+ * These parameters take effect only if |conn| is created with
+ * :enum:`NGHTTP3_SCHEDULER_URGENCY`.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * :enum:`NGHTTP3_ERR_INVALID_ARGUMENT`
+ *     Stream is not found; or |urgency| is out of range.
+ */
+NGHTTP3_EXTERN int nghttp3_conn_set_stream_urgency(nghttp3_conn *conn,
+                                                   int64_t stream_id,
+                                                   uint32_t urgency, int inc);
+
 /**
  * @function
  *
@@ -0,0 +1,253 @@
+/*
+ * nghttp3
+ *
+ * Copyright (c) 2019 nghttp3 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "nghttp3_arena.h"
+
+#include <string.h>
+
+#include "nghttp3_mem.h"
+#include "nghttp3_macro.h"
+
+static void *arena_malloc(size_t size, void *user_data);
+static void arena_free(void *ptr, void *user_data);
+static void *arena_calloc(size_t nmemb, size_t size, void *user_data);
+static void *arena_realloc(void *ptr, size_t size, void *user_data);
+
+void nghttp3_arena_init(nghttp3_arena *arena, const nghttp3_mem *parent) {
+  memset(arena, 0, sizeof(*arena));
+
+  arena->mem.mem_user_data = arena;
+  arena->mem.malloc = arena_malloc;
+  arena->mem.free = arena_free;
+  arena->mem.calloc = arena_calloc;
+  arena->mem.realloc = arena_realloc;
+  arena->parent = parent;
+}
+
+void nghttp3_arena_free(nghttp3_arena *arena) {
+  nghttp3_arena_block *block, *next_block;
+  nghttp3_arena_large *large, *next_large;
+
+  for (block = arena->blocks; block; block = next_block) {
+    next_block = block->next;
+    nghttp3_mem_free(arena->parent, block);
+  }
+
+  for (large = arena->large; large; large = next_large) {
+    next_large = large->next;
+    nghttp3_mem_free(arena->parent, large);
+  }
+
+  arena->blocks = NULL;
+  arena->large = NULL;
+  arena->pos = arena->end = NULL;
+  memset(arena->freelist, 0, sizeof(arena->freelist));
+}
+
+/*
+ * class_size returns the size of the objects of class |cls|.
+ */
+static size_t class_size(size_t cls) {
+  return (size_t)1 << (cls + NGHTTP3_ARENA_MIN_CLASS_BITS);
+}
+
+/*
+ * size_class returns the smallest class which can hold |size| bytes,
+ * or NGHTTP3_ARENA_NUM_CLASSES if there is no such class.
+ */
+static size_t size_class(size_t size) {
+  size_t cls;
+
+  for (cls = 0; cls < NGHTTP3_ARENA_NUM_CLASSES; ++cls) {
+    if (size <= class_size(cls)) {
+      return cls;
+    }
+  }
+
+  return NGHTTP3_ARENA_NUM_CLASSES;
+}
+
+/*
+ * arena_new_block obtains a new block which has at least |need|
+ * bytes of room for objects, and makes it current.  The unused region
+ * of the previous block is wasted.  It returns 0 if it succeeds, or
+ * -1.
+ */
+static int arena_new_block(nghttp3_arena *arena, size_t need) {
+  nghttp3_arena_block *block;
+  size_t len = NGHTTP3_ARENA_MIN_BLOCKLEN;
+
+  if (arena->blocks) {
+    len = nghttp3_min(arena->blocks->len * 2, NGHTTP3_ARENA_MAX_BLOCKLEN);
+  }
+
+  len = nghttp3_max(len, sizeof(nghttp3_arena_block) + need);
+
+  block = nghttp3_mem_malloc(arena->parent, len);
+  if (block == NULL) {
+    return -1;
+  }
+
+  block->next = arena->blocks;
+  block->len = len;
+  arena->blocks = block;
+  arena->pos = (uint8_t *)(block + 1);
+  arena->end = (uint8_t *)block + len;
+
+  return 0;
+}
+
+static void *arena_malloc_large(nghttp3_arena *arena, size_t size) {
+  nghttp3_arena_large *large;
+  nghttp3_arena_obj *obj;
+
+  large = nghttp3_mem_malloc(arena->parent, sizeof(nghttp3_arena_large) +
+                                                sizeof(nghttp3_arena_obj) +
+                                                size);
+  if (large == NULL) {
+    return NULL;
+  }
+
+  large->prev = NULL;
+  large->next = arena->large;
+  large->size = size;
+  if (arena->large) {
+    arena->large->prev = large;
+  }
+  arena->large = large;
+
+  obj = (nghttp3_arena_obj *)(large + 1);
+  obj->cls = NGHTTP3_ARENA_NUM_CLASSES;
+
+  return obj + 1;
+}
+
+static void *arena_malloc(size_t size, void *user_data) {
+  nghttp3_arena *arena = user_data;
+  size_t cls = size_class(size);
+  size_t objlen;
+  nghttp3_arena_obj *obj;
+
+  if (cls == NGHTTP3_ARENA_NUM_CLASSES) {
+    return arena_malloc_large(arena, size);
+  }
+
+  obj = arena->freelist[cls];
+  if (obj) {
+    arena->freelist[cls] = obj->next;
+    return obj + 1;
+  }
+
+  objlen = sizeof(nghttp3_arena_obj) + class_size(cls);
+
+  if ((size_t)(arena->end - arena->pos) < objlen &&
+      arena_new_block(arena, objlen) != 0) {
+    return NULL;
+  }
+
+  obj = (nghttp3_arena_obj *)arena->pos;
+  obj->cls = cls;
+  arena->pos += objlen;
+
+  return obj + 1;
+}
+
+static void arena_free(void *ptr, void *user_data) {
+  nghttp3_arena *arena = user_data;
+  nghttp3_arena_obj *obj;
+  nghttp3_arena_large *large;
+
+  if (ptr == NULL) {
+    return;
+  }
+
+  obj = (nghttp3_arena_obj *)ptr - 1;
+
+  if (obj->cls < NGHTTP3_ARENA_NUM_CLASSES) {
+    obj->next = arena->freelist[obj->cls];
+    arena->freelist[obj->cls] = obj;
+    return;
+  }
+
+  large = (nghttp3_arena_large *)obj - 1;
+
+  if (large->prev) {
+    large->prev->next = large->next;
+  } else {
+    arena->large = large->next;
+  }
+  if (large->next) {
+    large->next->prev = large->prev;
+  }
+
+  nghttp3_mem_free(arena->parent, large);
+}
+
+static void *arena_calloc(size_t nmemb, size_t size, void *user_data) {
+  void *p;
+
+  if (size && nmemb > SIZE_MAX / size) {
+    return NULL;
+  }
+
+  p = arena_malloc(nmemb * size, user_data);
+  if (p == NULL) {
+    return NULL;
+  }
+
+  memset(p, 0, nmemb * size);
+
+  return p;
+}
+
+static void *arena_realloc(void *ptr, size_t size, void *user_data) {
+  nghttp3_arena_obj *obj;
+  size_t oldlen;
+  void *p;
+
+  if (ptr == NULL) {
+    return arena_malloc(size, user_data);
+  }
+
+  obj = (nghttp3_arena_obj *)ptr - 1;
+
+  if (obj->cls < NGHTTP3_ARENA_NUM_CLASSES) {
+    oldlen = class_size(obj->cls);
+    if (size <= oldlen) {
+      return ptr;
+    }
+  } else {
+    oldlen = ((nghttp3_arena_large *)obj - 1)->size;
+  }
+
+  p = arena_malloc(size, user_data);
+  if (p == NULL) {
+    return NULL;
+  }
+
+  memcpy(p, ptr, nghttp3_min(oldlen, size));
+  arena_free(ptr, user_data);
+
+  return p;
+}
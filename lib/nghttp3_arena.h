@@ -0,0 +1,129 @@
+/*
+ * nghttp3
+ *
+ * Copyright (c) 2019 nghttp3 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef NGHTTP3_ARENA_H
+#define NGHTTP3_ARENA_H
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <nghttp3/nghttp3.h>
+
+/* NGHTTP3_ARENA_MIN_CLASS_BITS is log2 of the size of the smallest
+   size class. */
+#define NGHTTP3_ARENA_MIN_CLASS_BITS 4
+
+/* NGHTTP3_ARENA_NUM_CLASSES is the number of size classes.  The
+   largest class holds 16KiB, which is the size of a stream chunk.
+   Larger objects are allocated from the parent allocator one by
+   one. */
+#define NGHTTP3_ARENA_NUM_CLASSES 11
+
+/* NGHTTP3_ARENA_MIN_BLOCKLEN is the size of the first block which
+   the arena obtains from the parent allocator. */
+#define NGHTTP3_ARENA_MIN_BLOCKLEN 4096
+
+/* NGHTTP3_ARENA_MAX_BLOCKLEN is the maximum size of a block unless a
+   single object needs more. */
+#define NGHTTP3_ARENA_MAX_BLOCKLEN (256 * 1024)
+
+struct nghttp3_arena_obj;
+typedef struct nghttp3_arena_obj nghttp3_arena_obj;
+
+/*
+ * nghttp3_arena_obj is the header which precedes each object handed
+ * out by nghttp3_arena.
+ */
+struct nghttp3_arena_obj {
+  /* cls is the size class of this object, or
+     NGHTTP3_ARENA_NUM_CLASSES if it is allocated from the parent
+     allocator separately. */
+  size_t cls;
+  /* next points to the next free object of the same class while this
+     object is in the free list. */
+  nghttp3_arena_obj *next;
+};
+
+struct nghttp3_arena_large;
+typedef struct nghttp3_arena_large nghttp3_arena_large;
+
+/*
+ * nghttp3_arena_large is the header of an object which is larger than
+ * the largest size class.  It is followed by nghttp3_arena_obj.
+ */
+struct nghttp3_arena_large {
+  nghttp3_arena_large *prev;
+  nghttp3_arena_large *next;
+  size_t size;
+  size_t pad;
+};
+
+struct nghttp3_arena_block;
+typedef struct nghttp3_arena_block nghttp3_arena_block;
+
+/*
+ * nghttp3_arena_block is the header of a block obtained from the
+ * parent allocator.  Objects are carved from the rest of the block.
+ */
+struct nghttp3_arena_block {
+  nghttp3_arena_block *next;
+  size_t len;
+};
+
+/*
+ * nghttp3_arena is a region allocator which serves the allocations
+ * of a single connection.  Objects are rounded up to a power of 2
+ * size class, carved from large blocks, and recycled through per
+ * class free lists.  Nothing is returned to the parent allocator
+ * until nghttp3_arena_free releases all blocks at once.  It is not
+ * thread safe.
+ */
+typedef struct {
+  /* mem is the allocator which allocates from this arena.  Its
+     user_data points to this object. */
+  nghttp3_mem mem;
+  /* parent is the allocator from which blocks are obtained. */
+  const nghttp3_mem *parent;
+  nghttp3_arena_block *blocks;
+  nghttp3_arena_large *large;
+  /* pos and end delimit the unused region of the current block. */
+  uint8_t *pos;
+  uint8_t *end;
+  nghttp3_arena_obj *freelist[NGHTTP3_ARENA_NUM_CLASSES];
+} nghttp3_arena;
+
+/*
+ * nghttp3_arena_init initializes |arena| which obtains memory from
+ * |parent|.  It allocates nothing.
+ */
+void nghttp3_arena_init(nghttp3_arena *arena, const nghttp3_mem *parent);
+
+/*
+ * nghttp3_arena_free releases all memory which |arena| has obtained,
+ * including the objects which have not been freed.
+ */
+void nghttp3_arena_free(nghttp3_arena *arena);
+
+#endif /* NGHTTP3_ARENA_H */
@@ -86,5 +86,7 @@ void nghttp3_buf_swap(nghttp3_buf *a, nghttp3_buf *b) {
 void nghttp3_typed_buf_init(nghttp3_typed_buf *tbuf, const nghttp3_buf *buf,
                             nghttp3_buf_type type) {
   tbuf->buf = *buf;
+  tbuf->offset = 0;
   tbuf->type = type;
+  tbuf->flags = NGHTTP3_TYPED_BUF_FLAG_NONE;
 }
@@ -61,9 +61,20 @@ typedef enum {
   NGHTTP3_BUF_TYPE_ALIEN,
 } nghttp3_buf_type;
 
+/* NGHTTP3_TYPED_BUF_FLAG_NONE indicates that no flag is set. */
+#define NGHTTP3_TYPED_BUF_FLAG_NONE 0x00
+/* NGHTTP3_TYPED_BUF_FLAG_ACKED indicates that the buffer has been
+   entirely acknowledged out of order, and an application has been
+   notified of it. */
+#define NGHTTP3_TYPED_BUF_FLAG_ACKED 0x01
+
 typedef struct {
   nghttp3_buf buf;
+  /* offset is the stream offset of the first byte of buf.  It is
+     assigned when the buffer is queued to the stream outq. */
+  uint64_t offset;
   nghttp3_buf_type type;
+  uint8_t flags;
 } nghttp3_typed_buf;
 
 void nghttp3_typed_buf_init(nghttp3_typed_buf *tbuf, const nghttp3_buf *buf,
@@ -0,0 +1,288 @@
+/*
+ * nghttp3
+ *
+ * Copyright (c) 2019 nghttp3 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "nghttp3_calq.h"
+
+#include <assert.h>
+
+#include "nghttp3_macro.h"
+
+/* NGHTTP3_CALQ_MAX_BUCKET_BITS is the maximum value of bucket_bits.
+   It keeps a round of buckets far below 2^63. */
+#define NGHTTP3_CALQ_MAX_BUCKET_BITS 40
+
+void nghttp3_calq_init(nghttp3_calq *cq, nghttp3_calq_less less,
+                       const nghttp3_mem *mem) {
+  cq->buckets = NULL;
+  cq->nbuckets = 0;
+  cq->bucket_bits = NGHTTP3_CALQ_DEFAULT_BUCKET_BITS;
+  cq->mem = mem;
+  cq->less = less;
+  cq->top = NULL;
+  cq->base = 0;
+  cq->length = 0;
+  cq->nops = 0;
+  cq->insert_cost = 0;
+  cq->scan_cost = 0;
+}
+
+void nghttp3_calq_free(nghttp3_calq *cq) {
+  nghttp3_mem_free(cq->mem, cq->buckets);
+  cq->buckets = NULL;
+}
+
+static nghttp3_calq_bucket *calq_bucket(nghttp3_calq *cq, uint64_t key) {
+  return &cq->buckets[(key >> cq->bucket_bits) & (cq->nbuckets - 1)];
+}
+
+/*
+ * calq_key_less returns nonzero if |a| is less than |b| assuming that
+ * they are within 2^63 of each other.
+ */
+static int calq_key_less(uint64_t a, uint64_t b) {
+  return b - a - 1 < ((uint64_t)1 << 63);
+}
+
+/*
+ * calq_insert inserts |ent| to its bucket keeping the bucket sorted.
+ */
+static void calq_insert(nghttp3_calq *cq, nghttp3_calq_entry *ent) {
+  nghttp3_calq_bucket *b = calq_bucket(cq, ent->key);
+  nghttp3_calq_entry *p;
+
+  /* Keys are mostly pushed in ascending order.  Search the position
+     from the tail. */
+  for (p = b->tail; p && cq->less(ent, p); p = p->prev) {
+    ++cq->insert_cost;
+  }
+
+  ent->prev = p;
+
+  if (p) {
+    ent->next = p->next;
+    p->next = ent;
+  } else {
+    ent->next = b->head;
+    b->head = ent;
+  }
+
+  if (ent->next) {
+    ent->next->prev = ent;
+  } else {
+    b->tail = ent;
+  }
+}
+
+/*
+ * calq_resize changes the number of buckets to |nbuckets| and the
+ * bucket width to 1 << |bucket_bits|, and redistributes the entries.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGHTTP3_ERR_NOMEM
+ *     Out of memory.
+ */
+static int calq_resize(nghttp3_calq *cq, size_t nbuckets,
+                       size_t bucket_bits) {
+  nghttp3_calq_bucket *buckets = cq->buckets;
+  size_t obuckets = cq->nbuckets;
+  nghttp3_calq_entry *ent, *next;
+  size_t i;
+
+  cq->buckets =
+      nghttp3_mem_calloc(cq->mem, nbuckets, sizeof(nghttp3_calq_bucket));
+  if (cq->buckets == NULL) {
+    cq->buckets = buckets;
+    return NGHTTP3_ERR_NOMEM;
+  }
+
+  cq->nbuckets = nbuckets;
+  cq->bucket_bits = bucket_bits;
+
+  for (i = 0; i < obuckets; ++i) {
+    for (ent = buckets[i].head; ent; ent = next) {
+      next = ent->next;
+      calq_insert(cq, ent);
+    }
+  }
+
+  nghttp3_mem_free(cq->mem, buckets);
+
+  cq->nops = cq->insert_cost = cq->scan_cost = 0;
+
+  return 0;
+}
+
+static size_t calq_log2(size_t n) {
+  size_t res = 0;
+
+  for (; n > 1; n >>= 1) {
+    ++res;
+  }
+
+  return res;
+}
+
+/*
+ * calq_adapt evaluates the bucket width once in nbuckets operations
+ * so that redistribution of entries is amortized.  If either cost is
+ * dominant, the width is scaled by the average cost per operation.
+ */
+static void calq_adapt(nghttp3_calq *cq) {
+  size_t d;
+
+  if (++cq->nops < cq->nbuckets) {
+    return;
+  }
+
+  /* Resizing is best effort.  If it fails, the current buckets are
+     still valid. */
+  if (cq->insert_cost > cq->nops * 2 && cq->insert_cost > cq->scan_cost) {
+    d = nghttp3_min(calq_log2(cq->insert_cost / cq->nops), cq->bucket_bits);
+    if (d) {
+      calq_resize(cq, cq->nbuckets, cq->bucket_bits - d);
+      return;
+    }
+  } else if (cq->scan_cost > cq->nops * 2) {
+    d = nghttp3_min(calq_log2(cq->scan_cost / cq->nops),
+                    NGHTTP3_CALQ_MAX_BUCKET_BITS - cq->bucket_bits);
+    if (d) {
+      calq_resize(cq, cq->nbuckets, cq->bucket_bits + d);
+      return;
+    }
+  }
+
+  cq->nops = cq->insert_cost = cq->scan_cost = 0;
+}
+
+int nghttp3_calq_push(nghttp3_calq *cq, nghttp3_calq_entry *ent) {
+  int rv;
+
+  if (cq->length == 0 || calq_key_less(ent->key, cq->base)) {
+    cq->base = ent->key;
+  }
+
+  if (cq->buckets == NULL) {
+    rv = calq_resize(cq, NGHTTP3_CALQ_MIN_NBUCKETS, cq->bucket_bits);
+    if (rv != 0) {
+      return rv;
+    }
+  } else if (cq->length >= cq->nbuckets * 2) {
+    rv = calq_resize(cq, cq->nbuckets * 2, cq->bucket_bits);
+    if (rv != 0) {
+      return rv;
+    }
+  }
+
+  calq_insert(cq, ent);
+  calq_adapt(cq);
+
+  if (cq->top && cq->less(ent, cq->top)) {
+    cq->top = ent;
+  }
+
+  ++cq->length;
+
+  return 0;
+}
+
+/*
+ * calq_find_top finds the smallest entry in |cq|.  It first scans
+ * the buckets from base for the round which starts at base.  If no
+ * entry is found in this round, it falls back to compare the heads of
+ * all buckets.
+ */
+static nghttp3_calq_entry *calq_find_top(nghttp3_calq *cq) {
+  uint64_t width = (uint64_t)1 << cq->bucket_bits;
+  uint64_t start = cq->base & ~(width - 1);
+  nghttp3_calq_entry *ent, *top = NULL;
+  size_t i;
+
+  for (i = 0; i < cq->nbuckets; ++i) {
+    ent = calq_bucket(cq, start + i * width)->head;
+    if (ent && ent->key - start < (i + 1) * width) {
+      cq->scan_cost += i;
+      return ent;
+    }
+  }
+
+  cq->scan_cost += cq->nbuckets * 2;
+
+  for (i = 0; i < cq->nbuckets; ++i) {
+    ent = cq->buckets[i].head;
+    if (ent && (top == NULL || cq->less(ent, top))) {
+      top = ent;
+    }
+  }
+
+  return top;
+}
+
+nghttp3_calq_entry *nghttp3_calq_top(nghttp3_calq *cq) {
+  assert(cq->length);
+
+  if (cq->top == NULL) {
+    cq->top = calq_find_top(cq);
+    cq->base = cq->top->key;
+    calq_adapt(cq);
+  }
+
+  return cq->top;
+}
+
+void nghttp3_calq_remove(nghttp3_calq *cq, nghttp3_calq_entry *ent) {
+  nghttp3_calq_bucket *b = calq_bucket(cq, ent->key);
+
+  if (ent->prev) {
+    ent->prev->next = ent->next;
+  } else {
+    b->head = ent->next;
+  }
+
+  if (ent->next) {
+    ent->next->prev = ent->prev;
+  } else {
+    b->tail = ent->prev;
+  }
+
+  ent->prev = ent->next = NULL;
+
+  if (cq->top == ent) {
+    cq->top = NULL;
+  }
+
+  --cq->length;
+
+  /* Shrinking is best effort.  If it fails, the current buckets are
+     still valid. */
+  if (cq->nbuckets > NGHTTP3_CALQ_MIN_NBUCKETS &&
+      cq->length < cq->nbuckets / 4) {
+    calq_resize(cq, cq->nbuckets / 2, cq->bucket_bits);
+  }
+}
+
+int nghttp3_calq_empty(nghttp3_calq *cq) { return cq->length == 0; }
+
+size_t nghttp3_calq_size(nghttp3_calq *cq) { return cq->length; }
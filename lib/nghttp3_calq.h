@@ -0,0 +1,152 @@
+/*
+ * nghttp3
+ *
+ * Copyright (c) 2019 nghttp3 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef NGHTTP3_CALQ_H
+#define NGHTTP3_CALQ_H
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <nghttp3/nghttp3.h>
+
+#include "nghttp3_mem.h"
+
+/* Implementation of calendar queue */
+
+/* NGHTTP3_CALQ_MIN_NBUCKETS is the minimum number of buckets. */
+#define NGHTTP3_CALQ_MIN_NBUCKETS 16
+/* NGHTTP3_CALQ_DEFAULT_BUCKET_BITS is log2 of the range of keys
+   which a bucket covers in one round until the buckets are resized
+   for the first time. */
+#define NGHTTP3_CALQ_DEFAULT_BUCKET_BITS 14
+
+struct nghttp3_calq_entry;
+typedef struct nghttp3_calq_entry nghttp3_calq_entry;
+
+/*
+ * nghttp3_calq_entry is an entry of nghttp3_calq.  It is embedded in
+ * the object to be queued.
+ */
+struct nghttp3_calq_entry {
+  nghttp3_calq_entry *prev;
+  nghttp3_calq_entry *next;
+  /* key decides the bucket which this entry goes in.  It must be
+     consistent with the less function of nghttp3_calq. */
+  uint64_t key;
+};
+
+/* "less" function, return nonzero if |lhs| is less than |rhs|. */
+typedef int (*nghttp3_calq_less)(const nghttp3_calq_entry *lhs,
+                                 const nghttp3_calq_entry *rhs);
+
+typedef struct {
+  nghttp3_calq_entry *head;
+  nghttp3_calq_entry *tail;
+} nghttp3_calq_bucket;
+
+/*
+ * nghttp3_calq is a priority queue which distributes entries to
+ * buckets by their key.  Each bucket is sorted, and it covers
+ * 1 << bucket_bits keys in a round of nbuckets buckets.  The number
+ * of buckets follows the number of entries.  The bucket width adapts
+ * to the distribution of keys: it is narrowed if insertion has to
+ * walk long buckets, and widened if finding the smallest entry has to
+ * skip many empty buckets.  As long as keys grow roughly
+ * monotonically, which is the case for the virtual finish time of
+ * weighted fair queueing, push and top are amortized O(1), and remove
+ * is O(1).  The keys of the queued entries must be within 2^63 of
+ * each other.
+ */
+typedef struct {
+  /* buckets is allocated when the first entry is pushed. */
+  nghttp3_calq_bucket *buckets;
+  /* nbuckets is the number of buckets.  It is a power of 2. */
+  size_t nbuckets;
+  /* bucket_bits is log2 of the range of keys which a bucket
+     covers. */
+  size_t bucket_bits;
+  const nghttp3_mem *mem;
+  nghttp3_calq_less less;
+  /* top caches the smallest entry.  It is NULL if it is not known
+     yet. */
+  nghttp3_calq_entry *top;
+  /* base is the key which is not greater than the key of any queued
+     entry. */
+  uint64_t base;
+  /* length is the number of entries queued. */
+  size_t length;
+  /* nops is the number of push and top operations since the bucket
+     width was last evaluated. */
+  size_t nops;
+  /* insert_cost is the number of entries walked to insert entries
+     in the same period. */
+  size_t insert_cost;
+  /* scan_cost is the number of buckets skipped to find the smallest
+     entry in the same period. */
+  size_t scan_cost;
+} nghttp3_calq;
+
+void nghttp3_calq_init(nghttp3_calq *cq, nghttp3_calq_less less,
+                       const nghttp3_mem *mem);
+
+/*
+ * nghttp3_calq_free frees resources allocated for |cq|.  The queued
+ * entries are not freed by this function.
+ */
+void nghttp3_calq_free(nghttp3_calq *cq);
+
+/*
+ * nghttp3_calq_push adds |ent| to |cq|.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGHTTP3_ERR_NOMEM
+ *     Out of memory.
+ */
+int nghttp3_calq_push(nghttp3_calq *cq, nghttp3_calq_entry *ent);
+
+/*
+ * nghttp3_calq_top returns the smallest entry in |cq|.  It is
+ * undefined if |cq| is empty.
+ */
+nghttp3_calq_entry *nghttp3_calq_top(nghttp3_calq *cq);
+
+/*
+ * nghttp3_calq_remove removes |ent| from |cq|.
+ */
+void nghttp3_calq_remove(nghttp3_calq *cq, nghttp3_calq_entry *ent);
+
+/*
+ * nghttp3_calq_empty returns nonzero if |cq| is empty.
+ */
+int nghttp3_calq_empty(nghttp3_calq *cq);
+
+/*
+ * nghttp3_calq_size returns the number of entries in |cq|.
+ */
+size_t nghttp3_calq_size(nghttp3_calq *cq);
+
+#endif /* NGHTTP3_CALQ_H */
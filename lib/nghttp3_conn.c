@@ -159,6 +159,16 @@ static int ricnt_less(const nghttp3_pq_entry *lhsx,
   return lhs->qpack_sctx.ricnt < rhs->qpack_sctx.ricnt;
 }
 
+/*
+ * conn_qpack_trace forwards trace event |ev| emitted by QPACK encoder
+ * or decoder to the connection |user_data|.
+ */
+static void conn_qpack_trace(const nghttp3_trace_event *ev, void *user_data) {
+  nghttp3_conn *conn = user_data;
+
+  conn->callbacks.trace(conn, ev, conn->user_data);
+}
+
 static int conn_new(nghttp3_conn **pconn, int server,
                     const nghttp3_conn_callbacks *callbacks,
                     const nghttp3_conn_settings *settings,
@@ -167,23 +177,55 @@ static int conn_new(nghttp3_conn **pconn, int server,
   nghttp3_conn *conn;
   nghttp3_node_id nid;
 
+  if (settings->tx_high_watermark == 0 ||
+      settings->tx_low_watermark > settings->tx_high_watermark) {
+    return NGHTTP3_ERR_INVALID_ARGUMENT;
+  }
+
   conn = nghttp3_mem_calloc(mem, 1, sizeof(nghttp3_conn));
   if (conn == NULL) {
     return NGHTTP3_ERR_NOMEM;
   }
 
+  nghttp3_arena_init(&conn->arena, mem);
+
+  if (settings->arena) {
+    mem = &conn->arena.mem;
+  }
+
   nghttp3_tnode_init(&conn->root,
                      nghttp3_node_id_init(&nid, NGHTTP3_NODE_ID_TYPE_ROOT, 0),
                      0, NGHTTP3_DEFAULT_WEIGHT, NULL, mem);
 
+  if (settings->scheduler == NGHTTP3_SCHEDULER_TREE_CALENDAR) {
+    nghttp3_tnode_enable_calq(&conn->root);
+  }
+
+  nghttp3_urgq_init(&conn->urgq);
+
   rv = nghttp3_map_init(&conn->streams, mem);
   if (rv != 0) {
     goto streams_init_fail;
   }
 
-  rv = nghttp3_map_init(&conn->placeholders, mem);
+  if (server && settings->num_placeholders) {
+    if (settings->num_placeholders > SIZE_MAX / sizeof(nghttp3_placeholder)) {
+      rv = NGHTTP3_ERR_NOMEM;
+      goto placeholders_init_fail;
+    }
+
+    conn->placeholders =
+        nghttp3_mem_calloc(mem, (size_t)settings->num_placeholders,
+                           sizeof(nghttp3_placeholder));
+    if (conn->placeholders == NULL) {
+      rv = NGHTTP3_ERR_NOMEM;
+      goto placeholders_init_fail;
+    }
+  }
+
+  rv = nghttp3_map_init(&conn->phantoms, mem);
   if (rv != 0) {
-    goto placeholders_init_fail;
+    goto phantoms_init_fail;
   }
 
   rv = nghttp3_qpack_decoder_init(&conn->qdec,
@@ -206,6 +248,10 @@ static int conn_new(nghttp3_conn **pconn, int server,
   }
 
   conn->callbacks = *callbacks;
+  if (callbacks->trace) {
+    nghttp3_qpack_encoder_set_trace(&conn->qenc, conn_qpack_trace, conn);
+    nghttp3_qpack_decoder_set_trace(&conn->qdec, conn_qpack_trace, conn);
+  }
   conn->local.settings = *settings;
   nghttp3_conn_settings_default(&conn->remote.settings);
   conn->mem = mem;
@@ -222,11 +268,14 @@ remote_bidi_idtr_init_fail:
 qenc_init_fail:
   nghttp3_qpack_decoder_free(&conn->qdec);
 qdec_init_fail:
-  nghttp3_map_free(&conn->placeholders);
+  nghttp3_map_free(&conn->phantoms);
+phantoms_init_fail:
+  nghttp3_mem_free(mem, conn->placeholders);
 placeholders_init_fail:
   nghttp3_map_free(&conn->streams);
 streams_init_fail:
-  nghttp3_mem_free(mem, conn);
+  nghttp3_arena_free(&conn->arena);
+  nghttp3_mem_free(conn->arena.parent, conn);
 
   return rv;
 }
@@ -256,15 +305,58 @@ int nghttp3_conn_server_new(nghttp3_conn **pconn,
   return 0;
 }
 
-static int free_placeholder(nghttp3_map_entry *ent, void *ptr) {
-  nghttp3_placeholder *ph = nghttp3_struct_of(ent, nghttp3_placeholder, me);
-  const nghttp3_mem *mem = ptr;
+static int free_phantom(nghttp3_map_entry *ent, void *ptr) {
+  nghttp3_phantom *ph = nghttp3_struct_of(ent, nghttp3_phantom, u.me);
 
-  nghttp3_placeholder_del(ph, mem);
+  (void)ptr;
+
+  nghttp3_phantom_free(ph);
 
   return 0;
 }
 
+/*
+ * conn_alloc_phantom takes an unused phantom from
+ * conn->phantom_freelist.  If the list is empty, it allocates a new
+ * block.  It returns NULL if it fails to allocate memory.
+ */
+static nghttp3_phantom *conn_alloc_phantom(nghttp3_conn *conn) {
+  nghttp3_phantom_block *blk;
+  nghttp3_phantom *ph;
+  size_t i;
+
+  if (conn->phantom_freelist == NULL) {
+    blk = nghttp3_mem_malloc(conn->mem, sizeof(nghttp3_phantom_block));
+    if (blk == NULL) {
+      return NULL;
+    }
+
+    blk->next = conn->phantom_blocks;
+    conn->phantom_blocks = blk;
+
+    for (i = NGHTTP3_PHANTOM_BLOCKLEN; i > 0; --i) {
+      blk->phantoms[i - 1].u.next_free = conn->phantom_freelist;
+      conn->phantom_freelist = &blk->phantoms[i - 1];
+    }
+  }
+
+  ph = conn->phantom_freelist;
+  conn->phantom_freelist = ph->u.next_free;
+
+  return ph;
+}
+
+/*
+ * conn_free_phantom frees the resources of |ph|, and returns it to
+ * conn->phantom_freelist.
+ */
+static void conn_free_phantom(nghttp3_conn *conn, nghttp3_phantom *ph) {
+  nghttp3_phantom_free(ph);
+
+  ph->u.next_free = conn->phantom_freelist;
+  conn->phantom_freelist = ph;
+}
+
 static int free_stream(nghttp3_map_entry *ent, void *ptr) {
   nghttp3_stream *stream = nghttp3_struct_of(ent, nghttp3_stream, me);
 
@@ -275,28 +367,106 @@ static int free_stream(nghttp3_map_entry *ent, void *ptr) {
   return 0;
 }
 
+/*
+ * release_stream_foreign releases the resources of stream which do
+ * not come from the arena: the mapped file, and the cookie header
+ * fields which may come from the intern table.
+ */
+static int release_stream_foreign(nghttp3_map_entry *ent, void *ptr) {
+  nghttp3_stream *stream = nghttp3_struct_of(ent, nghttp3_stream, me);
+
+  (void)ptr;
+
+  if (stream->file) {
+    nghttp3_stream_delete_file(stream);
+  }
+  if (stream->cookies) {
+    nghttp3_stream_delete_cookies(stream);
+  }
+
+  return 0;
+}
+
 void nghttp3_conn_del(nghttp3_conn *conn) {
+  nghttp3_phantom_block *blk;
+  size_t i;
+
   if (conn == NULL) {
     return;
   }
 
+  if (conn->local.settings.arena) {
+    /* Everything but conn itself is in the arena.  Only mapped files
+       and the references to interned values have to be released one
+       by one. */
+    nghttp3_map_each(&conn->streams, release_stream_foreign, NULL);
+    nghttp3_arena_free(&conn->arena);
+    nghttp3_mem_free(conn->arena.parent, conn);
+    return;
+  }
+
   nghttp3_idtr_free(&conn->remote.bidi.idtr);
 
   nghttp3_pq_free(&conn->qpack_blocked_streams);
 
+  nghttp3_nva_del(conn->qpack_warm.nva, conn->mem);
   nghttp3_qpack_encoder_free(&conn->qenc);
   nghttp3_qpack_decoder_free(&conn->qdec);
 
-  nghttp3_map_each_free(&conn->placeholders, free_placeholder,
-                        (void *)conn->mem);
-  nghttp3_map_free(&conn->placeholders);
+  nghttp3_map_each_free(&conn->phantoms, free_phantom, NULL);
+  nghttp3_map_free(&conn->phantoms);
+
+  for (; conn->phantom_blocks; conn->phantom_blocks = blk) {
+    blk = conn->phantom_blocks->next;
+    nghttp3_mem_free(conn->mem, conn->phantom_blocks);
+  }
+
+  if (conn->placeholders) {
+    for (i = 0; i < conn->local.settings.num_placeholders; ++i) {
+      if (conn->placeholders[i].node.parent) {
+        nghttp3_tnode_free(&conn->placeholders[i].node);
+      }
+    }
+    nghttp3_mem_free(conn->mem, conn->placeholders);
+  }
 
   nghttp3_map_each_free(&conn->streams, free_stream, NULL);
   nghttp3_map_free(&conn->streams);
 
   nghttp3_tnode_free(&conn->root);
 
-  nghttp3_mem_free(conn->mem, conn);
+  nghttp3_mem_free(conn->arena.parent, conn);
+}
+
+/*
+ * conn_upgrade_phantom puts |stream| in the place of the phantom
+ * which has the same stream ID in the priority tree, and deletes the
+ * phantom.  If there is no such phantom, it opens the stream ID in
+ * remote.bidi.idtr.
+ */
+static int conn_upgrade_phantom(nghttp3_conn *conn, nghttp3_stream *stream) {
+  nghttp3_phantom *ph = nghttp3_conn_find_phantom(conn, stream->stream_id);
+  int rv;
+
+  if (ph == NULL) {
+    rv = nghttp3_idtr_open(&conn->remote.bidi.idtr, stream->stream_id);
+    assert(rv == 0);
+    return 0;
+  }
+
+  nghttp3_tnode_remove(&stream->node);
+
+  rv = nghttp3_tnode_replace(&ph->node, &stream->node);
+  if (rv != 0) {
+    return rv;
+  }
+
+  rv = nghttp3_map_remove(&conn->phantoms, (key_type)stream->stream_id);
+  assert(0 == rv);
+
+  conn_free_phantom(conn, ph);
+
+  return 0;
 }
 
 ssize_t nghttp3_conn_read_stream(nghttp3_conn *conn, int64_t stream_id,
@@ -314,8 +484,10 @@ ssize_t nghttp3_conn_read_stream(nghttp3_conn *conn, int64_t stream_id,
     }
     if (conn->server) {
       if (nghttp3_client_stream_bidi(stream_id)) {
-        rv = nghttp3_idtr_open(&conn->remote.bidi.idtr, stream_id);
-        assert(rv == 0);
+        rv = conn_upgrade_phantom(conn, stream);
+        if (rv != 0) {
+          return rv;
+        }
       }
       stream->rx.hstate = NGHTTP3_HTTP_STATE_REQ_INITIAL;
       stream->tx.hstate = NGHTTP3_HTTP_STATE_REQ_INITIAL;
@@ -336,6 +508,12 @@ ssize_t nghttp3_conn_read_stream(nghttp3_conn *conn, int64_t stream_id,
   if (nghttp3_stream_uni(stream_id)) {
     return nghttp3_conn_read_uni(conn, stream, src, srclen, fin);
   }
+
+  if (stream->timing &&
+      stream->timing->first_byte_recv == NGHTTP3_TIMESTAMP_NONE) {
+    stream->timing->first_byte_recv = nghttp3_conn_get_timestamp(conn);
+  }
+
   return nghttp3_conn_read_bidi(conn, stream, src, srclen, fin);
 }
 
@@ -515,6 +693,13 @@ ssize_t nghttp3_conn_read_control(nghttp3_conn *conn, nghttp3_stream *stream,
       rstate->left = rstate->fr.hd.length = rvint->acc;
       nghttp3_varint_read_state_reset(rvint);
 
+      nghttp3_frame_stats_add(&conn->stats.recv, &rstate->fr.hd);
+
+      if (conn->callbacks.trace) {
+        nghttp3_conn_trace_frame(conn, NGHTTP3_TRACE_EVENT_FRAME_RECV,
+                                 stream->stream_id, &rstate->fr.hd);
+      }
+
       if (!(conn->flags & NGHTTP3_CONN_FLAG_SETTINGS_RECVED)) {
         if (rstate->fr.hd.type != NGHTTP3_FRAME_SETTINGS) {
           return NGHTTP3_ERR_HTTP_MISSING_SETTINGS;
@@ -823,17 +1008,36 @@ ssize_t nghttp3_conn_read_push(nghttp3_conn *conn, nghttp3_stream *stream,
   return 0;
 }
 
+/*
+ * conn_timing_qpack_unblocked records the time when a stream is
+ * unblocked by QPACK decoder in |timing|, and accounts the time
+ * during which the stream has been blocked.
+ */
+static void conn_timing_qpack_unblocked(nghttp3_conn *conn,
+                                        nghttp3_stream_timing *timing) {
+  uint64_t ts = nghttp3_conn_get_timestamp(conn);
+  uint64_t blocked_time = ts - timing->qpack_blocked;
+
+  timing->qpack_unblocked = ts;
+  timing->qpack_blocked_time += blocked_time;
+  conn->stats.qpack_blocked_time += blocked_time;
+}
+
 ssize_t nghttp3_conn_read_qpack_encoder(nghttp3_conn *conn, const uint8_t *src,
                                         size_t srclen) {
   ssize_t nread = nghttp3_qpack_decoder_read_encoder(&conn->qdec, src, srclen);
+  ssize_t nconsumed;
   nghttp3_stream *stream;
   nghttp3_buf *buf;
+  uint16_t eof;
   int rv;
 
   if (nread < 0) {
     return nread;
   }
 
+  conn->stats.qpack_enc_stream_recv += (uint64_t)nread;
+
   for (; !nghttp3_pq_empty(&conn->qpack_blocked_streams);) {
     stream = nghttp3_struct_of(nghttp3_pq_top(&conn->qpack_blocked_streams),
                                nghttp3_stream, qpack_blocked_pe);
@@ -846,21 +1050,39 @@ ssize_t nghttp3_conn_read_qpack_encoder(nghttp3_conn *conn, const uint8_t *src,
 
     stream->flags &= (uint16_t)~NGHTTP3_STREAM_FLAG_QPACK_DECODE_BLOCKED;
 
+    if (conn->callbacks.trace) {
+      nghttp3_conn_trace_blocked(conn, NGHTTP3_TRACE_EVENT_STREAM_UNBLOCKED,
+                                 stream->stream_id,
+                                 NGHTTP3_TRACE_BLOCKED_QPACK);
+    }
+
+    if (stream->timing) {
+      conn_timing_qpack_unblocked(conn, stream->timing);
+    }
+
+    /* fin, if it has been received, belongs to the last buffered
+       data.  nghttp3_conn_read_bidi sets
+       NGHTTP3_STREAM_FLAG_READ_EOF again when it sees fin. */
+    eof = stream->flags & NGHTTP3_STREAM_FLAG_READ_EOF;
+    stream->flags &= (uint16_t)~NGHTTP3_STREAM_FLAG_READ_EOF;
+
     for (; nghttp3_ringbuf_len(&stream->inq);) {
       buf = nghttp3_ringbuf_get(&stream->inq, 0);
 
-      nread =
-          nghttp3_conn_read_bidi(conn, stream, buf->pos, nghttp3_buf_len(buf),
-                                 stream->flags & NGHTTP3_STREAM_FLAG_READ_EOF);
-      if (nread < 0) {
-        return nread;
+      nconsumed = nghttp3_conn_read_bidi(
+          conn, stream, buf->pos, nghttp3_buf_len(buf),
+          eof && nghttp3_ringbuf_len(&stream->inq) == 1);
+      if (nconsumed < 0) {
+        return nconsumed;
       }
 
-      buf->pos += nread;
+      buf->pos += nconsumed;
+      conn->stats.inq_bytes -= (uint64_t)nconsumed;
 
       if (conn->callbacks.deferred_consume) {
         rv = conn->callbacks.deferred_consume(conn, stream->stream_id,
-                                              (size_t)nread, conn->user_data,
+                                              (size_t)nconsumed,
+                                              conn->user_data,
                                               stream->user_data);
         if (rv != 0) {
           return NGHTTP3_ERR_CALLBACK_FAILURE;
@@ -876,6 +1098,10 @@ ssize_t nghttp3_conn_read_qpack_encoder(nghttp3_conn *conn, const uint8_t *src,
         break;
       }
     }
+
+    if (eof) {
+      stream->flags |= NGHTTP3_STREAM_FLAG_READ_EOF;
+    }
   }
 
   return nread;
@@ -883,7 +1109,15 @@ ssize_t nghttp3_conn_read_qpack_encoder(nghttp3_conn *conn, const uint8_t *src,
 
 ssize_t nghttp3_conn_read_qpack_decoder(nghttp3_conn *conn, const uint8_t *src,
                                         size_t srclen) {
-  return nghttp3_qpack_encoder_read_decoder(&conn->qenc, src, srclen);
+  ssize_t nread = nghttp3_qpack_encoder_read_decoder(&conn->qenc, src, srclen);
+
+  if (nread < 0) {
+    return nread;
+  }
+
+  conn->stats.qpack_dec_stream_recv += (uint64_t)nread;
+
+  return nread;
 }
 
 ssize_t nghttp3_conn_read_bidi(nghttp3_conn *conn, nghttp3_stream *stream,
@@ -953,6 +1187,13 @@ ssize_t nghttp3_conn_read_bidi(nghttp3_conn *conn, nghttp3_stream *stream,
       rstate->left = rstate->fr.hd.length = rvint->acc;
       nghttp3_varint_read_state_reset(rvint);
 
+      nghttp3_frame_stats_add(&conn->stats.recv, &rstate->fr.hd);
+
+      if (conn->callbacks.trace) {
+        nghttp3_conn_trace_frame(conn, NGHTTP3_TRACE_EVENT_FRAME_RECV,
+                                 stream->stream_id, &rstate->fr.hd);
+      }
+
       /* TODO Verify that PRIORITY is only allowed at the beginning of
          request stream */
       switch (rstate->fr.hd.type) {
@@ -1169,6 +1410,10 @@ ssize_t nghttp3_conn_read_bidi(nghttp3_conn *conn, nghttp3_stream *stream,
       switch (stream->rx.hstate) {
       case NGHTTP3_HTTP_STATE_REQ_HEADERS_BEGIN:
       case NGHTTP3_HTTP_STATE_RESP_HEADERS_BEGIN:
+        if (stream->timing &&
+            stream->timing->headers_recv == NGHTTP3_TIMESTAMP_NONE) {
+          stream->timing->headers_recv = nghttp3_conn_get_timestamp(conn);
+        }
         rv = conn_call_end_headers(conn, stream);
         break;
       case NGHTTP3_HTTP_STATE_REQ_TRAILERS_BEGIN:
@@ -1211,8 +1456,12 @@ almost_done:
       if (rvint->left) {
         return NGHTTP3_ERR_HTTP_GENERAL_PROTOCOL_ERROR;
       }
-      return nghttp3_stream_transit_rx_http_state(stream,
-                                                  NGHTTP3_HTTP_EVENT_MSG_END);
+      rv = nghttp3_stream_transit_rx_http_state(stream,
+                                                NGHTTP3_HTTP_EVENT_MSG_END);
+      if (rv != 0) {
+        return rv;
+      }
+      break;
     default:
       return nghttp3_err_malformed_frame(rstate->fr.hd.type);
     }
@@ -1238,6 +1487,42 @@ int nghttp3_conn_on_data(nghttp3_conn *conn, nghttp3_stream *stream,
   return 0;
 }
 
+/*
+ * conn_check_dependency checks that |dep_nid| is an element which a
+ * PRIORITY frame is allowed to depend on.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGHTTP3_ERR_HTTP_MALFORMED_FRAME - NGHTTP3_FRAME_PRIORITY
+ *     |dep_nid| is a stream, but not a client initiated
+ *     bidirectional one.
+ * NGHTTP3_ERR_HTTP_LIMIT_EXCEEDED
+ *     |dep_nid| exceeds the number of streams or placeholders.
+ */
+static int conn_check_dependency(nghttp3_conn *conn,
+                                 const nghttp3_node_id *dep_nid) {
+  switch (dep_nid->type) {
+  case NGHTTP3_NODE_ID_TYPE_STREAM:
+    if (!nghttp3_client_stream_bidi(dep_nid->id)) {
+      return nghttp3_err_malformed_frame(NGHTTP3_FRAME_PRIORITY);
+    }
+    if (nghttp3_ord_stream_id(dep_nid->id) > conn->rx.max_client_streams_bidi) {
+      return NGHTTP3_ERR_HTTP_LIMIT_EXCEEDED;
+    }
+    break;
+  case NGHTTP3_NODE_ID_TYPE_PLACEHOLDER:
+    if ((uint64_t)dep_nid->id >= conn->local.settings.num_placeholders) {
+      return NGHTTP3_ERR_HTTP_LIMIT_EXCEEDED;
+    }
+    break;
+  default:
+    break;
+  }
+
+  return 0;
+}
+
 static int conn_ensure_dependency(nghttp3_conn *conn,
                                   nghttp3_tnode **pdep_tnode,
                                   const nghttp3_node_id *dep_nid,
@@ -1245,31 +1530,46 @@ static int conn_ensure_dependency(nghttp3_conn *conn,
   nghttp3_tnode *dep_tnode = NULL;
   nghttp3_stream *dep_stream;
   nghttp3_placeholder *dep_ph;
+  nghttp3_phantom *dep_phantom;
   int rv;
 
   assert(conn->server);
 
+  rv = conn_check_dependency(conn, dep_nid);
+  if (rv != 0) {
+    return rv;
+  }
+
   switch (dep_nid->type) {
   case NGHTTP3_NODE_ID_TYPE_STREAM:
-    if (!nghttp3_client_stream_bidi(dep_nid->id)) {
-      return nghttp3_err_malformed_frame(NGHTTP3_FRAME_PRIORITY);
-    }
-    if (nghttp3_ord_stream_id(dep_nid->id) > conn->rx.max_client_streams_bidi) {
-      return NGHTTP3_ERR_HTTP_LIMIT_EXCEEDED;
-    }
-
     dep_stream = nghttp3_conn_find_stream(conn, dep_nid->id);
     if (dep_stream == NULL) {
-      rv = nghttp3_idtr_open(&conn->remote.bidi.idtr, dep_nid->id);
-      if (rv == NGHTTP3_ERR_STREAM_IN_USE) {
-        /* Stream has been closed; use root instead. */
-        dep_tnode = &conn->root;
-        return 0;
-      }
-      rv = nghttp3_conn_create_stream(conn, &dep_stream, dep_nid->id);
-      if (rv != 0) {
-        return rv;
+      dep_phantom = nghttp3_conn_find_phantom(conn, dep_nid->id);
+      if (dep_phantom == NULL) {
+        if (nghttp3_idtr_is_open(&conn->remote.bidi.idtr, dep_nid->id)) {
+          /* Stream has been closed; use root instead. */
+          dep_tnode = &conn->root;
+          break;
+        }
+        rv = nghttp3_conn_create_phantom(conn, &dep_phantom, dep_nid->id,
+                                         NGHTTP3_DEFAULT_WEIGHT, &conn->root);
+        if (rv != 0) {
+          return rv;
+        }
+      } else if (tnode && nghttp3_tnode_find_ascendant(&dep_phantom->node,
+                                                       &tnode->nid) != NULL) {
+        nghttp3_tnode_remove(&dep_phantom->node);
+        nghttp3_tnode_insert(&dep_phantom->node, tnode->parent);
+
+        if (nghttp3_tnode_has_active_descendant(&dep_phantom->node)) {
+          rv = nghttp3_tnode_schedule(&dep_phantom->node, 0);
+          if (rv != 0) {
+            return rv;
+          }
+        }
       }
+      dep_tnode = &dep_phantom->node;
+      break;
     } else if (tnode && nghttp3_tnode_find_ascendant(&dep_stream->node,
                                                      &tnode->nid) != NULL) {
       nghttp3_tnode_remove(&dep_stream->node);
@@ -1289,17 +1589,10 @@ static int conn_ensure_dependency(nghttp3_conn *conn,
     /* TODO Not implemented */
     break;
   case NGHTTP3_NODE_ID_TYPE_PLACEHOLDER:
-    if ((uint64_t)dep_nid->id >= conn->local.settings.num_placeholders) {
-      return NGHTTP3_ERR_HTTP_LIMIT_EXCEEDED;
-    }
-
     dep_ph = nghttp3_conn_find_placeholder(conn, dep_nid->id);
     if (dep_ph == NULL) {
-      rv = nghttp3_conn_create_placeholder(conn, &dep_ph, dep_nid->id,
-                                           NGHTTP3_DEFAULT_WEIGHT, &conn->root);
-      if (rv != 0) {
-        return rv;
-      }
+      dep_ph = nghttp3_conn_create_placeholder(
+          conn, dep_nid->id, NGHTTP3_DEFAULT_WEIGHT, &conn->root);
     } else if (tnode && nghttp3_tnode_find_ascendant(&dep_ph->node,
                                                      &tnode->nid) != NULL) {
       nghttp3_tnode_remove(&dep_ph->node);
@@ -1336,6 +1629,16 @@ int nghttp3_conn_on_request_priority(nghttp3_conn *conn, nghttp3_stream *stream,
     return nghttp3_err_malformed_frame(NGHTTP3_FRAME_PRIORITY);
   }
 
+  if (conn->local.settings.scheduler == NGHTTP3_SCHEDULER_URGENCY) {
+    /* The urgency scheduler ignores the dependency tree.  Validate
+       the frame, but do not build the tree which nothing reads. */
+    if (dep_nid.type == NGHTTP3_NODE_ID_TYPE_STREAM &&
+        dep_nid.id > stream->stream_id) {
+      return nghttp3_err_malformed_frame(NGHTTP3_FRAME_PRIORITY);
+    }
+    return conn_check_dependency(conn, &dep_nid);
+  }
+
   if (stream->node.weight == fr->weight &&
       nghttp3_node_id_eq(&stream->node.parent->nid, &dep_nid)) {
     return 0;
@@ -1380,8 +1683,9 @@ int nghttp3_conn_on_control_priority(nghttp3_conn *conn,
                                      const nghttp3_frame_priority *fr) {
   nghttp3_node_id nid, dep_nid;
   nghttp3_tnode *dep_tnode = NULL, *tnode = NULL;
-  nghttp3_stream *stream;
+  nghttp3_stream *stream = NULL;
   nghttp3_placeholder *ph;
+  nghttp3_phantom *phantom;
   int rv;
 
   assert(conn->server);
@@ -1400,6 +1704,11 @@ int nghttp3_conn_on_control_priority(nghttp3_conn *conn,
     stream = nghttp3_conn_find_stream(conn, nid.id);
     if (stream) {
       tnode = &stream->node;
+      break;
+    }
+    phantom = nghttp3_conn_find_phantom(conn, nid.id);
+    if (phantom) {
+      tnode = &phantom->node;
     } else if (nghttp3_idtr_is_open(&conn->remote.bidi.idtr, nid.id)) {
       return 0;
     }
@@ -1425,6 +1734,12 @@ int nghttp3_conn_on_control_priority(nghttp3_conn *conn,
     return nghttp3_err_malformed_frame(NGHTTP3_FRAME_PRIORITY);
   }
 
+  if (conn->local.settings.scheduler == NGHTTP3_SCHEDULER_URGENCY) {
+    /* Neither placeholders nor phantoms are created because nothing
+       is scheduled through them. */
+    return conn_check_dependency(conn, &dep_nid);
+  }
+
   if (tnode && tnode->weight == fr->weight &&
       nghttp3_node_id_eq(&tnode->parent->nid, &dep_nid)) {
     return 0;
@@ -1443,19 +1758,16 @@ int nghttp3_conn_on_control_priority(nghttp3_conn *conn,
   if (tnode == NULL) {
     switch (nid.type) {
     case NGHTTP3_NODE_ID_TYPE_STREAM:
-      rv = nghttp3_conn_create_stream_dependency(conn, &stream, nid.id,
-                                                 fr->weight, dep_tnode);
+      rv = nghttp3_conn_create_phantom(conn, &phantom, nid.id, fr->weight,
+                                       dep_tnode);
       if (rv != 0) {
         return rv;
       }
-      tnode = &stream->node;
+      tnode = &phantom->node;
       break;
     case NGHTTP3_NODE_ID_TYPE_PLACEHOLDER:
-      rv = nghttp3_conn_create_placeholder(conn, &ph, nid.id, fr->weight,
+      ph = nghttp3_conn_create_placeholder(conn, nid.id, fr->weight,
                                            dep_tnode);
-      if (rv != 0) {
-        return rv;
-      }
       tnode = &ph->node;
       break;
     default:
@@ -1471,6 +1783,15 @@ int nghttp3_conn_on_control_priority(nghttp3_conn *conn,
 
   switch (nid.type) {
   case NGHTTP3_NODE_ID_TYPE_STREAM:
+    if (stream == NULL) {
+      if (nghttp3_tnode_has_active_descendant(tnode)) {
+        rv = nghttp3_tnode_schedule(tnode, 0);
+        if (rv != 0) {
+          return rv;
+        }
+      }
+      break;
+    }
     if (nghttp3_stream_require_schedule(stream) ||
         nghttp3_tnode_has_active_descendant(tnode)) {
       rv = nghttp3_stream_schedule(stream);
@@ -1495,6 +1816,32 @@ int nghttp3_conn_on_control_priority(nghttp3_conn *conn,
   return 0;
 }
 
+/*
+ * conn_recv_cookie joins the cookie header fields buffered in
+ * |stream| into one, and passes it to |recv_header|.
+ *
+ * This function returns 0 if it succeeds, or NGHTTP3_ERR_NOMEM, or
+ * the nonzero value which |recv_header| returns.
+ */
+static int conn_recv_cookie(nghttp3_conn *conn, nghttp3_stream *stream,
+                            nghttp3_recv_header recv_header) {
+  nghttp3_qpack_nv nv;
+  int rv;
+
+  rv = nghttp3_stream_join_cookies(stream, &nv);
+  if (rv != 0) {
+    return rv;
+  }
+
+  rv = recv_header(conn, stream->stream_id, nv.token, nv.name, nv.value,
+                   nv.flags, conn->user_data, stream->user_data);
+
+  nghttp3_rcbuf_decref(nv.name);
+  nghttp3_rcbuf_decref(nv.value);
+
+  return rv;
+}
+
 static ssize_t conn_decode_headers(nghttp3_conn *conn, nghttp3_stream *stream,
                                    const uint8_t *src, size_t srclen, int fin) {
   ssize_t nread;
@@ -1549,11 +1896,30 @@ static ssize_t conn_decode_headers(nghttp3_conn *conn, nghttp3_stream *stream,
       if (rv != 0) {
         return rv;
       }
+
+      ++conn->stats.qpack_blocked_total;
+
+      if (stream->timing) {
+        stream->timing->qpack_blocked = nghttp3_conn_get_timestamp(conn);
+      }
+
+      if (conn->callbacks.trace) {
+        nghttp3_conn_trace_blocked(conn, NGHTTP3_TRACE_EVENT_STREAM_BLOCKED,
+                                   stream->stream_id,
+                                   NGHTTP3_TRACE_BLOCKED_QPACK);
+      }
       break;
     }
 
     if (flags & NGHTTP3_QPACK_DECODE_FLAG_FINAL) {
       nghttp3_qpack_stream_context_reset(&stream->qpack_sctx);
+
+      if (stream->cookies && nghttp3_ringbuf_len(stream->cookies)) {
+        rv = conn_recv_cookie(conn, stream, recv_header);
+        if (rv != 0) {
+          return rv;
+        }
+      }
       break;
     }
 
@@ -1562,6 +1928,17 @@ static ssize_t conn_decode_headers(nghttp3_conn *conn, nghttp3_stream *stream,
     }
 
     if (flags & NGHTTP3_QPACK_DECODE_FLAG_EMIT) {
+      if (recv_header && conn->local.settings.rejoin_cookie &&
+          nv.token == NGHTTP3_QPACK_TOKEN_COOKIE) {
+        rv = nghttp3_stream_add_cookie(stream, &nv);
+        if (rv != 0) {
+          nghttp3_rcbuf_decref(nv.name);
+          nghttp3_rcbuf_decref(nv.value);
+          return rv;
+        }
+        continue;
+      }
+
       if (recv_header) {
         rv = recv_header(conn, stream->stream_id, nv.token, nv.name, nv.value,
                          nv.flags, conn->user_data, stream->user_data);
@@ -1590,6 +1967,86 @@ ssize_t nghttp3_conn_on_headers(nghttp3_conn *conn, nghttp3_stream *stream,
   return conn_decode_headers(conn, stream, src, srclen, fin);
 }
 
+/*
+ * conn_prewarm_qpack inserts the header fields in conn->qpack_warm
+ * into dynamic table of QPACK encoder, and frees them.  It does
+ * nothing if there is no such header field, the capacity of dynamic
+ * table is not known yet, or QPACK encoder stream is not bound.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGHTTP3_ERR_NOMEM
+ *     Out of memory.
+ */
+static int conn_prewarm_qpack(nghttp3_conn *conn) {
+  nghttp3_buf ebuf;
+  nghttp3_typed_buf tbuf;
+  int rv;
+
+  if (conn->qpack_warm.nva == NULL || conn->tx.qenc == NULL ||
+      conn->qenc.ctx.hard_max_dtable_size == 0) {
+    return 0;
+  }
+
+  nghttp3_buf_init(&ebuf);
+
+  rv = nghttp3_qpack_encoder_prewarm(&conn->qenc, &ebuf, conn->qpack_warm.nva,
+                                     conn->qpack_warm.nvlen);
+
+  nghttp3_nva_del(conn->qpack_warm.nva, conn->mem);
+  conn->qpack_warm.nva = NULL;
+  conn->qpack_warm.nvlen = 0;
+
+  if (rv != 0) {
+    goto fail;
+  }
+
+  if (nghttp3_buf_len(&ebuf) == 0) {
+    nghttp3_buf_free(&ebuf, conn->mem);
+    return 0;
+  }
+
+  conn->stats.qpack_enc_stream_sent += nghttp3_buf_len(&ebuf);
+
+  nghttp3_typed_buf_init(&tbuf, &ebuf, NGHTTP3_BUF_TYPE_PRIVATE);
+  rv = nghttp3_stream_outq_add(conn->tx.qenc, &tbuf);
+  if (rv != 0) {
+    goto fail;
+  }
+
+  return 0;
+
+fail:
+  nghttp3_buf_free(&ebuf, conn->mem);
+
+  return rv;
+}
+
+int nghttp3_conn_set_qpack_warm_profile(nghttp3_conn *conn,
+                                        const nghttp3_nv *nva, size_t nvlen) {
+  int rv;
+
+  if (conn->qpack_warm.nva) {
+    nghttp3_nva_del(conn->qpack_warm.nva, conn->mem);
+    conn->qpack_warm.nva = NULL;
+    conn->qpack_warm.nvlen = 0;
+  }
+
+  if (nvlen == 0) {
+    return 0;
+  }
+
+  rv = nghttp3_nva_copy(&conn->qpack_warm.nva, nva, nvlen, conn->mem);
+  if (rv != 0) {
+    return rv;
+  }
+
+  conn->qpack_warm.nvlen = nvlen;
+
+  return conn_prewarm_qpack(conn);
+}
+
 int nghttp3_conn_on_settings_entry_received(nghttp3_conn *conn,
                                             const nghttp3_frame_settings *fr) {
   const nghttp3_settings_entry *ent = &fr->iv[0];
@@ -1621,6 +2078,10 @@ int nghttp3_conn_on_settings_entry_received(nghttp3_conn *conn,
     if (rv != 0) {
       return rv;
     }
+    rv = conn_prewarm_qpack(conn);
+    if (rv != 0) {
+      return rv;
+    }
     break;
   case NGHTTP3_SETTINGS_ID_QPACK_BLOCKED_STREAMS:
     if (ent->value > NGHTTP3_QPACK_MAX_BLOCKED_STREAMS) {
@@ -1666,6 +2127,17 @@ int nghttp3_conn_create_stream(nghttp3_conn *conn, nghttp3_stream **pstream,
       conn, pstream, stream_id, NGHTTP3_DEFAULT_WEIGHT, &conn->root);
 }
 
+static void stream_timing_init(nghttp3_stream_timing *timing) {
+  timing->first_byte_recv = NGHTTP3_TIMESTAMP_NONE;
+  timing->headers_recv = NGHTTP3_TIMESTAMP_NONE;
+  timing->qpack_blocked = NGHTTP3_TIMESTAMP_NONE;
+  timing->qpack_unblocked = NGHTTP3_TIMESTAMP_NONE;
+  timing->qpack_blocked_time = 0;
+  timing->first_read_data = NGHTTP3_TIMESTAMP_NONE;
+  timing->first_byte_sent = NGHTTP3_TIMESTAMP_NONE;
+  timing->last_byte_acked = NGHTTP3_TIMESTAMP_NONE;
+}
+
 int nghttp3_conn_create_stream_dependency(nghttp3_conn *conn,
                                           nghttp3_stream **pstream,
                                           int64_t stream_id, uint32_t weight,
@@ -1684,6 +2156,17 @@ int nghttp3_conn_create_stream_dependency(nghttp3_conn *conn,
 
   stream->conn = conn;
 
+  if (conn->callbacks.get_timestamp && !nghttp3_stream_uni(stream_id)) {
+    stream->timing =
+        nghttp3_mem_malloc(conn->mem, sizeof(nghttp3_stream_timing));
+    if (stream->timing == NULL) {
+      nghttp3_stream_del(stream);
+      return NGHTTP3_ERR_NOMEM;
+    }
+
+    stream_timing_init(stream->timing);
+  }
+
   rv = nghttp3_map_insert(&conn->streams, &stream->me);
   if (rv != 0) {
     nghttp3_stream_del(stream);
@@ -1696,24 +2179,52 @@ int nghttp3_conn_create_stream_dependency(nghttp3_conn *conn,
   return 0;
 }
 
-int nghttp3_conn_create_placeholder(nghttp3_conn *conn,
-                                    nghttp3_placeholder **pph, int64_t ph_id,
-                                    uint32_t weight, nghttp3_tnode *parent) {
+nghttp3_placeholder *nghttp3_conn_create_placeholder(nghttp3_conn *conn,
+                                                     int64_t ph_id,
+                                                     uint32_t weight,
+                                                     nghttp3_tnode *parent) {
   nghttp3_placeholder *ph;
+  nghttp3_node_id nid;
+
+  assert(ph_id >= 0);
+  assert((uint64_t)ph_id < conn->local.settings.num_placeholders);
+
+  ph = &conn->placeholders[ph_id];
+
+  assert(ph->node.parent == NULL);
+
+  nghttp3_tnode_init(
+      &ph->node,
+      nghttp3_node_id_init(&nid, NGHTTP3_NODE_ID_TYPE_PLACEHOLDER, ph_id),
+      conn->next_seq++, weight, parent, conn->mem);
+
+  return ph;
+}
+
+int nghttp3_conn_create_phantom(nghttp3_conn *conn, nghttp3_phantom **pph,
+                                int64_t stream_id, uint32_t weight,
+                                nghttp3_tnode *parent) {
+  nghttp3_phantom *ph;
   int rv;
 
-  rv = nghttp3_placeholder_new(&ph, ph_id, conn->next_seq, weight, parent,
-                               conn->mem);
-  if (rv != 0) {
-    return rv;
+  ph = conn_alloc_phantom(conn);
+  if (ph == NULL) {
+    return NGHTTP3_ERR_NOMEM;
   }
 
-  rv = nghttp3_map_insert(&conn->placeholders, &ph->me);
+  nghttp3_phantom_init(ph, stream_id, conn->next_seq, weight, parent,
+                       conn->mem);
+
+  rv = nghttp3_map_insert(&conn->phantoms, &ph->u.me);
   if (rv != 0) {
-    nghttp3_placeholder_del(ph, conn->mem);
+    nghttp3_tnode_remove(&ph->node);
+    conn_free_phantom(conn, ph);
     return rv;
   }
 
+  rv = nghttp3_idtr_open(&conn->remote.bidi.idtr, stream_id);
+  assert(rv == 0);
+
   ++conn->next_seq;
   *pph = ph;
 
@@ -1734,14 +2245,27 @@ nghttp3_stream *nghttp3_conn_find_stream(nghttp3_conn *conn,
 
 nghttp3_placeholder *nghttp3_conn_find_placeholder(nghttp3_conn *conn,
                                                    int64_t ph_id) {
+  nghttp3_placeholder *ph;
+
+  if (ph_id < 0 || (uint64_t)ph_id >= conn->local.settings.num_placeholders) {
+    return NULL;
+  }
+
+  ph = &conn->placeholders[ph_id];
+
+  return ph->node.parent ? ph : NULL;
+}
+
+nghttp3_phantom *nghttp3_conn_find_phantom(nghttp3_conn *conn,
+                                           int64_t stream_id) {
   nghttp3_map_entry *me;
 
-  me = nghttp3_map_find(&conn->placeholders, (key_type)ph_id);
+  me = nghttp3_map_find(&conn->phantoms, (key_type)stream_id);
   if (me == NULL) {
     return NULL;
   }
 
-  return nghttp3_struct_of(me, nghttp3_placeholder, me);
+  return nghttp3_struct_of(me, nghttp3_phantom, u.me);
 }
 
 int nghttp3_conn_bind_control_stream(nghttp3_conn *conn, int64_t stream_id) {
@@ -1805,7 +2329,12 @@ int nghttp3_conn_bind_qpack_streams(nghttp3_conn *conn, int64_t qenc_stream_id,
 
   conn->tx.qdec = stream;
 
-  return nghttp3_stream_write_stream_type(stream);
+  rv = nghttp3_stream_write_stream_type(stream);
+  if (rv != 0) {
+    return rv;
+  }
+
+  return conn_prewarm_qpack(conn);
 }
 
 static ssize_t conn_writev_stream(nghttp3_conn *conn, int64_t *pstream_id,
@@ -1841,11 +2370,47 @@ static ssize_t conn_writev_stream(nghttp3_conn *conn, int64_t *pstream_id,
     return 0;
   }
 
+  if (stream->timing &&
+      stream->timing->first_byte_sent == NGHTTP3_TIMESTAMP_NONE) {
+    stream->timing->first_byte_sent = nghttp3_conn_get_timestamp(conn);
+  }
+
   *pstream_id = stream->stream_id;
 
   return n;
 }
 
+/*
+ * conn_trace_sched_pick emits NGHTTP3_TRACE_EVENT_SCHED_PICK for
+ * |stream|.  The caller must check that conn->callbacks.trace is not
+ * NULL.
+ */
+static void conn_trace_sched_pick(nghttp3_conn *conn, nghttp3_stream *stream) {
+  nghttp3_trace_event ev;
+
+  ev.type = NGHTTP3_TRACE_EVENT_SCHED_PICK;
+  ev.stream_id = stream->stream_id;
+
+  conn->callbacks.trace(conn, &ev, conn->user_data);
+}
+
+/*
+ * conn_tx_budget_wait adds |stream| to the list of streams which wait
+ * for the connection wide budget if it has frames to send but cannot
+ * because the budget is exhausted.  It is called when
+ * nghttp3_stream_require_schedule(stream) returns 0 so that |stream|
+ * is scheduled again when the budget becomes available.
+ */
+static void conn_tx_budget_wait(nghttp3_stream *stream) {
+  if (nghttp3_stream_is_blocked(stream) ||
+      nghttp3_ringbuf_len(&stream->frq) == 0 ||
+      !nghttp3_stream_tx_budget_exhausted(stream)) {
+    return;
+  }
+
+  nghttp3_stream_tx_budget_wait(stream);
+}
+
 ssize_t nghttp3_conn_writev_stream(nghttp3_conn *conn, int64_t *pstream_id,
                                    int *pfin, nghttp3_vec *vec, size_t veccnt) {
   ssize_t ncnt;
@@ -1887,25 +2452,108 @@ ssize_t nghttp3_conn_writev_stream(nghttp3_conn *conn, int64_t *pstream_id,
     }
   }
 
-  stream = nghttp3_conn_get_next_tx_stream(conn);
-  if (stream == NULL) {
-    return 0;
-  }
+  for (;;) {
+    stream = nghttp3_conn_get_next_tx_stream(conn);
+    if (stream == NULL) {
+      return 0;
+    }
+
+    if (conn->callbacks.trace) {
+      conn_trace_sched_pick(conn, stream);
+    }
+
+    ncnt = conn_writev_stream(conn, pstream_id, pfin, vec, veccnt, stream);
+    if (ncnt < 0) {
+      return ncnt;
+    }
+
+    if (!nghttp3_stream_require_schedule(stream)) {
+      nghttp3_stream_unschedule(stream);
+      conn_tx_budget_wait(stream);
+      /* The stream might have nothing to write because it is waiting
+         for the connection wide budget.  Try the next stream. */
+      if (ncnt == 0) {
+        continue;
+      }
+    }
 
-  ncnt = conn_writev_stream(conn, pstream_id, pfin, vec, veccnt, stream);
-  if (ncnt < 0) {
     return ncnt;
   }
+}
+
+uint64_t nghttp3_conn_get_timestamp(nghttp3_conn *conn) {
+  return conn->callbacks.get_timestamp(conn, conn->user_data);
+}
+
+void nghttp3_conn_trace_frame(nghttp3_conn *conn,
+                              nghttp3_trace_event_type type,
+                              int64_t stream_id, const nghttp3_frame_hd *hd) {
+  nghttp3_trace_event ev;
+
+  ev.type = type;
+  ev.stream_id = stream_id;
+  ev.u.frame.type = hd->type;
+  ev.u.frame.length = hd->length;
+
+  conn->callbacks.trace(conn, &ev, conn->user_data);
+}
+
+void nghttp3_conn_trace_blocked(nghttp3_conn *conn,
+                                nghttp3_trace_event_type type,
+                                int64_t stream_id,
+                                nghttp3_trace_blocked_reason reason) {
+  nghttp3_trace_event ev;
+
+  ev.type = type;
+  ev.stream_id = stream_id;
+  ev.u.blocked.reason = reason;
+
+  conn->callbacks.trace(conn, &ev, conn->user_data);
+}
+
+int nghttp3_conn_get_stream_timing(nghttp3_conn *conn, int64_t stream_id,
+                                   nghttp3_stream_timing *timing) {
+  nghttp3_stream *stream = nghttp3_conn_find_stream(conn, stream_id);
 
-  if (!nghttp3_stream_require_schedule(stream)) {
-    nghttp3_stream_unschedule(stream);
+  if (stream == NULL || stream->timing == NULL) {
+    return NGHTTP3_ERR_INVALID_ARGUMENT;
   }
 
-  return ncnt;
+  *timing = *stream->timing;
+
+  return 0;
+}
+
+void nghttp3_conn_get_stats(nghttp3_conn *conn, nghttp3_conn_stats *stats) {
+  *stats = conn->stats;
+
+  stats->qpack_enc_dtable_size = conn->qenc.ctx.dtable_size;
+  stats->qpack_enc_inserts = conn->qenc.ctx.ninserts;
+  stats->qpack_enc_evictions = conn->qenc.ctx.nevictions;
+  stats->qpack_enc_fields = conn->qenc.nfields;
+  stats->qpack_enc_static_hits = conn->qenc.nstatic_hits;
+  stats->qpack_enc_dynamic_hits = conn->qenc.ndynamic_hits;
+  stats->qpack_enc_name_hits = conn->qenc.nname_hits;
+  stats->qpack_dec_dtable_size = conn->qdec.ctx.dtable_size;
+  stats->qpack_dec_inserts = conn->qdec.ctx.ninserts;
+  stats->qpack_dec_evictions = conn->qdec.ctx.nevictions;
+  stats->qpack_blocked_streams = nghttp3_pq_size(&conn->qpack_blocked_streams);
 }
 
 nghttp3_stream *nghttp3_conn_get_next_tx_stream(nghttp3_conn *conn) {
-  nghttp3_tnode *node = nghttp3_tnode_get_next(&conn->root);
+  nghttp3_tnode *node;
+  nghttp3_urgq_entry *ent;
+
+  if (conn->local.settings.scheduler == NGHTTP3_SCHEDULER_URGENCY) {
+    ent = nghttp3_urgq_top(&conn->urgq);
+    if (ent == NULL) {
+      return NULL;
+    }
+
+    return nghttp3_struct_of(ent, nghttp3_stream, urge);
+  }
+
+  node = nghttp3_tnode_get_next(&conn->root);
 
   if (node == NULL) {
     return NULL;
@@ -1914,6 +2562,19 @@ nghttp3_stream *nghttp3_conn_get_next_tx_stream(nghttp3_conn *conn) {
   return nghttp3_struct_of(node, nghttp3_stream, node);
 }
 
+ssize_t nghttp3_conn_get_stream_data_range(nghttp3_conn *conn,
+                                           int64_t stream_id, uint64_t offset,
+                                           size_t datalen, nghttp3_vec *vec,
+                                           size_t veccnt) {
+  nghttp3_stream *stream = nghttp3_conn_find_stream(conn, stream_id);
+
+  if (stream == NULL) {
+    return NGHTTP3_ERR_INVALID_ARGUMENT;
+  }
+
+  return nghttp3_stream_get_range(stream, vec, veccnt, offset, datalen);
+}
+
 int nghttp3_conn_add_write_offset(nghttp3_conn *conn, int64_t stream_id,
                                   size_t n) {
   nghttp3_stream *stream = nghttp3_conn_find_stream(conn, stream_id);
@@ -1936,21 +2597,127 @@ int nghttp3_conn_add_write_offset(nghttp3_conn *conn, int64_t stream_id,
   if ((!nghttp3_stream_uni(stream_id) ||
        stream->type == NGHTTP3_STREAM_TYPE_PUSH) &&
       nghttp3_stream_require_schedule(stream)) {
+    /* Keep the stream at the head of the queue until it has sent its
+       quantum. */
+    if (stream->unscheduled_nwrite < conn->local.settings.tx_quantum &&
+        nghttp3_stream_is_scheduled(stream)) {
+      return 0;
+    }
+
     return nghttp3_stream_schedule(stream);
   }
 
   return 0;
 }
 
+/*
+ * conn_on_tx_buffered_released is called when the number of bytes
+ * buffered in request streams decreases from |buffered|.  If the
+ * budget becomes available again, it schedules the streams which
+ * have been waiting for it.
+ */
+static int conn_on_tx_buffered_released(nghttp3_conn *conn,
+                                        uint64_t buffered) {
+  uint64_t max_tx_buffered = conn->local.settings.max_tx_buffered;
+  nghttp3_stream *stream;
+  int rv;
+
+  if (buffered < max_tx_buffered || conn->tx.buffered >= max_tx_buffered) {
+    return 0;
+  }
+
+  for (; conn->tx.budget_waitq;) {
+    stream = conn->tx.budget_waitq;
+    nghttp3_stream_tx_budget_unwait(stream);
+
+    if (!nghttp3_stream_require_schedule(stream)) {
+      continue;
+    }
+
+    rv = nghttp3_stream_ensure_scheduled(stream);
+    if (rv != 0) {
+      return rv;
+    }
+  }
+
+  return 0;
+}
+
 int nghttp3_conn_add_ack_offset(nghttp3_conn *conn, int64_t stream_id,
                                 size_t n) {
   nghttp3_stream *stream = nghttp3_conn_find_stream(conn, stream_id);
+  uint64_t buffered = conn->tx.buffered;
+  int rv;
 
   if (stream == NULL) {
     return NGHTTP3_ERR_INVALID_ARGUMENT;
   }
 
-  return nghttp3_stream_add_ack_offset(stream, n);
+  rv = nghttp3_stream_add_ack_offset(stream, n);
+  if (rv != 0) {
+    return rv;
+  }
+
+  if (stream->timing && n) {
+    stream->timing->last_byte_acked = nghttp3_conn_get_timestamp(conn);
+  }
+
+  return conn_on_tx_buffered_released(conn, buffered);
+}
+
+int nghttp3_conn_add_ack_range(nghttp3_conn *conn, int64_t stream_id,
+                               uint64_t offset, size_t datalen) {
+  nghttp3_stream *stream = nghttp3_conn_find_stream(conn, stream_id);
+  uint64_t buffered = conn->tx.buffered;
+  int rv;
+
+  if (stream == NULL) {
+    return NGHTTP3_ERR_INVALID_ARGUMENT;
+  }
+
+  rv = nghttp3_stream_add_ack_range(stream, offset, datalen);
+  if (rv != 0) {
+    return rv;
+  }
+
+  if (stream->timing && datalen) {
+    stream->timing->last_byte_acked = nghttp3_conn_get_timestamp(conn);
+  }
+
+  return conn_on_tx_buffered_released(conn, buffered);
+}
+
+/*
+ * nva_lowercase returns nonzero if the name of every header field in
+ * |nva| of length |nvlen| which nghttp3_nva_copy would downcase is
+ * already in lowercase.
+ */
+static int nva_lowercase(const nghttp3_nv *nva, size_t nvlen) {
+  size_t i, j;
+
+  for (i = 0; i < nvlen; ++i) {
+    if (nva[i].flags & NGHTTP3_NV_FLAG_NO_COPY_NAME) {
+      continue;
+    }
+    for (j = 0; j < nva[i].namelen; ++j) {
+      if ('A' <= nva[i].name[j] && nva[i].name[j] <= 'Z') {
+        return 0;
+      }
+    }
+  }
+
+  return 1;
+}
+
+/*
+ * conn_data_reader_valid returns nonzero if |dr| specifies exactly
+ * one of read_data, read_data_vec, and file.
+ */
+static int conn_data_reader_valid(const nghttp3_data_reader *dr) {
+  int nsrc = (dr->read_data != NULL) + (dr->read_data_vec != NULL) +
+             (dr->file.len != 0);
+
+  return nsrc == 1;
 }
 
 static int conn_submit_headers_data(nghttp3_conn *conn, nghttp3_stream *stream,
@@ -1960,19 +2727,44 @@ static int conn_submit_headers_data(nghttp3_conn *conn, nghttp3_stream *stream,
   nghttp3_nv *nnva;
   nghttp3_frame_entry frent;
 
-  rv = nghttp3_nva_copy(&nnva, nva, nvlen, conn->mem);
-  if (rv != 0) {
-    return rv;
+  if (dr && !conn_data_reader_valid(dr)) {
+    return NGHTTP3_ERR_INVALID_ARGUMENT;
   }
 
-  frent.fr.hd.type = NGHTTP3_FRAME_HEADERS;
-  frent.fr.headers.nva = nnva;
-  frent.fr.headers.nvlen = nvlen;
+  if (dr && dr->file.len) {
+    rv = nghttp3_stream_map_file(stream, &dr->file);
+    if (rv != 0) {
+      return rv;
+    }
+  }
 
-  rv = nghttp3_stream_frq_add(stream, &frent);
-  if (rv != 0) {
-    nghttp3_nva_del(nnva, conn->mem);
-    return rv;
+  if (conn->local.settings.eager_encode &&
+      nghttp3_ringbuf_len(&stream->frq) == 0 && nva_lowercase(nva, nvlen)) {
+    /* Nothing precedes HEADERS frame.  Encode it now from nva
+       directly so that it does not have to be copied. */
+    frent.fr.hd.type = NGHTTP3_FRAME_HEADERS;
+    frent.fr.headers.nva = (nghttp3_nv *)nva;
+    frent.fr.headers.nvlen = nvlen;
+
+    rv = nghttp3_stream_write_headers(stream, &frent);
+    if (rv != 0) {
+      return rv;
+    }
+  } else {
+    rv = nghttp3_nva_copy(&nnva, nva, nvlen, conn->mem);
+    if (rv != 0) {
+      return rv;
+    }
+
+    frent.fr.hd.type = NGHTTP3_FRAME_HEADERS;
+    frent.fr.headers.nva = nnva;
+    frent.fr.headers.nvlen = nvlen;
+
+    rv = nghttp3_stream_frq_add(stream, &frent);
+    if (rv != 0) {
+      nghttp3_nva_del(nnva, conn->mem);
+      return rv;
+    }
   }
 
   if (dr) {
@@ -1989,6 +2781,8 @@ static int conn_submit_headers_data(nghttp3_conn *conn, nghttp3_stream *stream,
     return nghttp3_stream_schedule(stream);
   }
 
+  conn_tx_budget_wait(stream);
+
   return 0;
 }
 
@@ -2035,6 +2829,11 @@ int nghttp3_conn_submit_request(nghttp3_conn *conn, int64_t stream_id,
     }
   }
 
+  /* Check data reader before stream is created. */
+  if (dr && !conn_data_reader_valid(dr)) {
+    return NGHTTP3_ERR_INVALID_ARGUMENT;
+  }
+
   stream = nghttp3_conn_find_stream(conn, stream_id);
   if (stream != NULL) {
     return NGHTTP3_ERR_INVALID_ARGUMENT;
@@ -2128,6 +2927,11 @@ int nghttp3_conn_block_stream(nghttp3_conn *conn, int64_t stream_id) {
 
   stream->flags |= NGHTTP3_STREAM_FLAG_FC_BLOCKED;
 
+  if (conn->callbacks.trace) {
+    nghttp3_conn_trace_blocked(conn, NGHTTP3_TRACE_EVENT_STREAM_BLOCKED,
+                               stream_id, NGHTTP3_TRACE_BLOCKED_FLOW_CONTROL);
+  }
+
   nghttp3_stream_unschedule(stream);
 
   return 0;
@@ -2140,12 +2944,20 @@ int nghttp3_conn_unblock_stream(nghttp3_conn *conn, int64_t stream_id) {
     return NGHTTP3_ERR_INVALID_ARGUMENT;
   }
 
+  if (conn->callbacks.trace &&
+      (stream->flags & NGHTTP3_STREAM_FLAG_FC_BLOCKED)) {
+    nghttp3_conn_trace_blocked(conn, NGHTTP3_TRACE_EVENT_STREAM_UNBLOCKED,
+                               stream_id, NGHTTP3_TRACE_BLOCKED_FLOW_CONTROL);
+  }
+
   stream->flags &= (uint16_t)~NGHTTP3_STREAM_FLAG_FC_BLOCKED;
 
   if (nghttp3_stream_require_schedule(stream)) {
     return nghttp3_stream_ensure_scheduled(stream);
   }
 
+  conn_tx_budget_wait(stream);
+
   return 0;
 }
 
@@ -2156,17 +2968,26 @@ int nghttp3_conn_resume_stream(nghttp3_conn *conn, int64_t stream_id) {
     return NGHTTP3_ERR_INVALID_ARGUMENT;
   }
 
+  if (conn->callbacks.trace &&
+      (stream->flags & NGHTTP3_STREAM_FLAG_READ_DATA_BLOCKED)) {
+    nghttp3_conn_trace_blocked(conn, NGHTTP3_TRACE_EVENT_STREAM_UNBLOCKED,
+                               stream_id, NGHTTP3_TRACE_BLOCKED_READ_DATA);
+  }
+
   stream->flags &= (uint16_t)~NGHTTP3_STREAM_FLAG_READ_DATA_BLOCKED;
 
   if (nghttp3_stream_require_schedule(stream)) {
     return nghttp3_stream_ensure_scheduled(stream);
   }
 
+  conn_tx_budget_wait(stream);
+
   return 0;
 }
 
 int nghttp3_conn_close_stream(nghttp3_conn *conn, int64_t stream_id) {
   nghttp3_stream *stream = nghttp3_conn_find_stream(conn, stream_id);
+  uint64_t buffered = conn->tx.buffered;
   int rv;
 
   if (stream == NULL) {
@@ -2187,6 +3008,8 @@ int nghttp3_conn_close_stream(nghttp3_conn *conn, int64_t stream_id) {
     }
   }
 
+  nghttp3_urgq_unschedule(&conn->urgq, &stream->urge);
+
   rv = nghttp3_tnode_squash(&stream->node);
   if (rv != 0) {
     return rv;
@@ -2198,13 +3021,18 @@ int nghttp3_conn_close_stream(nghttp3_conn *conn, int64_t stream_id) {
 
   nghttp3_stream_del(stream);
 
-  return 0;
+  return conn_on_tx_buffered_released(conn, buffered);
 }
 
 int nghttp3_conn_reset_stream(nghttp3_conn *conn, int64_t stream_id) {
   return nghttp3_qpack_decoder_cancel_stream(&conn->qdec, stream_id);
 }
 
+void nghttp3_conn_set_qpack_intern(nghttp3_conn *conn,
+                                   nghttp3_qpack_intern *intern) {
+  nghttp3_qpack_decoder_set_intern(&conn->qdec, intern);
+}
+
 int nghttp3_conn_qpack_blocked_streams_push(nghttp3_conn *conn,
                                             nghttp3_stream *stream) {
   assert(stream->qpack_blocked_pe.index == NGHTTP3_PQ_BAD_INDEX);
@@ -2281,6 +3109,19 @@ int nghttp3_conn_submit_priority(nghttp3_conn *conn, nghttp3_pri_elem_type pt,
   return nghttp3_stream_frq_add(conn->tx.ctrl, &frent);
 }
 
+int nghttp3_conn_set_stream_urgency(nghttp3_conn *conn, int64_t stream_id,
+                                    uint32_t urgency, int inc) {
+  nghttp3_stream *stream = nghttp3_conn_find_stream(conn, stream_id);
+
+  if (stream == NULL || urgency >= NGHTTP3_URGENCY_LEVELS) {
+    return NGHTTP3_ERR_INVALID_ARGUMENT;
+  }
+
+  nghttp3_urgq_set_priority(&conn->urgq, &stream->urge, (uint8_t)urgency, inc);
+
+  return 0;
+}
+
 int nghttp3_conn_end_stream(nghttp3_conn *conn, int64_t stream_id) {
   nghttp3_stream *stream;
 
@@ -2334,33 +3175,26 @@ uint64_t nghttp3_conn_get_remote_num_placeholders(nghttp3_conn *conn) {
 void nghttp3_conn_settings_default(nghttp3_conn_settings *settings) {
   memset(settings, 0, sizeof(nghttp3_conn_settings));
   settings->max_header_list_size = NGHTTP3_VARINT_MAX;
+  settings->max_tx_buffered = NGHTTP3_DEFAULT_MAX_TX_BUFFERED;
+  settings->tx_high_watermark = NGHTTP3_DEFAULT_TX_HIGH_WATERMARK;
+  settings->tx_low_watermark = NGHTTP3_DEFAULT_TX_LOW_WATERMARK;
 }
 
-int nghttp3_placeholder_new(nghttp3_placeholder **pph, int64_t ph_id,
-                            uint64_t seq, uint32_t weight,
-                            nghttp3_tnode *parent, const nghttp3_mem *mem) {
-  nghttp3_placeholder *ph;
+void nghttp3_phantom_init(nghttp3_phantom *ph, int64_t stream_id,
+                          uint64_t seq, uint32_t weight, nghttp3_tnode *parent,
+                          const nghttp3_mem *mem) {
   nghttp3_node_id nid;
 
-  ph = nghttp3_mem_calloc(mem, 1, sizeof(nghttp3_placeholder));
-  if (ph == NULL) {
-    return NGHTTP3_ERR_NOMEM;
-  }
-
   nghttp3_tnode_init(
       &ph->node,
-      nghttp3_node_id_init(&nid, NGHTTP3_NODE_ID_TYPE_PLACEHOLDER, ph_id), seq,
+      nghttp3_node_id_init(&nid, NGHTTP3_NODE_ID_TYPE_STREAM, stream_id), seq,
       weight, parent, mem);
 
-  ph->me.key = (key_type)ph_id;
-
-  *pph = ph;
-
-  return 0;
+  ph->u.me.key = (key_type)stream_id;
 }
 
-void nghttp3_placeholder_del(nghttp3_placeholder *ph, const nghttp3_mem *mem) {
-  nghttp3_mem_free(mem, ph);
+void nghttp3_phantom_free(nghttp3_phantom *ph) {
+  nghttp3_tnode_free(&ph->node);
 }
 
 nghttp3_priority *nghttp3_priority_init(nghttp3_priority *pri,
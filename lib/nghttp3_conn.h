@@ -35,7 +35,9 @@
 #include "nghttp3_map.h"
 #include "nghttp3_qpack.h"
 #include "nghttp3_tnode.h"
+#include "nghttp3_urgq.h"
 #include "nghttp3_idtr.h"
+#include "nghttp3_arena.h"
 
 #define NGHTTP3_VARINT_MAX ((1ull << 62) - 1)
 
@@ -43,11 +45,67 @@
    table size for QPACK encoder. */
 #define NGHTTP3_QPACK_ENCODER_MAX_TABLE_CAPACITY 16384
 
+/* NGHTTP3_DEFAULT_TX_HIGH_WATERMARK is the default number of unsent
+   bytes in a stream outq above which no more data is pulled from an
+   application. */
+#define NGHTTP3_DEFAULT_TX_HIGH_WATERMARK (64 * 1024)
+
+/* NGHTTP3_DEFAULT_TX_LOW_WATERMARK is the default number of unsent
+   bytes in a stream outq below which data is pulled from an
+   application again. */
+#define NGHTTP3_DEFAULT_TX_LOW_WATERMARK (16 * 1024)
+
+/* NGHTTP3_DEFAULT_MAX_TX_BUFFERED is the default maximum number of
+   bytes buffered in outq of all request streams until they are
+   acknowledged. */
+#define NGHTTP3_DEFAULT_MAX_TX_BUFFERED (1024 * 1024)
+
+/*
+ * nghttp3_placeholder is a placeholder in the priority tree.
+ * Placeholders are stored in the array of local.settings.
+ * num_placeholders elements, and indexed by placeholder ID.  A
+ * placeholder has not been created yet if node.parent is NULL.
+ */
 typedef struct {
-  nghttp3_map_entry me;
   nghttp3_tnode node;
 } nghttp3_placeholder;
 
+/* NGHTTP3_PHANTOM_BLOCKLEN is the number of phantoms which
+   nghttp3_phantom_block holds. */
+#define NGHTTP3_PHANTOM_BLOCKLEN 16
+
+struct nghttp3_phantom;
+typedef struct nghttp3_phantom nghttp3_phantom;
+
+/*
+ * nghttp3_phantom is a node in the priority tree for a client stream
+ * which is referenced by PRIORITY frame, but has not been opened yet.
+ * It is much smaller than nghttp3_stream, and it is replaced with the
+ * stream when the stream is opened.
+ */
+struct nghttp3_phantom {
+  union {
+    nghttp3_map_entry me;
+    /* next_free points to the next unused phantom while this phantom
+       is in conn->phantom_freelist. */
+    nghttp3_phantom *next_free;
+  } u;
+  nghttp3_tnode node;
+};
+
+struct nghttp3_phantom_block;
+typedef struct nghttp3_phantom_block nghttp3_phantom_block;
+
+/*
+ * nghttp3_phantom_block is a chunk of phantoms.  Phantoms are carved
+ * from blocks instead of being allocated one by one, and the blocks
+ * are kept until the connection is deleted.
+ */
+struct nghttp3_phantom_block {
+  nghttp3_phantom_block *next;
+  nghttp3_phantom phantoms[NGHTTP3_PHANTOM_BLOCKLEN];
+};
+
 typedef enum {
   NGHTTP3_CONN_FLAG_NONE = 0x0000,
   NGHTTP3_CONN_FLAG_SETTINGS_RECVED = 0x0001,
@@ -58,13 +116,45 @@ typedef enum {
 
 struct nghttp3_conn {
   nghttp3_tnode root;
+  /* urgq schedules streams if local.settings.scheduler is
+     NGHTTP3_SCHEDULER_URGENCY. */
+  nghttp3_urgq urgq;
   nghttp3_conn_callbacks callbacks;
   nghttp3_map streams;
-  nghttp3_map placeholders;
+  /* placeholders is an array of local.settings.num_placeholders
+     elements.  It is allocated only for server. */
+  nghttp3_placeholder *placeholders;
+  /* phantoms contains nghttp3_phantom keyed by stream ID.  The
+     stream IDs of phantoms are opened in remote.bidi.idtr. */
+  nghttp3_map phantoms;
+  /* phantom_blocks is the list of blocks which phantoms are carved
+     from. */
+  nghttp3_phantom_block *phantom_blocks;
+  /* phantom_freelist is the list of unused phantoms in
+     phantom_blocks. */
+  nghttp3_phantom *phantom_freelist;
   nghttp3_qpack_decoder qdec;
   nghttp3_qpack_encoder qenc;
+  /* qpack_warm is a copy of the header fields given by
+     nghttp3_conn_set_qpack_warm_profile.  They are inserted into
+     dynamic table of qenc once its capacity is known and the encoder
+     stream is bound, and the copy is freed then. */
+  struct {
+    nghttp3_nv *nva;
+    size_t nvlen;
+  } qpack_warm;
   nghttp3_pq qpack_blocked_streams;
+  /* stats holds the counters of nghttp3_conn_stats which are
+     maintained as the connection runs.  The other fields are filled
+     by nghttp3_conn_get_stats. */
+  nghttp3_conn_stats stats;
+  /* mem is the allocator for everything but this object.  It points
+     to arena.mem if local.settings.arena is nonzero. */
   const nghttp3_mem *mem;
+  /* arena is the region allocator which is used if
+     local.settings.arena is nonzero.  arena.parent is the allocator
+     which allocated this object. */
+  nghttp3_arena arena;
   void *user_data;
   int server;
   uint16_t flags;
@@ -85,6 +175,12 @@ struct nghttp3_conn {
     nghttp3_stream *ctrl;
     nghttp3_stream *qenc;
     nghttp3_stream *qdec;
+    /* buffered is the number of bytes buffered in outq of request
+       streams which have not been acknowledged yet. */
+    uint64_t buffered;
+    /* budget_waitq is the list of request streams which have data to
+       pull, but wait for buffered to go below max_tx_buffered. */
+    nghttp3_stream *budget_waitq;
   } tx;
 
   struct {
@@ -100,6 +196,9 @@ nghttp3_stream *nghttp3_conn_find_stream(nghttp3_conn *conn, int64_t stream_id);
 nghttp3_placeholder *nghttp3_conn_find_placeholder(nghttp3_conn *conn,
                                                    int64_t ph_id);
 
+nghttp3_phantom *nghttp3_conn_find_phantom(nghttp3_conn *conn,
+                                           int64_t stream_id);
+
 int nghttp3_conn_create_stream(nghttp3_conn *conn, nghttp3_stream **pstream,
                                int64_t stream_id);
 
@@ -108,9 +207,30 @@ int nghttp3_conn_create_stream_dependency(nghttp3_conn *conn,
                                           int64_t stream_id, uint32_t weight,
                                           nghttp3_tnode *parent);
 
-int nghttp3_conn_create_placeholder(nghttp3_conn *conn,
-                                    nghttp3_placeholder **pph, int64_t ph_id,
-                                    uint32_t weight, nghttp3_tnode *parent);
+/*
+ * nghttp3_conn_create_placeholder creates placeholder |ph_id| under
+ * |parent|, and returns it.  |ph_id| must be less than
+ * local.settings.num_placeholders, and the placeholder must not have
+ * been created yet.
+ */
+nghttp3_placeholder *nghttp3_conn_create_placeholder(nghttp3_conn *conn,
+                                                     int64_t ph_id,
+                                                     uint32_t weight,
+                                                     nghttp3_tnode *parent);
+
+/*
+ * nghttp3_conn_create_phantom creates phantom for |stream_id| under
+ * |parent|, and opens |stream_id| in remote.bidi.idtr.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGHTTP3_ERR_NOMEM
+ *     Out of memory.
+ */
+int nghttp3_conn_create_phantom(nghttp3_conn *conn, nghttp3_phantom **pph,
+                                int64_t stream_id, uint32_t weight,
+                                nghttp3_tnode *parent);
 
 ssize_t nghttp3_conn_read_bidi(nghttp3_conn *conn, nghttp3_stream *stream,
                                const uint8_t *src, size_t srclen, int fin);
@@ -150,16 +270,44 @@ int nghttp3_conn_qpack_blocked_streams_push(nghttp3_conn *conn,
 
 void nghttp3_conn_qpack_blocked_streams_pop(nghttp3_conn *conn);
 
+/*
+ * nghttp3_conn_get_timestamp returns the current time obtained from
+ * get_timestamp callback.  The caller must check that
+ * conn->callbacks.get_timestamp is not NULL.
+ */
+uint64_t nghttp3_conn_get_timestamp(nghttp3_conn *conn);
+
+/*
+ * nghttp3_conn_trace_frame emits trace event |type| for a frame
+ * whose header is |hd| on a stream |stream_id|.  The caller must
+ * check that conn->callbacks.trace is not NULL.
+ */
+void nghttp3_conn_trace_frame(nghttp3_conn *conn,
+                              nghttp3_trace_event_type type,
+                              int64_t stream_id, const nghttp3_frame_hd *hd);
+
+/*
+ * nghttp3_conn_trace_blocked emits trace event |type|, which is
+ * either NGHTTP3_TRACE_EVENT_STREAM_BLOCKED or
+ * NGHTTP3_TRACE_EVENT_STREAM_UNBLOCKED, for a stream |stream_id|
+ * because of |reason|.  The caller must check that
+ * conn->callbacks.trace is not NULL.
+ */
+void nghttp3_conn_trace_blocked(nghttp3_conn *conn,
+                                nghttp3_trace_event_type type,
+                                int64_t stream_id,
+                                nghttp3_trace_blocked_reason reason);
+
 /*
  * nghttp3_conn_get_next_tx_stream returns next stream to send.  It
  * returns NULL if there is no such stream.
  */
 nghttp3_stream *nghttp3_conn_get_next_tx_stream(nghttp3_conn *conn);
 
-int nghttp3_placeholder_new(nghttp3_placeholder **pph, int64_t ph_id,
-                            uint64_t seq, uint32_t weight,
-                            nghttp3_tnode *parent, const nghttp3_mem *mem);
+void nghttp3_phantom_init(nghttp3_phantom *ph, int64_t stream_id,
+                          uint64_t seq, uint32_t weight, nghttp3_tnode *parent,
+                          const nghttp3_mem *mem);
 
-void nghttp3_placeholder_del(nghttp3_placeholder *ph, const nghttp3_mem *mem);
+void nghttp3_phantom_free(nghttp3_phantom *ph);
 
 #endif /* NGHTTP3_CONN_H */
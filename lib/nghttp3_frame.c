@@ -51,6 +51,16 @@ size_t nghttp3_frame_write_hd_len(const nghttp3_frame_hd *hd) {
   return nghttp3_put_varint_len(hd->type) + nghttp3_put_varint_len(hd->length);
 }
 
+void nghttp3_frame_stats_add(nghttp3_frame_stats *fst,
+                             const nghttp3_frame_hd *hd) {
+  size_t idx = hd->type < NGHTTP3_STATS_FRAME_OTHER
+                   ? (size_t)hd->type
+                   : NGHTTP3_STATS_FRAME_OTHER;
+
+  ++fst->frames[idx];
+  fst->bytes[idx] += nghttp3_frame_write_hd_len(hd) + (uint64_t)hd->length;
+}
+
 int nghttp3_frame_write_settings(nghttp3_buf *dest,
                                  const nghttp3_frame_settings *fr) {
   size_t len = nghttp3_put_varint_len(NGHTTP3_FRAME_SETTINGS) +
@@ -51,6 +51,13 @@ int nghttp3_frame_write_hd(nghttp3_buf *dest, const nghttp3_frame_hd *hd);
  */
 size_t nghttp3_frame_write_hd_len(const nghttp3_frame_hd *hd);
 
+/*
+ * nghttp3_frame_stats_add counts a frame whose header is |hd| in
+ * |fst|.  hd->length must be set.
+ */
+void nghttp3_frame_stats_add(nghttp3_frame_stats *fst,
+                             const nghttp3_frame_hd *hd);
+
 /*
  * nghttp3_frame_write_settings writes SETTINGS frame |fr| to |dest|.
  *
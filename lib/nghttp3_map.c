@@ -28,19 +28,13 @@
 
 #include <string.h>
 
-#include "nghttp3_conv.h"
-
-#define INITIAL_TABLE_LENGTH 256
+#define INITIAL_TABLE_LENBITS 4
 
 int nghttp3_map_init(nghttp3_map *map, const nghttp3_mem *mem) {
   map->mem = mem;
-  map->tablelen = INITIAL_TABLE_LENGTH;
-  map->table =
-      nghttp3_mem_calloc(mem, map->tablelen, sizeof(nghttp3_map_entry *));
-  if (map->table == NULL) {
-    return NGHTTP3_ERR_NOMEM;
-  }
-
+  map->table = NULL;
+  map->tablelen = 0;
+  map->tablelenbits = 0;
   map->size = 0;
 
   return 0;
@@ -54,15 +48,15 @@ void nghttp3_map_each_free(nghttp3_map *map,
                            int (*func)(nghttp3_map_entry *entry, void *ptr),
                            void *ptr) {
   uint32_t i;
+
   for (i = 0; i < map->tablelen; ++i) {
-    nghttp3_map_entry *entry;
-    for (entry = map->table[i]; entry;) {
-      nghttp3_map_entry *next = entry->next;
-      func(entry, ptr);
-      entry = next;
+    if (map->table[i]) {
+      func(map->table[i], ptr);
+      map->table[i] = NULL;
     }
-    map->table[i] = NULL;
   }
+
+  map->size = 0;
 }
 
 int nghttp3_map_each(nghttp3_map *map,
@@ -70,84 +64,69 @@ int nghttp3_map_each(nghttp3_map *map,
                      void *ptr) {
   int rv;
   uint32_t i;
+
   for (i = 0; i < map->tablelen; ++i) {
-    nghttp3_map_entry *entry, *next;
-    for (entry = map->table[i]; entry;) {
-      next = entry->next;
-      rv = func(entry, ptr);
+    if (map->table[i]) {
+      rv = func(map->table[i], ptr);
       if (rv != 0) {
         return rv;
       }
-      entry = next;
     }
   }
+
   return 0;
 }
 
 void nghttp3_map_entry_init(nghttp3_map_entry *entry, key_type key) {
   entry->key = key;
-  entry->next = NULL;
 }
 
-/* FNV1a hash */
-static uint32_t hash(key_type key, uint32_t mod) {
-  uint8_t *p, *end;
-  uint32_t h = 0x811C9DC5u;
-
-  key = bswap64(key);
-  p = (uint8_t *)&key;
-  end = p + sizeof(key_type);
-
-  for (; p != end; ++p) {
-    h ^= *p;
-    h *= 0x01000193u;
-  }
-
-  return h & (mod - 1);
+/* Fibonacci hashing */
+static uint32_t hash(key_type key, uint32_t bits) {
+  return (uint32_t)((key * 11400714819323198485llu) >> (64 - bits));
 }
 
-static int insert(nghttp3_map_entry **table, uint32_t tablelen,
+/*
+ * insert inserts |entry| to |table| of length 1 << |bits|.  The
+ * |table| must have an empty slot.
+ */
+static int insert(nghttp3_map_entry **table, uint32_t bits,
                   nghttp3_map_entry *entry) {
-  uint32_t h = hash(entry->key, tablelen);
-  if (table[h] == NULL) {
-    table[h] = entry;
-  } else {
-    nghttp3_map_entry *p;
+  uint32_t mask = (1u << bits) - 1;
+  uint32_t i;
+
+  for (i = hash(entry->key, bits); table[i]; i = (i + 1) & mask) {
     /* We won't allow duplicated key, so check it out. */
-    for (p = table[h]; p; p = p->next) {
-      if (p->key == entry->key) {
-        return NGHTTP3_ERR_INVALID_ARGUMENT;
-      }
+    if (table[i]->key == entry->key) {
+      return NGHTTP3_ERR_INVALID_ARGUMENT;
     }
-    entry->next = table[h];
-    table[h] = entry;
   }
+
+  table[i] = entry;
+
   return 0;
 }
 
-/* new_tablelen must be power of 2 */
-static int resize(nghttp3_map *map, uint32_t new_tablelen) {
+static int resize(nghttp3_map *map, uint32_t new_tablelenbits) {
   uint32_t i;
   nghttp3_map_entry **new_table;
 
-  new_table =
-      nghttp3_mem_calloc(map->mem, new_tablelen, sizeof(nghttp3_map_entry *));
+  new_table = nghttp3_mem_calloc(map->mem, (size_t)1 << new_tablelenbits,
+                                 sizeof(nghttp3_map_entry *));
   if (new_table == NULL) {
     return NGHTTP3_ERR_NOMEM;
   }
 
   for (i = 0; i < map->tablelen; ++i) {
-    nghttp3_map_entry *entry;
-    for (entry = map->table[i]; entry;) {
-      nghttp3_map_entry *next = entry->next;
-      entry->next = NULL;
+    if (map->table[i]) {
       /* This function must succeed */
-      insert(new_table, new_tablelen, entry);
-      entry = next;
+      insert(new_table, new_tablelenbits, map->table[i]);
     }
   }
+
   nghttp3_mem_free(map->mem, map->table);
-  map->tablelen = new_tablelen;
+  map->tablelen = 1u << new_tablelenbits;
+  map->tablelenbits = new_tablelenbits;
   map->table = new_table;
 
   return 0;
@@ -155,56 +134,94 @@ static int resize(nghttp3_map *map, uint32_t new_tablelen) {
 
 int nghttp3_map_insert(nghttp3_map *map, nghttp3_map_entry *new_entry) {
   int rv;
+
   /* Load factor is 0.75 */
-  if ((map->size + 1) * 4 > map->tablelen * 3) {
-    rv = resize(map, map->tablelen * 2);
+  if ((map->size + 1) * 4 > (size_t)map->tablelen * 3) {
+    rv = resize(map, map->tablelen ? map->tablelenbits + 1
+                                   : INITIAL_TABLE_LENBITS);
     if (rv != 0) {
       return rv;
     }
   }
-  rv = insert(map->table, map->tablelen, new_entry);
+
+  rv = insert(map->table, map->tablelenbits, new_entry);
   if (rv != 0) {
     return rv;
   }
+
   ++map->size;
+
   return 0;
 }
 
-nghttp3_map_entry *nghttp3_map_find(nghttp3_map *map, key_type key) {
-  uint32_t h;
-  nghttp3_map_entry *entry;
-  h = hash(key, map->tablelen);
-  for (entry = map->table[h]; entry; entry = entry->next) {
-    if (entry->key == key) {
-      return entry;
+/*
+ * find_slot returns the index of the slot which contains the entry
+ * associated by |key|, or map->tablelen if there is no such entry.
+ */
+static uint32_t find_slot(nghttp3_map *map, key_type key) {
+  uint32_t mask = map->tablelen - 1;
+  uint32_t i;
+
+  if (map->size == 0) {
+    return map->tablelen;
+  }
+
+  for (i = hash(key, map->tablelenbits); map->table[i]; i = (i + 1) & mask) {
+    if (map->table[i]->key == key) {
+      return i;
     }
   }
-  return NULL;
+
+  return map->tablelen;
+}
+
+nghttp3_map_entry *nghttp3_map_find(nghttp3_map *map, key_type key) {
+  uint32_t i = find_slot(map, key);
+
+  if (i == map->tablelen) {
+    return NULL;
+  }
+
+  return map->table[i];
 }
 
 int nghttp3_map_remove(nghttp3_map *map, key_type key) {
-  uint32_t h;
-  nghttp3_map_entry **dst;
+  uint32_t mask = map->tablelen - 1;
+  uint32_t i, j, h;
 
-  h = hash(key, map->tablelen);
+  i = find_slot(map, key);
+  if (i == map->tablelen) {
+    return NGHTTP3_ERR_INVALID_ARGUMENT;
+  }
 
-  for (dst = &map->table[h]; *dst; dst = &(*dst)->next) {
-    if ((*dst)->key != key) {
-      continue;
+  /* Shift the following entries backward instead of leaving a
+     tombstone, so that no probe sequence is broken. */
+  for (j = (i + 1) & mask; map->table[j]; j = (j + 1) & mask) {
+    h = hash(map->table[j]->key, map->tablelenbits);
+    /* The entry at j can move to i only if its home slot h is not
+       cyclically in (i, j]. */
+    if (((j - h) & mask) >= ((j - i) & mask)) {
+      map->table[i] = map->table[j];
+      i = j;
     }
+  }
+
+  map->table[i] = NULL;
+  --map->size;
 
-    *dst = (*dst)->next;
-    --map->size;
-    return 0;
+  /* Shrink the table if it is less than 1/8 full.  If memory
+     allocation fails, just keep the current table. */
+  if (map->tablelenbits > INITIAL_TABLE_LENBITS &&
+      map->size * 8 < map->tablelen) {
+    resize(map, map->tablelenbits - 1);
   }
-  return NGHTTP3_ERR_INVALID_ARGUMENT;
+
+  return 0;
 }
 
 void nghttp3_map_clear(nghttp3_map *map) {
-  uint32_t i;
-
-  for (i = 0; i < map->tablelen; ++i) {
-    map->table[i] = NULL;
+  if (map->table) {
+    memset(map->table, 0, sizeof(nghttp3_map_entry *) * map->tablelen);
   }
 
   map->size = 0;
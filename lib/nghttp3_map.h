@@ -35,12 +35,13 @@
 
 #include "nghttp3_mem.h"
 
-/* Implementation of unordered map */
+/* Implementation of unordered map.  It is an open addressing hash
+   table with linear probing.  The table is allocated on the first
+   insertion, and shrunk when most of the entries are removed. */
 
 typedef uint64_t key_type;
 
 typedef struct nghttp3_map_entry {
-  struct nghttp3_map_entry *next;
   key_type key;
 } nghttp3_map_entry;
 
@@ -49,16 +50,13 @@ typedef struct {
   const nghttp3_mem *mem;
   size_t size;
   uint32_t tablelen;
+  /* tablelenbits is log2(tablelen) if tablelen is not 0. */
+  uint32_t tablelenbits;
 } nghttp3_map;
 
 /*
- * Initializes the map |map|.
- *
- * This function returns 0 if it succeeds, or one of the following
- * negative error codes:
- *
- * NGHTTP3_ERR_NOMEM
- *   Out of memory
+ * Initializes the map |map|.  This function does not allocate any
+ * memory, and always succeeds.
  */
 int nghttp3_map_init(nghttp3_map *map, const nghttp3_mem *mem);
 
@@ -74,6 +72,7 @@ void nghttp3_map_free(nghttp3_map *map);
  * allocated for |map|. The |func| function is responsible for freeing
  * given the |entry| object. The |ptr| will be passed to the |func| as
  * send argument. The return value of the |func| will be ignored.
+ * |map| becomes empty after this call.
  */
 void nghttp3_map_each_free(nghttp3_map *map,
                            int (*func)(nghttp3_map_entry *entry, void *ptr),
@@ -106,7 +105,8 @@ nghttp3_map_entry *nghttp3_map_find(nghttp3_map *map, key_type key);
 
 /*
  * Removes the entry associated by the key |key| from the |map|.  The
- * removed entry is not freed by this function.
+ * removed entry is not freed by this function.  The table might be
+ * shrunk if the number of entries gets small.
  *
  * This function returns 0 if it succeeds, or one of the following
  * negative error codes:
@@ -138,7 +138,8 @@ size_t nghttp3_map_size(nghttp3_map *map);
  * invocation of |func| returns.
  *
  * Don't use this function to free each entry. Use
- * nghttp3_map_each_free() instead.
+ * nghttp3_map_each_free() instead.  The |func| must not insert or
+ * remove an entry.
  */
 int nghttp3_map_each(nghttp3_map *map,
                      int (*func)(nghttp3_map_entry *entry, void *ptr),
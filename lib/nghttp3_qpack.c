@@ -32,6 +32,7 @@
 #include "nghttp3_str.h"
 #include "nghttp3_macro.h"
 #include "nghttp3_debug.h"
+#include "nghttp3_conv.h"
 
 /* Make scalar initialization form of nghttp3_qpack_static_entry */
 #define MAKE_STATIC_ENT(N, V, I, T, H)                                         \
@@ -865,6 +866,25 @@ static void encoder_qpack_map_find(nghttp3_qpack_encoder *encoder,
   }
 }
 
+/*
+ * qpack_context_trace_entry emits trace event |type| for |ent|.  The
+ * caller must check that ctx->trace is not NULL.
+ */
+static void qpack_context_trace_entry(nghttp3_qpack_context *ctx,
+                                      nghttp3_trace_event_type type,
+                                      const nghttp3_qpack_entry *ent) {
+  nghttp3_trace_event ev;
+
+  ev.type = type;
+  ev.stream_id = -1;
+  ev.u.qpack_entry.encoder = ctx->encoder;
+  ev.u.qpack_entry.absidx = ent->absidx;
+  ev.u.qpack_entry.size = table_space(ent->nv.name->len, ent->nv.value->len);
+  ev.u.qpack_entry.dtable_size = ctx->dtable_size;
+
+  ctx->trace(&ev, ctx->trace_user_data);
+}
+
 /*
  * qpack_context_init initializes |ctx|.  |max_dtable_size| is the
  * maximum size of dynamic table.  |mem| is a memory allocator.
@@ -898,6 +918,11 @@ static int qpack_context_init(nghttp3_qpack_context *ctx,
   ctx->max_blocked = max_blocked;
   ctx->next_absidx = 0;
   ctx->bad = 0;
+  ctx->ninserts = 0;
+  ctx->nevictions = 0;
+  ctx->encoder = 0;
+  ctx->trace = NULL;
+  ctx->trace_user_data = NULL;
 
   return 0;
 }
@@ -931,7 +956,7 @@ static int max_cnt_greater(const nghttp3_ksl_key *lhs,
 }
 
 static nghttp3_qpack_stream inf_stream = {
-    {NGHTTP3_PQ_BAD_INDEX}, {NULL, UINT64_MAX}, {0}, 0, 0,
+    {NGHTTP3_PQ_BAD_INDEX}, {UINT64_MAX}, {0}, 0, 0,
 };
 
 int nghttp3_qpack_encoder_init(nghttp3_qpack_encoder *encoder,
@@ -945,6 +970,8 @@ int nghttp3_qpack_encoder_init(nghttp3_qpack_encoder *encoder,
     return rv;
   }
 
+  encoder->ctx.encoder = 1;
+
   rv = nghttp3_map_init(&encoder->stream_refs, mem);
   if (rv != 0) {
     goto stream_refs_init_fail;
@@ -960,6 +987,10 @@ int nghttp3_qpack_encoder_init(nghttp3_qpack_encoder *encoder,
   nghttp3_pq_init(&encoder->refsq, ref_less, mem);
 
   encoder->krcnt = 0;
+  encoder->nfields = 0;
+  encoder->nstatic_hits = 0;
+  encoder->ndynamic_hits = 0;
+  encoder->nname_hits = 0;
   encoder->state = NGHTTP3_QPACK_DS_STATE_OPCODE;
   encoder->opcode = 0;
   encoder->min_dtable_update = encoder->last_max_dtable_update =
@@ -1076,6 +1107,12 @@ void nghttp3_qpack_encoder_shrink_dtable(nghttp3_qpack_encoder *encoder) {
 
     encoder->ctx.dtable_size -=
         table_space(ent->nv.name->len, ent->nv.value->len);
+    ++encoder->ctx.nevictions;
+
+    if (encoder->ctx.trace) {
+      qpack_context_trace_entry(&encoder->ctx, NGHTTP3_TRACE_EVENT_QPACK_EVICT,
+                                ent);
+    }
 
     nghttp3_ringbuf_pop_back(dtable);
     qpack_map_remove(&encoder->dtable_map, ent);
@@ -1195,6 +1232,82 @@ static int reserve_buf(nghttp3_buf *buf, size_t extra_size,
   return nghttp3_buf_reserve(buf, n, mem);
 }
 
+/*
+ * qpack_nv_is_cookie returns nonzero if the name of |nv| is
+ * "cookie".
+ */
+static int qpack_nv_is_cookie(const nghttp3_nv *nv) {
+  return nv->namelen == sizeof("cookie") - 1 &&
+         memcmp(nv->name, "cookie", sizeof("cookie") - 1) == 0;
+}
+
+/*
+ * qpack_encoder_encode_cookie encodes cookie header field |nv|.  The
+ * value is split into crumbs at ';' as permitted by HTTP/3, and each
+ * crumb is encoded as a separate cookie header field so that the
+ * crumbs which do not change are indexed individually.  The optional
+ * white space around each crumb is dropped.  If no crumb is left, |nv|
+ * is encoded as is.  The other parameters are passed to
+ * nghttp3_qpack_encoder_encode_nv.
+ *
+ * This function returns 0 if it succeeds, or one of the negative
+ * error codes which nghttp3_qpack_encoder_encode_nv returns.
+ */
+static int qpack_encoder_encode_cookie(nghttp3_qpack_encoder *encoder,
+                                       size_t *pmax_cnt, size_t *pmin_cnt,
+                                       nghttp3_buf *rbuf, nghttp3_buf *ebuf,
+                                       const nghttp3_nv *nv, size_t base,
+                                       int allow_blocking) {
+  nghttp3_nv crumb = *nv;
+  const uint8_t *p = nv->value, *end = nv->value + nv->valuelen, *q, *r;
+  size_t ncrumbs = 0;
+  int rv;
+
+  if (memchr(p, ';', nv->valuelen) == NULL) {
+    return nghttp3_qpack_encoder_encode_nv(encoder, pmax_cnt, pmin_cnt, rbuf,
+                                           ebuf, nv, base, allow_blocking);
+  }
+
+  for (;;) {
+    for (; p != end && (*p == ' ' || *p == '\t'); ++p)
+      ;
+
+    q = memchr(p, ';', (size_t)(end - p));
+    if (q == NULL) {
+      q = end;
+    }
+
+    for (r = q; r != p && (*(r - 1) == ' ' || *(r - 1) == '\t'); --r)
+      ;
+
+    if (r != p) {
+      crumb.value = (uint8_t *)p;
+      crumb.valuelen = (size_t)(r - p);
+
+      rv = nghttp3_qpack_encoder_encode_nv(encoder, pmax_cnt, pmin_cnt, rbuf,
+                                           ebuf, &crumb, base, allow_blocking);
+      if (rv != 0) {
+        return rv;
+      }
+
+      ++ncrumbs;
+    }
+
+    if (q == end) {
+      break;
+    }
+
+    p = q + 1;
+  }
+
+  if (ncrumbs == 0) {
+    return nghttp3_qpack_encoder_encode_nv(encoder, pmax_cnt, pmin_cnt, rbuf,
+                                           ebuf, nv, base, allow_blocking);
+  }
+
+  return 0;
+}
+
 int nghttp3_qpack_encoder_encode(nghttp3_qpack_encoder *encoder,
                                  nghttp3_buf *pbuf, nghttp3_buf *rbuf,
                                  nghttp3_buf *ebuf, int64_t stream_id,
@@ -1227,8 +1340,14 @@ int nghttp3_qpack_encoder_encode(nghttp3_qpack_encoder *encoder,
          blocked_stream, allow_blocking);
 
   for (i = 0; i < nvlen; ++i) {
-    rv = nghttp3_qpack_encoder_encode_nv(encoder, &max_cnt, &min_cnt, rbuf,
-                                         ebuf, &nva[i], base, allow_blocking);
+    if (qpack_nv_is_cookie(&nva[i])) {
+      rv = qpack_encoder_encode_cookie(encoder, &max_cnt, &min_cnt, rbuf, ebuf,
+                                       &nva[i], base, allow_blocking);
+    } else {
+      rv = nghttp3_qpack_encoder_encode_nv(encoder, &max_cnt, &min_cnt, rbuf,
+                                           ebuf, &nva[i], base,
+                                           allow_blocking);
+    }
     if (rv != 0) {
       goto fail;
     }
@@ -1497,9 +1616,12 @@ int nghttp3_qpack_encoder_encode_nv(nghttp3_qpack_encoder *encoder,
 
   indexing_mode = qpack_encoder_decide_indexing_mode(encoder, nv, token);
 
+  ++encoder->nfields;
+
   if (token != -1) {
     sres = nghttp3_qpack_lookup_stable(nv, token, indexing_mode);
     if (sres.index != -1 && sres.name_value_match) {
+      ++encoder->nstatic_hits;
       return nghttp3_qpack_encoder_write_static_indexed(encoder, rbuf,
                                                         (size_t)sres.index);
     }
@@ -1512,6 +1634,8 @@ int nghttp3_qpack_encoder_encode_nv(nghttp3_qpack_encoder *encoder,
       indexing_mode == NGHTTP3_QPACK_INDEXING_MODE_STORE && dres.pb_index == -1;
 
   if (dres.index != -1 && dres.name_value_match) {
+    ++encoder->ndynamic_hits;
+
     if (allow_blocking &&
         qpack_context_check_draining(&encoder->ctx, (size_t)dres.index) &&
         qpack_encoder_can_index_duplicate(encoder, (size_t)dres.index,
@@ -1537,6 +1661,10 @@ int nghttp3_qpack_encoder_encode_nv(nghttp3_qpack_encoder *encoder,
         encoder, rbuf, (size_t)dres.index, base);
   }
 
+  if (sres.index != -1 || dres.index != -1) {
+    ++encoder->nname_hits;
+  }
+
   if (sres.index != -1) {
     if (just_index && qpack_encoder_can_index_nv(encoder, nv, *pmin_cnt)) {
       rv = nghttp3_qpack_encoder_write_static_insert(encoder, ebuf,
@@ -1624,6 +1752,117 @@ int nghttp3_qpack_encoder_encode_nv(nghttp3_qpack_encoder *encoder,
   return nghttp3_qpack_encoder_write_literal(encoder, rbuf, nv);
 }
 
+/*
+ * qpack_encoder_prewarm_nv inserts |nv| into dynamic table unless it
+ * is already there, or it should not be indexed, or it cannot be
+ * inserted without evicting an entry which a header block refers to.
+ * It writes encoder stream into |ebuf|.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGHTTP3_ERR_NOMEM
+ *     Out of memory.
+ */
+static int qpack_encoder_prewarm_nv(nghttp3_qpack_encoder *encoder,
+                                    nghttp3_buf *ebuf, const nghttp3_nv *nv) {
+  uint32_t hash;
+  int32_t token;
+  nghttp3_qpack_indexing_mode indexing_mode;
+  nghttp3_qpack_lookup_result sres = {-1, 0, -1}, dres;
+  int rv;
+
+  token = qpack_lookup_token(nv->name, nv->namelen);
+  if (token == -1) {
+    hash = qpack_hash_name(nv);
+  } else {
+    hash = token_stable[token].hash;
+  }
+
+  indexing_mode = qpack_encoder_decide_indexing_mode(encoder, nv, token);
+  if (indexing_mode != NGHTTP3_QPACK_INDEXING_MODE_STORE) {
+    return 0;
+  }
+
+  if (token != -1) {
+    sres = nghttp3_qpack_lookup_stable(nv, token, indexing_mode);
+    if (sres.index != -1 && sres.name_value_match) {
+      return 0;
+    }
+  }
+
+  dres = nghttp3_qpack_encoder_lookup_dtable(encoder, nv, token, hash,
+                                             indexing_mode, encoder->krcnt, 1);
+  if (dres.index != -1 && dres.name_value_match) {
+    return 0;
+  }
+
+  if (sres.index != -1) {
+    if (!qpack_encoder_can_index_nv(encoder, nv, SIZE_MAX)) {
+      return 0;
+    }
+    rv = nghttp3_qpack_encoder_write_static_insert(encoder, ebuf,
+                                                   (size_t)sres.index, nv);
+    if (rv != 0) {
+      return rv;
+    }
+    return nghttp3_qpack_encoder_dtable_static_add(encoder, (size_t)sres.index,
+                                                   nv, hash);
+  }
+
+  if (dres.index != -1) {
+    /* Do not evict the entry whose name is referred to. */
+    if (!qpack_encoder_can_index_nv(encoder, nv, (size_t)dres.index + 1)) {
+      return 0;
+    }
+    rv = nghttp3_qpack_encoder_write_dynamic_insert(encoder, ebuf,
+                                                    (size_t)dres.index, nv);
+    if (rv != 0) {
+      return rv;
+    }
+    return nghttp3_qpack_encoder_dtable_dynamic_add(encoder, (size_t)dres.index,
+                                                    nv, hash);
+  }
+
+  if (!qpack_encoder_can_index_nv(encoder, nv, SIZE_MAX)) {
+    return 0;
+  }
+  rv = nghttp3_qpack_encoder_dtable_literal_add(encoder, nv, token, hash);
+  if (rv != 0) {
+    return rv;
+  }
+  return nghttp3_qpack_encoder_write_literal_insert(encoder, ebuf, nv);
+}
+
+int nghttp3_qpack_encoder_prewarm(nghttp3_qpack_encoder *encoder,
+                                  nghttp3_buf *ebuf, const nghttp3_nv *nva,
+                                  size_t nvlen) {
+  size_t i;
+  int rv;
+
+  if (encoder->ctx.bad) {
+    return NGHTTP3_ERR_QPACK_FATAL;
+  }
+
+  rv = nghttp3_qpack_encoder_process_dtable_update(encoder, ebuf);
+  if (rv != 0) {
+    goto fail;
+  }
+
+  for (i = 0; i < nvlen; ++i) {
+    rv = qpack_encoder_prewarm_nv(encoder, ebuf, &nva[i]);
+    if (rv != 0) {
+      goto fail;
+    }
+  }
+
+  return 0;
+
+fail:
+  encoder->ctx.bad = 1;
+  return rv;
+}
+
 nghttp3_qpack_lookup_result
 nghttp3_qpack_lookup_stable(const nghttp3_nv *nv, int32_t token,
                             nghttp3_qpack_indexing_mode indexing_mode) {
@@ -1693,7 +1932,6 @@ int nghttp3_qpack_stream_init(nghttp3_qpack_stream *stream, int64_t stream_id,
   }
 
   stream->pe.index = NGHTTP3_PQ_BAD_INDEX;
-  stream->me.next = NULL;
   stream->me.key = (uint64_t)stream_id;
   stream->max_cnt = 0;
   stream->min_cnt = SIZE_MAX;
@@ -2017,6 +2255,11 @@ int nghttp3_qpack_context_dtable_add(nghttp3_qpack_context *ctx,
     ent = *(nghttp3_qpack_entry **)nghttp3_ringbuf_get(&ctx->dtable, i - 1);
 
     ctx->dtable_size -= table_space(ent->nv.name->len, ent->nv.value->len);
+    ++ctx->nevictions;
+
+    if (ctx->trace) {
+      qpack_context_trace_entry(ctx, NGHTTP3_TRACE_EVENT_QPACK_EVICT, ent);
+    }
 
     nghttp3_ringbuf_pop_back(&ctx->dtable);
     if (dtable_map) {
@@ -2052,6 +2295,11 @@ int nghttp3_qpack_context_dtable_add(nghttp3_qpack_context *ctx,
 
   ctx->dtable_size += space;
   ctx->dtable_sum += space;
+  ++ctx->ninserts;
+
+  if (ctx->trace) {
+    qpack_context_trace_entry(ctx, NGHTTP3_TRACE_EVENT_QPACK_INSERT, new_ent);
+  }
 
   return 0;
 
@@ -2234,7 +2482,7 @@ int nghttp3_qpack_encoder_unblock(nghttp3_qpack_encoder *encoder,
   int rv;
   nghttp3_ksl_key key;
   nghttp3_qpack_stream needle = {
-      {NGHTTP3_PQ_BAD_INDEX}, {NULL, 0}, {0}, max_cnt, 0};
+      {NGHTTP3_PQ_BAD_INDEX}, {0}, {0}, max_cnt, 0};
   nghttp3_ksl_it it;
 
   it = nghttp3_ksl_lower_bound(&encoder->blocked_refs,
@@ -2251,6 +2499,22 @@ int nghttp3_qpack_encoder_unblock(nghttp3_qpack_encoder *encoder,
   return 0;
 }
 
+/*
+ * qpack_encoder_trace_ack emits NGHTTP3_TRACE_EVENT_QPACK_ACK for
+ * |stream_id|.  The caller must check that encoder->ctx.trace is not
+ * NULL.
+ */
+static void qpack_encoder_trace_ack(nghttp3_qpack_encoder *encoder,
+                                    int64_t stream_id) {
+  nghttp3_trace_event ev;
+
+  ev.type = NGHTTP3_TRACE_EVENT_QPACK_ACK;
+  ev.stream_id = stream_id;
+  ev.u.qpack_ack.krcnt = encoder->krcnt;
+
+  encoder->ctx.trace(&ev, encoder->ctx.trace_user_data);
+}
+
 int nghttp3_qpack_encoder_ack_header(nghttp3_qpack_encoder *encoder,
                                      int64_t stream_id) {
   nghttp3_qpack_stream *stream =
@@ -2282,6 +2546,10 @@ int nghttp3_qpack_encoder_ack_header(nghttp3_qpack_encoder *encoder,
     }
   }
 
+  if (encoder->ctx.trace) {
+    qpack_encoder_trace_ack(encoder, stream_id);
+  }
+
   nghttp3_qpack_stream_pop_ref(stream);
 
   if (nghttp3_ringbuf_len(&stream->refs)) {
@@ -2303,6 +2571,10 @@ int nghttp3_qpack_encoder_add_insert_count(nghttp3_qpack_encoder *encoder,
   }
   encoder->krcnt += n;
 
+  if (encoder->ctx.trace) {
+    qpack_encoder_trace_ack(encoder, -1);
+  }
+
   return nghttp3_qpack_encoder_unblock(encoder, encoder->krcnt);
 }
 
@@ -2620,6 +2892,7 @@ int nghttp3_qpack_decoder_init(nghttp3_qpack_decoder *decoder,
   decoder->state = NGHTTP3_QPACK_ES_STATE_OPCODE;
   decoder->opcode = 0;
   decoder->written_icnt = 0;
+  decoder->intern = NULL;
 
   nghttp3_qpack_read_state_reset(&decoder->rstate);
   nghttp3_buf_init(&decoder->dbuf);
@@ -3012,6 +3285,20 @@ fail:
   return rv;
 }
 
+void nghttp3_qpack_encoder_set_trace(nghttp3_qpack_encoder *encoder,
+                                     nghttp3_qpack_trace trace,
+                                     void *user_data) {
+  encoder->ctx.trace = trace;
+  encoder->ctx.trace_user_data = user_data;
+}
+
+void nghttp3_qpack_decoder_set_trace(nghttp3_qpack_decoder *decoder,
+                                     nghttp3_qpack_trace trace,
+                                     void *user_data) {
+  decoder->ctx.trace = trace;
+  decoder->ctx.trace_user_data = user_data;
+}
+
 void nghttp3_qpack_decoder_set_dtable_cap(nghttp3_qpack_decoder *decoder,
                                           size_t cap) {
   nghttp3_qpack_entry *ent;
@@ -3027,6 +3314,11 @@ void nghttp3_qpack_decoder_set_dtable_cap(nghttp3_qpack_decoder *decoder,
     ent = *(nghttp3_qpack_entry **)nghttp3_ringbuf_get(&ctx->dtable, i - 1);
 
     ctx->dtable_size -= table_space(ent->nv.name->len, ent->nv.value->len);
+    ++ctx->nevictions;
+
+    if (ctx->trace) {
+      qpack_context_trace_entry(ctx, NGHTTP3_TRACE_EVENT_QPACK_EVICT, ent);
+    }
 
     nghttp3_ringbuf_pop_back(&ctx->dtable);
     nghttp3_qpack_entry_free(ent);
@@ -3808,6 +4100,21 @@ void nghttp3_qpack_decoder_emit_indexed(nghttp3_qpack_decoder *decoder,
   }
 }
 
+/*
+ * qpack_decoder_intern_value returns |value| decoded from request
+ * stream, or the same value interned in decoder->intern if it is
+ * set.  The ownership of |value| is transferred to this function.
+ */
+static nghttp3_rcbuf *
+qpack_decoder_intern_value(nghttp3_qpack_decoder *decoder,
+                           nghttp3_rcbuf *value) {
+  if (decoder->intern == NULL) {
+    return value;
+  }
+
+  return nghttp3_qpack_intern_get(decoder->intern, value);
+}
+
 static void
 qpack_decoder_emit_static_indexed_name(nghttp3_qpack_decoder *decoder,
                                        nghttp3_qpack_stream_context *sctx,
@@ -3816,7 +4123,7 @@ qpack_decoder_emit_static_indexed_name(nghttp3_qpack_decoder *decoder,
   (void)decoder;
 
   nv->name = (nghttp3_rcbuf *)&shd->name;
-  nv->value = sctx->rstate.value;
+  nv->value = qpack_decoder_intern_value(decoder, sctx->rstate.value);
   nv->token = shd->token;
   nv->flags =
       sctx->rstate.never ? NGHTTP3_NV_FLAG_NEVER_INDEX : NGHTTP3_NV_FLAG_NONE;
@@ -3830,10 +4137,9 @@ qpack_decoder_emit_dynamic_indexed_name(nghttp3_qpack_decoder *decoder,
                                         nghttp3_qpack_nv *nv) {
   nghttp3_qpack_entry *ent =
       nghttp3_qpack_context_dtable_get(&decoder->ctx, sctx->rstate.absidx);
-  (void)decoder;
 
   nv->name = ent->nv.name;
-  nv->value = sctx->rstate.value;
+  nv->value = qpack_decoder_intern_value(decoder, sctx->rstate.value);
   nv->token = ent->nv.token;
   nv->flags =
       sctx->rstate.never ? NGHTTP3_NV_FLAG_NEVER_INDEX : NGHTTP3_NV_FLAG_NONE;
@@ -3862,14 +4168,12 @@ void nghttp3_qpack_decoder_emit_indexed_name(nghttp3_qpack_decoder *decoder,
 void nghttp3_qpack_decoder_emit_literal(nghttp3_qpack_decoder *decoder,
                                         nghttp3_qpack_stream_context *sctx,
                                         nghttp3_qpack_nv *nv) {
-  (void)decoder;
-
   DEBUGF("qpack::decode: Emit literal name=%*s value=%*s\n",
          (int)sctx->rstate.name->len, sctx->rstate.name->base,
          (int)sctx->rstate.value->len, sctx->rstate.value->base);
 
   nv->name = sctx->rstate.name;
-  nv->value = sctx->rstate.value;
+  nv->value = qpack_decoder_intern_value(decoder, sctx->rstate.value);
   nv->token = qpack_lookup_token(nv->name->base, nv->name->len);
   nv->flags =
       sctx->rstate.never ? NGHTTP3_NV_FLAG_NEVER_INDEX : NGHTTP3_NV_FLAG_NONE;
@@ -3976,6 +4280,587 @@ void nghttp3_qpack_decoder_del(nghttp3_qpack_decoder *decoder) {
   nghttp3_mem_free(mem, decoder);
 }
 
+void nghttp3_qpack_decoder_set_intern(nghttp3_qpack_decoder *decoder,
+                                      nghttp3_qpack_intern *intern) {
+  decoder->intern = intern;
+}
+
 size_t nghttp3_qpack_decoder_get_icnt(const nghttp3_qpack_decoder *decoder) {
   return decoder->ctx.next_absidx;
 }
+
+/*
+ * qpack_context_add_entry appends a copy of |ent|, which shares name
+ * and value with |ent|, to |ctx| as the newest entry.  If
+ * |dtable_map| is not NULL, the copy is also inserted into it.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGHTTP3_ERR_NOMEM
+ *     Out of memory.
+ */
+static int qpack_context_add_entry(nghttp3_qpack_context *ctx,
+                                   nghttp3_qpack_map *dtable_map,
+                                   nghttp3_qpack_entry *ent) {
+  nghttp3_qpack_entry *new_ent, **p;
+  int rv;
+
+  if (nghttp3_ringbuf_full(&ctx->dtable)) {
+    rv = nghttp3_ringbuf_reserve(&ctx->dtable,
+                                 nghttp3_ringbuf_len(&ctx->dtable) * 2);
+    if (rv != 0) {
+      return rv;
+    }
+  }
+
+  new_ent = nghttp3_mem_malloc(ctx->mem, sizeof(nghttp3_qpack_entry));
+  if (new_ent == NULL) {
+    return NGHTTP3_ERR_NOMEM;
+  }
+
+  nghttp3_qpack_entry_init(new_ent, &ent->nv, ent->sum, ent->absidx,
+                           ent->hash);
+
+  p = nghttp3_ringbuf_push_front(&ctx->dtable);
+  *p = new_ent;
+
+  if (dtable_map) {
+    qpack_map_insert(dtable_map, new_ent);
+  }
+
+  return 0;
+}
+
+/*
+ * qpack_context_copy makes |dest|, which has been initialized with
+ * the same maximum dynamic table size as |src|, have the same dynamic
+ * table as |src|.  The entries share name and value with those of
+ * |src|.  If |dtable_map| is not NULL, the entries are also inserted
+ * into it.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGHTTP3_ERR_NOMEM
+ *     Out of memory.
+ */
+static int qpack_context_copy(nghttp3_qpack_context *dest,
+                              nghttp3_qpack_map *dtable_map,
+                              nghttp3_qpack_context *src) {
+  nghttp3_qpack_entry *ent;
+  size_t i;
+  int rv;
+
+  for (i = nghttp3_ringbuf_len(&src->dtable); i > 0; --i) {
+    ent = *(nghttp3_qpack_entry **)nghttp3_ringbuf_get(&src->dtable, i - 1);
+
+    rv = qpack_context_add_entry(dest, dtable_map, ent);
+    if (rv != 0) {
+      return rv;
+    }
+  }
+
+  dest->dtable_size = src->dtable_size;
+  dest->dtable_sum = src->dtable_sum;
+  dest->max_dtable_size = src->max_dtable_size;
+  dest->next_absidx = src->next_absidx;
+
+  return 0;
+}
+
+int nghttp3_qpack_encoder_clone(nghttp3_qpack_encoder **pdest,
+                                const nghttp3_qpack_encoder *src,
+                                const nghttp3_mem *mem) {
+  nghttp3_qpack_encoder *p;
+  int rv;
+
+  if (src->ctx.bad || src->state != NGHTTP3_QPACK_DS_STATE_OPCODE ||
+      nghttp3_map_size((nghttp3_map *)&src->stream_refs)) {
+    return NGHTTP3_ERR_INVALID_STATE;
+  }
+
+  rv = nghttp3_qpack_encoder_new(&p, src->ctx.hard_max_dtable_size,
+                                 src->ctx.max_blocked, mem);
+  if (rv != 0) {
+    return rv;
+  }
+
+  rv = qpack_context_copy(&p->ctx, &p->dtable_map,
+                          (nghttp3_qpack_context *)&src->ctx);
+  if (rv != 0) {
+    nghttp3_qpack_encoder_del(p);
+    return rv;
+  }
+
+  p->krcnt = src->krcnt;
+  p->min_dtable_update = src->min_dtable_update;
+  p->last_max_dtable_update = src->last_max_dtable_update;
+  p->flags = src->flags;
+
+  *pdest = p;
+
+  return 0;
+}
+
+int nghttp3_qpack_decoder_clone(nghttp3_qpack_decoder **pdest,
+                                const nghttp3_qpack_decoder *src,
+                                const nghttp3_mem *mem) {
+  nghttp3_qpack_decoder *p;
+  int rv;
+
+  if (src->ctx.bad || src->state != NGHTTP3_QPACK_ES_STATE_OPCODE ||
+      nghttp3_buf_len(&src->dbuf)) {
+    return NGHTTP3_ERR_INVALID_STATE;
+  }
+
+  rv = nghttp3_qpack_decoder_new(&p, src->ctx.hard_max_dtable_size,
+                                 src->ctx.max_blocked, mem);
+  if (rv != 0) {
+    return rv;
+  }
+
+  rv = qpack_context_copy(&p->ctx, NULL, (nghttp3_qpack_context *)&src->ctx);
+  if (rv != 0) {
+    nghttp3_qpack_decoder_del(p);
+    return rv;
+  }
+
+  p->written_icnt = src->written_icnt;
+  p->intern = src->intern;
+
+  *pdest = p;
+
+  return 0;
+}
+
+/* NGHTTP3_QPACK_SNAPSHOT_VERSION is the version of the format which
+   nghttp3_qpack_encoder_serialize and
+   nghttp3_qpack_decoder_serialize write. */
+#define NGHTTP3_QPACK_SNAPSHOT_VERSION 1
+
+/* nghttp3_qpack_snapshot_type is the type of the serialized
+   context. */
+typedef enum {
+  NGHTTP3_QPACK_SNAPSHOT_TYPE_ENCODER,
+  NGHTTP3_QPACK_SNAPSHOT_TYPE_DECODER,
+} nghttp3_qpack_snapshot_type;
+
+/*
+ * qpack_snapshot_len returns the number of bytes required to
+ * serialize |ctx| followed by the integers in |extra| of length
+ * |extralen|.
+ */
+static size_t qpack_snapshot_len(nghttp3_qpack_context *ctx,
+                                 const uint64_t *extra, size_t extralen) {
+  nghttp3_qpack_entry *ent;
+  size_t i, len = nghttp3_ringbuf_len(&ctx->dtable);
+  size_t n = 2;
+
+  n += nghttp3_put_varint_len((int64_t)ctx->hard_max_dtable_size) +
+       nghttp3_put_varint_len((int64_t)ctx->max_dtable_size) +
+       nghttp3_put_varint_len((int64_t)ctx->max_blocked) +
+       nghttp3_put_varint_len((int64_t)ctx->next_absidx) +
+       nghttp3_put_varint_len((int64_t)ctx->dtable_sum) +
+       nghttp3_put_varint_len((int64_t)len);
+
+  for (i = 0; i < len; ++i) {
+    ent = *(nghttp3_qpack_entry **)nghttp3_ringbuf_get(&ctx->dtable, i);
+    n += nghttp3_put_varint_len((int64_t)ent->nv.name->len) +
+         ent->nv.name->len +
+         nghttp3_put_varint_len((int64_t)ent->nv.value->len) +
+         ent->nv.value->len;
+  }
+
+  for (i = 0; i < extralen; ++i) {
+    n += nghttp3_put_varint_len((int64_t)extra[i]);
+  }
+
+  return n;
+}
+
+/*
+ * qpack_snapshot_write serializes |ctx| of type |type| followed by
+ * the integers in |extra| of length |extralen| into |dest| of length
+ * |destlen|.  If |dest| is NULL, it just returns the number of bytes
+ * required.
+ *
+ * This function returns the number of bytes written if it succeeds,
+ * or one of the following negative error codes:
+ *
+ * NGHTTP3_ERR_NOBUF
+ *     |destlen| is too small.
+ */
+static ssize_t qpack_snapshot_write(uint8_t *dest, size_t destlen,
+                                    nghttp3_qpack_context *ctx,
+                                    nghttp3_qpack_snapshot_type type,
+                                    const uint64_t *extra, size_t extralen) {
+  nghttp3_qpack_entry *ent;
+  size_t i, len = nghttp3_ringbuf_len(&ctx->dtable);
+  size_t n = qpack_snapshot_len(ctx, extra, extralen);
+  uint8_t *p = dest;
+
+  if (dest == NULL) {
+    return (ssize_t)n;
+  }
+
+  if (destlen < n) {
+    return NGHTTP3_ERR_NOBUF;
+  }
+
+  *p++ = NGHTTP3_QPACK_SNAPSHOT_VERSION;
+  *p++ = (uint8_t)type;
+  p = nghttp3_put_varint(p, (int64_t)ctx->hard_max_dtable_size);
+  p = nghttp3_put_varint(p, (int64_t)ctx->max_dtable_size);
+  p = nghttp3_put_varint(p, (int64_t)ctx->max_blocked);
+  p = nghttp3_put_varint(p, (int64_t)ctx->next_absidx);
+  p = nghttp3_put_varint(p, (int64_t)ctx->dtable_sum);
+  p = nghttp3_put_varint(p, (int64_t)len);
+
+  /* Entries are written from the oldest one. */
+  for (i = len; i > 0; --i) {
+    ent = *(nghttp3_qpack_entry **)nghttp3_ringbuf_get(&ctx->dtable, i - 1);
+    p = nghttp3_put_varint(p, (int64_t)ent->nv.name->len);
+    p = nghttp3_cpymem(p, ent->nv.name->base, ent->nv.name->len);
+    p = nghttp3_put_varint(p, (int64_t)ent->nv.value->len);
+    p = nghttp3_cpymem(p, ent->nv.value->base, ent->nv.value->len);
+  }
+
+  for (i = 0; i < extralen; ++i) {
+    p = nghttp3_put_varint(p, (int64_t)extra[i]);
+  }
+
+  assert((size_t)(p - dest) == n);
+
+  return (ssize_t)n;
+}
+
+/*
+ * qpack_snapshot_read_varint reads a variable-length integer from
+ * |*pp| into |*dest|, and advances |*pp|.  It returns -1 if the
+ * integer exceeds |end|.
+ */
+static int qpack_snapshot_read_varint(uint64_t *dest, const uint8_t **pp,
+                                      const uint8_t *end) {
+  size_t len;
+
+  if (*pp == end || (size_t)(end - *pp) < nghttp3_get_varint_len(*pp)) {
+    return -1;
+  }
+
+  *dest = (uint64_t)nghttp3_get_varint(&len, *pp);
+  *pp += len;
+
+  return 0;
+}
+
+/*
+ * qpack_snapshot_read_string reads a length prefixed string from
+ * |*pp| into a newly allocated |*pdest|, and advances |*pp|.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGHTTP3_ERR_INVALID_ARGUMENT
+ *     The string exceeds |end|.
+ * NGHTTP3_ERR_NOMEM
+ *     Out of memory.
+ */
+static int qpack_snapshot_read_string(nghttp3_rcbuf **pdest,
+                                      const uint8_t **pp, const uint8_t *end,
+                                      const nghttp3_mem *mem) {
+  uint64_t len;
+  int rv;
+
+  if (qpack_snapshot_read_varint(&len, pp, end) != 0 ||
+      (uint64_t)(end - *pp) < len) {
+    return NGHTTP3_ERR_INVALID_ARGUMENT;
+  }
+
+  rv = nghttp3_rcbuf_new2(pdest, *pp, (size_t)len, mem);
+  if (rv != 0) {
+    return rv;
+  }
+
+  *pp += len;
+
+  return 0;
+}
+
+/*
+ * qpack_snapshot_read_header reads the fixed part of a snapshot of
+ * type |type| in [|*pp|, |end|) into |params|, which receives the
+ * maximum dynamic table size, its effective value, the maximum number
+ * of blocked streams, insert count, the sum of table space of all
+ * entries ever inserted, and the number of entries, in this order.
+ *
+ * This function returns 0 if it succeeds, or
+ * NGHTTP3_ERR_INVALID_ARGUMENT if the snapshot is malformed.
+ */
+static int qpack_snapshot_read_header(uint64_t *params, const uint8_t **pp,
+                                      const uint8_t *end,
+                                      nghttp3_qpack_snapshot_type type) {
+  size_t i;
+
+  if (end - *pp < 2 || (*pp)[0] != NGHTTP3_QPACK_SNAPSHOT_VERSION ||
+      (*pp)[1] != (uint8_t)type) {
+    return NGHTTP3_ERR_INVALID_ARGUMENT;
+  }
+
+  *pp += 2;
+
+  for (i = 0; i < 6; ++i) {
+    if (qpack_snapshot_read_varint(&params[i], pp, end) != 0) {
+      return NGHTTP3_ERR_INVALID_ARGUMENT;
+    }
+  }
+
+  /* max_dtable_size must not exceed hard_max_dtable_size, and the
+     entries must be less than or equal to the number inserted. */
+  if (params[1] > params[0] || params[5] > params[3]) {
+    return NGHTTP3_ERR_INVALID_ARGUMENT;
+  }
+
+  return 0;
+}
+
+/*
+ * qpack_snapshot_read_entries reads |nentries| entries from |*pp|
+ * into |ctx| whose dynamic table is empty, and advances |*pp|.  If
+ * |dtable_map| is not NULL, entries are also inserted into it.
+ * |next_absidx| and |dtable_sum| are insert count and the sum of
+ * table space of all entries ever inserted read from the snapshot.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGHTTP3_ERR_INVALID_ARGUMENT
+ *     The snapshot is malformed.
+ * NGHTTP3_ERR_NOMEM
+ *     Out of memory.
+ */
+static int qpack_snapshot_read_entries(nghttp3_qpack_context *ctx,
+                                       nghttp3_qpack_map *dtable_map,
+                                       const uint8_t **pp, const uint8_t *end,
+                                       uint64_t nentries, uint64_t next_absidx,
+                                       uint64_t dtable_sum) {
+  nghttp3_qpack_entry ent, **pent;
+  nghttp3_nv nv;
+  size_t sum, dtable_size = 0;
+  uint64_t i;
+  int rv;
+
+  ent.nv.name = ent.nv.value = NULL;
+  ent.absidx = (size_t)(next_absidx - nentries);
+  ent.sum = 0;
+
+  for (i = 0; i < nentries; ++i) {
+    rv = qpack_snapshot_read_string(&ent.nv.name, pp, end, ctx->mem);
+    if (rv != 0) {
+      goto fail;
+    }
+
+    rv = qpack_snapshot_read_string(&ent.nv.value, pp, end, ctx->mem);
+    if (rv != 0) {
+      goto fail;
+    }
+
+    dtable_size += table_space(ent.nv.name->len, ent.nv.value->len);
+
+    if (dtable_size > ctx->max_dtable_size) {
+      rv = NGHTTP3_ERR_INVALID_ARGUMENT;
+      goto fail;
+    }
+
+    ent.nv.token = qpack_lookup_token(ent.nv.name->base, ent.nv.name->len);
+    ent.nv.flags = NGHTTP3_NV_FLAG_NONE;
+    ent.hash = 0;
+
+    if (dtable_map) {
+      if (ent.nv.token == -1) {
+        nv.name = ent.nv.name->base;
+        nv.namelen = ent.nv.name->len;
+        ent.hash = qpack_hash_name(&nv);
+      } else {
+        ent.hash = token_stable[ent.nv.token].hash;
+      }
+    }
+
+    rv = qpack_context_add_entry(ctx, dtable_map, &ent);
+    if (rv != 0) {
+      goto fail;
+    }
+
+    nghttp3_qpack_entry_free(&ent);
+    ent.nv.name = ent.nv.value = NULL;
+
+    ++ent.absidx;
+  }
+
+  if (dtable_sum < dtable_size) {
+    return NGHTTP3_ERR_INVALID_ARGUMENT;
+  }
+
+  /* Each entry records the sum of table space of the entries
+     inserted before it. */
+  sum = (size_t)dtable_sum - dtable_size;
+
+  for (i = nentries; i > 0; --i) {
+    pent = nghttp3_ringbuf_get(&ctx->dtable, (size_t)(i - 1));
+    (*pent)->sum = sum;
+    sum += table_space((*pent)->nv.name->len, (*pent)->nv.value->len);
+  }
+
+  ctx->dtable_size = dtable_size;
+  ctx->dtable_sum = (size_t)dtable_sum;
+  ctx->next_absidx = (size_t)next_absidx;
+
+  return 0;
+
+fail:
+  nghttp3_rcbuf_decref(ent.nv.value);
+  nghttp3_rcbuf_decref(ent.nv.name);
+
+  return rv;
+}
+
+ssize_t nghttp3_qpack_encoder_serialize(const nghttp3_qpack_encoder *encoder,
+                                        uint8_t *dest, size_t destlen) {
+  uint64_t extra[4];
+
+  if (encoder->ctx.bad || encoder->state != NGHTTP3_QPACK_DS_STATE_OPCODE ||
+      nghttp3_map_size((nghttp3_map *)&encoder->stream_refs)) {
+    return NGHTTP3_ERR_INVALID_STATE;
+  }
+
+  extra[0] = encoder->krcnt;
+  extra[1] = encoder->min_dtable_update;
+  extra[2] = encoder->last_max_dtable_update;
+  extra[3] = encoder->flags;
+
+  return qpack_snapshot_write(dest, destlen,
+                              (nghttp3_qpack_context *)&encoder->ctx,
+                              NGHTTP3_QPACK_SNAPSHOT_TYPE_ENCODER, extra,
+                              nghttp3_arraylen(extra));
+}
+
+int nghttp3_qpack_encoder_deserialize(nghttp3_qpack_encoder **pencoder,
+                                      const uint8_t *src, size_t srclen,
+                                      const nghttp3_mem *mem) {
+  const uint8_t *p = src, *end = src + srclen;
+  uint64_t params[6], extra[4];
+  nghttp3_qpack_encoder *encoder;
+  size_t i;
+  int rv;
+
+  rv = qpack_snapshot_read_header(params, &p, end,
+                                  NGHTTP3_QPACK_SNAPSHOT_TYPE_ENCODER);
+  if (rv != 0) {
+    return rv;
+  }
+
+  rv = nghttp3_qpack_encoder_new(&encoder, (size_t)params[0],
+                                 (size_t)params[2], mem);
+  if (rv != 0) {
+    return rv;
+  }
+
+  encoder->ctx.max_dtable_size = (size_t)params[1];
+
+  rv = qpack_snapshot_read_entries(&encoder->ctx, &encoder->dtable_map, &p,
+                                   end, params[5], params[3], params[4]);
+  if (rv != 0) {
+    goto fail;
+  }
+
+  for (i = 0; i < nghttp3_arraylen(extra); ++i) {
+    if (qpack_snapshot_read_varint(&extra[i], &p, end) != 0) {
+      rv = NGHTTP3_ERR_INVALID_ARGUMENT;
+      goto fail;
+    }
+  }
+
+  if (p != end || extra[0] > params[3] ||
+      (extra[3] &
+       ~(uint64_t)NGHTTP3_QPACK_ENCODER_FLAG_PENDING_SET_DTABLE_CAP)) {
+    rv = NGHTTP3_ERR_INVALID_ARGUMENT;
+    goto fail;
+  }
+
+  encoder->krcnt = (size_t)extra[0];
+  encoder->min_dtable_update = (size_t)extra[1];
+  encoder->last_max_dtable_update = (size_t)extra[2];
+  encoder->flags = (uint8_t)extra[3];
+
+  *pencoder = encoder;
+
+  return 0;
+
+fail:
+  nghttp3_qpack_encoder_del(encoder);
+
+  return rv;
+}
+
+ssize_t nghttp3_qpack_decoder_serialize(const nghttp3_qpack_decoder *decoder,
+                                        uint8_t *dest, size_t destlen) {
+  uint64_t extra[1];
+
+  if (decoder->ctx.bad || decoder->state != NGHTTP3_QPACK_ES_STATE_OPCODE ||
+      nghttp3_buf_len(&decoder->dbuf)) {
+    return NGHTTP3_ERR_INVALID_STATE;
+  }
+
+  extra[0] = decoder->written_icnt;
+
+  return qpack_snapshot_write(dest, destlen,
+                              (nghttp3_qpack_context *)&decoder->ctx,
+                              NGHTTP3_QPACK_SNAPSHOT_TYPE_DECODER, extra,
+                              nghttp3_arraylen(extra));
+}
+
+int nghttp3_qpack_decoder_deserialize(nghttp3_qpack_decoder **pdecoder,
+                                      const uint8_t *src, size_t srclen,
+                                      const nghttp3_mem *mem) {
+  const uint8_t *p = src, *end = src + srclen;
+  uint64_t params[6], written_icnt;
+  nghttp3_qpack_decoder *decoder;
+  int rv;
+
+  rv = qpack_snapshot_read_header(params, &p, end,
+                                  NGHTTP3_QPACK_SNAPSHOT_TYPE_DECODER);
+  if (rv != 0) {
+    return rv;
+  }
+
+  rv = nghttp3_qpack_decoder_new(&decoder, (size_t)params[0],
+                                 (size_t)params[2], mem);
+  if (rv != 0) {
+    return rv;
+  }
+
+  decoder->ctx.max_dtable_size = (size_t)params[1];
+
+  rv = qpack_snapshot_read_entries(&decoder->ctx, NULL, &p, end, params[5],
+                                   params[3], params[4]);
+  if (rv != 0) {
+    goto fail;
+  }
+
+  if (qpack_snapshot_read_varint(&written_icnt, &p, end) != 0 || p != end ||
+      written_icnt > params[3]) {
+    rv = NGHTTP3_ERR_INVALID_ARGUMENT;
+    goto fail;
+  }
+
+  decoder->written_icnt = (size_t)written_icnt;
+
+  *pdecoder = decoder;
+
+  return 0;
+
+fail:
+  nghttp3_qpack_decoder_del(decoder);
+
+  return rv;
+}
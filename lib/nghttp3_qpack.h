@@ -39,6 +39,7 @@
 #include "nghttp3_buf.h"
 #include "nghttp3_ksl.h"
 #include "nghttp3_qpack_huffman.h"
+#include "nghttp3_qpack_intern.h"
 
 #define NGHTTP3_QPACK_INT_MAX ((1ull << 62) - 1)
 #define NGHTTP3_QPACK_MAX_MAX_TABLE_CAPACITY ((1u << 30) - 1)
@@ -145,6 +146,13 @@ void nghttp3_qpack_stream_pop_ref(nghttp3_qpack_stream *stream);
 
 #define NGHTTP3_QPACK_ENTRY_OVERHEAD 32
 
+/*
+ * nghttp3_qpack_trace is a function which is called with trace event
+ * |ev| emitted by QPACK encoder or decoder.
+ */
+typedef void (*nghttp3_qpack_trace)(const nghttp3_trace_event *ev,
+                                    void *user_data);
+
 typedef struct {
   /* dtable is a dynamic table */
   nghttp3_ringbuf dtable;
@@ -174,6 +182,18 @@ typedef struct {
      further invocation of inflate/deflate will fail with
      NGHTTP3_ERR_QPACK_FATAL. */
   uint8_t bad;
+  /* ninserts is the number of entries inserted into dtable. */
+  uint64_t ninserts;
+  /* nevictions is the number of entries evicted from dtable. */
+  uint64_t nevictions;
+  /* encoder is nonzero if this context belongs to encoder.  It is
+     only used to fill the trace events. */
+  uint8_t encoder;
+  /* trace, if non-NULL, is called when an entry is inserted into or
+     evicted from dtable, and when encoder receives acknowledgement.
+     trace_user_data is passed to it. */
+  nghttp3_qpack_trace trace;
+  void *trace_user_data;
 } nghttp3_qpack_context;
 
 typedef struct {
@@ -255,6 +275,17 @@ struct nghttp3_qpack_encoder {
   /* last_max_dtable_update is the dynamic table size last
      requested. */
   size_t last_max_dtable_update;
+  /* nfields is the number of header fields encoded. */
+  uint64_t nfields;
+  /* nstatic_hits is the number of header fields whose name and value
+     are found in static table. */
+  uint64_t nstatic_hits;
+  /* ndynamic_hits is the number of header fields whose name and value
+     are found in dynamic table. */
+  uint64_t ndynamic_hits;
+  /* nname_hits is the number of header fields only whose name is
+     found in static or dynamic table. */
+  uint64_t nname_hits;
   /* flags is bitwise OR of zero or more of
      nghttp3_qpack_encoder_flag. */
   uint8_t flags;
@@ -750,6 +781,9 @@ struct nghttp3_qpack_decoder {
   nghttp3_buf dbuf;
   /* written_icnt is Insert Count written to decoder stream so far. */
   size_t written_icnt;
+  /* intern, if not NULL, is a table to share header field values
+     decoded from request streams. */
+  nghttp3_qpack_intern *intern;
 };
 
 /*
@@ -774,6 +808,24 @@ int nghttp3_qpack_decoder_init(nghttp3_qpack_decoder *decoder,
  */
 void nghttp3_qpack_decoder_free(nghttp3_qpack_decoder *decoder);
 
+/*
+ * nghttp3_qpack_encoder_set_trace makes |encoder| call |trace| with
+ * |user_data| for QPACK trace events.  |trace| may be NULL to stop
+ * tracing.
+ */
+void nghttp3_qpack_encoder_set_trace(nghttp3_qpack_encoder *encoder,
+                                     nghttp3_qpack_trace trace,
+                                     void *user_data);
+
+/*
+ * nghttp3_qpack_decoder_set_trace makes |decoder| call |trace| with
+ * |user_data| for QPACK trace events.  |trace| may be NULL to stop
+ * tracing.
+ */
+void nghttp3_qpack_decoder_set_trace(nghttp3_qpack_decoder *decoder,
+                                     nghttp3_qpack_trace trace,
+                                     void *user_data);
+
 /*
  * nghttp3_qpack_decoder_set_dtable_cap sets |cap| as maximum dynamic
  * table size.
@@ -0,0 +1,134 @@
+/*
+ * nghttp3
+ *
+ * Copyright (c) 2019 nghttp3 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "nghttp3_qpack_intern.h"
+
+#include <string.h>
+
+#include "nghttp3_mem.h"
+#include "nghttp3_rcbuf.h"
+
+int nghttp3_qpack_intern_new(nghttp3_qpack_intern **pintern, size_t nmemb,
+                             size_t max_valuelen, const nghttp3_mem *mem) {
+  nghttp3_qpack_intern *intern;
+  size_t tablelen;
+
+  if (nmemb == 0) {
+    return NGHTTP3_ERR_INVALID_ARGUMENT;
+  }
+
+  for (tablelen = 1; tablelen < nmemb; tablelen <<= 1)
+    ;
+
+  intern = nghttp3_mem_malloc(mem, sizeof(nghttp3_qpack_intern));
+  if (intern == NULL) {
+    return NGHTTP3_ERR_NOMEM;
+  }
+
+  intern->table =
+      nghttp3_mem_calloc(mem, tablelen, sizeof(nghttp3_qpack_intern_entry));
+  if (intern->table == NULL) {
+    nghttp3_mem_free(mem, intern);
+    return NGHTTP3_ERR_NOMEM;
+  }
+
+  intern->mem = mem;
+  intern->tablelen = tablelen;
+  intern->max_valuelen = max_valuelen;
+
+  *pintern = intern;
+
+  return 0;
+}
+
+void nghttp3_qpack_intern_del(nghttp3_qpack_intern *intern) {
+  size_t i;
+
+  if (intern == NULL) {
+    return;
+  }
+
+  for (i = 0; i < intern->tablelen; ++i) {
+    nghttp3_rcbuf_decref(intern->table[i].value);
+  }
+
+  nghttp3_mem_free(intern->mem, intern->table);
+  nghttp3_mem_free(intern->mem, intern);
+}
+
+static uint32_t intern_hash(const uint8_t *s, size_t len) {
+  /* 32 bit FNV-1a: http://isthe.com/chongo/tech/comp/fnv/ */
+  uint32_t h = 2166136261u;
+  size_t i;
+
+  for (i = 0; i < len; ++i) {
+    h ^= s[i];
+    h += (h << 1) + (h << 4) + (h << 7) + (h << 8) + (h << 24);
+  }
+
+  return h;
+}
+
+nghttp3_rcbuf *nghttp3_qpack_intern_get(nghttp3_qpack_intern *intern,
+                                        nghttp3_rcbuf *value) {
+  nghttp3_qpack_intern_entry *ent;
+  nghttp3_rcbuf *copy;
+  uint32_t hash;
+
+  if (value->len > intern->max_valuelen) {
+    return value;
+  }
+
+  hash = intern_hash(value->base, value->len);
+  ent = &intern->table[hash & (intern->tablelen - 1)];
+
+  if (ent->value && ent->hash == hash && ent->value->len == value->len &&
+      memcmp(ent->value->base, value->base, value->len) == 0) {
+    nghttp3_rcbuf_decref(value);
+    nghttp3_rcbuf_incref(ent->value);
+    return ent->value;
+  }
+
+  if (ent->cand_hash != hash) {
+    ent->cand_hash = hash;
+    return value;
+  }
+
+  /* value might be allocated from the connection's arena, or have
+     room for Huffman decoding.  Keep an exact copy which is allocated
+     from intern->mem instead. */
+  if (nghttp3_rcbuf_new2(&copy, value->base, value->len, intern->mem) != 0) {
+    return value;
+  }
+
+  nghttp3_rcbuf_decref(ent->value);
+  ent->value = copy;
+  ent->hash = hash;
+  ent->cand_hash = 0;
+
+  nghttp3_rcbuf_decref(value);
+  nghttp3_rcbuf_incref(copy);
+
+  return copy;
+}
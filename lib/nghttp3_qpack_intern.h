@@ -0,0 +1,76 @@
+/*
+ * nghttp3
+ *
+ * Copyright (c) 2019 nghttp3 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef NGHTTP3_QPACK_INTERN_H
+#define NGHTTP3_QPACK_INTERN_H
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <nghttp3/nghttp3.h>
+
+typedef struct {
+  /* value is the interned value.  The table holds a reference to
+     it. */
+  nghttp3_rcbuf *value;
+  /* hash is the hash of value. */
+  uint32_t hash;
+  /* cand_hash is the hash of the value which missed this slot last.
+     It is 0 if no value has missed. */
+  uint32_t cand_hash;
+} nghttp3_qpack_intern_entry;
+
+/*
+ * nghttp3_qpack_intern is a direct mapped cache of header field
+ * values.  A value which misses is only admitted if it is the same
+ * value which missed the slot last, that is, if it is seen twice in
+ * a row.  Then it evicts the cached one in the same slot, so that
+ * the number of entries never exceeds the size of table.  This keeps
+ * the values which appear only once from copying and from evicting
+ * the popular ones.
+ */
+struct nghttp3_qpack_intern {
+  const nghttp3_mem *mem;
+  nghttp3_qpack_intern_entry *table;
+  /* tablelen is the number of slots in table.  It is a power of
+     2. */
+  size_t tablelen;
+  /* max_valuelen is the maximum length of value to intern. */
+  size_t max_valuelen;
+};
+
+/*
+ * nghttp3_qpack_intern_get returns an interned value which has the
+ * same bytes as |value| of reference count 1 that the caller owns.
+ * If such value is found, the reference to |value| is given up, and
+ * the caller owns a new reference to the found one.  Otherwise, if
+ * |value| is admitted, a copy of |value| is added to |intern| and
+ * returned in the same way.  If |value| is not admitted, is too long
+ * to intern, or a copy cannot be made, |value| is returned as is.
+ */
+nghttp3_rcbuf *nghttp3_qpack_intern_get(nghttp3_qpack_intern *intern,
+                                        nghttp3_rcbuf *value);
+
+#endif /* NGHTTP3_QPACK_INTERN_H */
@@ -32,11 +32,15 @@
 
 int nghttp3_ringbuf_init(nghttp3_ringbuf *rb, size_t nmemb, size_t size,
                          const nghttp3_mem *mem) {
-  assert(1 == __builtin_popcount((unsigned int)nmemb));
+  if (nmemb) {
+    assert(1 == __builtin_popcount((unsigned int)nmemb));
 
-  rb->buf = nghttp3_mem_malloc(mem, nmemb * size);
-  if (rb->buf == NULL) {
-    return NGHTTP3_ERR_NOMEM;
+    rb->buf = nghttp3_mem_malloc(mem, nmemb * size);
+    if (rb->buf == NULL) {
+      return NGHTTP3_ERR_NOMEM;
+    }
+  } else {
+    rb->buf = NULL;
   }
 
   rb->mem = mem;
@@ -102,6 +106,7 @@ int nghttp3_ringbuf_full(nghttp3_ringbuf *rb) { return rb->len == rb->nmemb; }
 
 int nghttp3_ringbuf_reserve(nghttp3_ringbuf *rb, size_t nmemb) {
   uint8_t *buf;
+  size_t n;
 
   assert(1 == __builtin_popcount((unsigned int)nmemb));
 
@@ -109,13 +114,24 @@ int nghttp3_ringbuf_reserve(nghttp3_ringbuf *rb, size_t nmemb) {
     return 0;
   }
 
-  buf = nghttp3_mem_realloc(rb->mem, rb->buf, nmemb * rb->size);
+  buf = nghttp3_mem_malloc(rb->mem, nmemb * rb->size);
   if (buf == NULL) {
     return NGHTTP3_ERR_NOMEM;
   }
 
+  /* Elements might wrap around the end of the old buffer.  Store them
+     from the beginning of the new buffer. */
+  if (rb->len) {
+    n = nghttp3_min(rb->len, rb->nmemb - rb->first);
+    memcpy(buf, rb->buf + rb->first * rb->size, n * rb->size);
+    memcpy(buf + n * rb->size, rb->buf, (rb->len - n) * rb->size);
+  }
+
+  nghttp3_mem_free(rb->mem, rb->buf);
+
   rb->buf = buf;
   rb->nmemb = nmemb;
+  rb->first = 0;
 
   return 0;
 }
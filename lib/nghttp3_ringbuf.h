@@ -52,7 +52,8 @@ typedef struct {
 /*
  * nghttp3_ringbuf_init initializes |rb|.  |nmemb| is the number of
  * elements that can be stored in this buffer.  |size| is the size of
- * each element.  |size| must be power of 2.
+ * each element.  |nmemb| must be power of 2, or 0.  If |nmemb| is 0,
+ * no memory is allocated until nghttp3_ringbuf_reserve is called.
  *
  * This function returns 0 if it succeeds, or one of the following
  * negative error codes:
@@ -108,6 +109,17 @@ size_t nghttp3_ringbuf_len(nghttp3_ringbuf *rb);
 /* nghttp3_ringbuf_full returns nonzero if |rb| is full. */
 int nghttp3_ringbuf_full(nghttp3_ringbuf *rb);
 
+/*
+ * nghttp3_ringbuf_reserve grows the capacity of |rb| to |nmemb|
+ * elements, keeping the stored elements.  |nmemb| must be power of
+ * 2.  It does nothing if the capacity is already at least |nmemb|.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGHTTP3_ERR_NOMEM
+ *     Out of memory.
+ */
 int nghttp3_ringbuf_reserve(nghttp3_ringbuf *rb, size_t nmemb);
 
 #endif /* NGHTTP3_RINGBUF_H */
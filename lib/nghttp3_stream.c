@@ -27,18 +27,24 @@
 #include <string.h>
 #include <assert.h>
 #include <stdio.h>
+#ifdef HAVE_SYS_MMAN_H
+#  include <sys/mman.h>
+#endif /* HAVE_SYS_MMAN_H */
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>
+#endif /* HAVE_UNISTD_H */
 
 #include "nghttp3_conv.h"
 #include "nghttp3_macro.h"
 #include "nghttp3_frame.h"
 #include "nghttp3_conn.h"
 #include "nghttp3_str.h"
+#include "nghttp3_vec.h"
 
 int nghttp3_stream_new(nghttp3_stream **pstream, int64_t stream_id,
                        uint64_t seq, uint32_t weight, nghttp3_tnode *parent,
                        const nghttp3_stream_callbacks *callbacks,
                        const nghttp3_mem *mem) {
-  int rv;
   nghttp3_stream *stream = nghttp3_mem_calloc(mem, 1, sizeof(nghttp3_stream));
   nghttp3_node_id nid;
 
@@ -51,26 +57,14 @@ int nghttp3_stream_new(nghttp3_stream **pstream, int64_t stream_id,
       nghttp3_node_id_init(&nid, NGHTTP3_NODE_ID_TYPE_STREAM, stream_id), seq,
       weight, parent, mem);
 
-  rv = nghttp3_ringbuf_init(&stream->frq, 16, sizeof(nghttp3_frame_entry), mem);
-  if (rv != 0) {
-    goto frq_init_fail;
-  }
-
-  rv = nghttp3_ringbuf_init(&stream->chunks, 16, sizeof(nghttp3_buf), mem);
-  if (rv != 0) {
-    goto chunks_init_fail;
-  }
-
-  rv = nghttp3_ringbuf_init(&stream->outq, 16, sizeof(nghttp3_typed_buf), mem);
-  if (rv != 0) {
-    goto outq_init_fail;
-  }
-
-  rv = nghttp3_ringbuf_init(&stream->inq, 16, sizeof(nghttp3_buf), mem);
-  if (rv != 0) {
-    goto inq_init_fail;
-  }
+  /* Ring buffers are allocated on first use.  nghttp3_ringbuf_init
+     never fails if nmemb is 0. */
+  nghttp3_ringbuf_init(&stream->frq, 0, sizeof(nghttp3_frame_entry), mem);
+  nghttp3_ringbuf_init(&stream->chunks, 0, sizeof(nghttp3_buf), mem);
+  nghttp3_ringbuf_init(&stream->outq, 0, sizeof(nghttp3_typed_buf), mem);
+  nghttp3_ringbuf_init(&stream->inq, 0, sizeof(nghttp3_buf), mem);
 
+  nghttp3_urgq_entry_init(&stream->urge);
   nghttp3_qpack_stream_context_init(&stream->qpack_sctx, stream_id, mem);
 
   stream->stream_id = stream_id;
@@ -85,17 +79,25 @@ int nghttp3_stream_new(nghttp3_stream **pstream, int64_t stream_id,
   *pstream = stream;
 
   return 0;
+}
 
-inq_init_fail:
-  nghttp3_ringbuf_free(&stream->outq);
-outq_init_fail:
-  nghttp3_ringbuf_free(&stream->chunks);
-chunks_init_fail:
-  nghttp3_ringbuf_free(&stream->frq);
-frq_init_fail:
-  nghttp3_mem_free(mem, stream);
+/*
+ * stream_ringbuf_reserve makes room for at least one more element in
+ * |rb|, which is one of the ring buffers of a stream.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGHTTP3_ERR_NOMEM
+ *     Out of memory.
+ */
+static int stream_ringbuf_reserve(nghttp3_ringbuf *rb) {
+  if (!nghttp3_ringbuf_full(rb)) {
+    return 0;
+  }
 
-  return rv;
+  return nghttp3_ringbuf_reserve(
+      rb, nghttp3_max(NGHTTP3_STREAM_MIN_RINGBUF_NMEMB, rb->nmemb * 2));
 }
 
 static void delete_outq(nghttp3_ringbuf *outq, const nghttp3_mem *mem) {
@@ -142,12 +144,180 @@ static void delete_frq(nghttp3_ringbuf *frq, const nghttp3_mem *mem) {
   nghttp3_ringbuf_free(frq);
 }
 
+/*
+ * stream_outq_end returns the stream offset just past the last
+ * element in outq.
+ */
+static uint64_t stream_outq_end(nghttp3_stream *stream) {
+  nghttp3_ringbuf *outq = &stream->outq;
+  size_t len = nghttp3_ringbuf_len(outq);
+  nghttp3_typed_buf *tbuf;
+
+  if (len == 0) {
+    return stream->ack_base;
+  }
+
+  tbuf = nghttp3_ringbuf_get(outq, len - 1);
+
+  return tbuf->offset + nghttp3_buf_len(&tbuf->buf);
+}
+
+/*
+ * stream_write_offset returns the stream offset up to which data
+ * have been written.
+ */
+static uint64_t stream_write_offset(nghttp3_stream *stream) {
+  nghttp3_ringbuf *outq = &stream->outq;
+  nghttp3_typed_buf *tbuf;
+
+  if (stream->outq_idx < nghttp3_ringbuf_len(outq)) {
+    tbuf = nghttp3_ringbuf_get(outq, stream->outq_idx);
+    return tbuf->offset + stream->outq_offset;
+  }
+
+  return stream_outq_end(stream);
+}
+
+/*
+ * stream_unsent returns the number of bytes in outq which have not
+ * been written yet.
+ */
+static size_t stream_unsent(nghttp3_stream *stream) {
+  return (size_t)(stream_outq_end(stream) - stream_write_offset(stream));
+}
+
+/*
+ * stream_tx_buffered_counted returns nonzero if the data buffered in
+ * outq of |stream| is counted toward the connection wide budget.
+ */
+static int stream_tx_buffered_counted(nghttp3_stream *stream) {
+  return stream->conn && !nghttp3_stream_uni(stream->stream_id);
+}
+
+void nghttp3_stream_delete_file(nghttp3_stream *stream) {
+  nghttp3_stream_file *file = stream->file;
+
+#ifdef HAVE_SYS_MMAN_H
+  if (file->unmapped < file->maplen) {
+    munmap(file->base + file->unmapped, file->maplen - file->unmapped);
+  }
+#endif /* HAVE_SYS_MMAN_H */
+
+  nghttp3_mem_free(stream->mem, file);
+  stream->file = NULL;
+}
+
+void nghttp3_stream_delete_cookies(nghttp3_stream *stream) {
+  nghttp3_ringbuf *cookies = stream->cookies;
+  nghttp3_qpack_nv *nv;
+  size_t i, len = nghttp3_ringbuf_len(cookies);
+
+  for (i = 0; i < len; ++i) {
+    nv = nghttp3_ringbuf_get(cookies, i);
+    nghttp3_rcbuf_decref(nv->name);
+    nghttp3_rcbuf_decref(nv->value);
+  }
+
+  nghttp3_ringbuf_free(cookies);
+  nghttp3_mem_free(stream->mem, cookies);
+  stream->cookies = NULL;
+}
+
+/*
+ * stream_file_release unmaps the pages of the mapped file which are
+ * entirely acknowledged, provided that the data up to |last| have
+ * been acknowledged.  If the whole mapping is acknowledged, the file
+ * is deleted.
+ */
+static void stream_file_release(nghttp3_stream *stream, const uint8_t *last) {
+  nghttp3_stream_file *file = stream->file;
+  size_t acked = (size_t)(last - file->base);
+  size_t n;
+
+  if (acked == file->maplen) {
+    nghttp3_stream_delete_file(stream);
+    return;
+  }
+
+  n = acked / file->pagesize * file->pagesize;
+  if (n <= file->unmapped) {
+    return;
+  }
+
+#ifdef HAVE_SYS_MMAN_H
+  munmap(file->base + file->unmapped, n - file->unmapped);
+#endif /* HAVE_SYS_MMAN_H */
+
+  file->unmapped = n;
+}
+
+/*
+ * stream_file_contains returns nonzero if |tbuf| points to the mapped
+ * file of |stream|.
+ */
+static int stream_file_contains(nghttp3_stream *stream,
+                                const nghttp3_typed_buf *tbuf) {
+  nghttp3_stream_file *file = stream->file;
+
+  return file && tbuf->type == NGHTTP3_BUF_TYPE_ALIEN &&
+         file->base <= tbuf->buf.pos &&
+         tbuf->buf.last <= file->base + file->maplen;
+}
+
+/*
+ * stream_stats_release subtracts the bytes which |stream| still holds
+ * in outq, inq and chunks from the statistics of its connection.
+ */
+static void stream_stats_release(nghttp3_stream *stream) {
+  nghttp3_conn_stats *stats = &stream->conn->stats;
+  size_t i, len;
+
+  stats->outq_bytes -= stream_outq_end(stream) - stream->ack_base;
+
+  len = nghttp3_ringbuf_len(&stream->inq);
+  for (i = 0; i < len; ++i) {
+    stats->inq_bytes -=
+        nghttp3_buf_len((nghttp3_buf *)nghttp3_ringbuf_get(&stream->inq, i));
+  }
+
+  stats->chunk_bytes -=
+      nghttp3_ringbuf_len(&stream->chunks) * NGHTTP3_STREAM_CHUNK_SIZE;
+}
+
+static void stream_delete_ack_gaptr(nghttp3_stream *stream) {
+  nghttp3_gaptr_free(stream->ack_gaptr);
+  nghttp3_mem_free(stream->mem, stream->ack_gaptr);
+  stream->ack_gaptr = NULL;
+}
+
 void nghttp3_stream_del(nghttp3_stream *stream) {
   if (stream == NULL) {
     return;
   }
 
+  if (stream_tx_buffered_counted(stream)) {
+    stream->conn->tx.buffered -= stream_outq_end(stream) - stream->ack_base;
+    nghttp3_stream_tx_budget_unwait(stream);
+  }
+
+  if (stream->conn) {
+    stream_stats_release(stream);
+  }
+
+  if (stream->ack_gaptr) {
+    stream_delete_ack_gaptr(stream);
+  }
+
+  if (stream->file) {
+    nghttp3_stream_delete_file(stream);
+  }
+  if (stream->timing) {
+    nghttp3_mem_free(stream->mem, stream->timing);
+  }
   nghttp3_qpack_stream_context_free(&stream->qpack_sctx);
+  if (stream->cookies) {
+    nghttp3_stream_delete_cookies(stream);
+  }
   delete_chunks(&stream->inq, stream->mem);
   delete_outq(&stream->outq, stream->mem);
   delete_chunks(&stream->chunks, stream->mem);
@@ -215,11 +385,9 @@ int nghttp3_stream_frq_add(nghttp3_stream *stream,
   nghttp3_frame_entry *dest;
   int rv;
 
-  if (nghttp3_ringbuf_full(frq)) {
-    rv = nghttp3_ringbuf_reserve(frq, nghttp3_ringbuf_len(frq) * 2);
-    if (rv != 0) {
-      return rv;
-    }
+  rv = stream_ringbuf_reserve(frq);
+  if (rv != 0) {
+    return rv;
   }
 
   dest = nghttp3_ringbuf_push_back(frq);
@@ -233,6 +401,15 @@ int nghttp3_stream_fill_outq(nghttp3_stream *stream) {
   nghttp3_frame_entry *frent;
   int data_eof;
   int rv;
+  size_t low_watermark = stream->conn
+                             ? stream->conn->local.settings.tx_low_watermark
+                             : NGHTTP3_DEFAULT_TX_LOW_WATERMARK;
+
+  /* Do not pull more data until the unsent data drains below the low
+     watermark. */
+  if (stream_unsent(stream) > low_watermark) {
+    return 0;
+  }
 
   for (; nghttp3_ringbuf_len(frq) && !nghttp3_stream_outq_is_full(stream);) {
     frent = nghttp3_ringbuf_get(frq, 0);
@@ -258,7 +435,11 @@ int nghttp3_stream_fill_outq(nghttp3_stream *stream) {
       nghttp3_frame_headers_free(&frent->fr.headers, stream->mem);
       break;
     case NGHTTP3_FRAME_DATA:
-      for (; !nghttp3_stream_outq_is_full(stream);) {
+      for (;;) {
+        if (nghttp3_stream_outq_is_full(stream)) {
+          /* Keep frent to pull the remaining data later. */
+          return 0;
+        }
         rv = nghttp3_stream_write_data(stream, &data_eof, frent);
         if (rv != 0) {
           return rv;
@@ -364,6 +545,15 @@ int nghttp3_stream_write_settings(nghttp3_stream *stream,
     return rv;
   }
 
+  if (stream->conn) {
+    nghttp3_frame_stats_add(&stream->conn->stats.sent, &fr.settings.hd);
+
+    if (stream->conn->callbacks.trace) {
+      nghttp3_conn_trace_frame(stream->conn, NGHTTP3_TRACE_EVENT_FRAME_SENT,
+                               stream->stream_id, &fr.settings.hd);
+    }
+  }
+
   tbuf.buf.last = chunk->last;
 
   return nghttp3_stream_outq_add(stream, &tbuf);
@@ -394,6 +584,15 @@ int nghttp3_stream_write_priority(nghttp3_stream *stream,
     return rv;
   }
 
+  if (stream->conn) {
+    nghttp3_frame_stats_add(&stream->conn->stats.sent, &fr->hd);
+
+    if (stream->conn->callbacks.trace) {
+      nghttp3_conn_trace_frame(stream->conn, NGHTTP3_TRACE_EVENT_FRAME_SENT,
+                               stream->stream_id, &fr->hd);
+    }
+  }
+
   tbuf.buf.last = chunk->last;
 
   return nghttp3_stream_outq_add(stream, &tbuf);
@@ -443,6 +642,13 @@ int nghttp3_stream_write_headers(nghttp3_stream *stream,
     goto fail;
   }
 
+  nghttp3_frame_stats_add(&stream->conn->stats.sent, &hd);
+
+  if (stream->conn->callbacks.trace) {
+    nghttp3_conn_trace_frame(stream->conn, NGHTTP3_TRACE_EVENT_FRAME_SENT,
+                             stream->stream_id, &hd);
+  }
+
   tbuf.buf.last = chunk->last;
 
   rv = nghttp3_stream_outq_add(stream, &tbuf);
@@ -469,6 +675,8 @@ int nghttp3_stream_write_headers(nghttp3_stream *stream,
   if (nghttp3_buf_len(&ebuf)) {
     assert(qenc_stream);
 
+    stream->conn->stats.qpack_enc_stream_sent += nghttp3_buf_len(&ebuf);
+
     nghttp3_typed_buf_init(&tbuf, &ebuf, NGHTTP3_BUF_TYPE_PRIVATE);
     rv = nghttp3_stream_outq_add(qenc_stream, &tbuf);
     if (rv != 0) {
@@ -492,6 +700,21 @@ fail:
   return rv;
 }
 
+/*
+ * stream_read_data_blocked marks |stream| blocked because an
+ * application has no data to send now.
+ */
+static void stream_read_data_blocked(nghttp3_stream *stream) {
+  stream->flags |= NGHTTP3_STREAM_FLAG_READ_DATA_BLOCKED;
+
+  if (stream->conn->callbacks.trace) {
+    nghttp3_conn_trace_blocked(stream->conn,
+                               NGHTTP3_TRACE_EVENT_STREAM_BLOCKED,
+                               stream->stream_id,
+                               NGHTTP3_TRACE_BLOCKED_READ_DATA);
+  }
+}
+
 int nghttp3_stream_write_data(nghttp3_stream *stream, int *peof,
                               nghttp3_frame_entry *frent) {
   int rv;
@@ -500,26 +723,74 @@ int nghttp3_stream_write_data(nghttp3_stream *stream, int *peof,
   nghttp3_buf buf;
   nghttp3_buf *chunk;
   nghttp3_read_data_callback read_data = frent->aux.data.dr.read_data;
+  nghttp3_read_data_vec_callback read_data_vec =
+      frent->aux.data.dr.read_data_vec;
   nghttp3_conn *conn = stream->conn;
   const uint8_t *data = NULL;
   size_t datalen = 0;
   uint32_t flags = 0;
   nghttp3_frame_hd hd;
+  nghttp3_vec vec[NGHTTP3_STREAM_MAX_DATA_VECCNT];
+  size_t veccnt;
+  ssize_t sveccnt;
+  size_t i;
 
   assert(!(stream->flags & NGHTTP3_STREAM_FLAG_READ_DATA_BLOCKED));
-  assert(read_data);
+  assert((read_data == NULL) || (read_data_vec == NULL));
   assert(conn);
 
   *peof = 0;
 
-  rv = read_data(conn, stream->stream_id, &data, &datalen, &flags,
-                 conn->user_data, stream->user_data);
-  if (rv != 0) {
-    if (rv == NGHTTP3_ERR_WOULDBLOCKED) {
-      stream->flags |= NGHTTP3_STREAM_FLAG_READ_DATA_BLOCKED;
-      return 0;
+  if (stream->timing && (read_data || read_data_vec) &&
+      stream->timing->first_read_data == NGHTTP3_TIMESTAMP_NONE) {
+    stream->timing->first_read_data = nghttp3_conn_get_timestamp(conn);
+  }
+
+  if (read_data == NULL && read_data_vec == NULL) {
+    assert(stream->file);
+    assert(stream->file->pos < stream->file->maplen);
+
+    datalen = nghttp3_min(stream->file->maplen - stream->file->pos,
+                          NGHTTP3_STREAM_MAX_FILE_DATALEN);
+    vec[0].base = stream->file->base + stream->file->pos;
+    vec[0].len = datalen;
+    veccnt = 1;
+
+    stream->file->pos += datalen;
+    if (stream->file->pos == stream->file->maplen) {
+      flags |= NGHTTP3_DATA_FLAG_EOF;
     }
-    return NGHTTP3_ERR_CALLBACK_FAILURE;
+  } else if (read_data_vec) {
+    sveccnt = read_data_vec(conn, stream->stream_id, vec, nghttp3_arraylen(vec),
+                            &flags, conn->user_data, stream->user_data);
+    if (sveccnt < 0) {
+      if (sveccnt == NGHTTP3_ERR_WOULDBLOCKED) {
+        stream_read_data_blocked(stream);
+        return 0;
+      }
+      return NGHTTP3_ERR_CALLBACK_FAILURE;
+    }
+
+    if ((size_t)sveccnt > nghttp3_arraylen(vec)) {
+      return NGHTTP3_ERR_CALLBACK_FAILURE;
+    }
+
+    veccnt = (size_t)sveccnt;
+    datalen = nghttp3_vec_len(vec, veccnt);
+  } else {
+    rv = read_data(conn, stream->stream_id, &data, &datalen, &flags,
+                   conn->user_data, stream->user_data);
+    if (rv != 0) {
+      if (rv == NGHTTP3_ERR_WOULDBLOCKED) {
+        stream_read_data_blocked(stream);
+        return 0;
+      }
+      return NGHTTP3_ERR_CALLBACK_FAILURE;
+    }
+
+    vec[0].base = (uint8_t *)data;
+    vec[0].len = datalen;
+    veccnt = 1;
   }
 
   assert(datalen || flags & NGHTTP3_DATA_FLAG_EOF);
@@ -546,6 +817,13 @@ int nghttp3_stream_write_data(nghttp3_stream *stream, int *peof,
     return rv;
   }
 
+  nghttp3_frame_stats_add(&conn->stats.sent, &hd);
+
+  if (conn->callbacks.trace) {
+    nghttp3_conn_trace_frame(conn, NGHTTP3_TRACE_EVENT_FRAME_SENT,
+                             stream->stream_id, &hd);
+  }
+
   tbuf.buf.last = chunk->last;
 
   rv = nghttp3_stream_outq_add(stream, &tbuf);
@@ -553,12 +831,18 @@ int nghttp3_stream_write_data(nghttp3_stream *stream, int *peof,
     return rv;
   }
 
-  nghttp3_buf_wrap_init(&buf, (uint8_t *)data, datalen);
-  buf.last = buf.end;
-  nghttp3_typed_buf_init(&tbuf, &buf, NGHTTP3_BUF_TYPE_ALIEN);
-  rv = nghttp3_stream_outq_add(stream, &tbuf);
-  if (rv != 0) {
-    return rv;
+  for (i = 0; i < veccnt; ++i) {
+    if (vec[i].len == 0) {
+      continue;
+    }
+
+    nghttp3_buf_wrap_init(&buf, vec[i].base, vec[i].len);
+    buf.last = buf.end;
+    nghttp3_typed_buf_init(&tbuf, &buf, NGHTTP3_BUF_TYPE_ALIEN);
+    rv = nghttp3_stream_outq_add(stream, &tbuf);
+    if (rv != 0) {
+      return rv;
+    }
   }
 
   return 0;
@@ -588,6 +872,8 @@ int nghttp3_stream_write_qpack_decoder_stream(nghttp3_stream *stream) {
     return 0;
   }
 
+  stream->conn->stats.qpack_dec_stream_sent += nghttp3_buf_len(&dbuf);
+
   nghttp3_typed_buf_init(&tbuf, &dbuf, NGHTTP3_BUF_TYPE_PRIVATE);
   rv = nghttp3_stream_outq_add(stream, &tbuf);
   if (rv != 0) {
@@ -599,8 +885,19 @@ int nghttp3_stream_write_qpack_decoder_stream(nghttp3_stream *stream) {
 }
 
 int nghttp3_stream_outq_is_full(nghttp3_stream *stream) {
-  /* TODO Verify that the limit is reasonable. */
-  return nghttp3_ringbuf_len(&stream->outq) >= 32;
+  size_t high_watermark = stream->conn
+                              ? stream->conn->local.settings.tx_high_watermark
+                              : NGHTTP3_DEFAULT_TX_HIGH_WATERMARK;
+
+  return stream_unsent(stream) >= high_watermark ||
+         nghttp3_stream_tx_budget_exhausted(stream);
+}
+
+int nghttp3_stream_tx_budget_exhausted(nghttp3_stream *stream) {
+  nghttp3_conn *conn = stream->conn;
+
+  return stream_tx_buffered_counted(stream) &&
+         conn->tx.buffered >= conn->local.settings.max_tx_buffered;
 }
 
 int nghttp3_stream_outq_add(nghttp3_stream *stream,
@@ -610,6 +907,15 @@ int nghttp3_stream_outq_add(nghttp3_stream *stream,
   nghttp3_typed_buf *dest;
   size_t len = nghttp3_ringbuf_len(outq);
 
+  uint64_t offset = stream->ack_base;
+
+  if (stream_tx_buffered_counted(stream)) {
+    stream->conn->tx.buffered += nghttp3_buf_len(&tbuf->buf);
+  }
+  if (stream->conn) {
+    stream->conn->stats.outq_bytes += nghttp3_buf_len(&tbuf->buf);
+  }
+
   if (len) {
     dest = nghttp3_ringbuf_get(outq, len - 1);
     if (dest->type == tbuf->type && dest->type == NGHTTP3_BUF_TYPE_SHARED &&
@@ -618,17 +924,18 @@ int nghttp3_stream_outq_add(nghttp3_stream *stream,
       dest->buf.end = tbuf->buf.end;
       return 0;
     }
+
+    offset = dest->offset + nghttp3_buf_len(&dest->buf);
   }
 
-  if (nghttp3_ringbuf_full(outq)) {
-    rv = nghttp3_ringbuf_reserve(outq, len * 2);
-    if (rv != 0) {
-      return rv;
-    }
+  rv = stream_ringbuf_reserve(outq);
+  if (rv != 0) {
+    return rv;
   }
 
   dest = nghttp3_ringbuf_push_back(outq);
   *dest = *tbuf;
+  dest->offset = offset;
 
   return 0;
 }
@@ -649,21 +956,23 @@ int nghttp3_stream_ensure_chunk(nghttp3_stream *stream, size_t need) {
 
   assert(NGHTTP3_STREAM_CHUNK_SIZE >= need);
 
+  rv = stream_ringbuf_reserve(chunks);
+  if (rv != 0) {
+    return rv;
+  }
+
   p = nghttp3_mem_malloc(stream->mem, NGHTTP3_STREAM_CHUNK_SIZE);
   if (p == NULL) {
     return NGHTTP3_ERR_NOMEM;
   }
 
-  if (nghttp3_ringbuf_full(chunks)) {
-    rv = nghttp3_ringbuf_reserve(chunks, len * 2);
-    if (rv != 0) {
-      return rv;
-    }
-  }
-
   chunk = nghttp3_ringbuf_push_back(chunks);
   nghttp3_buf_wrap_init(chunk, p, NGHTTP3_STREAM_CHUNK_SIZE);
 
+  if (stream->conn) {
+    stream->conn->stats.chunk_bytes += NGHTTP3_STREAM_CHUNK_SIZE;
+  }
+
   return 0;
 }
 
@@ -681,10 +990,55 @@ int nghttp3_stream_is_blocked(nghttp3_stream *stream) {
          (stream->flags & NGHTTP3_STREAM_FLAG_READ_DATA_BLOCKED);
 }
 
+void nghttp3_stream_tx_budget_wait(nghttp3_stream *stream) {
+  nghttp3_conn *conn = stream->conn;
+
+  if (stream->flags & NGHTTP3_STREAM_FLAG_TX_BUDGET_WAIT) {
+    return;
+  }
+
+  stream->flags |= NGHTTP3_STREAM_FLAG_TX_BUDGET_WAIT;
+  stream->budget_prev = NULL;
+  stream->budget_next = conn->tx.budget_waitq;
+  if (conn->tx.budget_waitq) {
+    conn->tx.budget_waitq->budget_prev = stream;
+  }
+  conn->tx.budget_waitq = stream;
+}
+
+void nghttp3_stream_tx_budget_unwait(nghttp3_stream *stream) {
+  if (!(stream->flags & NGHTTP3_STREAM_FLAG_TX_BUDGET_WAIT)) {
+    return;
+  }
+
+  stream->flags &= (uint16_t)~NGHTTP3_STREAM_FLAG_TX_BUDGET_WAIT;
+
+  if (stream->budget_prev) {
+    stream->budget_prev->budget_next = stream->budget_next;
+  } else {
+    stream->conn->tx.budget_waitq = stream->budget_next;
+  }
+  if (stream->budget_next) {
+    stream->budget_next->budget_prev = stream->budget_prev;
+  }
+
+  stream->budget_prev = stream->budget_next = NULL;
+}
+
 int nghttp3_stream_require_schedule(nghttp3_stream *stream) {
-  return (nghttp3_ringbuf_len(&stream->outq) ||
-          nghttp3_ringbuf_len(&stream->frq)) &&
-         !nghttp3_stream_is_blocked(stream);
+  if (nghttp3_stream_is_blocked(stream)) {
+    return 0;
+  }
+
+  if (stream_unsent(stream)) {
+    return 1;
+  }
+
+  if (nghttp3_ringbuf_len(&stream->frq) == 0) {
+    return 0;
+  }
+
+  return !nghttp3_stream_tx_budget_exhausted(stream);
 }
 
 ssize_t nghttp3_stream_writev(nghttp3_stream *stream, int *pfin,
@@ -722,11 +1076,139 @@ ssize_t nghttp3_stream_writev(nghttp3_stream *stream, int *pfin,
 
   /* TODO Rework this if we have finished implementing HTTP
      messaging */
-  *pfin = i == len && (stream->flags & NGHTTP3_STREAM_FLAG_WRITE_END_STREAM);
+  /* A DATA frame left in frq still has data to pull even if outq is
+     drained. */
+  *pfin = i == len && nghttp3_ringbuf_len(&stream->frq) == 0 &&
+          (stream->flags & NGHTTP3_STREAM_FLAG_WRITE_END_STREAM);
 
   return vec - vbegin;
 }
 
+/*
+ * stream_outq_find returns the index of the element in outq which
+ * contains stream offset |offset|.  |offset| must not be less than
+ * the stream offset of the first element in outq.  If |offset| is
+ * past the end of the last element, this function returns the index
+ * of the last element.
+ */
+static size_t stream_outq_find(nghttp3_stream *stream, uint64_t offset) {
+  nghttp3_ringbuf *outq = &stream->outq;
+  size_t lo = 0, hi = nghttp3_ringbuf_len(outq), mid;
+  nghttp3_typed_buf *tbuf;
+
+  assert(hi);
+
+  /* Find the last element whose offset is less than or equal to
+     |offset|. */
+  for (; hi - lo > 1;) {
+    mid = lo + (hi - lo) / 2;
+    tbuf = nghttp3_ringbuf_get(outq, mid);
+    if (tbuf->offset <= offset) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+ssize_t nghttp3_stream_get_range(nghttp3_stream *stream, nghttp3_vec *vec,
+                                 size_t veccnt, uint64_t offset,
+                                 size_t datalen) {
+  nghttp3_ringbuf *outq = &stream->outq;
+  size_t i, len = nghttp3_ringbuf_len(outq);
+  uint64_t end = offset + datalen;
+  uint64_t base;
+  size_t buflen, n;
+  nghttp3_vec *vbegin = vec, *vend = vec + veccnt;
+  nghttp3_typed_buf *tbuf;
+
+  if (offset < stream->ack_base + stream->ack_offset ||
+      end > stream_write_offset(stream)) {
+    return NGHTTP3_ERR_INVALID_ARGUMENT;
+  }
+
+  if (datalen == 0) {
+    return 0;
+  }
+
+  for (i = stream_outq_find(stream, offset); i < len && vec != vend;
+       ++i, ++vec) {
+    tbuf = nghttp3_ringbuf_get(outq, i);
+    /* Application might have released the memory which has been
+       acknowledged. */
+    if (tbuf->flags & NGHTTP3_TYPED_BUF_FLAG_ACKED) {
+      break;
+    }
+
+    base = nghttp3_max(offset, tbuf->offset);
+    buflen = nghttp3_buf_len(&tbuf->buf);
+    n = (size_t)(nghttp3_min(end, tbuf->offset + buflen) - base);
+
+    vec->base = tbuf->buf.pos + (base - tbuf->offset);
+    vec->len = n;
+
+    if (tbuf->offset + buflen >= end) {
+      ++vec;
+      break;
+    }
+  }
+
+  return vec - vbegin;
+}
+
+int nghttp3_stream_map_file(nghttp3_stream *stream,
+                            const nghttp3_data_file *file) {
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_UNISTD_H)
+  long pagesize = sysconf(_SC_PAGESIZE);
+  int64_t offset;
+  size_t skip;
+  void *p;
+
+  if (stream->file || file->len == 0 || file->offset < 0 || pagesize <= 0) {
+    return NGHTTP3_ERR_INVALID_ARGUMENT;
+  }
+
+  /* mmap requires offset aligned to page boundary. */
+  offset = file->offset / pagesize * pagesize;
+  skip = (size_t)(file->offset - offset);
+
+  if (file->len > SIZE_MAX - skip) {
+    return NGHTTP3_ERR_INVALID_ARGUMENT;
+  }
+
+  stream->file = nghttp3_mem_malloc(stream->mem, sizeof(nghttp3_stream_file));
+  if (stream->file == NULL) {
+    return NGHTTP3_ERR_NOMEM;
+  }
+
+  p = mmap(NULL, skip + file->len, PROT_READ, MAP_SHARED, file->fd,
+           (off_t)offset);
+  if (p == MAP_FAILED) {
+    nghttp3_mem_free(stream->mem, stream->file);
+    stream->file = NULL;
+    return NGHTTP3_ERR_INVALID_ARGUMENT;
+  }
+
+  stream->file->base = p;
+  stream->file->maplen = skip + file->len;
+  stream->file->pos = skip;
+  /* The bytes before the region are never acknowledged.  They are
+     unmapped with the page containing the first byte of the
+     region. */
+  stream->file->unmapped = 0;
+  stream->file->pagesize = (size_t)pagesize;
+
+  return 0;
+#else  /* !(defined(HAVE_SYS_MMAN_H) && defined(HAVE_UNISTD_H)) */
+  (void)stream;
+  (void)file;
+
+  return NGHTTP3_ERR_INVALID_ARGUMENT;
+#endif /* !(defined(HAVE_SYS_MMAN_H) && defined(HAVE_UNISTD_H)) */
+}
+
 int nghttp3_stream_add_outq_offset(nghttp3_stream *stream, size_t n) {
   nghttp3_ringbuf *outq = &stream->outq;
   size_t i;
@@ -782,6 +1264,10 @@ static int stream_pop_outq_entry(nghttp3_stream *stream,
     if (chunk->last == tbuf->buf.last) {
       nghttp3_buf_free(chunk, stream->mem);
       nghttp3_ringbuf_pop_front(chunks);
+
+      if (stream->conn) {
+        stream->conn->stats.chunk_bytes -= NGHTTP3_STREAM_CHUNK_SIZE;
+      }
     }
   };
 
@@ -790,12 +1276,20 @@ static int stream_pop_outq_entry(nghttp3_stream *stream,
   return 0;
 }
 
-int nghttp3_stream_add_ack_offset(nghttp3_stream *stream, size_t n) {
+/*
+ * stream_ack_contiguous acknowledges |n| bytes of data following the
+ * contiguously acknowledged offset, and removes the fully
+ * acknowledged buffers from the front of outq.
+ */
+static int stream_ack_contiguous(nghttp3_stream *stream, size_t n) {
   nghttp3_ringbuf *outq = &stream->outq;
   size_t offset = stream->ack_offset + n;
   size_t buflen;
   size_t npopped = 0;
   size_t nack;
+  /* nacked is the number of bytes of application data acknowledged
+     by this call.  Consecutive buffers are notified at once. */
+  size_t nacked = 0;
   nghttp3_typed_buf *tbuf;
   int rv;
 
@@ -803,25 +1297,31 @@ int nghttp3_stream_add_ack_offset(nghttp3_stream *stream, size_t n) {
     tbuf = nghttp3_ringbuf_get(outq, 0);
     buflen = nghttp3_buf_len(&tbuf->buf);
 
-    if (tbuf->type == NGHTTP3_BUF_TYPE_ALIEN) {
+    if (tbuf->type == NGHTTP3_BUF_TYPE_ALIEN &&
+        !(tbuf->flags & NGHTTP3_TYPED_BUF_FLAG_ACKED)) {
       nack = nghttp3_min(offset, buflen) - stream->ack_done;
-      if (stream->callbacks.acked_data) {
-        rv = stream->callbacks.acked_data(stream, stream->stream_id, nack,
-                                          stream->user_data);
-        if (rv != 0) {
-          return NGHTTP3_ERR_CALLBACK_FAILURE;
-        }
-      }
+      nacked += nack;
       stream->ack_done += nack;
     }
 
     if (offset >= buflen) {
+      if (stream_file_contains(stream, tbuf)) {
+        stream_file_release(stream, tbuf->buf.last);
+      }
+
       rv = stream_pop_outq_entry(stream, tbuf);
       if (rv != 0) {
         return rv;
       }
 
       offset -= buflen;
+      stream->ack_base += buflen;
+      if (stream_tx_buffered_counted(stream)) {
+        stream->conn->tx.buffered -= buflen;
+      }
+      if (stream->conn) {
+        stream->conn->stats.outq_bytes -= buflen;
+      }
       ++npopped;
       stream->ack_done = 0;
 
@@ -845,24 +1345,175 @@ int nghttp3_stream_add_ack_offset(nghttp3_stream *stream, size_t n) {
 
   stream->ack_offset = offset;
 
+  if (nacked && stream->callbacks.acked_data) {
+    rv = stream->callbacks.acked_data(stream, stream->stream_id, nacked,
+                                      stream->user_data);
+    if (rv != 0) {
+      return NGHTTP3_ERR_CALLBACK_FAILURE;
+    }
+  }
+
   return 0;
 }
 
-int nghttp3_stream_schedule(nghttp3_stream *stream) {
+/*
+ * stream_ack_covered notifies an application of the buffers of type
+ * NGHTTP3_BUF_TYPE_ALIEN which overlap the range [offset, offset +
+ * datalen) and are now entirely acknowledged.  Those buffers are not
+ * at the front of outq, and they are removed when the contiguously
+ * acknowledged offset passes them.
+ */
+static int stream_ack_covered(nghttp3_stream *stream, uint64_t offset,
+                              size_t datalen) {
+  nghttp3_ringbuf *outq = &stream->outq;
+  size_t i, len = nghttp3_ringbuf_len(outq);
+  uint64_t base = stream->ack_base;
+  uint64_t end = offset + datalen;
+  size_t buflen;
+  size_t nacked = 0;
+  nghttp3_typed_buf *tbuf;
+  int rv;
+
+  for (i = 0; i < len && base < end; ++i, base += buflen) {
+    tbuf = nghttp3_ringbuf_get(outq, i);
+    buflen = nghttp3_buf_len(&tbuf->buf);
+
+    if (base + buflen <= offset || tbuf->type != NGHTTP3_BUF_TYPE_ALIEN ||
+        (tbuf->flags & NGHTTP3_TYPED_BUF_FLAG_ACKED) ||
+        !nghttp3_gaptr_is_pushed(stream->ack_gaptr, base, buflen)) {
+      continue;
+    }
+
+    /* The first element in outq is never covered here because it
+       would have been removed by stream_ack_contiguous. */
+    assert(i > 0);
+
+    tbuf->flags |= NGHTTP3_TYPED_BUF_FLAG_ACKED;
+    nacked += buflen;
+  }
+
+  if (nacked && stream->callbacks.acked_data) {
+    rv = stream->callbacks.acked_data(stream, stream->stream_id, nacked,
+                                      stream->user_data);
+    if (rv != 0) {
+      return NGHTTP3_ERR_CALLBACK_FAILURE;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * stream_ack_gaptr_no_gap returns nonzero if |gaptr| has no
+ * acknowledged range beyond its first gap.
+ */
+static int stream_ack_gaptr_no_gap(nghttp3_gaptr *gaptr) {
+  nghttp3_psl_it it = nghttp3_psl_begin(&gaptr->gap);
+  nghttp3_range r = nghttp3_psl_it_range(&it);
+
+  return r.end == UINT64_MAX;
+}
+
+int nghttp3_stream_add_ack_offset(nghttp3_stream *stream, size_t n) {
+  return nghttp3_stream_add_ack_range(
+      stream, stream->ack_base + stream->ack_offset, n);
+}
+
+int nghttp3_stream_add_ack_range(nghttp3_stream *stream, uint64_t offset,
+                                 size_t datalen) {
+  uint64_t ack_offset = stream->ack_base + stream->ack_offset;
+  uint64_t end = offset + datalen;
+  uint64_t gap_offset;
   int rv;
 
-  rv = nghttp3_tnode_schedule(&stream->node, stream->unscheduled_nwrite);
+  if (end <= ack_offset) {
+    return 0;
+  }
+
+  if (stream->ack_gaptr == NULL) {
+    if (offset <= ack_offset) {
+      return stream_ack_contiguous(stream, (size_t)(end - ack_offset));
+    }
+
+    stream->ack_gaptr = nghttp3_mem_malloc(stream->mem, sizeof(nghttp3_gaptr));
+    if (stream->ack_gaptr == NULL) {
+      return NGHTTP3_ERR_NOMEM;
+    }
+
+    rv = nghttp3_gaptr_init(stream->ack_gaptr, stream->mem);
+    if (rv != 0) {
+      nghttp3_mem_free(stream->mem, stream->ack_gaptr);
+      stream->ack_gaptr = NULL;
+      return rv;
+    }
+
+    if (ack_offset) {
+      rv = nghttp3_gaptr_push(stream->ack_gaptr, 0, (size_t)ack_offset);
+      if (rv != 0) {
+        return rv;
+      }
+    }
+  }
+
+  rv = nghttp3_gaptr_push(stream->ack_gaptr, offset, datalen);
   if (rv != 0) {
     return rv;
   }
 
+  gap_offset = nghttp3_gaptr_first_gap_offset(stream->ack_gaptr);
+  if (gap_offset > ack_offset) {
+    rv = stream_ack_contiguous(stream, (size_t)(gap_offset - ack_offset));
+    if (rv != 0) {
+      return rv;
+    }
+  }
+
+  if (stream_ack_gaptr_no_gap(stream->ack_gaptr)) {
+    stream_delete_ack_gaptr(stream);
+    return 0;
+  }
+
+  if (end <= gap_offset) {
+    return 0;
+  }
+
+  return stream_ack_covered(stream, offset, datalen);
+}
+
+/*
+ * stream_urgq returns nghttp3_urgq which schedules |stream|, or NULL
+ * if |stream| is scheduled by the dependency tree.
+ */
+static nghttp3_urgq *stream_urgq(nghttp3_stream *stream) {
+  nghttp3_conn *conn = stream->conn;
+
+  if (conn && conn->local.settings.scheduler == NGHTTP3_SCHEDULER_URGENCY) {
+    return &conn->urgq;
+  }
+
+  return NULL;
+}
+
+int nghttp3_stream_schedule(nghttp3_stream *stream) {
+  nghttp3_urgq *urgq = stream_urgq(stream);
+  int rv;
+
+  if (urgq) {
+    nghttp3_urgq_schedule(urgq, &stream->urge);
+  } else {
+    rv = nghttp3_tnode_schedule(&stream->node, stream->unscheduled_nwrite);
+    if (rv != 0) {
+      return rv;
+    }
+  }
+
   stream->unscheduled_nwrite = 0;
 
   return 0;
 }
 
 int nghttp3_stream_ensure_scheduled(nghttp3_stream *stream) {
-  if (nghttp3_tnode_is_scheduled(&stream->node)) {
+  if (nghttp3_stream_is_scheduled(stream)) {
     return 0;
   }
 
@@ -870,9 +1521,110 @@ int nghttp3_stream_ensure_scheduled(nghttp3_stream *stream) {
 }
 
 void nghttp3_stream_unschedule(nghttp3_stream *stream) {
+  nghttp3_urgq *urgq = stream_urgq(stream);
+
+  if (urgq) {
+    nghttp3_urgq_unschedule(urgq, &stream->urge);
+    return;
+  }
+
   nghttp3_tnode_unschedule(&stream->node);
 }
 
+int nghttp3_stream_is_scheduled(nghttp3_stream *stream) {
+  if (stream_urgq(stream)) {
+    return stream->urge.queued;
+  }
+
+  return nghttp3_tnode_is_scheduled(&stream->node);
+}
+
+int nghttp3_stream_add_cookie(nghttp3_stream *stream,
+                              const nghttp3_qpack_nv *nv) {
+  int rv;
+
+  if (stream->cookies == NULL) {
+    stream->cookies = nghttp3_mem_malloc(stream->mem, sizeof(nghttp3_ringbuf));
+    if (stream->cookies == NULL) {
+      return NGHTTP3_ERR_NOMEM;
+    }
+
+    nghttp3_ringbuf_init(stream->cookies, 0, sizeof(nghttp3_qpack_nv),
+                         stream->mem);
+  }
+
+  rv = stream_ringbuf_reserve(stream->cookies);
+  if (rv != 0) {
+    return rv;
+  }
+
+  *(nghttp3_qpack_nv *)nghttp3_ringbuf_push_back(stream->cookies) = *nv;
+
+  return 0;
+}
+
+int nghttp3_stream_join_cookies(nghttp3_stream *stream, nghttp3_qpack_nv *nv) {
+  nghttp3_ringbuf *cookies = stream->cookies;
+  size_t i, len = nghttp3_ringbuf_len(cookies);
+  size_t valuelen = (len - 1) * 2;
+  nghttp3_qpack_nv *crumb;
+  nghttp3_rcbuf *value;
+  uint8_t *p;
+  uint8_t flags = NGHTTP3_NV_FLAG_NONE;
+  int rv;
+
+  assert(len);
+
+  if (len == 1) {
+    *nv = *(nghttp3_qpack_nv *)nghttp3_ringbuf_get(cookies, 0);
+    nghttp3_ringbuf_pop_front(cookies);
+    return 0;
+  }
+
+  for (i = 0; i < len; ++i) {
+    crumb = nghttp3_ringbuf_get(cookies, i);
+    valuelen += crumb->value->len;
+  }
+
+  rv = nghttp3_rcbuf_new(&value, valuelen + 1, stream->mem);
+  if (rv != 0) {
+    return rv;
+  }
+
+  p = value->base;
+
+  for (i = 0; i < len; ++i) {
+    crumb = nghttp3_ringbuf_get(cookies, i);
+    if (i) {
+      *p++ = ';';
+      *p++ = ' ';
+    }
+    p = nghttp3_cpymem(p, crumb->value->base, crumb->value->len);
+    flags |= crumb->flags;
+  }
+
+  *p = '\0';
+  value->len = valuelen;
+
+  crumb = nghttp3_ringbuf_get(cookies, 0);
+
+  nv->name = crumb->name;
+  nv->value = value;
+  nv->token = crumb->token;
+  nv->flags = flags;
+
+  nghttp3_rcbuf_incref(nv->name);
+
+  for (; nghttp3_ringbuf_len(cookies);) {
+    crumb = nghttp3_ringbuf_get(cookies, 0);
+    nghttp3_rcbuf_decref(crumb->name);
+    nghttp3_rcbuf_decref(crumb->value);
+    nghttp3_ringbuf_pop_front(cookies);
+  }
+
+  return 0;
+}
+
 int nghttp3_stream_buffer_data(nghttp3_stream *stream, const uint8_t *data,
                                size_t datalen) {
   nghttp3_ringbuf *inq = &stream->inq;
@@ -883,6 +1635,10 @@ int nghttp3_stream_buffer_data(nghttp3_stream *stream, const uint8_t *data,
   size_t bufleft;
   int rv;
 
+  if (stream->conn) {
+    stream->conn->stats.inq_bytes += datalen;
+  }
+
   if (len) {
     buf = nghttp3_ringbuf_get(inq, len - 1);
     bufleft = nghttp3_buf_left(buf);
@@ -896,11 +1652,9 @@ int nghttp3_stream_buffer_data(nghttp3_stream *stream, const uint8_t *data,
   }
 
   for (; datalen;) {
-    if (nghttp3_ringbuf_full(inq)) {
-      rv = nghttp3_ringbuf_reserve(inq, nghttp3_ringbuf_len(inq) * 2);
-      if (rv != 0) {
-        return rv;
-      }
+    rv = stream_ringbuf_reserve(inq);
+    if (rv != 0) {
+      return rv;
     }
 
     rawbuf = nghttp3_mem_malloc(stream->mem, 16384);
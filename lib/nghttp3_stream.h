@@ -33,13 +33,29 @@
 
 #include "nghttp3_map.h"
 #include "nghttp3_tnode.h"
+#include "nghttp3_urgq.h"
 #include "nghttp3_ringbuf.h"
 #include "nghttp3_buf.h"
 #include "nghttp3_frame.h"
 #include "nghttp3_qpack.h"
+#include "nghttp3_gaptr.h"
 
 #define NGHTTP3_STREAM_CHUNK_SIZE (16 * 1024)
 
+/* NGHTTP3_STREAM_MIN_RINGBUF_NMEMB is the number of elements which
+   the ring buffers of a stream can store when they are allocated on
+   first use. */
+#define NGHTTP3_STREAM_MIN_RINGBUF_NMEMB 4
+
+/* NGHTTP3_STREAM_MAX_DATA_VECCNT is the maximum number of buffers
+   that nghttp3_read_data_vec_callback can return for a single DATA
+   frame. */
+#define NGHTTP3_STREAM_MAX_DATA_VECCNT 16
+
+/* NGHTTP3_STREAM_MAX_FILE_DATALEN is the maximum number of bytes of
+   a file sent in a single DATA frame. */
+#define NGHTTP3_STREAM_MAX_FILE_DATALEN (64 * 1024)
+
 /* nghttp3_stream_type is unidirectional stream type. */
 typedef enum {
   NGHTTP3_STREAM_TYPE_CONTROL = 0x00,
@@ -112,6 +128,10 @@ typedef enum {
   /* NGHTTP3_STREAM_FLAG_READ_EOF indicates that remote endpoint sent
      fin. */
   NGHTTP3_STREAM_FLAG_READ_EOF = 0x0020,
+  /* NGHTTP3_STREAM_FLAG_TX_BUDGET_WAIT indicates that stream is in
+     the list of streams which wait for the connection wide budget of
+     buffered data. */
+  NGHTTP3_STREAM_FLAG_TX_BUDGET_WAIT = 0x0040,
 } nghttp3_stream_flag;
 
 typedef enum {
@@ -174,28 +194,65 @@ typedef struct {
   nghttp3_stream_acked_data acked_data;
 } nghttp3_stream_callbacks;
 
+/* nghttp3_stream_file is a memory mapped region of a file which is
+   sent as stream data. */
+typedef struct {
+  /* base is the beginning of the mapping.  It is aligned to page
+     boundary. */
+  uint8_t *base;
+  /* maplen is the length of the mapping. */
+  size_t maplen;
+  /* pos is the offset in the mapping of the data which is sent
+     next. */
+  size_t pos;
+  /* unmapped is the number of bytes at the beginning of the mapping
+     which have been acknowledged and unmapped. */
+  size_t unmapped;
+  /* pagesize is the size of memory page. */
+  size_t pagesize;
+} nghttp3_stream_file;
+
 struct nghttp3_stream {
-  const nghttp3_mem *mem;
-  nghttp3_map_entry me;
-  nghttp3_tnode node;
-  nghttp3_pq_entry qpack_blocked_pe;
-  nghttp3_stream_callbacks callbacks;
-  nghttp3_ringbuf frq;
-  nghttp3_ringbuf chunks;
-  nghttp3_ringbuf outq;
-  /* inq stores the stream raw data which cannot be read because
-     stream is blocked by QPACK decoder. */
-  nghttp3_ringbuf inq;
-  nghttp3_qpack_stream_context qpack_sctx;
+  /* The fields used by both read and write dispatch come first so
+     that they share a cache line.  The fields which only the
+     scheduler and the connection level lookup need are placed last.
+     An idle stream allocates nothing but this struct. */
+  int64_t stream_id;
+  nghttp3_stream_type type;
+
+  struct {
+    nghttp3_stream_http_state hstate;
+  } tx;
+
+  struct {
+    nghttp3_stream_http_state hstate;
+  } rx;
+
+  uint16_t flags;
   /* conn is a reference to underlying connection.  It could be NULL
      if stream is not a request/push stream. */
   nghttp3_conn *conn;
   void *user_data;
+  const nghttp3_mem *mem;
+
   /* outq_idx is an index into outq where next write is made. */
   size_t outq_idx;
   /* outq_offset is write offset relative to the element at outq_idx
      in outq. */
   size_t outq_offset;
+  size_t unscheduled_nwrite;
+  nghttp3_ringbuf frq;
+  nghttp3_ringbuf outq;
+  nghttp3_ringbuf chunks;
+  nghttp3_stream_callbacks callbacks;
+  /* file is the memory mapped file which is being sent.  It is
+     allocated only if an application submits a file as stream
+     data. */
+  nghttp3_stream_file *file;
+  /* timing is the time when the events occur on this stream.  It is
+     allocated only for a request stream if the connection has
+     get_timestamp callback. */
+  nghttp3_stream_timing *timing;
   /* ack_offset is offset acknowledged by peer relative to the first
      element in outq. */
   size_t ack_offset;
@@ -203,20 +260,36 @@ struct nghttp3_stream {
      they are acknowledged inside the first outq element if it is of
      type NGHTTP3_BUF_TYPE_ALIEN. */
   size_t ack_done;
-  size_t unscheduled_nwrite;
-  int64_t stream_id;
-  nghttp3_stream_type type;
-  nghttp3_stream_read_state rstate;
-
-  struct {
-    nghttp3_stream_http_state hstate;
-  } tx;
+  /* ack_base is the stream offset of the first element in outq. */
+  uint64_t ack_base;
+  /* ack_gaptr records the ranges acknowledged out of order.  It is
+     allocated when an acknowledgement arrives beyond the
+     contiguously acknowledged offset, and is freed once the gap is
+     filled. */
+  nghttp3_gaptr *ack_gaptr;
 
-  struct {
-    nghttp3_stream_http_state hstate;
-  } rx;
+  nghttp3_stream_read_state rstate;
+  /* inq stores the stream raw data which cannot be read because
+     stream is blocked by QPACK decoder. */
+  nghttp3_ringbuf inq;
+  nghttp3_qpack_stream_context qpack_sctx;
+  /* cookies stores the cookie header fields of nghttp3_qpack_nv in
+     the header block being decoded, which are joined into one when
+     the block ends.  It is allocated when the first cookie header
+     field is buffered, which only happens if the connection is
+     configured to rejoin cookie header fields, so that the other
+     streams pay for a pointer instead of a ring buffer. */
+  nghttp3_ringbuf *cookies;
 
-  uint16_t flags;
+  nghttp3_map_entry me;
+  nghttp3_pq_entry qpack_blocked_pe;
+  /* urge is used to schedule this stream if the connection uses
+     NGHTTP3_SCHEDULER_URGENCY. */
+  nghttp3_urgq_entry urge;
+  /* budget_prev and budget_next link the streams which wait for the
+     connection wide budget of buffered data. */
+  nghttp3_stream *budget_prev, *budget_next;
+  nghttp3_tnode node;
 };
 
 typedef struct {
@@ -238,6 +311,19 @@ int nghttp3_stream_new(nghttp3_stream **pstream, int64_t stream_id,
 
 void nghttp3_stream_del(nghttp3_stream *stream);
 
+/*
+ * nghttp3_stream_delete_file unmaps the file which |stream| is
+ * sending, and deletes stream->file.  stream->file must not be NULL.
+ */
+void nghttp3_stream_delete_file(nghttp3_stream *stream);
+
+/*
+ * nghttp3_stream_delete_cookies releases the references to the
+ * cookie header fields buffered in |stream|, and deletes
+ * stream->cookies.  stream->cookies must not be NULL.
+ */
+void nghttp3_stream_delete_cookies(nghttp3_stream *stream);
+
 void nghttp3_varint_read_state_reset(nghttp3_varint_read_state *rvint);
 
 void nghttp3_stream_read_state_reset(nghttp3_stream_read_state *rstate);
@@ -257,8 +343,35 @@ ssize_t nghttp3_stream_writev(nghttp3_stream *stream, int *pfin,
 
 int nghttp3_stream_write_qpack_decoder_stream(nghttp3_stream *stream);
 
+/*
+ * nghttp3_stream_outq_is_full returns nonzero if no more data should
+ * be queued to outq of |stream|, because either the unsent data in
+ * outq reach the high watermark, or the connection wide budget of
+ * buffered data is exhausted.
+ */
 int nghttp3_stream_outq_is_full(nghttp3_stream *stream);
 
+/*
+ * nghttp3_stream_tx_budget_exhausted returns nonzero if |stream| is a
+ * request stream and the number of bytes buffered in all request
+ * streams reaches the connection wide budget.
+ */
+int nghttp3_stream_tx_budget_exhausted(nghttp3_stream *stream);
+
+/*
+ * nghttp3_stream_tx_budget_wait adds |stream| to the list of streams
+ * which wait for the connection wide budget unless it is already
+ * there.
+ */
+void nghttp3_stream_tx_budget_wait(nghttp3_stream *stream);
+
+/*
+ * nghttp3_stream_tx_budget_unwait removes |stream| from the list of
+ * streams which wait for the connection wide budget if it is in the
+ * list.
+ */
+void nghttp3_stream_tx_budget_unwait(nghttp3_stream *stream);
+
 int nghttp3_stream_outq_add(nghttp3_stream *stream,
                             const nghttp3_typed_buf *tbuf);
 
@@ -280,10 +393,65 @@ nghttp3_buf *nghttp3_stream_get_chunk(nghttp3_stream *stream);
 
 int nghttp3_stream_is_blocked(nghttp3_stream *stream);
 
+/*
+ * nghttp3_stream_get_range stores the data in the range [offset,
+ * offset + datalen) of stream offset to |vec| of length |veccnt|,
+ * and returns the number of nghttp3_vec object in which it stored
+ * data.  The data must have been written and not acknowledged yet.
+ * The stored data might be shorter than |datalen| if |veccnt| is not
+ * large enough, or the range contains the buffer of application data
+ * that has already been acknowledged.
+ *
+ * This function returns the number of nghttp3_vec stored if it
+ * succeeds, or one of the following negative error codes:
+ *
+ * NGHTTP3_ERR_INVALID_ARGUMENT
+ *     The range contains the data which is acknowledged or not
+ *     written yet.
+ */
+ssize_t nghttp3_stream_get_range(nghttp3_stream *stream, nghttp3_vec *vec,
+                                 size_t veccnt, uint64_t offset,
+                                 size_t datalen);
+
+/*
+ * nghttp3_stream_map_file maps the region of a file specified by
+ * |file| into memory in order to send it as stream data.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGHTTP3_ERR_INVALID_ARGUMENT
+ *     The file cannot be mapped; or |stream| has already a file
+ *     mapped.
+ * NGHTTP3_ERR_NOMEM
+ *     Out of memory.
+ */
+int nghttp3_stream_map_file(nghttp3_stream *stream,
+                            const nghttp3_data_file *file);
+
 int nghttp3_stream_add_outq_offset(nghttp3_stream *stream, size_t n);
 
 int nghttp3_stream_add_ack_offset(nghttp3_stream *stream, size_t n);
 
+/*
+ * nghttp3_stream_add_ack_range tells |stream| that the data in the
+ * range [offset, offset + datalen) of stream offset has been
+ * acknowledged by peer.  The buffers at the front of outq are
+ * removed as soon as the range up to them is entirely acknowledged.
+ * An application is notified of the data it supplied as soon as each
+ * buffer is entirely acknowledged, even if a gap remains before it.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGHTTP3_ERR_NOMEM
+ *     Out of memory.
+ * NGHTTP3_ERR_CALLBACK_FAILURE
+ *     User callback failed.
+ */
+int nghttp3_stream_add_ack_range(nghttp3_stream *stream, uint64_t offset,
+                                 size_t datalen);
+
 /*
  * nghttp3_stream_require_schedule returns nonzero if |stream| should
  * be scheduled.  In other words, it has something to send.
@@ -306,9 +474,45 @@ int nghttp3_stream_ensure_scheduled(nghttp3_stream *stream);
 
 void nghttp3_stream_unschedule(nghttp3_stream *stream);
 
+/*
+ * nghttp3_stream_is_scheduled returns nonzero if |stream| is
+ * scheduled.
+ */
+int nghttp3_stream_is_scheduled(nghttp3_stream *stream);
+
 int nghttp3_stream_buffer_data(nghttp3_stream *stream, const uint8_t *src,
                                size_t srclen);
 
+/*
+ * nghttp3_stream_add_cookie appends cookie header field |nv| to
+ * stream->cookies, allocating it if it has not been.  The ownership
+ * of the references in |nv| is transferred to |stream| if it
+ * succeeds.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGHTTP3_ERR_NOMEM
+ *     Out of memory.
+ */
+int nghttp3_stream_add_cookie(nghttp3_stream *stream,
+                              const nghttp3_qpack_nv *nv);
+
+/*
+ * nghttp3_stream_join_cookies joins the values of cookie header
+ * fields in stream->cookies with "; " into a single header field, and
+ * assigns it to |*nv|.  stream->cookies must not be NULL nor empty,
+ * and it is empty after this function returns.  The caller owns the
+ * references in |*nv| if it succeeds.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGHTTP3_ERR_NOMEM
+ *     Out of memory.
+ */
+int nghttp3_stream_join_cookies(nghttp3_stream *stream, nghttp3_qpack_nv *nv);
+
 int nghttp3_stream_ensure_qpack_stream_context(nghttp3_stream *stream);
 
 void nghttp3_stream_delete_qpack_stream_context(nghttp3_stream *stream);
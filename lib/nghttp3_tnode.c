@@ -42,8 +42,8 @@ int nghttp3_node_id_eq(const nghttp3_node_id *a, const nghttp3_node_id *b) {
 
 static int cycle_less(const nghttp3_pq_entry *lhsx,
                       const nghttp3_pq_entry *rhsx) {
-  const nghttp3_tnode *lhs = nghttp3_struct_of(lhsx, nghttp3_tnode, pe);
-  const nghttp3_tnode *rhs = nghttp3_struct_of(rhsx, nghttp3_tnode, pe);
+  const nghttp3_tnode *lhs = nghttp3_struct_of(lhsx, nghttp3_tnode, qe.pe);
+  const nghttp3_tnode *rhs = nghttp3_struct_of(rhsx, nghttp3_tnode, qe.pe);
 
   if (lhs->cycle == rhs->cycle) {
     return lhs->seq < rhs->seq;
@@ -52,12 +52,34 @@ static int cycle_less(const nghttp3_pq_entry *lhsx,
   return rhs->cycle - lhs->cycle <= NGHTTP3_TNODE_MAX_CYCLE_GAP;
 }
 
+static int calq_cycle_less(const nghttp3_calq_entry *lhsx,
+                           const nghttp3_calq_entry *rhsx) {
+  const nghttp3_tnode *lhs = nghttp3_struct_of(lhsx, nghttp3_tnode, qe.ce);
+  const nghttp3_tnode *rhs = nghttp3_struct_of(rhsx, nghttp3_tnode, qe.ce);
+
+  /* Unlike cycle_less, nodes which have the same cycle are served in
+     the order they are queued.  Breaking ties by seq would make
+     rescheduled nodes walk the bucket past all nodes of the same
+     cycle. */
+  if (lhs->cycle == rhs->cycle) {
+    return 0;
+  }
+
+  return rhs->cycle - lhs->cycle <= NGHTTP3_TNODE_MAX_CYCLE_GAP;
+}
+
 void nghttp3_tnode_init(nghttp3_tnode *tnode, const nghttp3_node_id *nid,
                         uint64_t seq, uint32_t weight, nghttp3_tnode *parent,
                         const nghttp3_mem *mem) {
-  nghttp3_pq_init(&tnode->pq, cycle_less, mem);
+  tnode->use_calq = parent && parent->use_calq;
+  if (tnode->use_calq) {
+    tnode->q.cal.cq = NULL;
+    tnode->q.cal.mem = mem;
+  } else {
+    nghttp3_pq_init(&tnode->q.pq, cycle_less, mem);
+  }
 
-  tnode->pe.index = NGHTTP3_PQ_BAD_INDEX;
+  tnode->scheduled = 0;
   tnode->nid = *nid;
   tnode->seq = seq;
   tnode->cycle = 0;
@@ -67,9 +89,13 @@ void nghttp3_tnode_init(nghttp3_tnode *tnode, const nghttp3_node_id *nid,
   tnode->first_child = NULL;
   tnode->num_children = 0;
   tnode->active = 0;
+  tnode->prev_sibling = NULL;
 
   if (parent) {
     tnode->next_sibling = parent->first_child;
+    if (parent->first_child) {
+      parent->first_child->prev_sibling = tnode;
+    }
     parent->first_child = tnode;
     ++parent->num_children;
   } else {
@@ -77,24 +103,120 @@ void nghttp3_tnode_init(nghttp3_tnode *tnode, const nghttp3_node_id *nid,
   }
 }
 
-void nghttp3_tnode_free(nghttp3_tnode *tnode) { nghttp3_pq_free(&tnode->pq); }
+void nghttp3_tnode_free(nghttp3_tnode *tnode) {
+  if (!tnode->use_calq) {
+    nghttp3_pq_free(&tnode->q.pq);
+    return;
+  }
+
+  if (tnode->q.cal.cq) {
+    nghttp3_calq_free(tnode->q.cal.cq);
+    nghttp3_mem_free(tnode->q.cal.mem, tnode->q.cal.cq);
+  }
+}
+
+void nghttp3_tnode_enable_calq(nghttp3_tnode *tnode) {
+  const nghttp3_mem *mem;
+
+  if (tnode->use_calq) {
+    return;
+  }
+
+  assert(nghttp3_pq_empty(&tnode->q.pq));
+
+  mem = tnode->q.pq.mem;
+  nghttp3_pq_free(&tnode->q.pq);
+
+  tnode->q.cal.cq = NULL;
+  tnode->q.cal.mem = mem;
+  tnode->use_calq = 1;
+}
+
+/*
+ * tnode_queue_push pushes |tnode| to the queue of |parent|.
+ */
+static int tnode_queue_push(nghttp3_tnode *parent, nghttp3_tnode *tnode) {
+  nghttp3_calq *cq;
+  int rv;
+
+  if (!parent->use_calq) {
+    rv = nghttp3_pq_push(&parent->q.pq, &tnode->qe.pe);
+    if (rv != 0) {
+      return rv;
+    }
+
+    tnode->scheduled = 1;
+
+    return 0;
+  }
+
+  cq = parent->q.cal.cq;
+  if (cq == NULL) {
+    cq = nghttp3_mem_malloc(parent->q.cal.mem, sizeof(nghttp3_calq));
+    if (cq == NULL) {
+      return NGHTTP3_ERR_NOMEM;
+    }
+
+    nghttp3_calq_init(cq, calq_cycle_less, parent->q.cal.mem);
+    parent->q.cal.cq = cq;
+  }
+
+  tnode->qe.ce.key = tnode->cycle;
+
+  rv = nghttp3_calq_push(cq, &tnode->qe.ce);
+  if (rv != 0) {
+    return rv;
+  }
+
+  tnode->scheduled = 1;
+
+  return 0;
+}
+
+/*
+ * tnode_queue_remove removes |tnode| from the queue of |parent|.
+ */
+static void tnode_queue_remove(nghttp3_tnode *parent, nghttp3_tnode *tnode) {
+  if (parent->use_calq) {
+    nghttp3_calq_remove(parent->q.cal.cq, &tnode->qe.ce);
+  } else {
+    nghttp3_pq_remove(&parent->q.pq, &tnode->qe.pe);
+  }
+
+  tnode->scheduled = 0;
+}
+
+static int tnode_queue_empty(nghttp3_tnode *tnode) {
+  if (tnode->use_calq) {
+    return tnode->q.cal.cq == NULL || nghttp3_calq_empty(tnode->q.cal.cq);
+  }
+  return nghttp3_pq_empty(&tnode->q.pq);
+}
+
+static nghttp3_tnode *tnode_queue_top(nghttp3_tnode *tnode) {
+  if (tnode->use_calq) {
+    return nghttp3_struct_of(nghttp3_calq_top(tnode->q.cal.cq), nghttp3_tnode,
+                             qe.ce);
+  }
+  return nghttp3_struct_of(nghttp3_pq_top(&tnode->q.pq), nghttp3_tnode,
+                           qe.pe);
+}
 
 void nghttp3_tnode_unschedule(nghttp3_tnode *tnode) {
   nghttp3_tnode *parent = tnode->parent;
 
-  if (tnode->pe.index == NGHTTP3_PQ_BAD_INDEX) {
+  if (!tnode->scheduled) {
     return;
   }
 
   tnode->active = 0;
 
   for (parent = tnode->parent; parent; tnode = parent, parent = tnode->parent) {
-    assert(tnode->pe.index != NGHTTP3_PQ_BAD_INDEX);
+    assert(tnode->scheduled);
 
-    nghttp3_pq_remove(&parent->pq, &tnode->pe);
-    tnode->pe.index = NGHTTP3_PQ_BAD_INDEX;
+    tnode_queue_remove(parent, tnode);
 
-    if (parent->active || !nghttp3_pq_empty(&parent->pq)) {
+    if (parent->active || !tnode_queue_empty(parent)) {
       return;
     }
   }
@@ -108,33 +230,35 @@ static int tnode_schedule(nghttp3_tnode *tnode, nghttp3_tnode *parent,
   tnode->cycle = base_cycle + penalty / tnode->weight;
   tnode->pending_penalty = (uint32_t)(penalty % tnode->weight);
 
-  return nghttp3_pq_push(&parent->pq, &tnode->pe);
+  return tnode_queue_push(parent, tnode);
 }
 
 static uint64_t tnode_get_first_cycle(nghttp3_tnode *tnode) {
-  nghttp3_tnode *top;
-
-  if (nghttp3_pq_empty(&tnode->pq)) {
+  if (tnode_queue_empty(tnode)) {
     return 0;
   }
 
-  top = nghttp3_struct_of(nghttp3_pq_top(&tnode->pq), nghttp3_tnode, pe);
-  return top->cycle;
+  return tnode_queue_top(tnode)->cycle;
 }
 
 int nghttp3_tnode_schedule(nghttp3_tnode *tnode, size_t nwrite) {
   nghttp3_tnode *parent;
   uint64_t cycle;
+  uint8_t active;
   int rv;
 
   tnode->active = 1;
 
   for (parent = tnode->parent; parent; tnode = parent, parent = tnode->parent) {
-    if (tnode->pe.index == NGHTTP3_PQ_BAD_INDEX) {
+    if (!tnode->scheduled) {
       cycle = tnode_get_first_cycle(parent);
     } else if (nwrite != 0) {
       cycle = tnode->cycle;
+      active = tnode->active;
       nghttp3_tnode_unschedule(tnode);
+      /* Rescheduling must not change whether tnode is scheduled by
+         itself. */
+      tnode->active = active;
     } else {
       return 0;
     }
@@ -149,62 +273,87 @@ int nghttp3_tnode_schedule(nghttp3_tnode *tnode, size_t nwrite) {
 }
 
 int nghttp3_tnode_is_scheduled(nghttp3_tnode *tnode) {
-  return tnode->pe.index != NGHTTP3_PQ_BAD_INDEX;
+  return tnode->scheduled;
 }
 
 nghttp3_tnode *nghttp3_tnode_get_next(nghttp3_tnode *node) {
-  if (nghttp3_pq_empty(&node->pq)) {
+  if (tnode_queue_empty(node)) {
     return NULL;
   }
 
-  return nghttp3_struct_of(nghttp3_pq_top(&node->pq), nghttp3_tnode, pe);
+  return tnode_queue_top(node);
 }
 
 void nghttp3_tnode_insert(nghttp3_tnode *tnode, nghttp3_tnode *parent) {
   assert(tnode->parent == NULL);
   assert(tnode->next_sibling == NULL);
-  assert(tnode->pe.index == NGHTTP3_PQ_BAD_INDEX);
+  assert(tnode->prev_sibling == NULL);
+  assert(!tnode->scheduled);
 
   tnode->next_sibling = parent->first_child;
+  if (parent->first_child) {
+    parent->first_child->prev_sibling = tnode;
+  }
   parent->first_child = tnode;
   tnode->parent = parent;
   ++parent->num_children;
 }
 
+/*
+ * tnode_splice replaces |tnode| in the sibling list of its parent
+ * with the list which starts at |first| and ends at |last|.  If
+ * |first| is NULL, |tnode| is just unlinked.
+ */
+static void tnode_splice(nghttp3_tnode *tnode, nghttp3_tnode *first,
+                          nghttp3_tnode *last) {
+  nghttp3_tnode *prev = tnode->prev_sibling, *next = tnode->next_sibling;
+
+  if (first) {
+    first->prev_sibling = prev;
+    last->next_sibling = next;
+  } else {
+    first = next;
+    last = prev;
+  }
+
+  if (prev) {
+    prev->next_sibling = first;
+  } else {
+    tnode->parent->first_child = first;
+  }
+
+  if (next) {
+    next->prev_sibling = last;
+  }
+}
+
 void nghttp3_tnode_remove(nghttp3_tnode *tnode) {
-  nghttp3_tnode *parent = tnode->parent, **p;
+  nghttp3_tnode *parent = tnode->parent;
 
   assert(parent);
 
-  if (tnode->pe.index != NGHTTP3_PQ_BAD_INDEX) {
+  if (tnode->scheduled) {
     nghttp3_tnode_unschedule(tnode);
   }
 
-  for (p = &parent->first_child; *p != tnode; p = &(*p)->next_sibling)
-    ;
+  tnode_splice(tnode, NULL, NULL);
 
-  *p = tnode->next_sibling;
   --parent->num_children;
-  tnode->parent = tnode->next_sibling = NULL;
+  tnode->parent = tnode->next_sibling = tnode->prev_sibling = NULL;
 }
 
 int nghttp3_tnode_squash(nghttp3_tnode *tnode) {
-  nghttp3_tnode *parent = tnode->parent, *node, **p;
+  nghttp3_tnode *parent = tnode->parent, *node, *last = NULL;
   int rv;
 
   assert(parent);
 
-  if (tnode->pe.index != NGHTTP3_PQ_BAD_INDEX) {
+  if (tnode->scheduled) {
     nghttp3_tnode_unschedule(tnode);
   }
 
-  for (p = &parent->first_child; *p != tnode; p = &(*p)->next_sibling)
-    ;
-
-  *p = tnode->first_child;
-
-  for (; *p; p = &(*p)->next_sibling) {
-    node = *p;
+  for (node = tnode->first_child; node; node = node->next_sibling) {
+    last = node;
     node->parent = parent;
     node->weight =
         (uint32_t)(node->weight * tnode->weight / tnode->num_children);
@@ -212,12 +361,11 @@ int nghttp3_tnode_squash(nghttp3_tnode *tnode) {
       node->weight = 1;
     }
 
-    if (node->pe.index == NGHTTP3_PQ_BAD_INDEX) {
+    if (!node->scheduled) {
       continue;
     }
 
-    nghttp3_pq_remove(&tnode->pq, &node->pe);
-    node->pe.index = NGHTTP3_PQ_BAD_INDEX;
+    tnode_queue_remove(tnode, node);
     node->active = 0;
 
     rv = nghttp3_tnode_schedule(node, 0);
@@ -226,11 +374,66 @@ int nghttp3_tnode_squash(nghttp3_tnode *tnode) {
     }
   }
 
-  *p = tnode->next_sibling;
+  tnode_splice(tnode, tnode->first_child, last);
 
-  parent->num_children += tnode->num_children;
+  parent->num_children += tnode->num_children - 1;
   tnode->num_children = 0;
-  tnode->parent = tnode->next_sibling = tnode->first_child = NULL;
+  tnode->parent = tnode->next_sibling = tnode->prev_sibling =
+      tnode->first_child = NULL;
+
+  return 0;
+}
+
+int nghttp3_tnode_replace(nghttp3_tnode *tnode, nghttp3_tnode *dest) {
+  nghttp3_tnode *parent = tnode->parent, *node;
+  int rv;
+
+  assert(parent);
+  assert(dest->parent == NULL);
+  assert(dest->first_child == NULL);
+  assert(!dest->scheduled);
+
+  /* tnode is not active by itself, so it is scheduled only if one of
+     its descendants is. */
+  assert(!tnode->active);
+
+  dest->weight = tnode->weight;
+  dest->seq = tnode->seq;
+  dest->cycle = tnode->cycle;
+  dest->pending_penalty = tnode->pending_penalty;
+
+  /* Keep the position in the queue of parent by pushing dest with the
+     same cycle. */
+  if (tnode->scheduled) {
+    tnode_queue_remove(parent, tnode);
+    rv = tnode_queue_push(parent, dest);
+    if (rv != 0) {
+      return rv;
+    }
+  }
+
+  tnode_splice(tnode, dest, dest);
+  dest->parent = parent;
+  tnode->parent = tnode->next_sibling = tnode->prev_sibling = NULL;
+
+  dest->first_child = tnode->first_child;
+  dest->num_children = tnode->num_children;
+  tnode->first_child = NULL;
+  tnode->num_children = 0;
+
+  for (node = dest->first_child; node; node = node->next_sibling) {
+    node->parent = dest;
+
+    if (!node->scheduled) {
+      continue;
+    }
+
+    tnode_queue_remove(tnode, node);
+    rv = tnode_queue_push(dest, node);
+    if (rv != 0) {
+      return rv;
+    }
+  }
 
   return 0;
 }
@@ -245,5 +448,12 @@ nghttp3_tnode *nghttp3_tnode_find_ascendant(nghttp3_tnode *tnode,
 }
 
 int nghttp3_tnode_has_active_descendant(nghttp3_tnode *tnode) {
-  return !nghttp3_pq_empty(&tnode->pq);
+  return !tnode_queue_empty(tnode);
+}
+
+size_t nghttp3_tnode_num_scheduled_children(nghttp3_tnode *tnode) {
+  if (tnode->use_calq) {
+    return tnode->q.cal.cq ? nghttp3_calq_size(tnode->q.cal.cq) : 0;
+  }
+  return nghttp3_pq_size(&tnode->q.pq);
 }
@@ -32,6 +32,7 @@
 #include <nghttp3/nghttp3.h>
 
 #include "nghttp3_pq.h"
+#include "nghttp3_calq.h"
 
 #define NGHTTP3_DEFAULT_WEIGHT 16
 #define NGHTTP3_MAX_WEIGHT 256
@@ -59,21 +60,48 @@ struct nghttp3_tnode;
 typedef struct nghttp3_tnode nghttp3_tnode;
 
 struct nghttp3_tnode {
-  nghttp3_pq_entry pe;
-  nghttp3_pq pq;
+  /* qe is the entry in the queue of the parent.  pe is used if the
+     parent queues its children by binary heap, and ce if it does by
+     calendar queue. */
+  union {
+    nghttp3_pq_entry pe;
+    nghttp3_calq_entry ce;
+  } qe;
+  /* q is the queue of the scheduled children.  pq is used unless
+     use_calq is nonzero. */
+  union {
+    nghttp3_pq pq;
+    struct {
+      /* cq is allocated when the first child is scheduled so that a
+         node which never has scheduled children does not pay for the
+         buckets. */
+      nghttp3_calq *cq;
+      const nghttp3_mem *mem;
+    } cal;
+  } q;
   nghttp3_tnode *parent;
   nghttp3_tnode *first_child;
   nghttp3_tnode *next_sibling;
+  /* prev_sibling points to the previous sibling so that |tnode| can
+     be unlinked from its parent in O(1). */
+  nghttp3_tnode *prev_sibling;
   size_t num_children;
   nghttp3_node_id nid;
   uint64_t seq;
   uint64_t cycle;
   uint32_t pending_penalty;
   uint32_t weight;
+  /* scheduled is nonzero if this node is in the queue of its
+     parent. */
+  uint8_t scheduled;
   /* active is nonzero if this node is scheduled by itself. In other
      words, it is not scheduled just because one of its descendants is
      scheduled. */
-  int active;
+  uint8_t active;
+  /* use_calq is nonzero if the scheduled children are queued by
+     q.cal.cq.  It is inherited from the parent given to
+     nghttp3_tnode_init. */
+  uint8_t use_calq;
 };
 
 void nghttp3_tnode_init(nghttp3_tnode *tnode, const nghttp3_node_id *nid,
@@ -82,6 +110,14 @@ void nghttp3_tnode_init(nghttp3_tnode *tnode, const nghttp3_node_id *nid,
 
 void nghttp3_tnode_free(nghttp3_tnode *tnode);
 
+/*
+ * nghttp3_tnode_enable_calq makes |tnode| queue its scheduled
+ * children by calendar queue instead of binary heap.  The nodes which
+ * are initialized with |tnode| as parent inherit this.  This function
+ * must be called before any child is scheduled.
+ */
+void nghttp3_tnode_enable_calq(nghttp3_tnode *tnode);
+
 void nghttp3_tnode_unschedule(nghttp3_tnode *tnode);
 
 /*
@@ -121,6 +157,21 @@ void nghttp3_tnode_remove(nghttp3_tnode *tnode);
  */
 int nghttp3_tnode_squash(nghttp3_tnode *tnode);
 
+/*
+ * nghttp3_tnode_replace puts |dest| in the place of |tnode| in the
+ * tree.  |dest| takes over the parent, weight, scheduling state and
+ * children of |tnode|, and |tnode| is left detached.  |tnode| must
+ * not be active by itself.  |dest| must be detached, and must not
+ * have children.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGHTTP3_ERR_NOMEM
+ *     Out of memory.
+ */
+int nghttp3_tnode_replace(nghttp3_tnode *tnode, nghttp3_tnode *dest);
+
 /*
  * nghttp3_tnode_find_ascendant returns an ascendant of |tnode| whose
  * node ID is |nid|.  If no such node exists, this function returns
@@ -131,4 +182,10 @@ nghttp3_tnode *nghttp3_tnode_find_ascendant(nghttp3_tnode *tnode,
 
 int nghttp3_tnode_has_active_descendant(nghttp3_tnode *tnode);
 
+/*
+ * nghttp3_tnode_num_scheduled_children returns the number of
+ * scheduled direct descendants of |tnode|.
+ */
+size_t nghttp3_tnode_num_scheduled_children(nghttp3_tnode *tnode);
+
 #endif /* NGHTTP3_TNODE_H */
@@ -0,0 +1,137 @@
+/*
+ * nghttp3
+ *
+ * Copyright (c) 2019 nghttp3 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "nghttp3_urgq.h"
+
+#include <string.h>
+#include <assert.h>
+
+void nghttp3_urgq_init(nghttp3_urgq *urgq) {
+  memset(urgq, 0, sizeof(*urgq));
+}
+
+void nghttp3_urgq_entry_init(nghttp3_urgq_entry *ent) {
+  ent->prev = ent->next = NULL;
+  ent->urgency = NGHTTP3_DEFAULT_URGENCY;
+  ent->inc = 0;
+  ent->queued = 0;
+}
+
+static size_t urgq_index(const nghttp3_urgq_entry *ent) {
+  return (size_t)ent->urgency * 2 + ent->inc;
+}
+
+static void urgq_push(nghttp3_urgq *urgq, nghttp3_urgq_entry *ent) {
+  size_t idx = urgq_index(ent);
+  nghttp3_urgq_list *list = &urgq->lists[idx];
+
+  ent->next = NULL;
+  ent->prev = list->tail;
+
+  if (list->tail) {
+    list->tail->next = ent;
+  } else {
+    list->head = ent;
+    urgq->mask = (uint16_t)(urgq->mask | (1u << idx));
+  }
+
+  list->tail = ent;
+  ent->queued = 1;
+}
+
+static void urgq_remove(nghttp3_urgq *urgq, nghttp3_urgq_entry *ent) {
+  size_t idx = urgq_index(ent);
+  nghttp3_urgq_list *list = &urgq->lists[idx];
+
+  if (ent->prev) {
+    ent->prev->next = ent->next;
+  } else {
+    list->head = ent->next;
+  }
+
+  if (ent->next) {
+    ent->next->prev = ent->prev;
+  } else {
+    list->tail = ent->prev;
+  }
+
+  if (list->head == NULL) {
+    urgq->mask = (uint16_t)(urgq->mask & ~(1u << idx));
+  }
+
+  ent->prev = ent->next = NULL;
+  ent->queued = 0;
+}
+
+void nghttp3_urgq_schedule(nghttp3_urgq *urgq, nghttp3_urgq_entry *ent) {
+  if (ent->queued) {
+    if (!ent->inc) {
+      return;
+    }
+
+    urgq_remove(urgq, ent);
+  }
+
+  urgq_push(urgq, ent);
+}
+
+void nghttp3_urgq_unschedule(nghttp3_urgq *urgq, nghttp3_urgq_entry *ent) {
+  if (ent->queued) {
+    urgq_remove(urgq, ent);
+  }
+}
+
+void nghttp3_urgq_set_priority(nghttp3_urgq *urgq, nghttp3_urgq_entry *ent,
+                               uint8_t urgency, int inc) {
+  int queued = ent->queued;
+
+  assert(urgency < NGHTTP3_URGENCY_LEVELS);
+
+  if (queued) {
+    urgq_remove(urgq, ent);
+  }
+
+  ent->urgency = urgency;
+  ent->inc = inc != 0;
+
+  if (queued) {
+    urgq_push(urgq, ent);
+  }
+}
+
+nghttp3_urgq_entry *nghttp3_urgq_top(nghttp3_urgq *urgq) {
+  size_t idx;
+  unsigned int mask = urgq->mask;
+
+  if (mask == 0) {
+    return NULL;
+  }
+
+  /* Find the lowest set bit.  The loop is bounded by the number of
+     queues. */
+  for (idx = 0; !(mask & 1); ++idx, mask >>= 1)
+    ;
+
+  return urgq->lists[idx].head;
+}
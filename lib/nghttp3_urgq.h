@@ -0,0 +1,112 @@
+/*
+ * nghttp3
+ *
+ * Copyright (c) 2019 nghttp3 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef NGHTTP3_URGQ_H
+#define NGHTTP3_URGQ_H
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <nghttp3/nghttp3.h>
+
+/* NGHTTP3_URGENCY_LEVELS is the number of urgency levels defined in
+   RFC 9218. */
+#define NGHTTP3_URGENCY_LEVELS 8
+
+/* NGHTTP3_DEFAULT_URGENCY is the default urgency level. */
+#define NGHTTP3_DEFAULT_URGENCY 3
+
+struct nghttp3_urgq_entry;
+typedef struct nghttp3_urgq_entry nghttp3_urgq_entry;
+
+/*
+ * nghttp3_urgq_entry is an entry of nghttp3_urgq.  It is embedded in
+ * the object to be scheduled.
+ */
+struct nghttp3_urgq_entry {
+  nghttp3_urgq_entry *prev;
+  nghttp3_urgq_entry *next;
+  /* urgency is the urgency level in [0, NGHTTP3_URGENCY_LEVELS).
+     Lower value has higher priority. */
+  uint8_t urgency;
+  /* inc is nonzero if the data can be processed incrementally. */
+  uint8_t inc;
+  /* queued is nonzero if this entry is in nghttp3_urgq. */
+  uint8_t queued;
+};
+
+typedef struct {
+  nghttp3_urgq_entry *head;
+  nghttp3_urgq_entry *tail;
+} nghttp3_urgq_list;
+
+/*
+ * nghttp3_urgq is a scheduler which implements the urgency and
+ * incremental parameters of RFC 9218.  For each urgency level, it
+ * has a FIFO queue for non-incremental entries and a round-robin
+ * queue for incremental ones.  Non-incremental entries are served
+ * one at a time before incremental entries of the same urgency.  All
+ * operations are O(1).
+ */
+typedef struct {
+  /* lists is indexed by urgency * 2 + inc. */
+  nghttp3_urgq_list lists[NGHTTP3_URGENCY_LEVELS * 2];
+  /* mask has the bit at index of lists set if it is not empty. */
+  uint16_t mask;
+} nghttp3_urgq;
+
+void nghttp3_urgq_init(nghttp3_urgq *urgq);
+
+void nghttp3_urgq_entry_init(nghttp3_urgq_entry *ent);
+
+/*
+ * nghttp3_urgq_schedule schedules |ent|.  If |ent| has already been
+ * scheduled and it is incremental, it is moved to the tail of its
+ * queue so that the other entries of the same urgency get chance to
+ * be served.
+ */
+void nghttp3_urgq_schedule(nghttp3_urgq *urgq, nghttp3_urgq_entry *ent);
+
+/*
+ * nghttp3_urgq_unschedule removes |ent| from |urgq| if it is
+ * scheduled.
+ */
+void nghttp3_urgq_unschedule(nghttp3_urgq *urgq, nghttp3_urgq_entry *ent);
+
+/*
+ * nghttp3_urgq_set_priority changes urgency and incremental parameter
+ * of |ent| to |urgency| and |inc| respectively.  If |ent| is
+ * scheduled, it is moved to the tail of the corresponding queue.
+ */
+void nghttp3_urgq_set_priority(nghttp3_urgq *urgq, nghttp3_urgq_entry *ent,
+                               uint8_t urgency, int inc);
+
+/*
+ * nghttp3_urgq_top returns the entry which should be served next.
+ * It returns NULL if no entry is scheduled.
+ */
+nghttp3_urgq_entry *nghttp3_urgq_top(nghttp3_urgq *urgq);
+
+#endif /* NGHTTP3_URGQ_H */
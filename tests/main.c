@@ -35,6 +35,10 @@
 #include "nghttp3_qpack_test.h"
 #include "nghttp3_conn_test.h"
 #include "nghttp3_tnode_test.h"
+#include "nghttp3_urgq_test.h"
+#include "nghttp3_map_test.h"
+#include "nghttp3_arena_test.h"
+#include "nghttp3_ringbuf_test.h"
 
 static int init_suite1(void) { return 0; }
 
@@ -62,16 +66,63 @@ int main() {
                    test_nghttp3_qpack_encoder_still_blocked) ||
       !CU_add_test(pSuite, "qpack_encoder_set_dtable_cap",
                    test_nghttp3_qpack_encoder_set_dtable_cap) ||
+      !CU_add_test(pSuite, "qpack_encoder_cookie",
+                   test_nghttp3_qpack_encoder_cookie) ||
       !CU_add_test(pSuite, "qpack_decoder_feedback",
                    test_nghttp3_qpack_decoder_feedback) ||
+      !CU_add_test(pSuite, "qpack_decoder_intern",
+                   test_nghttp3_qpack_decoder_intern) ||
+      !CU_add_test(pSuite, "qpack_intern_admission",
+                   test_nghttp3_qpack_intern_admission) ||
+      !CU_add_test(pSuite, "qpack_clone", test_nghttp3_qpack_clone) ||
+      !CU_add_test(pSuite, "qpack_encoder_prewarm",
+                   test_nghttp3_qpack_encoder_prewarm) ||
       !CU_add_test(pSuite, "conn_read_control",
                    test_nghttp3_conn_read_control) ||
       !CU_add_test(pSuite, "conn_write_control",
                    test_nghttp3_conn_write_control) ||
       !CU_add_test(pSuite, "conn_submit_request",
                    test_nghttp3_conn_submit_request) ||
+      !CU_add_test(pSuite, "conn_submit_request_data_vec",
+                   test_nghttp3_conn_submit_request_data_vec) ||
+      !CU_add_test(pSuite, "conn_add_ack_range",
+                   test_nghttp3_conn_add_ack_range) ||
+      !CU_add_test(pSuite, "conn_get_stream_data_range",
+                   test_nghttp3_conn_get_stream_data_range) ||
+      !CU_add_test(pSuite, "conn_tx_watermark",
+                   test_nghttp3_conn_tx_watermark) ||
+      !CU_add_test(pSuite, "conn_tx_budget_reschedule",
+                   test_nghttp3_conn_tx_budget_reschedule) ||
+      !CU_add_test(pSuite, "conn_submit_request_file",
+                   test_nghttp3_conn_submit_request_file) ||
+      !CU_add_test(pSuite, "conn_urgency_scheduler",
+                   test_nghttp3_conn_urgency_scheduler) ||
+      !CU_add_test(pSuite, "conn_tx_quantum", test_nghttp3_conn_tx_quantum) ||
+      !CU_add_test(pSuite, "conn_tree_calendar_scheduler",
+                   test_nghttp3_conn_tree_calendar_scheduler) ||
       !CU_add_test(pSuite, "conn_submit_priority",
                    test_nghttp3_conn_submit_priority) ||
+      !CU_add_test(pSuite, "conn_arena", test_nghttp3_conn_arena) ||
+      !CU_add_test(pSuite, "conn_eager_encode",
+                   test_nghttp3_conn_eager_encode) ||
+      !CU_add_test(pSuite, "conn_rejoin_cookie",
+                   test_nghttp3_conn_rejoin_cookie) ||
+      !CU_add_test(pSuite, "conn_qpack_warm_profile",
+                   test_nghttp3_conn_qpack_warm_profile) ||
+      !CU_add_test(pSuite, "conn_read_bidi_fin",
+                   test_nghttp3_conn_read_bidi_fin) ||
+      !CU_add_test(pSuite, "conn_qpack_blocked",
+                   test_nghttp3_conn_qpack_blocked) ||
+      !CU_add_test(pSuite, "conn_qpack_blocked_fin",
+                   test_nghttp3_conn_qpack_blocked_fin) ||
+      !CU_add_test(pSuite, "conn_end_stream_pending_data",
+                   test_nghttp3_conn_end_stream_pending_data) ||
+      !CU_add_test(pSuite, "conn_arena_cookie",
+                   test_nghttp3_conn_arena_cookie) ||
+      !CU_add_test(pSuite, "conn_trace", test_nghttp3_conn_trace) ||
+      !CU_add_test(pSuite, "conn_get_stats", test_nghttp3_conn_get_stats) ||
+      !CU_add_test(pSuite, "conn_stream_timing",
+                   test_nghttp3_conn_stream_timing) ||
       !CU_add_test(pSuite, "conn_http_request",
                    test_nghttp3_conn_http_request) ||
       !CU_add_test(pSuite, "conn_recv_request_priority",
@@ -79,7 +130,12 @@ int main() {
       !CU_add_test(pSuite, "conn_recv_control_priority",
                    test_nghttp3_conn_recv_control_priority) ||
       !CU_add_test(pSuite, "tnode_mutation", test_nghttp3_tnode_mutation) ||
-      !CU_add_test(pSuite, "tnode_schedule", test_nghttp3_tnode_schedule)) {
+      !CU_add_test(pSuite, "tnode_schedule", test_nghttp3_tnode_schedule) ||
+      !CU_add_test(pSuite, "tnode_calq", test_nghttp3_tnode_calq) ||
+      !CU_add_test(pSuite, "urgq_schedule", test_nghttp3_urgq_schedule) ||
+      !CU_add_test(pSuite, "map", test_nghttp3_map) ||
+      !CU_add_test(pSuite, "arena", test_nghttp3_arena) ||
+      !CU_add_test(pSuite, "ringbuf_reserve", test_nghttp3_ringbuf_reserve)) {
     CU_cleanup_registry();
     return (int)CU_get_error();
   }
@@ -0,0 +1,110 @@
+/*
+ * nghttp3
+ *
+ * Copyright (c) 2019 nghttp3 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "nghttp3_arena_test.h"
+
+#include <string.h>
+
+#include <CUnit/CUnit.h>
+
+#include "nghttp3_arena.h"
+#include "nghttp3_mem.h"
+#include "nghttp3_macro.h"
+#include "nghttp3_test_helper.h"
+
+void test_nghttp3_arena(void) {
+  nghttp3_arena arena;
+  const nghttp3_mem *mem;
+  uint8_t *a, *b, *c, *large;
+  size_t i;
+
+  nghttp3_arena_init(&arena, nghttp3_mem_default());
+  mem = &arena.mem;
+
+  CU_ASSERT(NULL == arena.blocks);
+
+  a = nghttp3_mem_malloc(mem, 100);
+  b = nghttp3_mem_malloc(mem, 100);
+
+  CU_ASSERT(NULL != a);
+  CU_ASSERT(NULL != b);
+  CU_ASSERT(a != b);
+  CU_ASSERT(0 == ((uintptr_t)a & 0x7));
+
+  /* Freed object is reused for the same size class */
+  nghttp3_mem_free(mem, a);
+  c = nghttp3_mem_malloc(mem, 128);
+
+  CU_ASSERT(a == c);
+
+  /* realloc within the size class keeps the object */
+  CU_ASSERT(c == nghttp3_mem_realloc(mem, c, 120));
+
+  for (i = 0; i < 128; ++i) {
+    c[i] = (uint8_t)i;
+  }
+
+  c = nghttp3_mem_realloc(mem, c, 1000);
+
+  CU_ASSERT(a != c);
+
+  for (i = 0; i < 128; ++i) {
+    CU_ASSERT((uint8_t)i == c[i]);
+  }
+
+  c = nghttp3_mem_calloc(mem, 10, 100);
+
+  for (i = 0; i < 1000; ++i) {
+    CU_ASSERT(0 == c[i]);
+  }
+
+  /* Objects larger than the largest class are allocated one by one */
+  large = nghttp3_mem_malloc(mem, 100000);
+
+  CU_ASSERT(NULL != large);
+  CU_ASSERT(NULL != arena.large);
+
+  memset(large, 0xff, 100000);
+
+  nghttp3_mem_free(mem, large);
+
+  CU_ASSERT(NULL == arena.large);
+
+  large = nghttp3_mem_malloc(mem, 20000);
+
+  CU_ASSERT(NULL != arena.large);
+
+  /* Stream chunk fits in the largest class */
+  a = nghttp3_mem_malloc(mem, 16384);
+
+  CU_ASSERT(NULL != a);
+
+  memset(a, 0, 16384);
+
+  /* Everything is released including the objects not freed */
+  nghttp3_arena_free(&arena);
+
+  CU_ASSERT(NULL == arena.blocks);
+  CU_ASSERT(NULL == arena.large);
+}
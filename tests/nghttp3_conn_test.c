@@ -24,6 +24,12 @@
  */
 #include "nghttp3_conn_test.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
 #include <CUnit/CUnit.h>
 
 #include "nghttp3_conn.h"
@@ -31,6 +37,7 @@
 #include "nghttp3_conv.h"
 #include "nghttp3_frame.h"
 #include "nghttp3_vec.h"
+#include "nghttp3_str.h"
 #include "nghttp3_test_helper.h"
 
 static uint8_t nulldata[4096];
@@ -42,6 +49,7 @@ typedef struct {
   } data;
   struct {
     size_t acc;
+    size_t ncalls;
   } ack;
 } userdata;
 
@@ -55,6 +63,7 @@ static int acked_stream_data(nghttp3_conn *conn, int64_t stream_id,
   (void)stream_user_data;
 
   ud->ack.acc += datalen;
+  ++ud->ack.ncalls;
 
   return 0;
 }
@@ -113,6 +122,57 @@ static int step_read_data(nghttp3_conn *conn, int64_t stream_id,
   return 0;
 }
 
+static ssize_t step_read_data_vec(nghttp3_conn *conn, int64_t stream_id,
+                                  nghttp3_vec *vec, size_t veccnt,
+                                  uint32_t *pflags, void *user_data,
+                                  void *stream_user_data) {
+  userdata *ud = user_data;
+  size_t n;
+  size_t i;
+
+  (void)conn;
+  (void)stream_id;
+  (void)stream_user_data;
+
+  for (i = 0; i < veccnt && ud->data.left; ++i) {
+    n = nghttp3_min(ud->data.left, ud->data.step);
+    ud->data.left -= n;
+
+    vec[i].base = nulldata;
+    vec[i].len = n;
+  }
+
+  if (ud->data.left == 0) {
+    *pflags = NGHTTP3_DATA_FLAG_EOF;
+  }
+
+  return (ssize_t)i;
+}
+
+static ssize_t overflow_read_data_vec(nghttp3_conn *conn, int64_t stream_id,
+                                      nghttp3_vec *vec, size_t veccnt,
+                                      uint32_t *pflags, void *user_data,
+                                      void *stream_user_data) {
+  (void)conn;
+  (void)stream_id;
+  (void)vec;
+  (void)pflags;
+  (void)user_data;
+  (void)stream_user_data;
+
+  /* Claim more elements than |vec| can hold. */
+  return (ssize_t)veccnt + 1;
+}
+
+static uint64_t test_clock;
+
+static uint64_t tick(nghttp3_conn *conn, void *user_data) {
+  (void)conn;
+  (void)user_data;
+
+  return ++test_clock;
+}
+
 void test_nghttp3_conn_read_control(void) {
   const nghttp3_mem *mem = nghttp3_mem_default();
   nghttp3_conn *conn;
@@ -263,150 +323,2432 @@ void test_nghttp3_conn_submit_request(void) {
   CU_ASSERT(NULL != conn->tx.qdec);
   CU_ASSERT(NGHTTP3_STREAM_TYPE_QPACK_DECODER == conn->tx.qdec->type);
 
-  dr.read_data = step_read_data;
-  rv = nghttp3_conn_submit_request(
-      conn, 0, nghttp3_priority_init(&pri, NGHTTP3_ELEM_DEP_TYPE_ROOT, 0, 256),
-      nva, nghttp3_arraylen(nva), &dr, NULL);
+  memset(&dr, 0, sizeof(dr));
+  dr.read_data = step_read_data;
+  rv = nghttp3_conn_submit_request(
+      conn, 0, nghttp3_priority_init(&pri, NGHTTP3_ELEM_DEP_TYPE_ROOT, 0, 256),
+      nva, nghttp3_arraylen(nva), &dr, NULL);
+
+  CU_ASSERT(0 == rv);
+
+  /* This will write QPACK decoder stream; just stream type */
+  sveccnt = nghttp3_conn_writev_stream(conn, &stream_id, &fin, vec,
+                                       nghttp3_arraylen(vec));
+
+  CU_ASSERT(10 == stream_id);
+  CU_ASSERT(1 == sveccnt);
+  CU_ASSERT(1 == nghttp3_ringbuf_len(&conn->tx.qdec->outq));
+  CU_ASSERT(0 == conn->tx.qdec->outq_idx);
+  CU_ASSERT(0 == conn->tx.qdec->outq_offset);
+
+  /* Calling twice will return the same result */
+  sveccnt = nghttp3_conn_writev_stream(conn, &stream_id, &fin, vec,
+                                       nghttp3_arraylen(vec));
+
+  CU_ASSERT(10 == stream_id);
+  CU_ASSERT(1 == sveccnt);
+
+  rv = nghttp3_conn_add_write_offset(conn, 10, vec[0].len);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(1 == nghttp3_ringbuf_len(&conn->tx.qdec->outq));
+  CU_ASSERT(0 == conn->tx.qdec->outq_idx);
+  CU_ASSERT(vec[0].len == conn->tx.qdec->outq_offset);
+
+  rv = nghttp3_conn_add_ack_offset(conn, 10, vec[0].len);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(0 == nghttp3_ringbuf_len(&conn->tx.qdec->outq));
+  CU_ASSERT(0 == conn->tx.qdec->outq_idx);
+  CU_ASSERT(0 == conn->tx.qdec->outq_offset);
+  CU_ASSERT(0 == conn->tx.qdec->ack_offset);
+
+  /* This will write QPACK encoder stream; just stream type */
+  sveccnt = nghttp3_conn_writev_stream(conn, &stream_id, &fin, vec,
+                                       nghttp3_arraylen(vec));
+
+  CU_ASSERT(6 == stream_id);
+  CU_ASSERT(1 == sveccnt);
+
+  rv = nghttp3_conn_add_write_offset(conn, 6, vec[0].len);
+
+  CU_ASSERT(0 == rv);
+
+  rv = nghttp3_conn_add_ack_offset(conn, 6, vec[0].len);
+
+  CU_ASSERT(0 == rv);
+
+  /* This will write request stream */
+  sveccnt = nghttp3_conn_writev_stream(conn, &stream_id, &fin, vec,
+                                       nghttp3_arraylen(vec));
+
+  CU_ASSERT(0 == stream_id);
+  CU_ASSERT(7 == sveccnt);
+
+  len = nghttp3_vec_len(vec, (size_t)sveccnt);
+
+  for (i = 0; i < len; ++i) {
+    rv = nghttp3_conn_add_write_offset(conn, 0, 1);
+
+    CU_ASSERT(0 == rv);
+
+    rv = nghttp3_conn_add_ack_offset(conn, 0, 1);
+
+    CU_ASSERT(0 == rv);
+  }
+
+  stream = nghttp3_conn_find_stream(conn, 0);
+
+  CU_ASSERT(0 == nghttp3_ringbuf_len(&stream->outq));
+  CU_ASSERT(0 == nghttp3_ringbuf_len(&stream->chunks));
+  CU_ASSERT(0 == stream->outq_idx);
+  CU_ASSERT(0 == stream->outq_offset);
+  CU_ASSERT(0 == stream->ack_offset);
+  CU_ASSERT(2000 == ud.ack.acc);
+
+  nghttp3_conn_del(conn);
+}
+
+void test_nghttp3_conn_submit_request_data_vec(void) {
+  const nghttp3_mem *mem = nghttp3_mem_default();
+  nghttp3_conn *conn;
+  nghttp3_conn_callbacks callbacks;
+  nghttp3_conn_settings settings;
+  nghttp3_vec vec[256];
+  ssize_t sveccnt;
+  int rv;
+  int64_t stream_id;
+  const nghttp3_nv nva[] = {
+      MAKE_NV(":path", "/"),
+      MAKE_NV(":authority", "example.com"),
+      MAKE_NV(":scheme", "https"),
+      MAKE_NV(":method", "POST"),
+  };
+  nghttp3_stream *stream;
+  userdata ud;
+  nghttp3_data_reader dr;
+  int fin;
+  size_t len;
+
+  memset(&callbacks, 0, sizeof(callbacks));
+  memset(&ud, 0, sizeof(ud));
+  nghttp3_conn_settings_default(&settings);
+
+  callbacks.acked_stream_data = acked_stream_data;
+
+  ud.data.left = 1000;
+  ud.data.step = 100;
+
+  rv = nghttp3_conn_client_new(&conn, &callbacks, &settings, mem, &ud);
+
+  CU_ASSERT(0 == rv);
+
+  rv = nghttp3_conn_bind_qpack_streams(conn, 6, 10);
+
+  CU_ASSERT(0 == rv);
+
+  memset(&dr, 0, sizeof(dr));
+  dr.read_data = step_read_data;
+  dr.read_data_vec = step_read_data_vec;
+
+  /* read_data and read_data_vec are mutually exclusive. */
+  rv = nghttp3_conn_submit_request(conn, 0, NULL, nva, nghttp3_arraylen(nva),
+                                   &dr, NULL);
+
+  CU_ASSERT(NGHTTP3_ERR_INVALID_ARGUMENT == rv);
+  CU_ASSERT(NULL == nghttp3_conn_find_stream(conn, 0));
+
+  dr.read_data = NULL;
+
+  rv = nghttp3_conn_submit_request(conn, 0, NULL, nva, nghttp3_arraylen(nva),
+                                   &dr, NULL);
+
+  CU_ASSERT(0 == rv);
+
+  for (;;) {
+    sveccnt = nghttp3_conn_writev_stream(conn, &stream_id, &fin, vec,
+                                         nghttp3_arraylen(vec));
+
+    CU_ASSERT(sveccnt > 0);
+
+    if (sveccnt <= 0 || stream_id == 0) {
+      break;
+    }
+
+    len = nghttp3_vec_len(vec, (size_t)sveccnt);
+
+    rv = nghttp3_conn_add_write_offset(conn, stream_id, len);
+
+    CU_ASSERT(0 == rv);
+
+    rv = nghttp3_conn_add_ack_offset(conn, stream_id, len);
+
+    CU_ASSERT(0 == rv);
+  }
+
+  stream = nghttp3_conn_find_stream(conn, 0);
+
+  /* HEADERS frame header, header block prefix, header block, and a
+     single DATA frame header followed by 10 application buffers. */
+  CU_ASSERT(0 == ud.data.left);
+  CU_ASSERT(14 == sveccnt);
+  CU_ASSERT(14 == nghttp3_ringbuf_len(&stream->outq));
+  CU_ASSERT(NGHTTP3_FRAME_DATA == vec[3].base[0]);
+
+  len = nghttp3_vec_len(vec, (size_t)sveccnt);
+
+  rv = nghttp3_conn_add_write_offset(conn, 0, len);
+
+  CU_ASSERT(0 == rv);
+
+  rv = nghttp3_conn_add_ack_offset(conn, 0, len);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(0 == nghttp3_ringbuf_len(&stream->outq));
+  CU_ASSERT(0 == nghttp3_ringbuf_len(&stream->chunks));
+  CU_ASSERT(1000 == ud.ack.acc);
+  CU_ASSERT(1 == ud.ack.ncalls);
+
+  nghttp3_conn_del(conn);
+
+  /* The callback claims more elements than it was given. */
+  rv = nghttp3_conn_client_new(&conn, &callbacks, &settings, mem, &ud);
+
+  CU_ASSERT(0 == rv);
+
+  rv = nghttp3_conn_bind_qpack_streams(conn, 6, 10);
+
+  CU_ASSERT(0 == rv);
+
+  dr.read_data_vec = overflow_read_data_vec;
+
+  rv = nghttp3_conn_submit_request(conn, 0, NULL, nva, nghttp3_arraylen(nva),
+                                   &dr, NULL);
+
+  CU_ASSERT(0 == rv);
+
+  for (;;) {
+    sveccnt = nghttp3_conn_writev_stream(conn, &stream_id, &fin, vec,
+                                         nghttp3_arraylen(vec));
+    if (sveccnt <= 0) {
+      break;
+    }
+
+    len = nghttp3_vec_len(vec, (size_t)sveccnt);
+
+    rv = nghttp3_conn_add_write_offset(conn, stream_id, len);
+
+    CU_ASSERT(0 == rv);
+  }
+
+  CU_ASSERT(NGHTTP3_ERR_CALLBACK_FAILURE == sveccnt);
+
+  nghttp3_conn_del(conn);
+}
+
+void test_nghttp3_conn_add_ack_range(void) {
+  const nghttp3_mem *mem = nghttp3_mem_default();
+  nghttp3_conn *conn;
+  nghttp3_conn_callbacks callbacks;
+  nghttp3_conn_settings settings;
+  nghttp3_vec vec[256];
+  ssize_t sveccnt;
+  int rv;
+  int64_t stream_id;
+  const nghttp3_nv nva[] = {
+      MAKE_NV(":path", "/"),
+      MAKE_NV(":authority", "example.com"),
+      MAKE_NV(":scheme", "https"),
+      MAKE_NV(":method", "POST"),
+  };
+  nghttp3_stream *stream;
+  userdata ud;
+  nghttp3_data_reader dr;
+  int fin;
+  size_t len, hdlen;
+
+  memset(&callbacks, 0, sizeof(callbacks));
+  memset(&ud, 0, sizeof(ud));
+  nghttp3_conn_settings_default(&settings);
+
+  callbacks.acked_stream_data = acked_stream_data;
+
+  ud.data.left = 1000;
+  ud.data.step = 100;
+
+  rv = nghttp3_conn_client_new(&conn, &callbacks, &settings, mem, &ud);
+
+  CU_ASSERT(0 == rv);
+
+  rv = nghttp3_conn_bind_qpack_streams(conn, 6, 10);
+
+  CU_ASSERT(0 == rv);
+
+  memset(&dr, 0, sizeof(dr));
+  dr.read_data_vec = step_read_data_vec;
+
+  rv = nghttp3_conn_submit_request(conn, 0, NULL, nva, nghttp3_arraylen(nva),
+                                   &dr, NULL);
+
+  CU_ASSERT(0 == rv);
+
+  for (;;) {
+    sveccnt = nghttp3_conn_writev_stream(conn, &stream_id, &fin, vec,
+                                         nghttp3_arraylen(vec));
+
+    CU_ASSERT(sveccnt > 0);
+
+    if (sveccnt <= 0 || stream_id == 0) {
+      break;
+    }
+
+    len = nghttp3_vec_len(vec, (size_t)sveccnt);
+
+    rv = nghttp3_conn_add_write_offset(conn, stream_id, len);
+
+    CU_ASSERT(0 == rv);
+
+    rv = nghttp3_conn_add_ack_offset(conn, stream_id, len);
+
+    CU_ASSERT(0 == rv);
+  }
+
+  stream = nghttp3_conn_find_stream(conn, 0);
+
+  CU_ASSERT(14 == sveccnt);
+
+  /* Frame headers and header block precede 10 buffers of 100 bytes
+     each. */
+  hdlen = nghttp3_vec_len(vec, 4);
+  len = nghttp3_vec_len(vec, (size_t)sveccnt);
+
+  rv = nghttp3_conn_add_write_offset(conn, 0, len);
+
+  CU_ASSERT(0 == rv);
+
+  /* Acknowledge the last buffer */
+  rv = nghttp3_conn_add_ack_range(conn, 0, len - 100, 100);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(100 == ud.ack.acc);
+  CU_ASSERT(1 == ud.ack.ncalls);
+  CU_ASSERT(14 == nghttp3_ringbuf_len(&stream->outq));
+  CU_ASSERT(NULL != stream->ack_gaptr);
+
+  /* Acknowledge the second buffer partially */
+  rv = nghttp3_conn_add_ack_range(conn, 0, hdlen + 150, 50);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(100 == ud.ack.acc);
+  CU_ASSERT(1 == ud.ack.ncalls);
+
+  /* Acknowledge the remaining of the second buffer */
+  rv = nghttp3_conn_add_ack_range(conn, 0, hdlen + 90, 70);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(200 == ud.ack.acc);
+  CU_ASSERT(2 == ud.ack.ncalls);
+
+  /* Acknowledge the same range again */
+  rv = nghttp3_conn_add_ack_range(conn, 0, hdlen + 100, 100);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(200 == ud.ack.acc);
+  CU_ASSERT(2 == ud.ack.ncalls);
+
+  /* Acknowledge the data from the beginning.  The second buffer is
+     not notified twice. */
+  rv = nghttp3_conn_add_ack_range(conn, 0, 0, hdlen + 100);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(300 == ud.ack.acc);
+  CU_ASSERT(3 == ud.ack.ncalls);
+  CU_ASSERT(8 == nghttp3_ringbuf_len(&stream->outq));
+  CU_ASSERT(0 == nghttp3_ringbuf_len(&stream->chunks));
+  CU_ASSERT(0 == stream->ack_offset);
+
+  rv = nghttp3_conn_add_ack_offset(conn, 0, len - hdlen - 200);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(1000 == ud.ack.acc);
+  CU_ASSERT(4 == ud.ack.ncalls);
+  CU_ASSERT(0 == nghttp3_ringbuf_len(&stream->outq));
+  CU_ASSERT(NULL == stream->ack_gaptr);
+
+  nghttp3_conn_del(conn);
+}
+
+static void vec_copy(uint8_t *dest, const nghttp3_vec *vec, size_t veccnt) {
+  size_t i;
+
+  for (i = 0; i < veccnt; ++i) {
+    dest = nghttp3_cpymem(dest, vec[i].base, vec[i].len);
+  }
+}
+
+void test_nghttp3_conn_get_stream_data_range(void) {
+  const nghttp3_mem *mem = nghttp3_mem_default();
+  nghttp3_conn *conn;
+  nghttp3_conn_callbacks callbacks;
+  nghttp3_conn_settings settings;
+  nghttp3_vec vec[256], rvec[256];
+  ssize_t sveccnt, nvec;
+  int rv;
+  int64_t stream_id;
+  const nghttp3_nv nva[] = {
+      MAKE_NV(":path", "/"),
+      MAKE_NV(":authority", "example.com"),
+      MAKE_NV(":scheme", "https"),
+      MAKE_NV(":method", "POST"),
+  };
+  userdata ud;
+  nghttp3_data_reader dr;
+  int fin;
+  size_t len, hdlen;
+  uint8_t sent[2048], buf[2048];
+
+  memset(&callbacks, 0, sizeof(callbacks));
+  memset(&ud, 0, sizeof(ud));
+  nghttp3_conn_settings_default(&settings);
+
+  ud.data.left = 1000;
+  ud.data.step = 100;
+
+  rv = nghttp3_conn_client_new(&conn, &callbacks, &settings, mem, &ud);
+
+  CU_ASSERT(0 == rv);
+
+  rv = nghttp3_conn_bind_qpack_streams(conn, 6, 10);
+
+  CU_ASSERT(0 == rv);
+
+  memset(&dr, 0, sizeof(dr));
+  dr.read_data_vec = step_read_data_vec;
+
+  rv = nghttp3_conn_submit_request(conn, 0, NULL, nva, nghttp3_arraylen(nva),
+                                   &dr, NULL);
+
+  CU_ASSERT(0 == rv);
+
+  for (;;) {
+    sveccnt = nghttp3_conn_writev_stream(conn, &stream_id, &fin, vec,
+                                         nghttp3_arraylen(vec));
+
+    CU_ASSERT(sveccnt > 0);
+
+    if (sveccnt <= 0 || stream_id == 0) {
+      break;
+    }
+
+    len = nghttp3_vec_len(vec, (size_t)sveccnt);
+
+    rv = nghttp3_conn_add_write_offset(conn, stream_id, len);
+
+    CU_ASSERT(0 == rv);
+
+    rv = nghttp3_conn_add_ack_offset(conn, stream_id, len);
+
+    CU_ASSERT(0 == rv);
+  }
+
+  hdlen = nghttp3_vec_len(vec, 4);
+  len = nghttp3_vec_len(vec, (size_t)sveccnt);
+
+  CU_ASSERT(len <= sizeof(sent));
+
+  vec_copy(sent, vec, (size_t)sveccnt);
+
+  /* Data which are not written cannot be read */
+  nvec = nghttp3_conn_get_stream_data_range(conn, 0, 0, 1, rvec,
+                                            nghttp3_arraylen(rvec));
+
+  CU_ASSERT(NGHTTP3_ERR_INVALID_ARGUMENT == nvec);
+
+  rv = nghttp3_conn_add_write_offset(conn, 0, len);
+
+  CU_ASSERT(0 == rv);
+
+  nvec = nghttp3_conn_get_stream_data_range(conn, 0, 0, len, rvec,
+                                            nghttp3_arraylen(rvec));
+
+  CU_ASSERT(sveccnt == nvec);
+  CU_ASSERT(len == nghttp3_vec_len(rvec, (size_t)nvec));
+
+  vec_copy(buf, rvec, (size_t)nvec);
+
+  CU_ASSERT(0 == memcmp(sent, buf, len));
+
+  /* A range which starts and ends in the middle of buffers */
+  nvec = nghttp3_conn_get_stream_data_range(conn, 0, 1, hdlen + 149, rvec,
+                                            nghttp3_arraylen(rvec));
+
+  CU_ASSERT(6 == nvec);
+  CU_ASSERT(hdlen + 149 == nghttp3_vec_len(rvec, (size_t)nvec));
+
+  vec_copy(buf, rvec, (size_t)nvec);
+
+  CU_ASSERT(0 == memcmp(sent + 1, buf, hdlen + 149));
+
+  /* |veccnt| limits the number of buffers returned */
+  nvec = nghttp3_conn_get_stream_data_range(conn, 0, hdlen, 500, rvec, 2);
+
+  CU_ASSERT(2 == nvec);
+  CU_ASSERT(200 == nghttp3_vec_len(rvec, (size_t)nvec));
+
+  nvec = nghttp3_conn_get_stream_data_range(conn, 0, len - 1, 2, rvec,
+                                            nghttp3_arraylen(rvec));
+
+  CU_ASSERT(NGHTTP3_ERR_INVALID_ARGUMENT == nvec);
+
+  rv = nghttp3_conn_add_ack_offset(conn, 0, hdlen);
+
+  CU_ASSERT(0 == rv);
+
+  nvec = nghttp3_conn_get_stream_data_range(conn, 0, hdlen - 1, 1, rvec,
+                                            nghttp3_arraylen(rvec));
+
+  CU_ASSERT(NGHTTP3_ERR_INVALID_ARGUMENT == nvec);
+
+  /* Reading stops before the buffer acknowledged out of order */
+  rv = nghttp3_conn_add_ack_range(conn, 0, hdlen + 300, 100);
+
+  CU_ASSERT(0 == rv);
+
+  nvec = nghttp3_conn_get_stream_data_range(conn, 0, hdlen, len - hdlen, rvec,
+                                            nghttp3_arraylen(rvec));
+
+  CU_ASSERT(3 == nvec);
+  CU_ASSERT(300 == nghttp3_vec_len(rvec, (size_t)nvec));
+
+  nghttp3_conn_del(conn);
+}
+
+static ssize_t write_qpack_streams(nghttp3_conn *conn, int64_t *pstream_id,
+                                   nghttp3_vec *vec, size_t veccnt) {
+  ssize_t sveccnt;
+  int fin;
+  size_t len;
+  int rv;
+
+  for (;;) {
+    sveccnt = nghttp3_conn_writev_stream(conn, pstream_id, &fin, vec, veccnt);
+    if (sveccnt <= 0 || !nghttp3_stream_uni(*pstream_id)) {
+      return sveccnt;
+    }
+
+    len = nghttp3_vec_len(vec, (size_t)sveccnt);
+
+    rv = nghttp3_conn_add_write_offset(conn, *pstream_id, len);
+
+    CU_ASSERT(0 == rv);
+
+    rv = nghttp3_conn_add_ack_offset(conn, *pstream_id, len);
+
+    CU_ASSERT(0 == rv);
+  }
+}
+
+void test_nghttp3_conn_tx_watermark(void) {
+  const nghttp3_mem *mem = nghttp3_mem_default();
+  nghttp3_conn *conn;
+  nghttp3_conn_callbacks callbacks;
+  nghttp3_conn_settings settings;
+  nghttp3_vec vec[256];
+  ssize_t sveccnt;
+  int rv;
+  int64_t stream_id;
+  const nghttp3_nv nva[] = {
+      MAKE_NV(":path", "/"),
+      MAKE_NV(":authority", "example.com"),
+      MAKE_NV(":scheme", "https"),
+      MAKE_NV(":method", "POST"),
+  };
+  userdata ud;
+  nghttp3_data_reader dr;
+  size_t len;
+
+  memset(&callbacks, 0, sizeof(callbacks));
+  memset(&dr, 0, sizeof(dr));
+  dr.read_data = step_read_data;
+
+  /* Invalid watermarks */
+  nghttp3_conn_settings_default(&settings);
+  settings.tx_high_watermark = 0;
+  settings.tx_low_watermark = 0;
+
+  rv = nghttp3_conn_client_new(&conn, &callbacks, &settings, mem, NULL);
+
+  CU_ASSERT(NGHTTP3_ERR_INVALID_ARGUMENT == rv);
+
+  settings.tx_high_watermark = 100;
+  settings.tx_low_watermark = 101;
+
+  rv = nghttp3_conn_server_new(&conn, &callbacks, &settings, mem, NULL);
+
+  CU_ASSERT(NGHTTP3_ERR_INVALID_ARGUMENT == rv);
+
+  /* Per stream watermarks */
+  memset(&ud, 0, sizeof(ud));
+  nghttp3_conn_settings_default(&settings);
+  settings.tx_high_watermark = 300;
+  settings.tx_low_watermark = 100;
+
+  ud.data.left = 1000;
+  ud.data.step = 100;
+
+  rv = nghttp3_conn_client_new(&conn, &callbacks, &settings, mem, &ud);
+
+  CU_ASSERT(0 == rv);
+
+  rv = nghttp3_conn_bind_qpack_streams(conn, 6, 10);
+
+  CU_ASSERT(0 == rv);
+
+  rv = nghttp3_conn_submit_request(conn, 0, NULL, nva, nghttp3_arraylen(nva),
+                                   &dr, NULL);
+
+  CU_ASSERT(0 == rv);
+
+  sveccnt = write_qpack_streams(conn, &stream_id, vec, nghttp3_arraylen(vec));
+
+  CU_ASSERT(sveccnt > 0);
+  CU_ASSERT(0 == stream_id);
+  /* HEADERS followed by 3 DATA frames reach the high watermark */
+  CU_ASSERT(700 == ud.data.left);
+
+  len = nghttp3_vec_len(vec, (size_t)sveccnt);
+
+  rv = nghttp3_conn_add_write_offset(conn, 0, 200);
+
+  CU_ASSERT(0 == rv);
+
+  /* Unsent data are still above the low watermark */
+  sveccnt = write_qpack_streams(conn, &stream_id, vec, nghttp3_arraylen(vec));
+
+  CU_ASSERT(sveccnt > 0);
+  CU_ASSERT(700 == ud.data.left);
+
+  rv = nghttp3_conn_add_write_offset(conn, 0, len - 200);
+
+  CU_ASSERT(0 == rv);
+
+  sveccnt = write_qpack_streams(conn, &stream_id, vec, nghttp3_arraylen(vec));
+
+  CU_ASSERT(sveccnt > 0);
+  CU_ASSERT(400 == ud.data.left);
+
+  nghttp3_conn_del(conn);
+
+  /* Connection wide budget */
+  memset(&ud, 0, sizeof(ud));
+  nghttp3_conn_settings_default(&settings);
+  settings.max_tx_buffered = 200;
+
+  ud.data.left = 1000;
+  ud.data.step = 100;
+
+  rv = nghttp3_conn_client_new(&conn, &callbacks, &settings, mem, &ud);
+
+  CU_ASSERT(0 == rv);
+
+  rv = nghttp3_conn_bind_qpack_streams(conn, 6, 10);
+
+  CU_ASSERT(0 == rv);
+
+  rv = nghttp3_conn_submit_request(conn, 0, NULL, nva, nghttp3_arraylen(nva),
+                                   &dr, NULL);
+
+  CU_ASSERT(0 == rv);
+
+  sveccnt = write_qpack_streams(conn, &stream_id, vec, nghttp3_arraylen(vec));
+
+  CU_ASSERT(sveccnt > 0);
+  CU_ASSERT(0 == stream_id);
+  CU_ASSERT(800 == ud.data.left);
+
+  len = nghttp3_vec_len(vec, (size_t)sveccnt);
+
+  CU_ASSERT(len == conn->tx.buffered);
+
+  rv = nghttp3_conn_add_write_offset(conn, 0, len);
+
+  CU_ASSERT(0 == rv);
+
+  /* No budget left until the data are acknowledged */
+  sveccnt = write_qpack_streams(conn, &stream_id, vec, nghttp3_arraylen(vec));
+
+  CU_ASSERT(0 == sveccnt);
+  CU_ASSERT(800 == ud.data.left);
+  CU_ASSERT(nghttp3_conn_find_stream(conn, 0) == conn->tx.budget_waitq);
+
+  /* A new stream waits for the budget as well, and leaves the list
+     when it is closed. */
+  rv = nghttp3_conn_submit_request(conn, 4, NULL, nva, nghttp3_arraylen(nva),
+                                   NULL, NULL);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(nghttp3_conn_find_stream(conn, 4) == conn->tx.budget_waitq);
+  CU_ASSERT(nghttp3_conn_find_stream(conn, 0) ==
+            conn->tx.budget_waitq->budget_next);
+
+  rv = nghttp3_conn_close_stream(conn, 4);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(nghttp3_conn_find_stream(conn, 0) == conn->tx.budget_waitq);
+  CU_ASSERT(NULL == conn->tx.budget_waitq->budget_next);
+
+  rv = nghttp3_conn_add_ack_offset(conn, 0, len);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(0 == conn->tx.buffered);
+  CU_ASSERT(NULL == conn->tx.budget_waitq);
+
+  sveccnt = write_qpack_streams(conn, &stream_id, vec, nghttp3_arraylen(vec));
+
+  CU_ASSERT(sveccnt > 0);
+  CU_ASSERT(0 == stream_id);
+  CU_ASSERT(600 == ud.data.left);
+
+  nghttp3_conn_del(conn);
+}
+
+void test_nghttp3_conn_tx_budget_reschedule(void) {
+  const nghttp3_mem *mem = nghttp3_mem_default();
+  nghttp3_conn *conn;
+  nghttp3_conn_callbacks callbacks;
+  nghttp3_conn_settings settings;
+  nghttp3_vec vec[256];
+  ssize_t sveccnt;
+  int rv;
+  int64_t stream_id;
+  const nghttp3_nv nva[] = {
+      MAKE_NV(":path", "/"),
+      MAKE_NV(":authority", "example.com"),
+      MAKE_NV(":scheme", "https"),
+      MAKE_NV(":method", "POST"),
+  };
+  nghttp3_stream *stream;
+  userdata ud;
+  nghttp3_data_reader dr;
+  size_t len;
+
+  memset(&callbacks, 0, sizeof(callbacks));
+  memset(&dr, 0, sizeof(dr));
+  dr.read_data = step_read_data;
+
+  memset(&ud, 0, sizeof(ud));
+  nghttp3_conn_settings_default(&settings);
+  settings.max_tx_buffered = 200;
+
+  ud.data.left = 1000;
+  ud.data.step = 100;
+
+  rv = nghttp3_conn_client_new(&conn, &callbacks, &settings, mem, &ud);
+
+  CU_ASSERT(0 == rv);
+
+  rv = nghttp3_conn_bind_qpack_streams(conn, 6, 10);
+
+  CU_ASSERT(0 == rv);
+
+  rv = nghttp3_conn_submit_request(conn, 0, NULL, nva, nghttp3_arraylen(nva),
+                                   &dr, NULL);
+
+  CU_ASSERT(0 == rv);
+
+  sveccnt = write_qpack_streams(conn, &stream_id, vec, nghttp3_arraylen(vec));
+
+  CU_ASSERT(sveccnt > 0);
+  CU_ASSERT(0 == stream_id);
+
+  len = nghttp3_vec_len(vec, (size_t)sveccnt);
+
+  rv = nghttp3_conn_add_write_offset(conn, 0, len);
+
+  CU_ASSERT(0 == rv);
+
+  stream = nghttp3_conn_find_stream(conn, 0);
+
+  /* Asking whether the stream should be scheduled has no side
+     effect even if the budget is exhausted. */
+  CU_ASSERT(0 == nghttp3_stream_require_schedule(stream));
+  CU_ASSERT(0 == nghttp3_stream_require_schedule(stream));
+  CU_ASSERT(NULL == conn->tx.budget_waitq);
+  CU_ASSERT(!(stream->flags & NGHTTP3_STREAM_FLAG_TX_BUDGET_WAIT));
+
+  /* Writing finds the budget exhausted and parks the stream. */
+  sveccnt = write_qpack_streams(conn, &stream_id, vec, nghttp3_arraylen(vec));
+
+  CU_ASSERT(0 == sveccnt);
+  CU_ASSERT(stream == conn->tx.budget_waitq);
+  CU_ASSERT(NULL == stream->budget_next);
+  CU_ASSERT(!nghttp3_stream_is_scheduled(stream));
+
+  sveccnt = write_qpack_streams(conn, &stream_id, vec, nghttp3_arraylen(vec));
+
+  CU_ASSERT(0 == sveccnt);
+  CU_ASSERT(stream == conn->tx.budget_waitq);
+  CU_ASSERT(NULL == stream->budget_next);
+
+  rv = nghttp3_conn_add_ack_range(conn, 0, 0, len);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(NULL == conn->tx.budget_waitq);
+  CU_ASSERT(!(stream->flags & NGHTTP3_STREAM_FLAG_TX_BUDGET_WAIT));
+  CU_ASSERT(nghttp3_stream_is_scheduled(stream));
+  CU_ASSERT(1 == nghttp3_pq_size(&conn->root.q.pq));
+
+  sveccnt = write_qpack_streams(conn, &stream_id, vec, nghttp3_arraylen(vec));
+
+  CU_ASSERT(sveccnt > 0);
+  CU_ASSERT(0 == stream_id);
+
+  nghttp3_conn_del(conn);
+}
+
+void test_nghttp3_conn_submit_request_file(void) {
+  const nghttp3_mem *mem = nghttp3_mem_default();
+  nghttp3_conn *conn;
+  nghttp3_conn_callbacks callbacks;
+  nghttp3_conn_settings settings;
+  nghttp3_vec vec[256];
+  ssize_t sveccnt;
+  int rv;
+  int64_t stream_id;
+  const nghttp3_nv nva[] = {
+      MAKE_NV(":path", "/"),
+      MAKE_NV(":authority", "example.com"),
+      MAKE_NV(":scheme", "https"),
+      MAKE_NV(":method", "POST"),
+  };
+  nghttp3_stream *stream;
+  userdata ud;
+  nghttp3_data_reader dr;
+  int fin;
+  size_t len, i, nread, total;
+  static uint8_t data[200000];
+  FILE *fp;
+  const uint8_t *p;
+
+  for (i = 0; i < sizeof(data); ++i) {
+    data[i] = (uint8_t)(i * 7);
+  }
+
+  fp = tmpfile();
+
+  CU_ASSERT(NULL != fp);
+  CU_ASSERT(1 == fwrite(data, sizeof(data), 1, fp));
+  CU_ASSERT(0 == fflush(fp));
+
+  memset(&callbacks, 0, sizeof(callbacks));
+  memset(&ud, 0, sizeof(ud));
+  nghttp3_conn_settings_default(&settings);
+
+  callbacks.acked_stream_data = acked_stream_data;
+
+  rv = nghttp3_conn_client_new(&conn, &callbacks, &settings, mem, &ud);
+
+  CU_ASSERT(0 == rv);
+
+  rv = nghttp3_conn_bind_qpack_streams(conn, 6, 10);
+
+  CU_ASSERT(0 == rv);
+
+  /* A data reader must specify a data source. */
+  memset(&dr, 0, sizeof(dr));
+
+  rv = nghttp3_conn_submit_request(conn, 0, NULL, nva, nghttp3_arraylen(nva),
+                                   &dr, NULL);
+
+  CU_ASSERT(NGHTTP3_ERR_INVALID_ARGUMENT == rv);
+  CU_ASSERT(NULL == nghttp3_conn_find_stream(conn, 0));
+
+  /* file is exclusive with read_data. */
+  dr.read_data = step_read_data;
+  dr.file.fd = fileno(fp);
+  dr.file.offset = 5000;
+  dr.file.len = 150000;
+
+  rv = nghttp3_conn_submit_request(conn, 0, NULL, nva, nghttp3_arraylen(nva),
+                                   &dr, NULL);
+
+  CU_ASSERT(NGHTTP3_ERR_INVALID_ARGUMENT == rv);
+  CU_ASSERT(NULL == nghttp3_conn_find_stream(conn, 0));
+
+  dr.read_data = NULL;
+
+  rv = nghttp3_conn_submit_request(conn, 0, NULL, nva, nghttp3_arraylen(nva),
+                                   &dr, NULL);
+
+  CU_ASSERT(0 == rv);
+
+  /* The mapping is independent from the file descriptor */
+  fclose(fp);
+
+  stream = nghttp3_conn_find_stream(conn, 0);
+
+  CU_ASSERT(NULL != stream->file);
+
+  nread = 0;
+  total = 0;
+
+  for (;;) {
+    sveccnt = nghttp3_conn_writev_stream(conn, &stream_id, &fin, vec,
+                                         nghttp3_arraylen(vec));
+
+    CU_ASSERT(sveccnt >= 0);
+
+    if (sveccnt <= 0) {
+      break;
+    }
+
+    len = nghttp3_vec_len(vec, (size_t)sveccnt);
+
+    if (stream_id == 0) {
+      total += len;
+
+      /* Application data point into the mapping */
+      for (i = 0; i < (size_t)sveccnt; ++i) {
+        p = vec[i].base;
+        if (p >= stream->file->base &&
+            p < stream->file->base + stream->file->maplen) {
+          CU_ASSERT(0 == memcmp(p, data + 5000 + nread, vec[i].len));
+          nread += vec[i].len;
+        }
+      }
+    }
+
+    rv = nghttp3_conn_add_write_offset(conn, stream_id, len);
+
+    CU_ASSERT(0 == rv);
+  }
+
+  CU_ASSERT(150000 == nread);
+  CU_ASSERT(NULL != stream->file);
+
+  /* Acknowledge the first 100000 bytes of stream data */
+  rv = nghttp3_conn_add_ack_offset(conn, 0, 100000);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(NULL != stream->file);
+  CU_ASSERT(stream->file->unmapped > 0);
+  CU_ASSERT(0 == stream->file->unmapped % stream->file->pagesize);
+
+  rv = nghttp3_conn_add_ack_range(conn, 0, 0, total);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(NULL == stream->file);
+  CU_ASSERT(150000 == ud.ack.acc);
+
+  nghttp3_conn_del(conn);
+}
+
+void test_nghttp3_conn_urgency_scheduler(void) {
+  const nghttp3_mem *mem = nghttp3_mem_default();
+  nghttp3_conn *conn;
+  nghttp3_conn_callbacks callbacks;
+  nghttp3_conn_settings settings;
+  nghttp3_vec vec[256];
+  ssize_t sveccnt;
+  int rv;
+  int64_t stream_id;
+  const nghttp3_nv nva[] = {
+      MAKE_NV(":path", "/"),
+      MAKE_NV(":authority", "example.com"),
+      MAKE_NV(":scheme", "https"),
+      MAKE_NV(":method", "GET"),
+  };
+  userdata ud;
+  int64_t i;
+
+  memset(&callbacks, 0, sizeof(callbacks));
+  memset(&ud, 0, sizeof(ud));
+  nghttp3_conn_settings_default(&settings);
+  settings.scheduler = NGHTTP3_SCHEDULER_URGENCY;
+
+  rv = nghttp3_conn_client_new(&conn, &callbacks, &settings, mem, &ud);
+
+  CU_ASSERT(0 == rv);
+
+  rv = nghttp3_conn_bind_qpack_streams(conn, 6, 10);
+
+  CU_ASSERT(0 == rv);
+
+  for (i = 0; i < 3; ++i) {
+    rv = nghttp3_conn_submit_request(conn, i * 4, NULL, nva,
+                                     nghttp3_arraylen(nva), NULL, NULL);
+
+    CU_ASSERT(0 == rv);
+  }
+
+  rv = nghttp3_conn_set_stream_urgency(conn, 8, 0, 0);
+
+  CU_ASSERT(0 == rv);
+
+  rv = nghttp3_conn_set_stream_urgency(conn, 4, 8, 0);
+
+  CU_ASSERT(NGHTTP3_ERR_INVALID_ARGUMENT == rv);
+
+  rv = nghttp3_conn_set_stream_urgency(conn, 4, 7, 0);
+
+  CU_ASSERT(0 == rv);
+
+  /* Streams are served in the order of urgency */
+  sveccnt = write_qpack_streams(conn, &stream_id, vec, nghttp3_arraylen(vec));
+
+  CU_ASSERT(sveccnt > 0);
+  CU_ASSERT(8 == stream_id);
+
+  rv = nghttp3_conn_add_write_offset(conn, stream_id,
+                                     nghttp3_vec_len(vec, (size_t)sveccnt));
+
+  CU_ASSERT(0 == rv);
+
+  sveccnt = write_qpack_streams(conn, &stream_id, vec, nghttp3_arraylen(vec));
+
+  CU_ASSERT(sveccnt > 0);
+  CU_ASSERT(0 == stream_id);
+
+  rv = nghttp3_conn_add_write_offset(conn, stream_id,
+                                     nghttp3_vec_len(vec, (size_t)sveccnt));
+
+  CU_ASSERT(0 == rv);
+
+  sveccnt = write_qpack_streams(conn, &stream_id, vec, nghttp3_arraylen(vec));
+
+  CU_ASSERT(sveccnt > 0);
+  CU_ASSERT(4 == stream_id);
+
+  rv = nghttp3_conn_add_write_offset(conn, stream_id,
+                                     nghttp3_vec_len(vec, (size_t)sveccnt));
+
+  CU_ASSERT(0 == rv);
+
+  sveccnt = write_qpack_streams(conn, &stream_id, vec, nghttp3_arraylen(vec));
+
+  CU_ASSERT(0 == sveccnt);
+  CU_ASSERT(0 == conn->urgq.mask);
+
+  nghttp3_conn_del(conn);
+}
+
+void test_nghttp3_conn_tx_quantum(void) {
+  const nghttp3_mem *mem = nghttp3_mem_default();
+  nghttp3_conn *conn;
+  nghttp3_conn_callbacks callbacks;
+  nghttp3_conn_settings settings;
+  nghttp3_vec vec[256];
+  ssize_t sveccnt;
+  int rv;
+  int64_t stream_id;
+  const nghttp3_nv nva[] = {
+      MAKE_NV(":path", "/"),
+      MAKE_NV(":authority", "example.com"),
+      MAKE_NV(":scheme", "https"),
+      MAKE_NV(":method", "POST"),
+  };
+  userdata ud;
+  nghttp3_data_reader dr;
+  size_t i, j;
+  static const size_t quanta[] = {0, 3000};
+  static const int64_t expected[][8] = {
+      {0, 4, 0, 4, 0, 4, 0, 4},
+      {0, 0, 0, 4, 4, 4, 0, 0},
+  };
+
+  memset(&callbacks, 0, sizeof(callbacks));
+  memset(&dr, 0, sizeof(dr));
+  dr.read_data = step_read_data;
+
+  for (i = 0; i < nghttp3_arraylen(quanta); ++i) {
+    memset(&ud, 0, sizeof(ud));
+    nghttp3_conn_settings_default(&settings);
+    settings.tx_quantum = quanta[i];
+
+    ud.data.left = 100000;
+    ud.data.step = 1000;
+
+    rv = nghttp3_conn_client_new(&conn, &callbacks, &settings, mem, &ud);
+
+    CU_ASSERT(0 == rv);
+
+    rv = nghttp3_conn_bind_qpack_streams(conn, 6, 10);
+
+    CU_ASSERT(0 == rv);
+
+    rv = nghttp3_conn_submit_request(conn, 0, NULL, nva,
+                                     nghttp3_arraylen(nva), &dr, NULL);
+
+    CU_ASSERT(0 == rv);
+
+    rv = nghttp3_conn_submit_request(conn, 4, NULL, nva,
+                                     nghttp3_arraylen(nva), &dr, NULL);
+
+    CU_ASSERT(0 == rv);
+
+    /* Each stream sends 1000 bytes at a time. */
+    for (j = 0; j < nghttp3_arraylen(expected[i]); ++j) {
+      sveccnt =
+          write_qpack_streams(conn, &stream_id, vec, nghttp3_arraylen(vec));
+
+      CU_ASSERT(sveccnt > 0);
+      CU_ASSERT(expected[i][j] == stream_id);
+
+      rv = nghttp3_conn_add_write_offset(conn, stream_id, 1000);
+
+      CU_ASSERT(0 == rv);
+    }
+
+    nghttp3_conn_del(conn);
+  }
+}
+
+void test_nghttp3_conn_tree_calendar_scheduler(void) {
+  const nghttp3_mem *mem = nghttp3_mem_default();
+  nghttp3_conn *conn;
+  nghttp3_conn_callbacks callbacks;
+  nghttp3_conn_settings settings;
+  nghttp3_vec vec[256];
+  ssize_t sveccnt;
+  int rv;
+  int64_t stream_id;
+  const nghttp3_nv nva[] = {
+      MAKE_NV(":path", "/"),
+      MAKE_NV(":authority", "example.com"),
+      MAKE_NV(":scheme", "https"),
+      MAKE_NV(":method", "POST"),
+  };
+  userdata ud;
+  nghttp3_data_reader dr;
+  nghttp3_stream *stream;
+  size_t i, j;
+  static const nghttp3_scheduler schedulers[] = {
+      NGHTTP3_SCHEDULER_TREE,
+      NGHTTP3_SCHEDULER_TREE_CALENDAR,
+  };
+  static const int64_t expected[] = {0, 4, 0, 4, 0, 4, 0, 4};
+
+  memset(&callbacks, 0, sizeof(callbacks));
+  memset(&dr, 0, sizeof(dr));
+  dr.read_data = step_read_data;
+
+  /* The calendar queue serves streams in the same order as the binary
+     heap. */
+  for (i = 0; i < nghttp3_arraylen(schedulers); ++i) {
+    memset(&ud, 0, sizeof(ud));
+    nghttp3_conn_settings_default(&settings);
+    settings.scheduler = schedulers[i];
+
+    ud.data.left = 100000;
+    ud.data.step = 1000;
+
+    rv = nghttp3_conn_client_new(&conn, &callbacks, &settings, mem, &ud);
+
+    CU_ASSERT(0 == rv);
+    CU_ASSERT((schedulers[i] == NGHTTP3_SCHEDULER_TREE_CALENDAR) ==
+              conn->root.use_calq);
+
+    rv = nghttp3_conn_bind_qpack_streams(conn, 6, 10);
+
+    CU_ASSERT(0 == rv);
+
+    rv = nghttp3_conn_submit_request(conn, 0, NULL, nva,
+                                     nghttp3_arraylen(nva), &dr, NULL);
+
+    CU_ASSERT(0 == rv);
+
+    rv = nghttp3_conn_submit_request(conn, 4, NULL, nva,
+                                     nghttp3_arraylen(nva), &dr, NULL);
+
+    CU_ASSERT(0 == rv);
+    CU_ASSERT(2 == nghttp3_tnode_num_scheduled_children(&conn->root));
+
+    stream = nghttp3_conn_find_stream(conn, 4);
+
+    CU_ASSERT(conn->root.use_calq == stream->node.use_calq);
+
+    /* Each stream sends 1000 bytes at a time. */
+    for (j = 0; j < nghttp3_arraylen(expected); ++j) {
+      sveccnt =
+          write_qpack_streams(conn, &stream_id, vec, nghttp3_arraylen(vec));
+
+      CU_ASSERT(sveccnt > 0);
+      CU_ASSERT(expected[j] == stream_id);
+
+      rv = nghttp3_conn_add_write_offset(conn, stream_id, 1000);
+
+      CU_ASSERT(0 == rv);
+    }
+
+    /* Closing a stream takes it out of the queue of root. */
+    rv = nghttp3_conn_close_stream(conn, 4);
+
+    CU_ASSERT(0 == rv);
+    CU_ASSERT(1 == nghttp3_tnode_num_scheduled_children(&conn->root));
+
+    nghttp3_conn_del(conn);
+  }
+}
+
+static void conn_read_write(nghttp3_conn *cl, nghttp3_conn *sv) {
+  nghttp3_vec vec[256];
+  ssize_t sveccnt;
+  ssize_t sconsumed;
+  int64_t stream_id;
+  int fin;
+  int rv;
+  size_t i, j;
+  nghttp3_conn *sender = cl, *receiver = sv;
+
+  for (j = 0; j < 2; ++j) {
+    for (;;) {
+      sveccnt = nghttp3_conn_writev_stream(sender, &stream_id, &fin, vec,
+                                           nghttp3_arraylen(vec));
+
+      CU_ASSERT(sveccnt >= 0);
+
+      if (sveccnt <= 0) {
+        break;
+      }
+
+      rv = nghttp3_conn_add_write_offset(sender, stream_id,
+                                         nghttp3_vec_len(vec, (size_t)sveccnt));
+
+      CU_ASSERT(0 == rv);
+
+      for (i = 0; i < (size_t)sveccnt; ++i) {
+        sconsumed = nghttp3_conn_read_stream(receiver, stream_id, vec[i].base,
+                                             vec[i].len,
+                                             fin && i == (size_t)sveccnt - 1);
+        CU_ASSERT(sconsumed >= 0);
+      }
+
+      rv = nghttp3_conn_add_ack_offset(sender, stream_id,
+                                       nghttp3_vec_len(vec, (size_t)sveccnt));
+
+      CU_ASSERT(0 == rv);
+    }
+
+    sender = sv;
+    receiver = cl;
+  }
+}
+
+void test_nghttp3_conn_submit_priority(void) {
+  const nghttp3_mem *mem = nghttp3_mem_default();
+  nghttp3_conn *cl, *sv;
+  nghttp3_conn_callbacks callbacks;
+  nghttp3_conn_settings settings;
+  int rv;
+  nghttp3_placeholder *ph;
+
+  memset(&callbacks, 0, sizeof(callbacks));
+  nghttp3_conn_settings_default(&settings);
+
+  nghttp3_conn_client_new(&cl, &callbacks, &settings, mem, NULL);
+
+  settings.num_placeholders = 10;
+  nghttp3_conn_server_new(&sv, &callbacks, &settings, mem, NULL);
+
+  nghttp3_conn_set_max_client_streams_bidi(sv, 100);
+
+  nghttp3_conn_bind_control_stream(cl, 2);
+  nghttp3_conn_bind_control_stream(sv, 3);
+
+  nghttp3_conn_bind_qpack_streams(cl, 6, 10);
+  nghttp3_conn_bind_qpack_streams(sv, 7, 11);
+
+  conn_read_write(cl, sv);
+
+  rv = nghttp3_conn_submit_priority(cl, NGHTTP3_PRI_ELEM_TYPE_PLACEHOLDER, 7,
+                                    NGHTTP3_ELEM_DEP_TYPE_ROOT, 0, 249);
+
+  CU_ASSERT(0 == rv);
+
+  conn_read_write(cl, sv);
+
+  ph = nghttp3_conn_find_placeholder(sv, 7);
+
+  CU_ASSERT(&sv->root == ph->node.parent);
+  CU_ASSERT(249 == ph->node.weight);
+  CU_ASSERT(NULL == nghttp3_conn_find_placeholder(sv, 6));
+  CU_ASSERT(NULL == nghttp3_conn_find_placeholder(sv, 10));
+
+  nghttp3_conn_del(sv);
+  nghttp3_conn_del(cl);
+}
+
+typedef struct {
+  /* nalloc is the number of allocations currently live. */
+  size_t nalloc;
+} countmem;
+
+static void *countmem_malloc(size_t size, void *user_data) {
+  countmem *cm = user_data;
+  void *p = malloc(size);
+
+  if (p) {
+    ++cm->nalloc;
+  }
+
+  return p;
+}
+
+static void countmem_free(void *ptr, void *user_data) {
+  countmem *cm = user_data;
+
+  if (ptr) {
+    --cm->nalloc;
+    free(ptr);
+  }
+}
+
+static void *countmem_calloc(size_t nmemb, size_t size, void *user_data) {
+  countmem *cm = user_data;
+  void *p = calloc(nmemb, size);
+
+  if (p) {
+    ++cm->nalloc;
+  }
+
+  return p;
+}
+
+static void *countmem_realloc(void *ptr, size_t size, void *user_data) {
+  countmem *cm = user_data;
+  void *p = realloc(ptr, size);
+
+  if (ptr == NULL && p) {
+    ++cm->nalloc;
+  }
+
+  return p;
+}
+
+/*
+ * conn_arena_exchange sends a request with body from client to server
+ * whose settings.arena is |arena|, and returns the number of
+ * allocations live just before both connections are deleted.
+ */
+static size_t conn_arena_exchange(int arena) {
+  countmem cm = {0};
+  nghttp3_mem mem = {&cm, countmem_malloc, countmem_free, countmem_calloc,
+                     countmem_realloc};
+  nghttp3_conn *cl, *sv;
+  nghttp3_conn_callbacks callbacks;
+  nghttp3_conn_settings settings;
+  const nghttp3_nv nva[] = {
+      MAKE_NV(":path", "/"),
+      MAKE_NV(":authority", "example.com"),
+      MAKE_NV(":scheme", "https"),
+      MAKE_NV(":method", "POST"),
+  };
+  nghttp3_data_reader dr;
+  userdata ud;
+  size_t nalloc;
+  int64_t stream_id;
+  int rv;
+
+  memset(&callbacks, 0, sizeof(callbacks));
+  memset(&ud, 0, sizeof(ud));
+  nghttp3_conn_settings_default(&settings);
+
+  settings.qpack_max_table_capacity = 4096;
+  settings.qpack_blocked_streams = 100;
+  settings.arena = arena;
+
+  ud.data.left = 100000;
+  ud.data.step = 1000;
+
+  nghttp3_conn_client_new(&cl, &callbacks, &settings, &mem, &ud);
+  nghttp3_conn_server_new(&sv, &callbacks, &settings, &mem, NULL);
+
+  nghttp3_conn_set_max_client_streams_bidi(sv, 100);
+
+  nghttp3_conn_bind_control_stream(cl, 2);
+  nghttp3_conn_bind_control_stream(sv, 3);
+
+  nghttp3_conn_bind_qpack_streams(cl, 6, 10);
+  nghttp3_conn_bind_qpack_streams(sv, 7, 11);
+
+  memset(&dr, 0, sizeof(dr));
+  dr.read_data = step_read_data;
+
+  for (stream_id = 0; stream_id < 40; stream_id += 4) {
+    rv = nghttp3_conn_submit_request(cl, stream_id, NULL, nva,
+                                     nghttp3_arraylen(nva), &dr, NULL);
+
+    CU_ASSERT(0 == rv);
+  }
+
+  conn_read_write(cl, sv);
+
+  CU_ASSERT(NULL != nghttp3_conn_find_stream(sv, 36));
+
+  nalloc = cm.nalloc;
+
+  nghttp3_conn_del(sv);
+  nghttp3_conn_del(cl);
+
+  CU_ASSERT(0 == cm.nalloc);
+
+  return nalloc;
+}
+
+void test_nghttp3_conn_arena(void) {
+  size_t nalloc, arena_nalloc;
+
+  nalloc = conn_arena_exchange(0);
+  arena_nalloc = conn_arena_exchange(1);
+
+  /* Arena obtains memory in a few large blocks. */
+  CU_ASSERT(arena_nalloc < nalloc);
+  CU_ASSERT(arena_nalloc < 32);
+}
+
+typedef struct {
+  uint8_t path[32];
+  size_t pathlen;
+} pathrecord;
+
+static int recv_path(nghttp3_conn *conn, int64_t stream_id, int32_t token,
+                     nghttp3_rcbuf *name, nghttp3_rcbuf *value, uint8_t flags,
+                     void *user_data, void *stream_user_data) {
+  pathrecord *pr = user_data;
+  nghttp3_vec v;
+  (void)conn;
+  (void)stream_id;
+  (void)name;
+  (void)flags;
+  (void)stream_user_data;
+
+  if (token == NGHTTP3_QPACK_TOKEN__PATH) {
+    v = nghttp3_rcbuf_get_buf(value);
+    memcpy(pr->path, v.base, v.len);
+    pr->pathlen = v.len;
+  }
+
+  return 0;
+}
+
+void test_nghttp3_conn_eager_encode(void) {
+  const nghttp3_mem *mem = nghttp3_mem_default();
+  nghttp3_conn *cl, *sv;
+  nghttp3_conn_callbacks callbacks;
+  nghttp3_conn_settings settings;
+  uint8_t path[] = "/eager";
+  nghttp3_nv nva[] = {
+      MAKE_NV(":path", "/"),
+      MAKE_NV(":authority", "example.com"),
+      MAKE_NV(":scheme", "https"),
+      MAKE_NV(":method", "GET"),
+  };
+  const nghttp3_nv upper_nva[] = {
+      MAKE_NV(":path", "/"),
+      MAKE_NV(":authority", "example.com"),
+      MAKE_NV(":scheme", "https"),
+      MAKE_NV(":method", "GET"),
+      MAKE_NV("X-Upper", "1"),
+  };
+  pathrecord pr;
+  nghttp3_stream *stream;
+  int rv;
+
+  memset(&callbacks, 0, sizeof(callbacks));
+  memset(&pr, 0, sizeof(pr));
+  callbacks.recv_header = recv_path;
+  nghttp3_conn_settings_default(&settings);
+
+  settings.qpack_max_table_capacity = 4096;
+  settings.qpack_blocked_streams = 100;
+  settings.eager_encode = 1;
+
+  nghttp3_conn_client_new(&cl, &callbacks, &settings, mem, NULL);
+  nghttp3_conn_server_new(&sv, &callbacks, &settings, mem, &pr);
+
+  nghttp3_conn_set_max_client_streams_bidi(sv, 100);
+
+  nghttp3_conn_bind_control_stream(cl, 2);
+  nghttp3_conn_bind_control_stream(sv, 3);
+
+  nghttp3_conn_bind_qpack_streams(cl, 6, 10);
+  nghttp3_conn_bind_qpack_streams(sv, 7, 11);
+
+  nva[0].value = path;
+  nva[0].valuelen = sizeof(path) - 1;
+
+  rv = nghttp3_conn_submit_request(cl, 0, NULL, nva, nghttp3_arraylen(nva),
+                                   NULL, NULL);
+
+  CU_ASSERT(0 == rv);
+
+  /* HEADERS frame has been encoded already. */
+  stream = nghttp3_conn_find_stream(cl, 0);
+
+  CU_ASSERT(0 == nghttp3_ringbuf_len(&stream->frq));
+  CU_ASSERT(nghttp3_ringbuf_len(&stream->outq) > 0);
+
+  /* Header fields are not referenced after submission. */
+  memset(path, 'x', sizeof(path) - 1);
+
+  conn_read_write(cl, sv);
+
+  CU_ASSERT(sizeof("/eager") - 1 == pr.pathlen);
+  CU_ASSERT(0 == memcmp("/eager", pr.path, pr.pathlen));
+
+  /* Uppercase name has to be copied to be downcased. */
+  rv = nghttp3_conn_submit_request(cl, 4, NULL, upper_nva,
+                                   nghttp3_arraylen(upper_nva), NULL, NULL);
+
+  CU_ASSERT(0 == rv);
+
+  stream = nghttp3_conn_find_stream(cl, 4);
+
+  CU_ASSERT(1 == nghttp3_ringbuf_len(&stream->frq));
+
+  nghttp3_conn_del(sv);
+  nghttp3_conn_del(cl);
+}
+
+typedef struct {
+  uint8_t cookie[64];
+  size_t cookielen;
+  size_t ncookies;
+} cookierecord;
+
+static int recv_cookie(nghttp3_conn *conn, int64_t stream_id, int32_t token,
+                       nghttp3_rcbuf *name, nghttp3_rcbuf *value,
+                       uint8_t flags, void *user_data,
+                       void *stream_user_data) {
+  cookierecord *cr = user_data;
+  nghttp3_vec v;
+  (void)conn;
+  (void)stream_id;
+  (void)name;
+  (void)flags;
+  (void)stream_user_data;
+
+  if (token == NGHTTP3_QPACK_TOKEN_COOKIE) {
+    v = nghttp3_rcbuf_get_buf(value);
+    CU_ASSERT(v.len <= sizeof(cr->cookie));
+    memcpy(cr->cookie, v.base, v.len);
+    cr->cookielen = v.len;
+    ++cr->ncookies;
+  }
+
+  return 0;
+}
+
+/*
+ * conn_cookie_exchange sends a request with a cookie header field to
+ * server whose settings.rejoin_cookie is |rejoin_cookie|, and records
+ * the cookie header fields that server receives in |cr|.
+ */
+static void conn_cookie_exchange(int rejoin_cookie, cookierecord *cr) {
+  const nghttp3_mem *mem = nghttp3_mem_default();
+  nghttp3_conn *cl, *sv;
+  nghttp3_conn_callbacks callbacks;
+  nghttp3_conn_settings settings;
+  const nghttp3_nv nva[] = {
+      MAKE_NV(":path", "/"),
+      MAKE_NV(":authority", "example.com"),
+      MAKE_NV(":scheme", "https"),
+      MAKE_NV(":method", "GET"),
+      MAKE_NV("cookie", "a=1; session=0123456789abcdefghij; theme=dark"),
+  };
+  int rv;
+
+  memset(&callbacks, 0, sizeof(callbacks));
+  memset(cr, 0, sizeof(*cr));
+  callbacks.recv_header = recv_cookie;
+  nghttp3_conn_settings_default(&settings);
+
+  settings.qpack_max_table_capacity = 4096;
+  settings.qpack_blocked_streams = 100;
+
+  nghttp3_conn_client_new(&cl, &callbacks, &settings, mem, NULL);
+
+  settings.rejoin_cookie = rejoin_cookie;
+  nghttp3_conn_server_new(&sv, &callbacks, &settings, mem, cr);
+
+  nghttp3_conn_set_max_client_streams_bidi(sv, 100);
+
+  nghttp3_conn_bind_control_stream(cl, 2);
+  nghttp3_conn_bind_control_stream(sv, 3);
+
+  nghttp3_conn_bind_qpack_streams(cl, 6, 10);
+  nghttp3_conn_bind_qpack_streams(sv, 7, 11);
+
+  rv = nghttp3_conn_submit_request(cl, 0, NULL, nva, nghttp3_arraylen(nva),
+                                   NULL, NULL);
+
+  CU_ASSERT(0 == rv);
+
+  conn_read_write(cl, sv);
+
+  nghttp3_conn_del(sv);
+  nghttp3_conn_del(cl);
+}
+
+void test_nghttp3_conn_rejoin_cookie(void) {
+  cookierecord cr;
+  const char cookie[] = "a=1; session=0123456789abcdefghij; theme=dark";
+
+  /* Client splits cookie into crumbs. */
+  conn_cookie_exchange(0, &cr);
+
+  CU_ASSERT(3 == cr.ncookies);
+  CU_ASSERT(sizeof("theme=dark") - 1 == cr.cookielen);
+  CU_ASSERT(0 == memcmp("theme=dark", cr.cookie, cr.cookielen));
+
+  conn_cookie_exchange(1, &cr);
+
+  CU_ASSERT(1 == cr.ncookies);
+  CU_ASSERT(sizeof(cookie) - 1 == cr.cookielen);
+  CU_ASSERT(0 == memcmp(cookie, cr.cookie, cr.cookielen));
+}
+
+void test_nghttp3_conn_qpack_warm_profile(void) {
+  const nghttp3_mem *mem = nghttp3_mem_default();
+  nghttp3_conn *cl, *sv;
+  nghttp3_conn_callbacks callbacks;
+  nghttp3_conn_settings settings;
+  const nghttp3_nv profile[] = {
+      MAKE_NV(":authority", "example.com"),
+      MAKE_NV("user-agent", "nghttp3 test"),
+  };
+  const nghttp3_nv nva[] = {
+      MAKE_NV(":path", "/"),
+      MAKE_NV(":authority", "example.com"),
+      MAKE_NV(":scheme", "https"),
+      MAKE_NV(":method", "GET"),
+      MAKE_NV("user-agent", "nghttp3 test"),
+  };
+  int rv;
+
+  memset(&callbacks, 0, sizeof(callbacks));
+  nghttp3_conn_settings_default(&settings);
+
+  settings.qpack_max_table_capacity = 4096;
+  /* Header blocks cannot refer to unacknowledged entries. */
+  settings.qpack_blocked_streams = 0;
+
+  nghttp3_conn_client_new(&cl, &callbacks, &settings, mem, NULL);
+  nghttp3_conn_server_new(&sv, &callbacks, &settings, mem, NULL);
+
+  nghttp3_conn_set_max_client_streams_bidi(sv, 100);
+
+  rv = nghttp3_conn_set_qpack_warm_profile(cl, profile,
+                                           nghttp3_arraylen(profile));
+
+  CU_ASSERT(0 == rv);
+
+  nghttp3_conn_bind_control_stream(cl, 2);
+  nghttp3_conn_bind_control_stream(sv, 3);
+
+  nghttp3_conn_bind_qpack_streams(cl, 6, 10);
+  nghttp3_conn_bind_qpack_streams(sv, 7, 11);
+
+  /* Capacity of dynamic table is not known yet. */
+  CU_ASSERT(0 == nghttp3_ringbuf_len(&cl->qenc.ctx.dtable));
+
+  /* Client learns the capacity from SETTINGS sent by server. */
+  conn_read_write(cl, sv);
+
+  CU_ASSERT(2 == nghttp3_ringbuf_len(&cl->qenc.ctx.dtable));
+  CU_ASSERT(NULL == cl->qpack_warm.nva);
+
+  conn_read_write(cl, sv);
+
+  CU_ASSERT(2 == nghttp3_qpack_decoder_get_icnt(&sv->qdec));
+  CU_ASSERT(2 == cl->qenc.krcnt);
+
+  rv = nghttp3_conn_submit_request(cl, 0, NULL, nva, nghttp3_arraylen(nva),
+                                   NULL, NULL);
+
+  CU_ASSERT(0 == rv);
+
+  conn_read_write(cl, sv);
+
+  CU_ASSERT(2 == nghttp3_ringbuf_len(&cl->qenc.ctx.dtable));
+  CU_ASSERT(2 == nghttp3_qpack_decoder_get_icnt(&sv->qdec));
+
+  nghttp3_conn_del(sv);
+  nghttp3_conn_del(cl);
+}
+
+/*
+ * conn_write_hold writes the stream data of |cl| to |sv| except for
+ * request stream 0 and QPACK encoder stream 6, which are copied to
+ * |reqbuf| and |encbuf| instead, and acknowledges all of them.
+ * *preqfin is set to nonzero if fin is written to request stream.
+ */
+static void conn_write_hold(nghttp3_conn *cl, nghttp3_conn *sv,
+                            uint8_t *reqbuf, size_t *preqlen, int *preqfin,
+                            uint8_t *encbuf, size_t *penclen) {
+  nghttp3_vec vec[256];
+  ssize_t sveccnt, nread;
+  int64_t stream_id;
+  size_t len, i;
+  int fin;
+  int rv;
+
+  for (;;) {
+    sveccnt = nghttp3_conn_writev_stream(cl, &stream_id, &fin, vec,
+                                         nghttp3_arraylen(vec));
+
+    CU_ASSERT(sveccnt >= 0);
+
+    if (sveccnt <= 0) {
+      break;
+    }
+
+    len = nghttp3_vec_len(vec, (size_t)sveccnt);
+
+    for (i = 0; i < (size_t)sveccnt; ++i) {
+      if (stream_id == 0) {
+        memcpy(reqbuf + *preqlen, vec[i].base, vec[i].len);
+        *preqlen += vec[i].len;
+      } else if (stream_id == 6) {
+        memcpy(encbuf + *penclen, vec[i].base, vec[i].len);
+        *penclen += vec[i].len;
+      } else {
+        nread = nghttp3_conn_read_stream(sv, stream_id, vec[i].base,
+                                         vec[i].len, 0);
+
+        CU_ASSERT(nread >= 0);
+      }
+    }
+
+    if (stream_id == 0) {
+      *preqfin = fin;
+    }
+
+    rv = nghttp3_conn_add_write_offset(cl, stream_id, len);
+
+    CU_ASSERT(0 == rv);
+
+    rv = nghttp3_conn_add_ack_offset(cl, stream_id, len);
+
+    CU_ASSERT(0 == rv);
+  }
+}
+
+void test_nghttp3_conn_read_bidi_fin(void) {
+  const nghttp3_mem *mem = nghttp3_mem_default();
+  nghttp3_conn *cl, *sv;
+  nghttp3_conn_callbacks callbacks;
+  nghttp3_conn_settings settings;
+  const nghttp3_nv nva[] = {
+      MAKE_NV(":path", "/"),
+      MAKE_NV(":authority", "example.com"),
+      MAKE_NV(":scheme", "https"),
+      MAKE_NV(":method", "GET"),
+  };
+  uint8_t reqbuf[256], encbuf[256];
+  size_t reqlen = 0, enclen = 0;
+  ssize_t nread;
+  int reqfin = 0;
+  nghttp3_stream *stream;
+  int rv;
+
+  memset(&callbacks, 0, sizeof(callbacks));
+  nghttp3_conn_settings_default(&settings);
+
+  nghttp3_conn_client_new(&cl, &callbacks, &settings, mem, NULL);
+  nghttp3_conn_server_new(&sv, &callbacks, &settings, mem, NULL);
+
+  nghttp3_conn_set_max_client_streams_bidi(sv, 100);
+
+  nghttp3_conn_bind_control_stream(cl, 2);
+  nghttp3_conn_bind_control_stream(sv, 3);
+
+  nghttp3_conn_bind_qpack_streams(cl, 6, 10);
+  nghttp3_conn_bind_qpack_streams(sv, 7, 11);
+
+  rv = nghttp3_conn_submit_request(cl, 0, NULL, nva, nghttp3_arraylen(nva),
+                                   NULL, NULL);
+
+  CU_ASSERT(0 == rv);
+
+  rv = nghttp3_conn_end_stream(cl, 0);
+
+  CU_ASSERT(0 == rv);
+
+  conn_write_hold(cl, sv, reqbuf, &reqlen, &reqfin, encbuf, &enclen);
+
+  CU_ASSERT(reqfin);
+
+  /* fin is received at the end of HEADERS frame, and the whole data
+     are consumed. */
+  nread = nghttp3_conn_read_stream(sv, 0, reqbuf, reqlen, 1);
+
+  CU_ASSERT((ssize_t)reqlen == nread);
+
+  stream = nghttp3_conn_find_stream(sv, 0);
+
+  CU_ASSERT(NGHTTP3_HTTP_STATE_REQ_END == stream->rx.hstate);
+
+  nghttp3_conn_del(sv);
+  nghttp3_conn_del(cl);
+}
+
+void test_nghttp3_conn_qpack_blocked(void) {
+  const nghttp3_mem *mem = nghttp3_mem_default();
+  nghttp3_conn *cl, *sv;
+  nghttp3_conn_callbacks callbacks;
+  nghttp3_conn_settings settings;
+  const nghttp3_nv nva[] = {
+      MAKE_NV(":path", "/blocked"),
+      MAKE_NV(":authority", "example.com"),
+      MAKE_NV(":scheme", "https"),
+      MAKE_NV(":method", "GET"),
+      MAKE_NV("x-blocked", "yes"),
+  };
+  uint8_t reqbuf[256], encbuf[256];
+  size_t reqlen = 0, enclen = 0;
+  ssize_t nread;
+  int reqfin = 0;
+  pathrecord pr;
+  int rv;
+
+  memset(&callbacks, 0, sizeof(callbacks));
+  memset(&pr, 0, sizeof(pr));
+  callbacks.recv_header = recv_path;
+  nghttp3_conn_settings_default(&settings);
+
+  settings.qpack_max_table_capacity = 4096;
+  settings.qpack_blocked_streams = 100;
+
+  nghttp3_conn_client_new(&cl, &callbacks, &settings, mem, NULL);
+  nghttp3_conn_server_new(&sv, &callbacks, &settings, mem, &pr);
+
+  nghttp3_conn_set_max_client_streams_bidi(sv, 100);
+
+  nghttp3_conn_bind_control_stream(cl, 2);
+  nghttp3_conn_bind_control_stream(sv, 3);
+
+  nghttp3_conn_bind_qpack_streams(cl, 6, 10);
+  nghttp3_conn_bind_qpack_streams(sv, 7, 11);
+
+  conn_read_write(cl, sv);
+
+  rv = nghttp3_conn_submit_request(cl, 0, NULL, nva, nghttp3_arraylen(nva),
+                                   NULL, NULL);
+
+  CU_ASSERT(0 == rv);
+
+  conn_write_hold(cl, sv, reqbuf, &reqlen, &reqfin, encbuf, &enclen);
+
+  CU_ASSERT(!reqfin);
+  CU_ASSERT(enclen > 0);
+
+  nread = nghttp3_conn_read_stream(sv, 0, reqbuf, reqlen, 0);
+
+  CU_ASSERT(nread >= 0);
+  CU_ASSERT(0 == pr.pathlen);
+
+  /* The return value is the number of bytes consumed from encoder
+     stream, not from the unblocked request stream. */
+  nread = nghttp3_conn_read_stream(sv, 6, encbuf, enclen, 0);
+
+  CU_ASSERT((ssize_t)enclen == nread);
+  CU_ASSERT(sizeof("/blocked") - 1 == pr.pathlen);
+  CU_ASSERT(0 == memcmp("/blocked", pr.path, pr.pathlen));
+
+  nghttp3_conn_del(sv);
+  nghttp3_conn_del(cl);
+}
+
+static int sum_stream_buffers(nghttp3_map_entry *ent, void *ptr) {
+  nghttp3_stream *stream = nghttp3_struct_of(ent, nghttp3_stream, me);
+  nghttp3_conn_stats *st = ptr;
+  nghttp3_typed_buf *tbuf;
+  size_t i, len;
+
+  len = nghttp3_ringbuf_len(&stream->outq);
+  if (len) {
+    tbuf = nghttp3_ringbuf_get(&stream->outq, len - 1);
+    st->outq_bytes +=
+        tbuf->offset + nghttp3_buf_len(&tbuf->buf) - stream->ack_base;
+  }
+
+  len = nghttp3_ringbuf_len(&stream->inq);
+  for (i = 0; i < len; ++i) {
+    st->inq_bytes +=
+        nghttp3_buf_len((nghttp3_buf *)nghttp3_ringbuf_get(&stream->inq, i));
+  }
+
+  len = nghttp3_ringbuf_len(&stream->chunks);
+  for (i = 0; i < len; ++i) {
+    st->chunk_bytes +=
+        nghttp3_buf_cap((nghttp3_buf *)nghttp3_ringbuf_get(&stream->chunks, i));
+  }
+
+  return 0;
+}
+
+/*
+ * check_buffer_stats checks that the running counters of the buffers
+ * of |conn| agree with the buffers of its streams.
+ */
+static void check_buffer_stats(nghttp3_conn *conn) {
+  nghttp3_conn_stats stats, sum;
+
+  memset(&sum, 0, sizeof(sum));
+
+  nghttp3_conn_get_stats(conn, &stats);
+  nghttp3_map_each(&conn->streams, sum_stream_buffers, &sum);
+
+  CU_ASSERT(sum.outq_bytes == stats.outq_bytes);
+  CU_ASSERT(sum.inq_bytes == stats.inq_bytes);
+  CU_ASSERT(sum.chunk_bytes == stats.chunk_bytes);
+}
+
+void test_nghttp3_conn_qpack_blocked_fin(void) {
+  const nghttp3_mem *mem = nghttp3_mem_default();
+  nghttp3_conn *cl, *sv;
+  nghttp3_conn_callbacks callbacks;
+  nghttp3_conn_settings settings;
+  const nghttp3_nv nva[] = {
+      MAKE_NV(":path", "/blocked"),
+      MAKE_NV(":authority", "example.com"),
+      MAKE_NV(":scheme", "https"),
+      MAKE_NV(":method", "GET"),
+      MAKE_NV("x-blocked", "yes"),
+  };
+  uint8_t reqbuf[256], encbuf[256];
+  size_t reqlen = 0, enclen = 0;
+  ssize_t nread;
+  int reqfin = 0;
+  pathrecord pr;
+  nghttp3_stream *stream;
+  nghttp3_stream_timing timing;
+  nghttp3_conn_stats stats;
+  int rv;
+
+  memset(&callbacks, 0, sizeof(callbacks));
+  memset(&pr, 0, sizeof(pr));
+  callbacks.recv_header = recv_path;
+  callbacks.get_timestamp = tick;
+  nghttp3_conn_settings_default(&settings);
+
+  settings.qpack_max_table_capacity = 4096;
+  settings.qpack_blocked_streams = 100;
+
+  nghttp3_conn_client_new(&cl, &callbacks, &settings, mem, NULL);
+  nghttp3_conn_server_new(&sv, &callbacks, &settings, mem, &pr);
+
+  nghttp3_conn_set_max_client_streams_bidi(sv, 100);
+
+  nghttp3_conn_bind_control_stream(cl, 2);
+  nghttp3_conn_bind_control_stream(sv, 3);
+
+  nghttp3_conn_bind_qpack_streams(cl, 6, 10);
+  nghttp3_conn_bind_qpack_streams(sv, 7, 11);
+
+  conn_read_write(cl, sv);
+
+  rv = nghttp3_conn_submit_request(cl, 0, NULL, nva, nghttp3_arraylen(nva),
+                                   NULL, NULL);
+
+  CU_ASSERT(0 == rv);
+
+  rv = nghttp3_conn_end_stream(cl, 0);
+
+  CU_ASSERT(0 == rv);
+
+  conn_write_hold(cl, sv, reqbuf, &reqlen, &reqfin, encbuf, &enclen);
+
+  CU_ASSERT(reqfin);
+  CU_ASSERT(enclen > 0);
+
+  /* Request stream arrives first, and it is blocked. */
+  nread = nghttp3_conn_read_stream(sv, 0, reqbuf, reqlen, 1);
+
+  CU_ASSERT(nread >= 0);
+  CU_ASSERT(0 == pr.pathlen);
+
+  nghttp3_conn_get_stats(sv, &stats);
+
+  CU_ASSERT(stats.inq_bytes > 0);
+
+  check_buffer_stats(sv);
+
+  nread = nghttp3_conn_read_stream(sv, 6, encbuf, enclen, 0);
+
+  CU_ASSERT((ssize_t)enclen == nread);
+  CU_ASSERT(sizeof("/blocked") - 1 == pr.pathlen);
+  CU_ASSERT(0 == memcmp("/blocked", pr.path, pr.pathlen));
+
+  stream = nghttp3_conn_find_stream(sv, 0);
+
+  CU_ASSERT(NGHTTP3_HTTP_STATE_REQ_END == stream->rx.hstate);
+  CU_ASSERT(0 == nghttp3_ringbuf_len(&stream->inq));
+
+  rv = nghttp3_conn_get_stream_timing(sv, 0, &timing);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(NGHTTP3_TIMESTAMP_NONE != timing.qpack_blocked);
+  CU_ASSERT(timing.first_byte_recv < timing.qpack_blocked);
+  CU_ASSERT(timing.qpack_blocked < timing.qpack_unblocked);
+  CU_ASSERT(timing.qpack_unblocked < timing.headers_recv);
+  CU_ASSERT(timing.qpack_unblocked - timing.qpack_blocked ==
+            timing.qpack_blocked_time);
+
+  nghttp3_conn_get_stats(sv, &stats);
+
+  CU_ASSERT(1 == stats.qpack_blocked_total);
+  CU_ASSERT(0 == stats.qpack_blocked_streams);
+  CU_ASSERT(timing.qpack_blocked_time == stats.qpack_blocked_time);
+  CU_ASSERT(0 == stats.inq_bytes);
+
+  nghttp3_conn_del(sv);
+  nghttp3_conn_del(cl);
+}
+
+void test_nghttp3_conn_end_stream_pending_data(void) {
+  const nghttp3_mem *mem = nghttp3_mem_default();
+  nghttp3_conn *conn;
+  nghttp3_conn_callbacks callbacks;
+  nghttp3_conn_settings settings;
+  const nghttp3_nv nva[] = {
+      MAKE_NV(":path", "/"),
+      MAKE_NV(":authority", "example.com"),
+      MAKE_NV(":scheme", "https"),
+      MAKE_NV(":method", "POST"),
+  };
+  nghttp3_vec vec[256];
+  nghttp3_data_reader dr;
+  userdata ud;
+  ssize_t sveccnt;
+  int64_t stream_id;
+  size_t len;
+  int fin, nfin = 0;
+  int rv;
+
+  memset(&callbacks, 0, sizeof(callbacks));
+  memset(&dr, 0, sizeof(dr));
+  memset(&ud, 0, sizeof(ud));
+  dr.read_data = step_read_data;
+  nghttp3_conn_settings_default(&settings);
+  settings.tx_high_watermark = 300;
+  settings.tx_low_watermark = 100;
+
+  ud.data.left = 1000;
+  ud.data.step = 100;
+
+  nghttp3_conn_client_new(&conn, &callbacks, &settings, mem, &ud);
+  nghttp3_conn_bind_qpack_streams(conn, 6, 10);
+
+  rv = nghttp3_conn_submit_request(conn, 0, NULL, nva, nghttp3_arraylen(nva),
+                                   &dr, NULL);
+
+  CU_ASSERT(0 == rv);
+
+  rv = nghttp3_conn_end_stream(conn, 0);
+
+  CU_ASSERT(0 == rv);
+
+  /* outq is drained each time it reaches the high watermark, but fin
+     must not be sent before all data are pulled. */
+  for (;;) {
+    sveccnt = nghttp3_conn_writev_stream(conn, &stream_id, &fin, vec,
+                                         nghttp3_arraylen(vec));
+
+    CU_ASSERT(sveccnt >= 0);
+
+    if (sveccnt <= 0) {
+      break;
+    }
+
+    if (stream_id == 0 && fin) {
+      CU_ASSERT(0 == ud.data.left);
+      ++nfin;
+    }
+
+    len = nghttp3_vec_len(vec, (size_t)sveccnt);
+
+    rv = nghttp3_conn_add_write_offset(conn, stream_id, len);
+
+    CU_ASSERT(0 == rv);
+  }
+
+  CU_ASSERT(0 == ud.data.left);
+  CU_ASSERT(1 == nfin);
+
+  nghttp3_conn_del(conn);
+}
+
+void test_nghttp3_conn_arena_cookie(void) {
+  const nghttp3_mem *mem = nghttp3_mem_default();
+  countmem cm = {0};
+  nghttp3_mem imem = {&cm, countmem_malloc, countmem_free, countmem_calloc,
+                      countmem_realloc};
+  nghttp3_qpack_intern *intern;
+  nghttp3_conn *cl, *sv;
+  nghttp3_conn_callbacks callbacks;
+  nghttp3_conn_settings settings;
+  const nghttp3_nv nva[] = {
+      MAKE_NV(":path", "/"),
+      MAKE_NV(":authority", "example.com"),
+      MAKE_NV(":scheme", "https"),
+      MAKE_NV(":method", "GET"),
+      MAKE_NV("cookie", "a=1; session=0123456789abcdefghij; theme=dark"),
+  };
+  cookierecord cr;
+  uint8_t reqbuf[1024], encbuf[1024];
+  size_t reqlen = 0, enclen = 0;
+  int reqfin = 0;
+  ssize_t nread;
+  nghttp3_stream *stream;
+  static const char *crumbs[] = {"a=1", "session=0123456789abcdefghij"};
+  nghttp3_rcbuf *value;
+  size_t i;
+  int rv;
+
+  rv = nghttp3_qpack_intern_new(&intern, 64, 64, &imem);
+
+  CU_ASSERT(0 == rv);
+
+  /* Make the cookie crumbs admitted to the table, as if they had been
+     seen before. */
+  for (i = 0; i < 2 * nghttp3_arraylen(crumbs); ++i) {
+    rv = nghttp3_rcbuf_new2(&value, (const uint8_t *)crumbs[i / 2],
+                            strlen(crumbs[i / 2]), mem);
+
+    CU_ASSERT(0 == rv);
+
+    nghttp3_rcbuf_decref(nghttp3_qpack_intern_get(intern, value));
+  }
+
+  memset(&callbacks, 0, sizeof(callbacks));
+  memset(&cr, 0, sizeof(cr));
+  callbacks.recv_header = recv_cookie;
+  nghttp3_conn_settings_default(&settings);
+
+  nghttp3_conn_client_new(&cl, &callbacks, &settings, mem, NULL);
+
+  settings.arena = 1;
+  settings.rejoin_cookie = 1;
+  nghttp3_conn_server_new(&sv, &callbacks, &settings, mem, &cr);
+  nghttp3_conn_set_qpack_intern(sv, intern);
+
+  nghttp3_conn_set_max_client_streams_bidi(sv, 100);
+
+  nghttp3_conn_bind_control_stream(cl, 2);
+  nghttp3_conn_bind_qpack_streams(cl, 6, 10);
+
+  rv = nghttp3_conn_submit_request(cl, 0, NULL, nva, nghttp3_arraylen(nva),
+                                   NULL, NULL);
+
+  CU_ASSERT(0 == rv);
+
+  conn_write_hold(cl, sv, reqbuf, &reqlen, &reqfin, encbuf, &enclen);
+
+  nread = nghttp3_conn_read_stream(sv, 6, encbuf, enclen, 0);
+
+  CU_ASSERT((ssize_t)enclen == nread);
+
+  /* The last cookie crumb is cut off, so the others are buffered. */
+  nread = nghttp3_conn_read_stream(sv, 0, reqbuf, reqlen - 1, 0);
+
+  CU_ASSERT((ssize_t)reqlen - 1 == nread);
+  CU_ASSERT(0 == cr.ncookies);
+
+  stream = nghttp3_conn_find_stream(sv, 0);
+
+  CU_ASSERT(NULL != stream->cookies);
+  CU_ASSERT(nghttp3_ringbuf_len(stream->cookies) > 0);
+
+  /* The arena must not leak the references to the interned values. */
+  nghttp3_conn_del(sv);
+  nghttp3_conn_del(cl);
+
+  nghttp3_qpack_intern_del(intern);
+
+  CU_ASSERT(0 == cm.nalloc);
+}
+
+typedef struct {
+  nghttp3_trace_event evs[64];
+  size_t nevs;
+} tracerecord;
+
+static void record_trace(nghttp3_conn *conn, const nghttp3_trace_event *ev,
+                         void *user_data) {
+  tracerecord *tr = user_data;
+  (void)conn;
+
+  if (tr->nevs < nghttp3_arraylen(tr->evs)) {
+    tr->evs[tr->nevs++] = *ev;
+  }
+}
+
+static const nghttp3_trace_event *
+find_trace(const tracerecord *tr, nghttp3_trace_event_type type,
+           int64_t stream_id) {
+  size_t i;
+
+  for (i = 0; i < tr->nevs; ++i) {
+    if (tr->evs[i].type == type && tr->evs[i].stream_id == stream_id) {
+      return &tr->evs[i];
+    }
+  }
+
+  return NULL;
+}
+
+void test_nghttp3_conn_trace(void) {
+  const nghttp3_mem *mem = nghttp3_mem_default();
+  nghttp3_conn *cl, *sv;
+  nghttp3_conn_callbacks callbacks;
+  nghttp3_conn_settings settings;
+  const nghttp3_nv nva[] = {
+      MAKE_NV(":path", "/"),
+      MAKE_NV(":authority", "example.com"),
+      MAKE_NV(":scheme", "https"),
+      MAKE_NV(":method", "GET"),
+      MAKE_NV("x-trace", "yes"),
+  };
+  tracerecord cltr, svtr;
+  const nghttp3_trace_event *ev;
+  int rv;
+
+  memset(&callbacks, 0, sizeof(callbacks));
+  memset(&cltr, 0, sizeof(cltr));
+  memset(&svtr, 0, sizeof(svtr));
+  callbacks.trace = record_trace;
+  nghttp3_conn_settings_default(&settings);
+
+  settings.qpack_max_table_capacity = 4096;
+  settings.qpack_blocked_streams = 100;
+
+  nghttp3_conn_client_new(&cl, &callbacks, &settings, mem, &cltr);
+  nghttp3_conn_server_new(&sv, &callbacks, &settings, mem, &svtr);
+
+  nghttp3_conn_set_max_client_streams_bidi(sv, 100);
 
-  CU_ASSERT(0 == rv);
+  nghttp3_conn_bind_control_stream(cl, 2);
+  nghttp3_conn_bind_control_stream(sv, 3);
 
-  /* This will write QPACK decoder stream; just stream type */
-  sveccnt = nghttp3_conn_writev_stream(conn, &stream_id, &fin, vec,
-                                       nghttp3_arraylen(vec));
+  nghttp3_conn_bind_qpack_streams(cl, 6, 10);
+  nghttp3_conn_bind_qpack_streams(sv, 7, 11);
 
-  CU_ASSERT(10 == stream_id);
-  CU_ASSERT(1 == sveccnt);
-  CU_ASSERT(1 == nghttp3_ringbuf_len(&conn->tx.qdec->outq));
-  CU_ASSERT(0 == conn->tx.qdec->outq_idx);
-  CU_ASSERT(0 == conn->tx.qdec->outq_offset);
+  conn_read_write(cl, sv);
 
-  /* Calling twice will return the same result */
-  sveccnt = nghttp3_conn_writev_stream(conn, &stream_id, &fin, vec,
-                                       nghttp3_arraylen(vec));
+  ev = find_trace(&cltr, NGHTTP3_TRACE_EVENT_FRAME_SENT, 2);
 
-  CU_ASSERT(10 == stream_id);
-  CU_ASSERT(1 == sveccnt);
+  CU_ASSERT(NULL != ev);
+  CU_ASSERT(NGHTTP3_FRAME_SETTINGS == ev->u.frame.type);
 
-  rv = nghttp3_conn_add_write_offset(conn, 10, vec[0].len);
+  ev = find_trace(&svtr, NGHTTP3_TRACE_EVENT_FRAME_RECV, 2);
+
+  CU_ASSERT(NULL != ev);
+  CU_ASSERT(NGHTTP3_FRAME_SETTINGS == ev->u.frame.type);
+
+  rv = nghttp3_conn_submit_request(cl, 0, NULL, nva, nghttp3_arraylen(nva),
+                                   NULL, NULL);
 
   CU_ASSERT(0 == rv);
-  CU_ASSERT(1 == nghttp3_ringbuf_len(&conn->tx.qdec->outq));
-  CU_ASSERT(0 == conn->tx.qdec->outq_idx);
-  CU_ASSERT(vec[0].len == conn->tx.qdec->outq_offset);
 
-  rv = nghttp3_conn_add_ack_offset(conn, 10, vec[0].len);
+  rv = nghttp3_conn_block_stream(cl, 0);
 
   CU_ASSERT(0 == rv);
-  CU_ASSERT(0 == nghttp3_ringbuf_len(&conn->tx.qdec->outq));
-  CU_ASSERT(0 == conn->tx.qdec->outq_idx);
-  CU_ASSERT(0 == conn->tx.qdec->outq_offset);
-  CU_ASSERT(0 == conn->tx.qdec->ack_offset);
 
-  /* This will write QPACK encoder stream; just stream type */
-  sveccnt = nghttp3_conn_writev_stream(conn, &stream_id, &fin, vec,
-                                       nghttp3_arraylen(vec));
+  ev = find_trace(&cltr, NGHTTP3_TRACE_EVENT_STREAM_BLOCKED, 0);
 
-  CU_ASSERT(6 == stream_id);
-  CU_ASSERT(1 == sveccnt);
+  CU_ASSERT(NULL != ev);
+  CU_ASSERT(NGHTTP3_TRACE_BLOCKED_FLOW_CONTROL == ev->u.blocked.reason);
 
-  rv = nghttp3_conn_add_write_offset(conn, 6, vec[0].len);
+  rv = nghttp3_conn_unblock_stream(cl, 0);
 
   CU_ASSERT(0 == rv);
 
-  rv = nghttp3_conn_add_ack_offset(conn, 6, vec[0].len);
+  ev = find_trace(&cltr, NGHTTP3_TRACE_EVENT_STREAM_UNBLOCKED, 0);
 
-  CU_ASSERT(0 == rv);
+  CU_ASSERT(NULL != ev);
+  CU_ASSERT(NGHTTP3_TRACE_BLOCKED_FLOW_CONTROL == ev->u.blocked.reason);
 
-  /* This will write request stream */
-  sveccnt = nghttp3_conn_writev_stream(conn, &stream_id, &fin, vec,
-                                       nghttp3_arraylen(vec));
+  conn_read_write(cl, sv);
 
-  CU_ASSERT(0 == stream_id);
-  CU_ASSERT(7 == sveccnt);
+  CU_ASSERT(NULL != find_trace(&cltr, NGHTTP3_TRACE_EVENT_SCHED_PICK, 0));
 
-  len = nghttp3_vec_len(vec, (size_t)sveccnt);
+  ev = find_trace(&cltr, NGHTTP3_TRACE_EVENT_FRAME_SENT, 0);
 
-  for (i = 0; i < len; ++i) {
-    rv = nghttp3_conn_add_write_offset(conn, 0, 1);
+  CU_ASSERT(NULL != ev);
+  CU_ASSERT(NGHTTP3_FRAME_HEADERS == ev->u.frame.type);
 
-    CU_ASSERT(0 == rv);
+  ev = find_trace(&svtr, NGHTTP3_TRACE_EVENT_FRAME_RECV, 0);
 
-    rv = nghttp3_conn_add_ack_offset(conn, 0, 1);
+  CU_ASSERT(NULL != ev);
+  CU_ASSERT(NGHTTP3_FRAME_HEADERS == ev->u.frame.type);
 
-    CU_ASSERT(0 == rv);
-  }
+  ev = find_trace(&cltr, NGHTTP3_TRACE_EVENT_QPACK_INSERT, -1);
 
-  stream = nghttp3_conn_find_stream(conn, 0);
+  CU_ASSERT(NULL != ev);
+  CU_ASSERT(ev->u.qpack_entry.encoder);
+  CU_ASSERT(0 == ev->u.qpack_entry.absidx);
+  CU_ASSERT(ev->u.qpack_entry.size == ev->u.qpack_entry.dtable_size);
 
-  CU_ASSERT(0 == nghttp3_ringbuf_len(&stream->outq));
-  CU_ASSERT(0 == nghttp3_ringbuf_len(&stream->chunks));
-  CU_ASSERT(0 == stream->outq_idx);
-  CU_ASSERT(0 == stream->outq_offset);
-  CU_ASSERT(0 == stream->ack_offset);
-  CU_ASSERT(2000 == ud.ack.acc);
+  ev = find_trace(&svtr, NGHTTP3_TRACE_EVENT_QPACK_INSERT, -1);
 
-  nghttp3_conn_del(conn);
+  CU_ASSERT(NULL != ev);
+  CU_ASSERT(!ev->u.qpack_entry.encoder);
+  CU_ASSERT(0 == ev->u.qpack_entry.absidx);
+
+  ev = find_trace(&cltr, NGHTTP3_TRACE_EVENT_QPACK_ACK, 0);
+
+  CU_ASSERT(NULL != ev);
+  CU_ASSERT(ev->u.qpack_ack.krcnt > 0);
+  CU_ASSERT(cl->qenc.krcnt == ev->u.qpack_ack.krcnt);
+
+  nghttp3_conn_del(sv);
+  nghttp3_conn_del(cl);
 }
 
-static void conn_read_write(nghttp3_conn *cl, nghttp3_conn *sv) {
+void test_nghttp3_conn_get_stats(void) {
+  const nghttp3_mem *mem = nghttp3_mem_default();
+  nghttp3_conn *cl, *sv;
+  nghttp3_conn_callbacks callbacks;
+  nghttp3_conn_settings settings;
+  const nghttp3_nv nva[] = {
+      MAKE_NV(":path", "/"),
+      MAKE_NV(":authority", "example.com"),
+      MAKE_NV(":scheme", "https"),
+      MAKE_NV(":method", "GET"),
+      MAKE_NV("x-stats", "yes"),
+  };
+  nghttp3_conn_stats clst, svst;
   nghttp3_vec vec[256];
-  ssize_t sveccnt;
-  ssize_t sconsumed;
+  ssize_t sveccnt, nread;
   int64_t stream_id;
   int fin;
+  size_t i;
   int rv;
-  size_t i, j;
-  nghttp3_conn *sender = cl, *receiver = sv;
 
-  for (j = 0; j < 2; ++j) {
-    for (;;) {
-      sveccnt = nghttp3_conn_writev_stream(sender, &stream_id, &fin, vec,
-                                           nghttp3_arraylen(vec));
+  memset(&callbacks, 0, sizeof(callbacks));
+  nghttp3_conn_settings_default(&settings);
 
-      CU_ASSERT(sveccnt >= 0);
+  settings.qpack_max_table_capacity = 4096;
+  settings.qpack_blocked_streams = 100;
 
-      if (sveccnt <= 0) {
-        break;
-      }
+  nghttp3_conn_client_new(&cl, &callbacks, &settings, mem, NULL);
+  nghttp3_conn_server_new(&sv, &callbacks, &settings, mem, NULL);
 
-      rv = nghttp3_conn_add_write_offset(sender, stream_id,
-                                         nghttp3_vec_len(vec, (size_t)sveccnt));
+  nghttp3_conn_set_max_client_streams_bidi(sv, 100);
 
-      CU_ASSERT(0 == rv);
+  nghttp3_conn_bind_control_stream(cl, 2);
+  nghttp3_conn_bind_control_stream(sv, 3);
 
-      for (i = 0; i < (size_t)sveccnt; ++i) {
-        sconsumed = nghttp3_conn_read_stream(receiver, stream_id, vec[i].base,
-                                             vec[i].len,
-                                             fin && i == (size_t)sveccnt - 1);
-        CU_ASSERT(sconsumed >= 0);
-      }
+  nghttp3_conn_bind_qpack_streams(cl, 6, 10);
+  nghttp3_conn_bind_qpack_streams(sv, 7, 11);
 
-      rv = nghttp3_conn_add_ack_offset(sender, stream_id,
-                                       nghttp3_vec_len(vec, (size_t)sveccnt));
+  conn_read_write(cl, sv);
 
-      CU_ASSERT(0 == rv);
-    }
+  rv = nghttp3_conn_submit_request(cl, 0, NULL, nva, nghttp3_arraylen(nva),
+                                   NULL, NULL);
 
-    sender = sv;
-    receiver = cl;
+  CU_ASSERT(0 == rv);
+
+  sveccnt = nghttp3_conn_writev_stream(cl, &stream_id, &fin, vec,
+                                       nghttp3_arraylen(vec));
+
+  CU_ASSERT(sveccnt > 0);
+
+  rv = nghttp3_conn_add_write_offset(cl, stream_id,
+                                     nghttp3_vec_len(vec, (size_t)sveccnt));
+
+  CU_ASSERT(0 == rv);
+
+  nghttp3_conn_get_stats(cl, &clst);
+
+  CU_ASSERT(clst.outq_bytes > 0);
+  CU_ASSERT(clst.chunk_bytes > 0);
+
+  check_buffer_stats(cl);
+
+  for (i = 0; i < (size_t)sveccnt; ++i) {
+    nread = nghttp3_conn_read_stream(sv, stream_id, vec[i].base, vec[i].len,
+                                     fin && i == (size_t)sveccnt - 1);
+
+    CU_ASSERT(nread >= 0);
   }
+
+  rv = nghttp3_conn_add_ack_offset(cl, stream_id,
+                                   nghttp3_vec_len(vec, (size_t)sveccnt));
+
+  CU_ASSERT(0 == rv);
+
+  check_buffer_stats(cl);
+
+  conn_read_write(cl, sv);
+
+  check_buffer_stats(cl);
+  check_buffer_stats(sv);
+
+  nghttp3_conn_get_stats(cl, &clst);
+  nghttp3_conn_get_stats(sv, &svst);
+
+  CU_ASSERT(1 == clst.sent.frames[NGHTTP3_FRAME_SETTINGS]);
+  CU_ASSERT(1 == clst.sent.frames[NGHTTP3_FRAME_HEADERS]);
+  CU_ASSERT(1 == svst.recv.frames[NGHTTP3_FRAME_SETTINGS]);
+  CU_ASSERT(1 == svst.recv.frames[NGHTTP3_FRAME_HEADERS]);
+  CU_ASSERT(clst.sent.bytes[NGHTTP3_FRAME_HEADERS] > 0);
+  CU_ASSERT(clst.sent.bytes[NGHTTP3_FRAME_HEADERS] ==
+            svst.recv.bytes[NGHTTP3_FRAME_HEADERS]);
+  CU_ASSERT(clst.sent.bytes[NGHTTP3_FRAME_SETTINGS] ==
+            svst.recv.bytes[NGHTTP3_FRAME_SETTINGS]);
+  CU_ASSERT(1 == clst.recv.frames[NGHTTP3_FRAME_SETTINGS]);
+
+  CU_ASSERT(nghttp3_arraylen(nva) == clst.qpack_enc_fields);
+  CU_ASSERT(clst.qpack_enc_static_hits > 0);
+  CU_ASSERT(clst.qpack_enc_inserts > 0);
+  CU_ASSERT(0 == clst.qpack_enc_evictions);
+  CU_ASSERT(clst.qpack_enc_dtable_size > 0);
+  CU_ASSERT(clst.qpack_enc_inserts == svst.qpack_dec_inserts);
+  CU_ASSERT(clst.qpack_enc_dtable_size == svst.qpack_dec_dtable_size);
+  CU_ASSERT(clst.qpack_enc_stream_sent > 0);
+  CU_ASSERT(clst.qpack_enc_stream_sent == svst.qpack_enc_stream_recv);
+  CU_ASSERT(svst.qpack_dec_stream_sent > 0);
+  CU_ASSERT(svst.qpack_dec_stream_sent == clst.qpack_dec_stream_recv);
+  CU_ASSERT(0 == svst.qpack_blocked_streams);
+  CU_ASSERT(0 == svst.qpack_blocked_total);
+  CU_ASSERT(0 == clst.inq_bytes);
+  /* Everything has been acknowledged. */
+  CU_ASSERT(0 == clst.outq_bytes);
+  CU_ASSERT(0 == clst.chunk_bytes);
+
+  nghttp3_conn_del(sv);
+  nghttp3_conn_del(cl);
 }
 
-void test_nghttp3_conn_submit_priority(void) {
+void test_nghttp3_conn_stream_timing(void) {
   const nghttp3_mem *mem = nghttp3_mem_default();
   nghttp3_conn *cl, *sv;
   nghttp3_conn_callbacks callbacks;
   nghttp3_conn_settings settings;
+  const nghttp3_nv reqnva[] = {
+      MAKE_NV(":path", "/"),
+      MAKE_NV(":authority", "example.com"),
+      MAKE_NV(":scheme", "https"),
+      MAKE_NV(":method", "GET"),
+  };
+  const nghttp3_nv respnva[] = {
+      MAKE_NV(":status", "200"),
+  };
+  nghttp3_data_reader dr;
+  nghttp3_stream_timing cltm, svtm;
+  userdata ud;
   int rv;
-  nghttp3_placeholder *ph;
 
   memset(&callbacks, 0, sizeof(callbacks));
+  memset(&ud, 0, sizeof(ud));
+  callbacks.get_timestamp = tick;
   nghttp3_conn_settings_default(&settings);
 
   nghttp3_conn_client_new(&cl, &callbacks, &settings, mem, NULL);
-
-  settings.num_placeholders = 10;
-  nghttp3_conn_server_new(&sv, &callbacks, &settings, mem, NULL);
+  nghttp3_conn_server_new(&sv, &callbacks, &settings, mem, &ud);
 
   nghttp3_conn_set_max_client_streams_bidi(sv, 100);
 
@@ -416,19 +2758,63 @@ void test_nghttp3_conn_submit_priority(void) {
   nghttp3_conn_bind_qpack_streams(cl, 6, 10);
   nghttp3_conn_bind_qpack_streams(sv, 7, 11);
 
+  rv = nghttp3_conn_submit_request(cl, 0, NULL, reqnva,
+                                   nghttp3_arraylen(reqnva), NULL, NULL);
+
+  CU_ASSERT(0 == rv);
+
+  rv = nghttp3_conn_get_stream_timing(cl, 0, &cltm);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(NGHTTP3_TIMESTAMP_NONE == cltm.first_byte_sent);
+
   conn_read_write(cl, sv);
 
-  rv = nghttp3_conn_submit_priority(cl, NGHTTP3_PRI_ELEM_TYPE_PLACEHOLDER, 7,
-                                    NGHTTP3_ELEM_DEP_TYPE_ROOT, 0, 249);
+  rv = nghttp3_conn_get_stream_timing(cl, 0, &cltm);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(NGHTTP3_TIMESTAMP_NONE != cltm.first_byte_sent);
+  CU_ASSERT(cltm.first_byte_sent < cltm.last_byte_acked);
+  CU_ASSERT(NGHTTP3_TIMESTAMP_NONE == cltm.first_read_data);
+  CU_ASSERT(NGHTTP3_TIMESTAMP_NONE == cltm.first_byte_recv);
+
+  rv = nghttp3_conn_get_stream_timing(sv, 0, &svtm);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(NGHTTP3_TIMESTAMP_NONE != svtm.first_byte_recv);
+  CU_ASSERT(svtm.first_byte_recv < svtm.headers_recv);
+  CU_ASSERT(NGHTTP3_TIMESTAMP_NONE == svtm.qpack_blocked);
+  CU_ASSERT(0 == svtm.qpack_blocked_time);
+  CU_ASSERT(NGHTTP3_TIMESTAMP_NONE == svtm.first_byte_sent);
+
+  ud.data.left = 100;
+  ud.data.step = 100;
+  memset(&dr, 0, sizeof(dr));
+  dr.read_data = step_read_data;
+
+  rv = nghttp3_conn_submit_response(sv, 0, respnva, nghttp3_arraylen(respnva),
+                                    &dr);
 
   CU_ASSERT(0 == rv);
 
   conn_read_write(cl, sv);
 
-  ph = nghttp3_conn_find_placeholder(sv, 7);
+  rv = nghttp3_conn_get_stream_timing(sv, 0, &svtm);
 
-  CU_ASSERT(&sv->root == ph->node.parent);
-  CU_ASSERT(249 == ph->node.weight);
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(NGHTTP3_TIMESTAMP_NONE != svtm.first_read_data);
+  CU_ASSERT(svtm.first_read_data < svtm.first_byte_sent);
+  CU_ASSERT(svtm.first_byte_sent < svtm.last_byte_acked);
+
+  rv = nghttp3_conn_get_stream_timing(cl, 0, &cltm);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(svtm.first_byte_sent < cltm.first_byte_recv);
+  CU_ASSERT(cltm.first_byte_recv < cltm.headers_recv);
+
+  rv = nghttp3_conn_get_stream_timing(cl, 2, &cltm);
+
+  CU_ASSERT(NGHTTP3_ERR_INVALID_ARGUMENT == rv);
 
   nghttp3_conn_del(sv);
   nghttp3_conn_del(cl);
@@ -486,6 +2872,7 @@ void test_nghttp3_conn_http_request(void) {
   nghttp3_conn_bind_qpack_streams(cl, 6, 10);
   nghttp3_conn_bind_qpack_streams(sv, 7, 11);
 
+  memset(&dr, 0, sizeof(dr));
   dr.read_data = step_read_data;
   rv = nghttp3_conn_submit_request(cl, 0, NULL, reqnva,
                                    nghttp3_arraylen(reqnva), &dr, NULL);
@@ -675,6 +3062,7 @@ void test_nghttp3_conn_recv_control_priority(void) {
   nghttp3_stream *stream;
   nghttp3_tnode *parent;
   nghttp3_placeholder *ph;
+  nghttp3_phantom *phantom;
 
   memset(&callbacks, 0, sizeof(callbacks));
   nghttp3_conn_settings_default(&settings);
@@ -709,14 +3097,47 @@ void test_nghttp3_conn_recv_control_priority(void) {
 
   CU_ASSERT((ssize_t)nghttp3_buf_len(&buf) == sconsumed);
 
-  stream = nghttp3_conn_find_stream(conn, 0);
-  parent = stream->node.parent;
+  CU_ASSERT(NULL == nghttp3_conn_find_stream(conn, 0));
+  CU_ASSERT(NULL == nghttp3_conn_find_stream(conn, 4));
 
-  CU_ASSERT(111 == stream->node.weight);
+  phantom = nghttp3_conn_find_phantom(conn, 0);
+  parent = phantom->node.parent;
+
+  CU_ASSERT(111 == phantom->node.weight);
   CU_ASSERT(NGHTTP3_NODE_ID_TYPE_STREAM == parent->nid.type);
   CU_ASSERT(4 == parent->nid.id);
   CU_ASSERT(&conn->root == parent->parent);
   CU_ASSERT(NGHTTP3_DEFAULT_WEIGHT == parent->weight);
+  CU_ASSERT(&nghttp3_conn_find_phantom(conn, 4)->node == parent);
+  /* Both phantoms are carved from the same block. */
+  CU_ASSERT(NULL != conn->phantom_blocks);
+  CU_ASSERT(NULL == conn->phantom_blocks->next);
+
+  /* Opening stream replaces its phantom */
+  sconsumed = nghttp3_conn_read_stream(conn, 4, NULL, 0, /* fin = */ 0);
+
+  CU_ASSERT(0 == sconsumed);
+  CU_ASSERT(NULL == nghttp3_conn_find_phantom(conn, 4));
+
+  stream = nghttp3_conn_find_stream(conn, 4);
+
+  CU_ASSERT(&conn->root == stream->node.parent);
+  CU_ASSERT(NGHTTP3_DEFAULT_WEIGHT == stream->node.weight);
+  CU_ASSERT(1 == stream->node.num_children);
+  CU_ASSERT(&phantom->node == stream->node.first_child);
+  CU_ASSERT(&stream->node == phantom->node.parent);
+
+  sconsumed = nghttp3_conn_read_stream(conn, 0, NULL, 0, /* fin = */ 0);
+
+  CU_ASSERT(0 == sconsumed);
+  CU_ASSERT(NULL == nghttp3_conn_find_phantom(conn, 0));
+  /* The freed phantoms go back to the free list. */
+  CU_ASSERT(phantom == conn->phantom_freelist);
+
+  stream = nghttp3_conn_find_stream(conn, 0);
+
+  CU_ASSERT(111 == stream->node.weight);
+  CU_ASSERT(&nghttp3_conn_find_stream(conn, 4)->node == stream->node.parent);
 
   nghttp3_conn_del(conn);
 
@@ -794,10 +3215,10 @@ void test_nghttp3_conn_recv_control_priority(void) {
 
   CU_ASSERT((ssize_t)nghttp3_buf_len(&buf) == sconsumed);
 
-  stream = nghttp3_conn_find_stream(conn, 4);
-  parent = stream->node.parent;
+  phantom = nghttp3_conn_find_phantom(conn, 4);
+  parent = phantom->node.parent;
 
-  CU_ASSERT(12 == stream->node.weight);
+  CU_ASSERT(12 == phantom->node.weight);
   CU_ASSERT(NGHTTP3_NODE_ID_TYPE_STREAM == parent->nid.type);
   CU_ASSERT(0 == parent->nid.id);
   CU_ASSERT(&conn->root == parent->parent);
@@ -831,10 +3252,10 @@ void test_nghttp3_conn_recv_control_priority(void) {
 
   CU_ASSERT((ssize_t)nghttp3_buf_len(&buf) == sconsumed);
 
-  stream = nghttp3_conn_find_stream(conn, 100);
-  parent = stream->node.parent;
+  phantom = nghttp3_conn_find_phantom(conn, 100);
+  parent = phantom->node.parent;
 
-  CU_ASSERT(111 == stream->node.weight);
+  CU_ASSERT(111 == phantom->node.weight);
   CU_ASSERT(&conn->root == parent);
 
   nghttp3_conn_del(conn);
@@ -866,4 +3287,69 @@ void test_nghttp3_conn_recv_control_priority(void) {
             sconsumed);
 
   nghttp3_conn_del(conn);
+
+  /* The urgency scheduler does not build the dependency tree */
+  settings.scheduler = NGHTTP3_SCHEDULER_URGENCY;
+
+  nghttp3_conn_server_new(&conn, &callbacks, &settings, mem, NULL);
+  nghttp3_conn_set_max_client_streams_bidi(conn, 2);
+
+  nghttp3_buf_wrap_init(&buf, rawbuf, sizeof(rawbuf));
+
+  buf.last = nghttp3_put_varint(buf.last, NGHTTP3_STREAM_TYPE_CONTROL);
+
+  fr.hd.type = NGHTTP3_FRAME_SETTINGS;
+  fr.settings.niv = 0;
+
+  nghttp3_write_frame(&buf, &fr);
+
+  fr.hd.type = NGHTTP3_FRAME_PRIORITY;
+  fr.priority.pt = NGHTTP3_PRI_ELEM_TYPE_REQUEST;
+  fr.priority.dt = NGHTTP3_ELEM_DEP_TYPE_REQUEST;
+  fr.priority.pri_elem_id = 0;
+  fr.priority.elem_dep_id = 4;
+  fr.priority.weight = 111;
+
+  nghttp3_write_frame(&buf, &fr);
+
+  fr.hd.type = NGHTTP3_FRAME_PRIORITY;
+  fr.priority.pt = NGHTTP3_PRI_ELEM_TYPE_PLACEHOLDER;
+  fr.priority.dt = NGHTTP3_ELEM_DEP_TYPE_PLACEHOLDER;
+  fr.priority.pri_elem_id = 1;
+  fr.priority.elem_dep_id = 0;
+  fr.priority.weight = 256;
+
+  nghttp3_write_frame(&buf, &fr);
+
+  sconsumed = nghttp3_conn_read_stream(conn, 2, buf.pos, nghttp3_buf_len(&buf),
+                                       /* fin = */ 0);
+
+  CU_ASSERT((ssize_t)nghttp3_buf_len(&buf) == sconsumed);
+  CU_ASSERT(NULL == nghttp3_conn_find_phantom(conn, 0));
+  CU_ASSERT(NULL == nghttp3_conn_find_phantom(conn, 4));
+  CU_ASSERT(NULL == conn->phantom_blocks);
+  CU_ASSERT(NULL == nghttp3_conn_find_placeholder(conn, 0));
+  CU_ASSERT(NULL == nghttp3_conn_find_placeholder(conn, 1));
+  /* Only the control stream hangs off the root. */
+  CU_ASSERT(1 == conn->root.num_children);
+  CU_ASSERT(&nghttp3_conn_find_stream(conn, 2)->node == conn->root.first_child);
+
+  /* The frame is still validated. */
+  nghttp3_buf_reset(&buf);
+
+  fr.hd.type = NGHTTP3_FRAME_PRIORITY;
+  fr.priority.pt = NGHTTP3_PRI_ELEM_TYPE_REQUEST;
+  fr.priority.dt = NGHTTP3_ELEM_DEP_TYPE_PLACEHOLDER;
+  fr.priority.pri_elem_id = 0;
+  fr.priority.elem_dep_id = 2;
+  fr.priority.weight = 1;
+
+  nghttp3_write_frame(&buf, &fr);
+
+  sconsumed = nghttp3_conn_read_stream(conn, 2, buf.pos, nghttp3_buf_len(&buf),
+                                       /* fin = */ 0);
+
+  CU_ASSERT(NGHTTP3_ERR_HTTP_LIMIT_EXCEEDED == sconsumed);
+
+  nghttp3_conn_del(conn);
 }
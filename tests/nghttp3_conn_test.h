@@ -32,7 +32,28 @@
 void test_nghttp3_conn_read_control(void);
 void test_nghttp3_conn_write_control(void);
 void test_nghttp3_conn_submit_request(void);
+void test_nghttp3_conn_submit_request_data_vec(void);
+void test_nghttp3_conn_add_ack_range(void);
+void test_nghttp3_conn_get_stream_data_range(void);
+void test_nghttp3_conn_tx_watermark(void);
+void test_nghttp3_conn_tx_budget_reschedule(void);
+void test_nghttp3_conn_submit_request_file(void);
+void test_nghttp3_conn_urgency_scheduler(void);
+void test_nghttp3_conn_tx_quantum(void);
+void test_nghttp3_conn_tree_calendar_scheduler(void);
 void test_nghttp3_conn_submit_priority(void);
+void test_nghttp3_conn_arena(void);
+void test_nghttp3_conn_eager_encode(void);
+void test_nghttp3_conn_rejoin_cookie(void);
+void test_nghttp3_conn_qpack_warm_profile(void);
+void test_nghttp3_conn_read_bidi_fin(void);
+void test_nghttp3_conn_qpack_blocked(void);
+void test_nghttp3_conn_qpack_blocked_fin(void);
+void test_nghttp3_conn_end_stream_pending_data(void);
+void test_nghttp3_conn_arena_cookie(void);
+void test_nghttp3_conn_trace(void);
+void test_nghttp3_conn_get_stats(void);
+void test_nghttp3_conn_stream_timing(void);
 void test_nghttp3_conn_http_request(void);
 void test_nghttp3_conn_recv_request_priority(void);
 void test_nghttp3_conn_recv_control_priority(void);
@@ -0,0 +1,89 @@
+/*
+ * nghttp3
+ *
+ * Copyright (c) 2019 nghttp3 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "nghttp3_map_test.h"
+
+#include <CUnit/CUnit.h>
+
+#include "nghttp3_map.h"
+#include "nghttp3_macro.h"
+#include "nghttp3_test_helper.h"
+
+void test_nghttp3_map(void) {
+  const nghttp3_mem *mem = nghttp3_mem_default();
+  nghttp3_map map;
+  nghttp3_map_entry ents[1000];
+  nghttp3_map_entry dup;
+  size_t i;
+  int rv;
+
+  nghttp3_map_init(&map, mem);
+
+  /* No memory is allocated until the first insertion */
+  CU_ASSERT(NULL == map.table);
+  CU_ASSERT(NULL == nghttp3_map_find(&map, 0));
+  CU_ASSERT(NGHTTP3_ERR_INVALID_ARGUMENT == nghttp3_map_remove(&map, 0));
+
+  for (i = 0; i < nghttp3_arraylen(ents); ++i) {
+    nghttp3_map_entry_init(&ents[i], (key_type)(i * 4));
+    rv = nghttp3_map_insert(&map, &ents[i]);
+
+    CU_ASSERT(0 == rv);
+  }
+
+  CU_ASSERT(nghttp3_arraylen(ents) == nghttp3_map_size(&map));
+
+  nghttp3_map_entry_init(&dup, 4);
+
+  CU_ASSERT(NGHTTP3_ERR_INVALID_ARGUMENT == nghttp3_map_insert(&map, &dup));
+
+  for (i = 0; i < nghttp3_arraylen(ents); ++i) {
+    CU_ASSERT(&ents[i] == nghttp3_map_find(&map, (key_type)(i * 4)));
+    CU_ASSERT(NULL == nghttp3_map_find(&map, (key_type)(i * 4 + 1)));
+  }
+
+  /* Removing every other entry must not break probe sequences of the
+     remaining entries. */
+  for (i = 0; i < nghttp3_arraylen(ents); i += 2) {
+    CU_ASSERT(0 == nghttp3_map_remove(&map, (key_type)(i * 4)));
+  }
+
+  for (i = 0; i < nghttp3_arraylen(ents); ++i) {
+    if (i % 2) {
+      CU_ASSERT(&ents[i] == nghttp3_map_find(&map, (key_type)(i * 4)));
+    } else {
+      CU_ASSERT(NULL == nghttp3_map_find(&map, (key_type)(i * 4)));
+    }
+  }
+
+  for (i = 1; i < nghttp3_arraylen(ents); i += 2) {
+    CU_ASSERT(0 == nghttp3_map_remove(&map, (key_type)(i * 4)));
+  }
+
+  /* The table is shrunk after mass removal */
+  CU_ASSERT(0 == nghttp3_map_size(&map));
+  CU_ASSERT(16 == map.tablelen);
+
+  nghttp3_map_free(&map);
+}
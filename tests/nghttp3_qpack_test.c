@@ -24,6 +24,8 @@
  */
 #include "nghttp3_qpack_test.h"
 
+#include <string.h>
+
 #include <CUnit/CUnit.h>
 
 #include "nghttp3_qpack.h"
@@ -680,3 +682,519 @@ void test_nghttp3_qpack_decoder_feedback(void) {
   nghttp3_buf_free(&rbuf1, mem);
   nghttp3_buf_free(&pbuf1, mem);
 }
+
+/*
+ * decode_values decodes a header block in |pbuf| and |rbuf| with
+ * |dec|, and stores the references to the decoded values in
+ * |values|.  It returns the number of values decoded.
+ */
+static size_t decode_values(nghttp3_qpack_decoder *dec, nghttp3_buf *pbuf,
+                            nghttp3_buf *rbuf, int64_t stream_id,
+                            nghttp3_rcbuf **values, size_t nvalues,
+                            const nghttp3_mem *mem) {
+  ssize_t nread;
+  nghttp3_qpack_stream_context sctx;
+  nghttp3_qpack_nv qnv;
+  uint8_t flags;
+  size_t n = 0;
+
+  nghttp3_qpack_stream_context_init(&sctx, stream_id, mem);
+
+  nread = nghttp3_qpack_decoder_read_request(
+      dec, &sctx, &qnv, &flags, pbuf->pos, nghttp3_buf_len(pbuf), 0);
+
+  CU_ASSERT((ssize_t)nghttp3_buf_len(pbuf) == nread);
+
+  for (;;) {
+    nread = nghttp3_qpack_decoder_read_request(
+        dec, &sctx, &qnv, &flags, rbuf->pos, nghttp3_buf_len(rbuf), 1);
+
+    CU_ASSERT(nread >= 0);
+
+    if (nread < 0 || (flags & NGHTTP3_QPACK_DECODE_FLAG_FINAL)) {
+      break;
+    }
+
+    rbuf->pos += nread;
+
+    if (flags & NGHTTP3_QPACK_DECODE_FLAG_EMIT) {
+      nghttp3_rcbuf_decref(qnv.name);
+
+      CU_ASSERT(n < nvalues);
+
+      if (n == nvalues) {
+        nghttp3_rcbuf_decref(qnv.value);
+        continue;
+      }
+
+      values[n++] = qnv.value;
+    }
+  }
+
+  nghttp3_qpack_stream_context_free(&sctx);
+
+  return n;
+}
+
+void test_nghttp3_qpack_decoder_intern(void) {
+  const nghttp3_mem *mem = nghttp3_mem_default();
+  nghttp3_qpack_encoder enc;
+  nghttp3_qpack_decoder dec1, dec2;
+  nghttp3_qpack_intern *intern;
+  const nghttp3_nv nva[] = {
+      MAKE_NV(":path", "/index.html"),
+      MAKE_NV("accept-encoding", "gzip, deflate, br, zstd"),
+      MAKE_NV("x-custom", "stable"),
+      MAKE_NV("user-agent", "Mozilla/5.0 (X11; Linux x86_64) Gecko/20100101 "
+                            "Firefox/120.0"),
+  };
+  nghttp3_rcbuf *values1[4], *values2[4], *values3[4];
+  nghttp3_buf pbuf, rbuf, ebuf;
+  size_t i, n1, n2, n3;
+  int rv;
+
+  nghttp3_buf_init(&pbuf);
+  nghttp3_buf_init(&rbuf);
+  nghttp3_buf_init(&ebuf);
+
+  rv = nghttp3_qpack_intern_new(&intern, 0, 32, mem);
+
+  CU_ASSERT(NGHTTP3_ERR_INVALID_ARGUMENT == rv);
+
+  rv = nghttp3_qpack_intern_new(&intern, 60, 32, mem);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(64 == intern->tablelen);
+
+  /* Without dynamic table, all values are sent as literals. */
+  nghttp3_qpack_encoder_init(&enc, 0, 0, mem);
+  nghttp3_qpack_decoder_init(&dec1, 0, 0, mem);
+  nghttp3_qpack_decoder_init(&dec2, 0, 0, mem);
+
+  nghttp3_qpack_decoder_set_intern(&dec1, intern);
+  nghttp3_qpack_decoder_set_intern(&dec2, intern);
+
+  rv = nghttp3_qpack_encoder_encode(&enc, &pbuf, &rbuf, &ebuf, 0, nva,
+                                    nghttp3_arraylen(nva));
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(0 == nghttp3_buf_len(&ebuf));
+
+  n1 = decode_values(&dec1, &pbuf, &rbuf, 0, values1,
+                     nghttp3_arraylen(values1), mem);
+
+  pbuf.pos = pbuf.begin;
+  rbuf.pos = rbuf.begin;
+
+  n2 = decode_values(&dec2, &pbuf, &rbuf, 0, values2,
+                     nghttp3_arraylen(values2), mem);
+
+  pbuf.pos = pbuf.begin;
+  rbuf.pos = rbuf.begin;
+
+  n3 = decode_values(&dec1, &pbuf, &rbuf, 4, values3,
+                     nghttp3_arraylen(values3), mem);
+
+  CU_ASSERT(nghttp3_arraylen(nva) == n1);
+  CU_ASSERT(nghttp3_arraylen(nva) == n2);
+  CU_ASSERT(nghttp3_arraylen(nva) == n3);
+
+  /* Values are admitted when they are seen for the second time, and
+     shared across decoders from then on. */
+  for (i = 0; i < 3; ++i) {
+    CU_ASSERT(values1[i] != values2[i]);
+    CU_ASSERT(values2[i] == values3[i]);
+    CU_ASSERT(nva[i].valuelen == values2[i]->len);
+    CU_ASSERT(0 == memcmp(nva[i].value, values2[i]->base, nva[i].valuelen));
+  }
+
+  /* user-agent is longer than max_valuelen. */
+  CU_ASSERT(values2[3] != values3[3]);
+  CU_ASSERT(0 == memcmp(values2[3]->base, values3[3]->base, nva[3].valuelen));
+
+  nghttp3_qpack_decoder_free(&dec2);
+  nghttp3_qpack_decoder_free(&dec1);
+
+  /* Values outlive the table. */
+  nghttp3_qpack_intern_del(intern);
+
+  for (i = 0; i < n1; ++i) {
+    CU_ASSERT(0 == memcmp(nva[i].value, values2[i]->base, nva[i].valuelen));
+
+    nghttp3_rcbuf_decref(values1[i]);
+    nghttp3_rcbuf_decref(values2[i]);
+    nghttp3_rcbuf_decref(values3[i]);
+  }
+
+  nghttp3_qpack_encoder_free(&enc);
+  nghttp3_buf_free(&ebuf, mem);
+  nghttp3_buf_free(&rbuf, mem);
+  nghttp3_buf_free(&pbuf, mem);
+}
+
+/*
+ * intern_str passes a new rcbuf which contains |s| to
+ * nghttp3_qpack_intern_get, and returns the result.
+ */
+static nghttp3_rcbuf *intern_str(nghttp3_qpack_intern *intern,
+                                 const char *s, const nghttp3_mem *mem) {
+  nghttp3_rcbuf *value;
+  int rv;
+
+  rv = nghttp3_rcbuf_new2(&value, (const uint8_t *)s, strlen(s), mem);
+
+  CU_ASSERT(0 == rv);
+
+  return nghttp3_qpack_intern_get(intern, value);
+}
+
+void test_nghttp3_qpack_intern_admission(void) {
+  const nghttp3_mem *mem = nghttp3_mem_default();
+  nghttp3_qpack_intern *intern;
+  nghttp3_rcbuf *a1, *a2, *a3, *b1, *a4;
+  int rv;
+
+  /* All values go in the same slot. */
+  rv = nghttp3_qpack_intern_new(&intern, 1, 32, mem);
+
+  CU_ASSERT(0 == rv);
+
+  /* A value seen for the first time is not copied. */
+  a1 = intern_str(intern, "alpha", mem);
+
+  CU_ASSERT(NULL == intern->table[0].value);
+
+  a2 = intern_str(intern, "alpha", mem);
+
+  CU_ASSERT(a1 != a2);
+  CU_ASSERT(a2 == intern->table[0].value);
+
+  a3 = intern_str(intern, "alpha", mem);
+
+  CU_ASSERT(a2 == a3);
+
+  /* A value seen only once does not evict the cached one. */
+  b1 = intern_str(intern, "bravo", mem);
+
+  CU_ASSERT(b1 != a2);
+  CU_ASSERT(a2 == intern->table[0].value);
+
+  a4 = intern_str(intern, "alpha", mem);
+
+  CU_ASSERT(a2 == a4);
+
+  nghttp3_rcbuf_decref(a4);
+  nghttp3_rcbuf_decref(b1);
+  nghttp3_rcbuf_decref(a3);
+  nghttp3_rcbuf_decref(a2);
+  nghttp3_rcbuf_decref(a1);
+
+  nghttp3_qpack_intern_del(intern);
+}
+
+void test_nghttp3_qpack_encoder_cookie(void) {
+  const nghttp3_mem *mem = nghttp3_mem_default();
+  nghttp3_qpack_encoder enc;
+  nghttp3_qpack_decoder dec;
+  const nghttp3_nv nva[] = {
+      MAKE_NV(":path", "/"),
+      MAKE_NV("cookie",
+              "a=1 ; session=0123456789abcdefghij\t;theme=dark;  "),
+  };
+  const nghttp3_nv semicolon[] = {
+      MAKE_NV(":path", "/"),
+      MAKE_NV("cookie", ";"),
+  };
+  const nghttp3_nv crumbs[] = {
+      MAKE_NV(":path", "/"),
+      MAKE_NV("cookie", "a=1"),
+      MAKE_NV("cookie", "session=0123456789abcdefghij"),
+      MAKE_NV("cookie", "theme=dark"),
+  };
+  nghttp3_qpack_entry *ent;
+  nghttp3_buf pbuf, rbuf, ebuf;
+  int rv;
+
+  nghttp3_buf_init(&pbuf);
+  nghttp3_buf_init(&rbuf);
+  nghttp3_buf_init(&ebuf);
+
+  nghttp3_qpack_encoder_init(&enc, 4096, 1, mem);
+  nghttp3_qpack_decoder_init(&dec, 4096, 1, mem);
+
+  rv = nghttp3_qpack_encoder_encode(&enc, &pbuf, &rbuf, &ebuf, 0, nva,
+                                    nghttp3_arraylen(nva));
+
+  CU_ASSERT(0 == rv);
+
+  /* Only the crumb which is long enough is indexed. */
+  CU_ASSERT(1 == nghttp3_ringbuf_len(&enc.ctx.dtable));
+
+  ent = nghttp3_qpack_context_dtable_get(&enc.ctx, 0);
+
+  CU_ASSERT(crumbs[2].valuelen == ent->nv.value->len);
+  CU_ASSERT(0 == memcmp(crumbs[2].value, ent->nv.value->base,
+                        crumbs[2].valuelen));
+
+  check_decode_header(&dec, &pbuf, &rbuf, &ebuf, 0, crumbs,
+                      nghttp3_arraylen(crumbs), mem);
+
+  nghttp3_buf_reset(&pbuf);
+  nghttp3_buf_reset(&rbuf);
+  nghttp3_buf_reset(&ebuf);
+
+  /* A value without any crumb is sent unchanged. */
+  rv = nghttp3_qpack_encoder_encode(&enc, &pbuf, &rbuf, &ebuf, 4, semicolon,
+                                    nghttp3_arraylen(semicolon));
+
+  CU_ASSERT(0 == rv);
+
+  check_decode_header(&dec, &pbuf, &rbuf, &ebuf, 4, semicolon,
+                      nghttp3_arraylen(semicolon), mem);
+
+  nghttp3_qpack_decoder_free(&dec);
+  nghttp3_qpack_encoder_free(&enc);
+  nghttp3_buf_free(&ebuf, mem);
+  nghttp3_buf_free(&rbuf, mem);
+  nghttp3_buf_free(&pbuf, mem);
+}
+
+/*
+ * sync_decoder writes decoder stream of |dec| and feeds it to |enc|.
+ */
+static void sync_decoder(nghttp3_qpack_encoder *enc,
+                         nghttp3_qpack_decoder *dec, const nghttp3_mem *mem) {
+  nghttp3_buf dbuf;
+  ssize_t nread;
+  int rv;
+
+  nghttp3_buf_init(&dbuf);
+
+  rv = nghttp3_qpack_decoder_write_decoder(dec, &dbuf);
+
+  CU_ASSERT(0 == rv);
+
+  nread =
+      nghttp3_qpack_encoder_read_decoder(enc, dbuf.pos, nghttp3_buf_len(&dbuf));
+
+  CU_ASSERT((ssize_t)nghttp3_buf_len(&dbuf) == nread);
+
+  nghttp3_buf_free(&dbuf, mem);
+}
+
+void test_nghttp3_qpack_clone(void) {
+  const nghttp3_mem *mem = nghttp3_mem_default();
+  nghttp3_qpack_encoder enc, *enc2, *enc3;
+  nghttp3_qpack_decoder dec, *dec2, *dec3;
+  const nghttp3_nv nva[] = {
+      MAKE_NV(":authority", "example.com"),
+      MAKE_NV("accept-language", "en-US,en;q=0.9"),
+      MAKE_NV("x-trace", "0123456789"),
+      MAKE_NV("user-agent", "nghttp3 test"),
+  };
+  nghttp3_buf pbuf, rbuf, ebuf;
+  uint8_t snapshot[1024];
+  ssize_t nwrite, n;
+  size_t rlen;
+  int rv;
+
+  nghttp3_buf_init(&pbuf);
+  nghttp3_buf_init(&rbuf);
+  nghttp3_buf_init(&ebuf);
+
+  nghttp3_qpack_encoder_init(&enc, 4096, 1, mem);
+  nghttp3_qpack_decoder_init(&dec, 4096, 1, mem);
+
+  rv = nghttp3_qpack_encoder_encode(&enc, &pbuf, &rbuf, &ebuf, 0, nva,
+                                    nghttp3_arraylen(nva));
+
+  CU_ASSERT(0 == rv);
+
+  /* Unacknowledged header block prevents cloning. */
+  CU_ASSERT(NGHTTP3_ERR_INVALID_STATE ==
+            nghttp3_qpack_encoder_clone(&enc2, &enc, mem));
+  CU_ASSERT(NGHTTP3_ERR_INVALID_STATE ==
+            nghttp3_qpack_encoder_serialize(&enc, NULL, 0));
+
+  check_decode_header(&dec, &pbuf, &rbuf, &ebuf, 0, nva, nghttp3_arraylen(nva),
+                      mem);
+  sync_decoder(&enc, &dec, mem);
+
+  CU_ASSERT(4 == enc.krcnt);
+
+  /* check_decode_header does not finish header block. */
+  rv = nghttp3_qpack_encoder_ack_header(&enc, 0);
+
+  CU_ASSERT(0 == rv);
+
+  rv = nghttp3_qpack_encoder_clone(&enc2, &enc, mem);
+
+  CU_ASSERT(0 == rv);
+
+  rv = nghttp3_qpack_decoder_clone(&dec2, &dec, mem);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(4 == nghttp3_qpack_decoder_get_icnt(dec2));
+
+  /* Name and value are shared. */
+  CU_ASSERT(nghttp3_qpack_context_dtable_get(&enc.ctx, 0)->nv.value ==
+            nghttp3_qpack_context_dtable_get(&enc2->ctx, 0)->nv.value);
+
+  /* The clones only exchange references to dynamic table. */
+  rv = nghttp3_qpack_encoder_encode(enc2, &pbuf, &rbuf, &ebuf, 4, nva,
+                                    nghttp3_arraylen(nva));
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(0 == nghttp3_buf_len(&ebuf));
+  CU_ASSERT(nghttp3_arraylen(nva) == nghttp3_buf_len(&rbuf));
+
+  check_decode_header(dec2, &pbuf, &rbuf, &ebuf, 4, nva, nghttp3_arraylen(nva),
+                      mem);
+  sync_decoder(enc2, dec2, mem);
+
+  rv = nghttp3_qpack_encoder_ack_header(enc2, 4);
+
+  CU_ASSERT(0 == rv);
+
+  /* Snapshot round trip */
+  nwrite = nghttp3_qpack_encoder_serialize(enc2, NULL, 0);
+
+  CU_ASSERT(nwrite > 0);
+  CU_ASSERT(NGHTTP3_ERR_NOBUF == nghttp3_qpack_encoder_serialize(
+                                     enc2, snapshot, (size_t)nwrite - 1));
+  CU_ASSERT(nwrite ==
+            nghttp3_qpack_encoder_serialize(enc2, snapshot, sizeof(snapshot)));
+  CU_ASSERT(NGHTTP3_ERR_INVALID_ARGUMENT ==
+            nghttp3_qpack_encoder_deserialize(&enc3, snapshot,
+                                              (size_t)nwrite - 1, mem));
+  CU_ASSERT(NGHTTP3_ERR_INVALID_ARGUMENT ==
+            nghttp3_qpack_decoder_deserialize(&dec3, snapshot, (size_t)nwrite,
+                                              mem));
+
+  /* The flags are the last varint of the snapshot.  Undefined flags
+     are rejected. */
+  CU_ASSERT(snapshot[nwrite - 1] <= 1);
+
+  snapshot[nwrite - 1] = 0x02;
+
+  CU_ASSERT(NGHTTP3_ERR_INVALID_ARGUMENT ==
+            nghttp3_qpack_encoder_deserialize(&enc3, snapshot, (size_t)nwrite,
+                                              mem));
+
+  nghttp3_qpack_encoder_serialize(enc2, snapshot, sizeof(snapshot));
+
+  rv = nghttp3_qpack_encoder_deserialize(&enc3, snapshot, (size_t)nwrite, mem);
+
+  CU_ASSERT(0 == rv);
+
+  n = nghttp3_qpack_decoder_serialize(dec2, snapshot, sizeof(snapshot));
+
+  CU_ASSERT(n > 0);
+
+  rv = nghttp3_qpack_decoder_deserialize(&dec3, snapshot, (size_t)n, mem);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(enc2->ctx.dtable_sum == enc3->ctx.dtable_sum);
+  CU_ASSERT(enc2->ctx.dtable_size == enc3->ctx.dtable_size);
+  CU_ASSERT(enc2->krcnt == enc3->krcnt);
+  CU_ASSERT(nghttp3_qpack_context_dtable_get(&enc2->ctx, 0)->sum ==
+            nghttp3_qpack_context_dtable_get(&enc3->ctx, 0)->sum);
+
+  rv = nghttp3_qpack_encoder_encode(enc3, &pbuf, &rbuf, &ebuf, 8, nva,
+                                    nghttp3_arraylen(nva));
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(0 == nghttp3_buf_len(&ebuf));
+
+  rlen = nghttp3_buf_len(&rbuf);
+
+  CU_ASSERT(nghttp3_arraylen(nva) == rlen);
+
+  check_decode_header(dec3, &pbuf, &rbuf, &ebuf, 8, nva, nghttp3_arraylen(nva),
+                      mem);
+
+  nghttp3_qpack_decoder_del(dec3);
+  nghttp3_qpack_encoder_del(enc3);
+  nghttp3_qpack_decoder_del(dec2);
+  nghttp3_qpack_encoder_del(enc2);
+  nghttp3_qpack_decoder_free(&dec);
+  nghttp3_qpack_encoder_free(&enc);
+  nghttp3_buf_free(&ebuf, mem);
+  nghttp3_buf_free(&rbuf, mem);
+  nghttp3_buf_free(&pbuf, mem);
+}
+
+void test_nghttp3_qpack_encoder_prewarm(void) {
+  const nghttp3_mem *mem = nghttp3_mem_default();
+  nghttp3_qpack_encoder enc;
+  nghttp3_qpack_decoder dec;
+  const nghttp3_nv profile[] = {
+      MAKE_NV(":method", "GET"),
+      MAKE_NV(":path", "/index.html"),
+      MAKE_NV(":authority", "example.com"),
+      MAKE_NV("user-agent", "nghttp3 test"),
+      MAKE_NV("x-trace", "0123456789"),
+      MAKE_NV("authorization", "secret"),
+  };
+  const nghttp3_nv nva[] = {
+      MAKE_NV(":authority", "example.com"),
+      MAKE_NV("user-agent", "nghttp3 test"),
+      MAKE_NV("x-trace", "0123456789"),
+  };
+  nghttp3_buf pbuf, rbuf, ebuf;
+  int rv;
+
+  nghttp3_buf_init(&pbuf);
+  nghttp3_buf_init(&rbuf);
+  nghttp3_buf_init(&ebuf);
+
+  /* No stream is allowed to be blocked. */
+  nghttp3_qpack_encoder_init(&enc, 4096, 0, mem);
+  nghttp3_qpack_decoder_init(&dec, 4096, 0, mem);
+
+  rv = nghttp3_qpack_encoder_prewarm(&enc, &ebuf, profile,
+                                     nghttp3_arraylen(profile));
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(3 == nghttp3_ringbuf_len(&enc.ctx.dtable));
+  CU_ASSERT(nghttp3_buf_len(&ebuf) > 0);
+  CU_ASSERT(0 == nghttp3_qpack_encoder_get_num_blocked(&enc));
+
+  /* Inserting the same fields again is noop. */
+  rv = nghttp3_qpack_encoder_prewarm(&enc, &ebuf, profile,
+                                     nghttp3_arraylen(profile));
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(3 == nghttp3_ringbuf_len(&enc.ctx.dtable));
+
+  /* Unacknowledged entries cannot be referred to. */
+  rv = nghttp3_qpack_encoder_encode(&enc, &pbuf, &rbuf, &ebuf, 0, nva,
+                                    nghttp3_arraylen(nva));
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(3 == nghttp3_ringbuf_len(&enc.ctx.dtable));
+  CU_ASSERT(nghttp3_arraylen(nva) < nghttp3_buf_len(&rbuf));
+
+  check_decode_header(&dec, &pbuf, &rbuf, &ebuf, 0, nva, nghttp3_arraylen(nva),
+                      mem);
+  sync_decoder(&enc, &dec, mem);
+
+  CU_ASSERT(3 == nghttp3_qpack_decoder_get_icnt(&dec));
+  CU_ASSERT(3 == enc.krcnt);
+
+  rv = nghttp3_qpack_encoder_encode(&enc, &pbuf, &rbuf, &ebuf, 4, nva,
+                                    nghttp3_arraylen(nva));
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(0 == nghttp3_buf_len(&ebuf));
+  CU_ASSERT(nghttp3_arraylen(nva) == nghttp3_buf_len(&rbuf));
+
+  check_decode_header(&dec, &pbuf, &rbuf, &ebuf, 4, nva, nghttp3_arraylen(nva),
+                      mem);
+
+  nghttp3_qpack_decoder_free(&dec);
+  nghttp3_qpack_encoder_free(&enc);
+  nghttp3_buf_free(&ebuf, mem);
+  nghttp3_buf_free(&rbuf, mem);
+  nghttp3_buf_free(&pbuf, mem);
+}
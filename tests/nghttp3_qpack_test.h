@@ -32,6 +32,11 @@
 void test_nghttp3_qpack_encoder_encode(void);
 void test_nghttp3_qpack_encoder_still_blocked(void);
 void test_nghttp3_qpack_encoder_set_dtable_cap(void);
+void test_nghttp3_qpack_encoder_cookie(void);
 void test_nghttp3_qpack_decoder_feedback(void);
+void test_nghttp3_qpack_decoder_intern(void);
+void test_nghttp3_qpack_intern_admission(void);
+void test_nghttp3_qpack_clone(void);
+void test_nghttp3_qpack_encoder_prewarm(void);
 
 #endif /* NGTCP2_QPCK_TEST_H */
@@ -0,0 +1,98 @@
+/*
+ * nghttp3
+ *
+ * Copyright (c) 2019 nghttp3 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "nghttp3_ringbuf_test.h"
+
+#include <CUnit/CUnit.h>
+
+#include "nghttp3_ringbuf.h"
+#include "nghttp3_test_helper.h"
+
+void test_nghttp3_ringbuf_reserve(void) {
+  const nghttp3_mem *mem = nghttp3_mem_default();
+  nghttp3_ringbuf rb;
+  size_t i;
+  int rv;
+
+  rv = nghttp3_ringbuf_init(&rb, 4, sizeof(size_t), mem);
+
+  CU_ASSERT(0 == rv);
+
+  /* Fill the buffer from the front, and drop the oldest elements from
+     the back, so that the elements wrap around the end of the
+     underlying buffer. */
+  for (i = 0; i < 6; ++i) {
+    *(size_t *)nghttp3_ringbuf_push_front(&rb) = i;
+    if (nghttp3_ringbuf_len(&rb) == 4) {
+      nghttp3_ringbuf_pop_back(&rb);
+    }
+  }
+
+  CU_ASSERT(3 == nghttp3_ringbuf_len(&rb));
+  CU_ASSERT(rb.first + nghttp3_ringbuf_len(&rb) > rb.nmemb);
+
+  rv = nghttp3_ringbuf_reserve(&rb, 16);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(16 == rb.nmemb);
+  CU_ASSERT(3 == nghttp3_ringbuf_len(&rb));
+
+  for (i = 0; i < 3; ++i) {
+    CU_ASSERT(5 - i == *(size_t *)nghttp3_ringbuf_get(&rb, i));
+  }
+
+  /* Elements pushed after reserve keep their order as well. */
+  *(size_t *)nghttp3_ringbuf_push_front(&rb) = 6;
+  *(size_t *)nghttp3_ringbuf_push_back(&rb) = 2;
+
+  CU_ASSERT(5 == nghttp3_ringbuf_len(&rb));
+
+  for (i = 0; i < 5; ++i) {
+    CU_ASSERT(6 - i == *(size_t *)nghttp3_ringbuf_get(&rb, i));
+  }
+
+  /* Reserving less than the capacity does nothing. */
+  rv = nghttp3_ringbuf_reserve(&rb, 8);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(16 == rb.nmemb);
+
+  nghttp3_ringbuf_free(&rb);
+
+  /* An empty buffer without storage grows on reserve. */
+  rv = nghttp3_ringbuf_init(&rb, 0, sizeof(size_t), mem);
+
+  CU_ASSERT(0 == rv);
+
+  rv = nghttp3_ringbuf_reserve(&rb, 2);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(2 == rb.nmemb);
+
+  *(size_t *)nghttp3_ringbuf_push_back(&rb) = 1;
+
+  CU_ASSERT(1 == *(size_t *)nghttp3_ringbuf_get(&rb, 0));
+
+  nghttp3_ringbuf_free(&rb);
+}
@@ -30,7 +30,19 @@
 #include "nghttp3_macro.h"
 #include "nghttp3_test_helper.h"
 
-void test_nghttp3_tnode_mutation(void) {
+/*
+ * tnode_init_root initializes |root| as root node.  If |use_calq| is
+ * nonzero, it queues its scheduled children by calendar queue.
+ */
+static void tnode_init_root(nghttp3_tnode *root, const nghttp3_node_id *nid,
+                            int use_calq, const nghttp3_mem *mem) {
+  nghttp3_tnode_init(root, nid, 0, NGHTTP3_DEFAULT_WEIGHT, NULL, mem);
+  if (use_calq) {
+    nghttp3_tnode_enable_calq(root);
+  }
+}
+
+static void tnode_mutation(int use_calq) {
   const nghttp3_mem *mem = nghttp3_mem_default();
   nghttp3_tnode nodes[6];
   nghttp3_tnode *root = &nodes[0], *a = &nodes[1], *b = &nodes[2],
@@ -41,7 +53,7 @@ void test_nghttp3_tnode_mutation(void) {
   nghttp3_node_id_init(&snid, NGHTTP3_NODE_ID_TYPE_STREAM, 0);
 
   /* Insert a node to empty root */
-  nghttp3_tnode_init(root, &rnid, 0, NGHTTP3_DEFAULT_WEIGHT, NULL, mem);
+  tnode_init_root(root, &rnid, use_calq, mem);
   nghttp3_tnode_init(a, &snid, 0, 12, NULL, mem);
 
   nghttp3_tnode_insert(a, root);
@@ -49,7 +61,7 @@ void test_nghttp3_tnode_mutation(void) {
   CU_ASSERT(a == root->first_child);
   CU_ASSERT(NULL == root->next_sibling);
   CU_ASSERT(1 == root->num_children);
-  CU_ASSERT(nghttp3_pq_empty(&root->pq));
+  CU_ASSERT(0 == nghttp3_tnode_num_scheduled_children(root));
   CU_ASSERT(root == a->parent);
   CU_ASSERT(NULL == a->next_sibling);
   CU_ASSERT(0 == a->num_children);
@@ -58,7 +70,7 @@ void test_nghttp3_tnode_mutation(void) {
   nghttp3_tnode_free(root);
 
   /* Insert a node to root which has descendants */
-  nghttp3_tnode_init(root, &rnid, 0, NGHTTP3_DEFAULT_WEIGHT, NULL, mem);
+  tnode_init_root(root, &rnid, use_calq, mem);
   nghttp3_tnode_init(c, &snid, 0, 19, root, mem);
   nghttp3_tnode_init(b, &snid, 0, 99, root, mem);
   nghttp3_tnode_init(a, &snid, 0, 12, NULL, mem);
@@ -67,7 +79,7 @@ void test_nghttp3_tnode_mutation(void) {
 
   CU_ASSERT(a == root->first_child);
   CU_ASSERT(3 == root->num_children);
-  CU_ASSERT(nghttp3_pq_empty(&root->pq));
+  CU_ASSERT(0 == nghttp3_tnode_num_scheduled_children(root));
   CU_ASSERT(root == a->parent);
   CU_ASSERT(b == a->next_sibling);
 
@@ -77,7 +89,7 @@ void test_nghttp3_tnode_mutation(void) {
   nghttp3_tnode_free(root);
 
   /* Remove a node from root */
-  nghttp3_tnode_init(root, &rnid, 0, NGHTTP3_DEFAULT_WEIGHT, NULL, mem);
+  tnode_init_root(root, &rnid, use_calq, mem);
   nghttp3_tnode_init(a, &snid, 0, 1, root, mem);
 
   nghttp3_tnode_remove(a);
@@ -85,7 +97,7 @@ void test_nghttp3_tnode_mutation(void) {
   CU_ASSERT(NULL == root->first_child);
   CU_ASSERT(NULL == root->next_sibling);
   CU_ASSERT(0 == root->num_children);
-  CU_ASSERT(nghttp3_pq_empty(&root->pq));
+  CU_ASSERT(0 == nghttp3_tnode_num_scheduled_children(root));
   CU_ASSERT(NULL == a->parent);
   CU_ASSERT(NULL == a->next_sibling);
   CU_ASSERT(NULL == a->first_child);
@@ -94,7 +106,7 @@ void test_nghttp3_tnode_mutation(void) {
   nghttp3_tnode_free(root);
 
   /* Remove a node with siblings from root */
-  nghttp3_tnode_init(root, &rnid, 0, NGHTTP3_DEFAULT_WEIGHT, NULL, mem);
+  tnode_init_root(root, &rnid, use_calq, mem);
   nghttp3_tnode_init(c, &snid, 0, 250, root, mem);
   nghttp3_tnode_init(a, &snid, 0, 249, root, mem);
   nghttp3_tnode_init(b, &snid, 0, 112, root, mem);
@@ -113,24 +125,24 @@ void test_nghttp3_tnode_mutation(void) {
   nghttp3_tnode_free(root);
 
   /* Remove a scheduled node from root */
-  nghttp3_tnode_init(root, &rnid, 0, NGHTTP3_DEFAULT_WEIGHT, NULL, mem);
+  tnode_init_root(root, &rnid, use_calq, mem);
   nghttp3_tnode_init(a, &snid, 0, 1, root, mem);
 
   nghttp3_tnode_schedule(a, 1200);
 
-  CU_ASSERT(1 == nghttp3_pq_size(&root->pq));
+  CU_ASSERT(1 == nghttp3_tnode_num_scheduled_children(root));
 
   nghttp3_tnode_remove(a);
 
   CU_ASSERT(NULL == root->first_child);
-  CU_ASSERT(nghttp3_pq_empty(&root->pq));
+  CU_ASSERT(0 == nghttp3_tnode_num_scheduled_children(root));
   CU_ASSERT(!nghttp3_tnode_is_scheduled(a));
 
   nghttp3_tnode_free(a);
   nghttp3_tnode_free(root);
 
   /* Squash a node from root */
-  nghttp3_tnode_init(root, &rnid, 0, NGHTTP3_DEFAULT_WEIGHT, NULL, mem);
+  tnode_init_root(root, &rnid, use_calq, mem);
   nghttp3_tnode_init(a, &snid, 0, 128, root, mem);
   nghttp3_tnode_init(c, &snid, 0, 5, a, mem);
   nghttp3_tnode_init(b, &snid, 0, 3, a, mem);
@@ -138,7 +150,7 @@ void test_nghttp3_tnode_mutation(void) {
   nghttp3_tnode_squash(a);
 
   CU_ASSERT(b == root->first_child);
-  CU_ASSERT(nghttp3_pq_empty(&root->pq));
+  CU_ASSERT(0 == nghttp3_tnode_num_scheduled_children(root));
   CU_ASSERT(root == b->parent);
   CU_ASSERT(3 * 128 / 2 == b->weight);
   CU_ASSERT(root == c->parent);
@@ -153,7 +165,7 @@ void test_nghttp3_tnode_mutation(void) {
   nghttp3_tnode_free(root);
 
   /* Squash a node with siblings from root */
-  nghttp3_tnode_init(root, &rnid, 0, NGHTTP3_DEFAULT_WEIGHT, NULL, mem);
+  tnode_init_root(root, &rnid, use_calq, mem);
   nghttp3_tnode_init(e, &snid, 0, 128, root, mem);
   nghttp3_tnode_init(a, &snid, 0, 1, root, mem);
   nghttp3_tnode_init(b, &snid, 0, 129, root, mem);
@@ -163,12 +175,18 @@ void test_nghttp3_tnode_mutation(void) {
   nghttp3_tnode_squash(a);
 
   CU_ASSERT(b == root->first_child);
+  CU_ASSERT(NULL == b->prev_sibling);
   CU_ASSERT(c == b->next_sibling);
+  CU_ASSERT(b == c->prev_sibling);
+  CU_ASSERT(c == d->prev_sibling);
   CU_ASSERT(e == d->next_sibling);
+  CU_ASSERT(d == e->prev_sibling);
+  CU_ASSERT(4 == root->num_children);
   CU_ASSERT(root == c->parent);
   CU_ASSERT(root == d->parent);
   CU_ASSERT(NULL == a->parent);
   CU_ASSERT(NULL == a->next_sibling);
+  CU_ASSERT(NULL == a->prev_sibling);
   CU_ASSERT(NULL == a->first_child);
 
   nghttp3_tnode_free(e);
@@ -179,7 +197,7 @@ void test_nghttp3_tnode_mutation(void) {
   nghttp3_tnode_free(root);
 
   /* Squash a scheduled node with scheduled siblings from root */
-  nghttp3_tnode_init(root, &rnid, 0, NGHTTP3_DEFAULT_WEIGHT, NULL, mem);
+  tnode_init_root(root, &rnid, use_calq, mem);
   nghttp3_tnode_init(e, &snid, 0, 128, root, mem);
   nghttp3_tnode_init(a, &snid, 0, 1, root, mem);
   nghttp3_tnode_init(b, &snid, 0, 129, root, mem);
@@ -192,7 +210,7 @@ void test_nghttp3_tnode_mutation(void) {
 
   nghttp3_tnode_squash(a);
 
-  CU_ASSERT(2 == nghttp3_pq_size(&root->pq));
+  CU_ASSERT(2 == nghttp3_tnode_num_scheduled_children(root));
 
   nghttp3_tnode_free(e);
   nghttp3_tnode_free(d);
@@ -202,7 +220,7 @@ void test_nghttp3_tnode_mutation(void) {
   nghttp3_tnode_free(root);
 }
 
-void test_nghttp3_tnode_schedule(void) {
+static void tnode_schedule(int use_calq) {
   const nghttp3_mem *mem = nghttp3_mem_default();
   nghttp3_tnode nodes[3];
   nghttp3_tnode *root = &nodes[0], *a = &nodes[1], *b = &nodes[2];
@@ -213,7 +231,7 @@ void test_nghttp3_tnode_schedule(void) {
   nghttp3_node_id_init(&snid, NGHTTP3_NODE_ID_TYPE_STREAM, 0);
 
   /* Unscheduled internal node should be scheduled */
-  nghttp3_tnode_init(root, &rnid, 0, NGHTTP3_DEFAULT_WEIGHT, NULL, mem);
+  tnode_init_root(root, &rnid, use_calq, mem);
   nghttp3_tnode_init(b, &snid, 0, 100, root, mem);
   nghttp3_tnode_init(a, &snid, 0, 15, b, mem);
 
@@ -230,7 +248,7 @@ void test_nghttp3_tnode_schedule(void) {
   nghttp3_tnode_free(root);
 
   /* Scheduled internal node is updated if nwrite > 0 */
-  nghttp3_tnode_init(root, &rnid, 0, NGHTTP3_DEFAULT_WEIGHT, NULL, mem);
+  tnode_init_root(root, &rnid, use_calq, mem);
   nghttp3_tnode_init(b, &snid, 0, 100, root, mem);
   nghttp3_tnode_init(a, &snid, 0, 15, b, mem);
 
@@ -251,7 +269,7 @@ void test_nghttp3_tnode_schedule(void) {
   nghttp3_tnode_free(root);
 
   /* Unschedule inactive internal node */
-  nghttp3_tnode_init(root, &rnid, 0, NGHTTP3_DEFAULT_WEIGHT, NULL, mem);
+  tnode_init_root(root, &rnid, use_calq, mem);
   nghttp3_tnode_init(b, &snid, 0, 100, root, mem);
   nghttp3_tnode_init(a, &snid, 0, 15, b, mem);
 
@@ -270,7 +288,7 @@ void test_nghttp3_tnode_schedule(void) {
   nghttp3_tnode_free(root);
 
   /* Active internal node remains scheduled */
-  nghttp3_tnode_init(root, &rnid, 0, NGHTTP3_DEFAULT_WEIGHT, NULL, mem);
+  tnode_init_root(root, &rnid, use_calq, mem);
   nghttp3_tnode_init(b, &snid, 0, 100, root, mem);
   nghttp3_tnode_init(a, &snid, 0, 15, b, mem);
 
@@ -289,3 +307,94 @@ void test_nghttp3_tnode_schedule(void) {
   nghttp3_tnode_free(a);
   nghttp3_tnode_free(root);
 }
+
+void test_nghttp3_tnode_mutation(void) {
+  tnode_mutation(0);
+  tnode_mutation(1);
+}
+
+void test_nghttp3_tnode_schedule(void) {
+  tnode_schedule(0);
+  tnode_schedule(1);
+}
+
+void test_nghttp3_tnode_calq(void) {
+  const nghttp3_mem *mem = nghttp3_mem_default();
+  nghttp3_tnode nodes[65];
+  nghttp3_tnode *root = &nodes[0], *node;
+  nghttp3_node_id rnid, snid;
+  size_t i, j, nscheduled;
+  size_t n = nghttp3_arraylen(nodes) - 1;
+  int rv;
+
+  nghttp3_node_id_init(&rnid, NGHTTP3_NODE_ID_TYPE_ROOT, 0);
+  nghttp3_node_id_init(&snid, NGHTTP3_NODE_ID_TYPE_STREAM, 0);
+
+  nghttp3_tnode_init(root, &rnid, 0, NGHTTP3_DEFAULT_WEIGHT, NULL, mem);
+  nghttp3_tnode_enable_calq(root);
+
+  /* The first 4 nodes depend on root, and the others depend on one of
+     them. */
+  for (i = 1; i <= n; ++i) {
+    nghttp3_tnode_init(&nodes[i], &snid, i, (uint32_t)(i * 37 % 256 + 1),
+                       i <= 4 ? root : &nodes[i % 4 + 1], mem);
+  }
+
+  CU_ASSERT(nodes[n].use_calq);
+
+  for (i = 5; i <= n; ++i) {
+    rv = nghttp3_tnode_schedule(&nodes[i], 0);
+
+    CU_ASSERT(0 == rv);
+  }
+
+  for (i = 0; i < 10000; ++i) {
+    for (node = root; node == root || !node->active;) {
+      /* No sibling may have smaller cycle than the next node. */
+      node = nghttp3_tnode_get_next(node);
+      for (j = 1; j <= n; ++j) {
+        if (nodes[j].parent == node->parent &&
+            nghttp3_tnode_is_scheduled(&nodes[j])) {
+          CU_ASSERT(nodes[j].cycle >= node->cycle);
+        }
+      }
+    }
+
+    if (i % 7 == 0) {
+      nghttp3_tnode_unschedule(node);
+    } else {
+      rv = nghttp3_tnode_schedule(node, (i * 131) % 16384);
+
+      CU_ASSERT(0 == rv);
+    }
+
+    j = i % (n - 4) + 5;
+    if (!nghttp3_tnode_is_scheduled(&nodes[j])) {
+      rv = nghttp3_tnode_schedule(&nodes[j], 0);
+
+      CU_ASSERT(0 == rv);
+    }
+
+    /* Squash an internal node halfway */
+    if (i == 5000) {
+      rv = nghttp3_tnode_squash(&nodes[2]);
+
+      CU_ASSERT(0 == rv);
+
+      nscheduled = 0;
+      for (j = 1; j <= n; ++j) {
+        if (nodes[j].parent == root &&
+            nghttp3_tnode_is_scheduled(&nodes[j])) {
+          ++nscheduled;
+        }
+      }
+
+      CU_ASSERT(nscheduled > 3);
+      CU_ASSERT(nscheduled == nghttp3_tnode_num_scheduled_children(root));
+    }
+  }
+
+  for (i = 0; i <= n; ++i) {
+    nghttp3_tnode_free(&nodes[i]);
+  }
+}
@@ -31,5 +31,6 @@
 
 void test_nghttp3_tnode_mutation(void);
 void test_nghttp3_tnode_schedule(void);
+void test_nghttp3_tnode_calq(void);
 
 #endif /* NGTCP2_TNODE_TEST_H */
@@ -0,0 +1,104 @@
+/*
+ * nghttp3
+ *
+ * Copyright (c) 2019 nghttp3 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "nghttp3_urgq_test.h"
+
+#include <CUnit/CUnit.h>
+
+#include "nghttp3_urgq.h"
+#include "nghttp3_macro.h"
+#include "nghttp3_test_helper.h"
+
+void test_nghttp3_urgq_schedule(void) {
+  nghttp3_urgq urgq;
+  nghttp3_urgq_entry ents[5];
+  nghttp3_urgq_entry *a = &ents[0], *b = &ents[1], *c = &ents[2],
+                     *d = &ents[3], *e = &ents[4];
+  size_t i;
+
+  nghttp3_urgq_init(&urgq);
+
+  for (i = 0; i < nghttp3_arraylen(ents); ++i) {
+    nghttp3_urgq_entry_init(&ents[i]);
+  }
+
+  CU_ASSERT(NULL == nghttp3_urgq_top(&urgq));
+
+  /* Non-incremental entries are served in FIFO order */
+  nghttp3_urgq_schedule(&urgq, a);
+  nghttp3_urgq_schedule(&urgq, b);
+
+  CU_ASSERT(a == nghttp3_urgq_top(&urgq));
+
+  nghttp3_urgq_schedule(&urgq, a);
+
+  CU_ASSERT(a == nghttp3_urgq_top(&urgq));
+
+  /* Incremental entries of the same urgency come after
+     non-incremental ones, and rotate. */
+  nghttp3_urgq_set_priority(&urgq, c, NGHTTP3_DEFAULT_URGENCY, 1);
+  nghttp3_urgq_set_priority(&urgq, d, NGHTTP3_DEFAULT_URGENCY, 1);
+  nghttp3_urgq_schedule(&urgq, c);
+  nghttp3_urgq_schedule(&urgq, d);
+
+  nghttp3_urgq_unschedule(&urgq, a);
+
+  CU_ASSERT(!a->queued);
+  CU_ASSERT(b == nghttp3_urgq_top(&urgq));
+
+  nghttp3_urgq_unschedule(&urgq, b);
+
+  CU_ASSERT(c == nghttp3_urgq_top(&urgq));
+
+  nghttp3_urgq_schedule(&urgq, c);
+
+  CU_ASSERT(d == nghttp3_urgq_top(&urgq));
+
+  nghttp3_urgq_schedule(&urgq, d);
+
+  CU_ASSERT(c == nghttp3_urgq_top(&urgq));
+
+  /* More urgent entry takes precedence */
+  nghttp3_urgq_schedule(&urgq, e);
+  nghttp3_urgq_set_priority(&urgq, e, 0, 1);
+
+  CU_ASSERT(e == nghttp3_urgq_top(&urgq));
+
+  /* Less urgent entry is served last */
+  nghttp3_urgq_set_priority(&urgq, e, NGHTTP3_URGENCY_LEVELS - 1, 0);
+
+  CU_ASSERT(c == nghttp3_urgq_top(&urgq));
+
+  nghttp3_urgq_unschedule(&urgq, c);
+  nghttp3_urgq_unschedule(&urgq, d);
+
+  CU_ASSERT(e == nghttp3_urgq_top(&urgq));
+
+  nghttp3_urgq_unschedule(&urgq, e);
+  /* Unscheduling an entry which is not scheduled is no-op */
+  nghttp3_urgq_unschedule(&urgq, e);
+
+  CU_ASSERT(NULL == nghttp3_urgq_top(&urgq));
+  CU_ASSERT(0 == urgq.mask);
+}